@@ -24,16 +24,55 @@
 #include "emer-aggregate-tally.h"
 #include "shared/metrics-util.h"
 
+#include <string.h>
+
 #include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <sqlite3.h>
 
+/* Once this many distinct increments are pending, they are written to the
+ * database straight away rather than when the flush timeout fires.
+ */
+#define MAX_PENDING_ENTRIES 256
+
+/* The maximum number of seconds that increments are held in memory before
+ * being written to the database.
+ */
+#define PENDING_FLUSH_TIMEOUT_SEC 10
+
+#define UPSERT_SQL \
+  "INSERT INTO tally (date, event_id, unix_user_id, " \
+  "                   payload, counter) " \
+  "VALUES (?, ?, ?, ?, ?) " \
+  "ON CONFLICT (date, event_id, unix_user_id, " \
+  "             payload) " \
+  "DO UPDATE SET counter = tally.counter + excluded.counter;"
+
+/* An increment which has been accumulated in memory but not yet written to the
+ * database. The first four fields form the key; they match the unique index on
+ * the tally table.
+ */
+typedef struct
+{
+  gchar *date;
+  uuid_t event_id;
+  guint32 unix_user_id;
+  GBytes *payload; /* serialized payload, or empty if there is none */
+
+  guint64 counter;
+} PendingEntry;
+
 struct _EmerAggregateTally
 {
   GObject parent_instance;
 
   gchar *persistent_cache_directory;
   sqlite3 *db;
+
+  /* Set of PendingEntry */
+  GHashTable *pending;
+  gsize pending_size; /* approximate bytes held by pending */
+  guint flush_source_id;
 };
 
 G_DEFINE_TYPE (EmerAggregateTally, emer_aggregate_tally, G_TYPE_OBJECT)
@@ -153,6 +192,92 @@ column_to_uint32 (sqlite3_stmt *stmt,
 
 G_STATIC_ASSERT (sizeof (sqlite_int64) == sizeof (gint64));
 
+static void
+pending_entry_free (gpointer data)
+{
+  PendingEntry *entry = data;
+
+  g_free (entry->date);
+  g_bytes_unref (entry->payload);
+  g_free (entry);
+}
+
+static guint
+pending_entry_hash (gconstpointer key)
+{
+  const PendingEntry *entry = key;
+  guint hash = g_str_hash (entry->date);
+
+  for (gsize i = 0; i < sizeof (uuid_t); i++)
+    hash = (hash << 5) - hash + entry->event_id[i];
+
+  hash = (hash << 5) - hash + entry->unix_user_id;
+
+  return hash ^ g_bytes_hash (entry->payload);
+}
+
+static gboolean
+pending_entry_equal (gconstpointer a,
+                     gconstpointer b)
+{
+  const PendingEntry *entry_a = a;
+  const PendingEntry *entry_b = b;
+
+  return entry_a->unix_user_id == entry_b->unix_user_id &&
+         uuid_compare (entry_a->event_id, entry_b->event_id) == 0 &&
+         strcmp (entry_a->date, entry_b->date) == 0 &&
+         g_bytes_equal (entry_a->payload, entry_b->payload);
+}
+
+static gboolean
+upsert_pending_entries (EmerAggregateTally  *self,
+                        sqlite3_stmt        *stmt,
+                        GError             **error)
+{
+  GHashTableIter iter;
+  PendingEntry *entry;
+
+  g_hash_table_iter_init (&iter, self->pending);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+    {
+      gsize payload_size;
+      gconstpointer payload_data =
+        g_bytes_get_data (entry->payload, &payload_size);
+      gint64 counter = MIN (entry->counter, (guint64) G_MAXINT64);
+
+      /* A zero-length blob rather than NULL represents the absence of a
+       * payload, as in emer_aggregate_tally_store_event().
+       */
+      if (!CHECK (sqlite3_bind_text (stmt, 1, entry->date, -1, SQLITE_STATIC)) ||
+          !CHECK (sqlite3_bind_blob (stmt, 2, entry->event_id, sizeof (uuid_t), SQLITE_STATIC)) ||
+          !CHECK (sqlite3_bind_int64 (stmt, 3, entry->unix_user_id)) ||
+          !CHECK (sqlite3_bind_blob (stmt, 4,
+                                     payload_data != NULL ? payload_data : "",
+                                     payload_size,
+                                     SQLITE_STATIC)) ||
+          !CHECK (sqlite3_bind_int64 (stmt, 5, counter)) ||
+          !CHECK (sqlite3_step (stmt)) ||
+          !CHECK (sqlite3_reset (stmt)))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+flush_timeout_cb (gpointer user_data)
+{
+  EmerAggregateTally *self = EMER_AGGREGATE_TALLY (user_data);
+  g_autoptr(GError) error = NULL;
+
+  self->flush_source_id = 0;
+
+  if (!emer_aggregate_tally_flush (self, &error))
+    g_warning ("%s", error->message);
+
+  return G_SOURCE_REMOVE;
+}
+
 static gboolean
 delete_tally_entries (EmerAggregateTally  *self,
                       GArray              *rows_to_delete,
@@ -255,6 +380,13 @@ emer_aggregate_tally_init_db (EmerAggregateTally  *self,
   if (!CHECK (sqlite3_exec (self->db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL)))
     return FALSE;
 
+  /* The tally is small and mostly written rather than read, so there's no
+   * point in letting its page cache grow to SQLite's default of 2 MiB; it
+   * counts against the daemon's memory budget. A negative value is in KiB.
+   */
+  if (!CHECK (sqlite3_exec (self->db, "PRAGMA cache_size = -256", NULL, NULL, NULL)))
+    return FALSE;
+
   /* Magic number is "emer" in ASCII */
   if (!CHECK (sqlite3_exec (self->db, "PRAGMA application_id = 0x656d6572", NULL, NULL, NULL)))
     return FALSE;
@@ -393,7 +525,13 @@ static void
 emer_aggregate_tally_finalize (GObject *object)
 {
   EmerAggregateTally *self = (EmerAggregateTally *)object;
+  g_autoptr(GError) error = NULL;
 
+  if (self->db != NULL && !emer_aggregate_tally_flush (self, &error))
+    g_warning ("%s", error->message);
+
+  g_clear_handle_id (&self->flush_source_id, g_source_remove);
+  g_clear_pointer (&self->pending, g_hash_table_unref);
   g_clear_pointer (&self->db, close_db);
   g_clear_pointer (&self->persistent_cache_directory, g_free);
 
@@ -450,6 +588,10 @@ emer_aggregate_tally_class_init (EmerAggregateTallyClass *klass)
 static void
 emer_aggregate_tally_init (EmerAggregateTally *self)
 {
+  self->pending = g_hash_table_new_full (pending_entry_hash,
+                                         pending_entry_equal,
+                                         pending_entry_free,
+                                         NULL);
 }
 
 EmerAggregateTally *
@@ -475,14 +617,6 @@ emer_aggregate_tally_store_event (EmerAggregateTally  *self,
   if (payload != NULL)
     g_variant_ref_sink (payload);
 
-  const char *UPSERT_SQL =
-    "INSERT INTO tally (date, event_id, unix_user_id, "
-    "                   payload, counter) "
-    "VALUES (?, ?, ?, ?, ?) "
-    "ON CONFLICT (date, event_id, unix_user_id, "
-    "             payload) "
-    "DO UPDATE SET counter = tally.counter + excluded.counter;";
-
   g_autofree gchar *date = NULL;
   sqlite3_stmt *stmt = NULL;
 
@@ -505,6 +639,134 @@ emer_aggregate_tally_store_event (EmerAggregateTally  *self,
   return ret;
 }
 
+/*
+ * emer_aggregate_tally_add_event:
+ * @self: the tally
+ * @tally_type: whether to add to the daily or the monthly tally
+ * @unix_user_id: the user who triggered the event
+ * @event_id: the event ID
+ * @payload: (nullable): the event's payload, of type 'v'
+ * @counter: the amount to add to the tally
+ * @datetime: the time at which the event occurred
+ *
+ * Like emer_aggregate_tally_store_event(), but the increment is accumulated
+ * in memory and written to the database later in a single transaction along
+ * with any others, so this is cheap enough to be called for every event
+ * received. Pending increments are written out before the tally is iterated
+ * and when it is finalized, or explicitly with emer_aggregate_tally_flush().
+ */
+void
+emer_aggregate_tally_add_event (EmerAggregateTally *self,
+                                EmerTallyType       tally_type,
+                                guint32             unix_user_id,
+                                uuid_t              event_id,
+                                GVariant           *payload,
+                                guint32             counter,
+                                GDateTime          *datetime)
+{
+  g_return_if_fail (EMER_IS_AGGREGATE_TALLY (self));
+  g_return_if_fail (payload == NULL || g_variant_is_of_type (payload, G_VARIANT_TYPE_VARIANT));
+
+  PendingEntry key = { NULL, };
+  PendingEntry *entry;
+
+  key.date = format_datetime_for_tally_type (datetime, tally_type);
+  uuid_copy (key.event_id, event_id);
+  key.unix_user_id = unix_user_id;
+
+  if (payload != NULL)
+    {
+      g_variant_ref_sink (payload);
+      key.payload = g_variant_get_data_as_bytes (payload);
+      g_variant_unref (payload);
+    }
+  else
+    {
+      key.payload = g_bytes_new (NULL, 0);
+    }
+
+  entry = g_hash_table_lookup (self->pending, &key);
+  if (entry != NULL)
+    {
+      entry->counter += counter;
+      g_free (key.date);
+      g_bytes_unref (key.payload);
+    }
+  else
+    {
+      entry = g_memdup2 (&key, sizeof (key));
+      entry->counter = counter;
+      g_hash_table_add (self->pending, entry);
+      self->pending_size += sizeof (PendingEntry) + strlen (entry->date) + 1 +
+        g_bytes_get_size (entry->payload);
+    }
+
+  if (g_hash_table_size (self->pending) >= MAX_PENDING_ENTRIES)
+    {
+      g_autoptr(GError) error = NULL;
+
+      if (!emer_aggregate_tally_flush (self, &error))
+        g_warning ("%s", error->message);
+    }
+  else if (self->flush_source_id == 0)
+    {
+      self->flush_source_id =
+        g_timeout_add_seconds (PENDING_FLUSH_TIMEOUT_SEC, flush_timeout_cb,
+                               self);
+    }
+}
+
+/*
+ * emer_aggregate_tally_flush:
+ * @self: the tally
+ * @error: return location for a #GError
+ *
+ * Writes all increments accumulated by emer_aggregate_tally_add_event() to
+ * the database in a single transaction. If this fails, the increments are
+ * kept in memory so that the next flush can try again.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emer_aggregate_tally_flush (EmerAggregateTally  *self,
+                            GError             **error)
+{
+  sqlite3_stmt *stmt = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (EMER_IS_AGGREGATE_TALLY (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_clear_handle_id (&self->flush_source_id, g_source_remove);
+
+  if (g_hash_table_size (self->pending) == 0)
+    return TRUE;
+
+  if (!CHECK (sqlite3_exec (self->db, "BEGIN IMMEDIATE", NULL, NULL, NULL)))
+    {
+      g_prefix_error (error, "Failed to flush %u pending tally entries: ",
+                      g_hash_table_size (self->pending));
+      return FALSE;
+    }
+
+  ret = CHECK (sqlite3_prepare_v2 (self->db, UPSERT_SQL, -1, &stmt, NULL)) &&
+        upsert_pending_entries (self, stmt, error);
+  sqlite3_finalize (stmt);
+  ret = ret && CHECK (sqlite3_exec (self->db, "COMMIT", NULL, NULL, NULL));
+
+  if (!ret)
+    {
+      sqlite3_exec (self->db, "ROLLBACK", NULL, NULL, NULL);
+      g_prefix_error (error, "Failed to flush %u pending tally entries: ",
+                      g_hash_table_size (self->pending));
+      return FALSE;
+    }
+
+  g_hash_table_remove_all (self->pending);
+  self->pending_size = 0;
+  return TRUE;
+}
+
 G_STATIC_ASSERT (sizeof (sqlite3_int64) == sizeof (gint64));
 
 static gboolean
@@ -522,6 +784,9 @@ emer_aggregate_tally_iter_internal (EmerAggregateTally *self,
   sqlite3_stmt *stmt = NULL;
   int ret;
 
+  if (!emer_aggregate_tally_flush (self, error))
+    return FALSE;
+
   date = format_datetime_for_tally_type (datetime, tally_type);
   rows_to_delete = g_array_new (FALSE, FALSE, sizeof (sqlite3_int64));
 
@@ -622,7 +887,54 @@ emer_aggregate_tally_clear (EmerAggregateTally  *self,
   g_return_val_if_fail (EMER_IS_AGGREGATE_TALLY (self), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  g_clear_handle_id (&self->flush_source_id, g_source_remove);
+  g_hash_table_remove_all (self->pending);
+  self->pending_size = 0;
+
   return CHECK (sqlite3_exec (self->db,
                               "DELETE FROM tally",
                               NULL, NULL, NULL));
 }
+
+/*
+ * emer_aggregate_tally_get_memory_usage:
+ * @self: the tally
+ *
+ * Returns: approximately how many bytes of memory the tally holds, in
+ *   increments not yet flushed to the database and in SQLite's page cache
+ */
+gsize
+emer_aggregate_tally_get_memory_usage (EmerAggregateTally *self)
+{
+  int cache_used = 0, cache_highwater = 0;
+  gsize usage;
+
+  g_return_val_if_fail (EMER_IS_AGGREGATE_TALLY (self), 0);
+
+  usage = self->pending_size;
+  if (sqlite3_db_status (self->db, SQLITE_DBSTATUS_CACHE_USED, &cache_used,
+                         &cache_highwater, FALSE) == SQLITE_OK)
+    usage += cache_used;
+
+  return usage;
+}
+
+/*
+ * emer_aggregate_tally_release_memory:
+ * @self: the tally
+ *
+ * Flushes any pending increments and asks SQLite to free as much of the
+ * tally's page cache as it can, for use when memory is tight.
+ */
+void
+emer_aggregate_tally_release_memory (EmerAggregateTally *self)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_return_if_fail (EMER_IS_AGGREGATE_TALLY (self));
+
+  if (!emer_aggregate_tally_flush (self, &error))
+    g_warning ("%s", error->message);
+
+  sqlite3_db_release_memory (self->db);
+}
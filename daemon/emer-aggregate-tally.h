@@ -67,6 +67,17 @@ gboolean emer_aggregate_tally_store_event (EmerAggregateTally  *self,
                                            GDateTime            *datetime,
                                            GError             **error);
 
+void emer_aggregate_tally_add_event (EmerAggregateTally *self,
+                                     EmerTallyType       tally_type,
+                                     guint32             unix_user_id,
+                                     uuid_t              event_id,
+                                     GVariant           *payload,
+                                     guint32             counter,
+                                     GDateTime          *datetime);
+
+gboolean emer_aggregate_tally_flush (EmerAggregateTally  *self,
+                                     GError             **error);
+
 void emer_aggregate_tally_iter (EmerAggregateTally *self,
                                 EmerTallyType       tally_type,
                                 GDateTime          *datetime,
@@ -84,4 +95,8 @@ void emer_aggregate_tally_iter_before (EmerAggregateTally *self,
 gboolean emer_aggregate_tally_clear (EmerAggregateTally  *self,
                                      GError             **error);
 
+gsize emer_aggregate_tally_get_memory_usage (EmerAggregateTally *self);
+
+void emer_aggregate_tally_release_memory (EmerAggregateTally *self);
+
 G_END_DECLS
@@ -0,0 +1,89 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-cache-record.h"
+
+#include <string.h>
+
+static const gchar * const kind_type_strings[] = {
+  [EMER_CACHE_RECORD_TYPED] = NULL,
+  [EMER_CACHE_RECORD_SINGULAR] = "(aysxmv)",
+  [EMER_CACHE_RECORD_AGGREGATE] = "(ayssumv)",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (kind_type_strings) == EMER_CACHE_RECORD_N_KINDS);
+
+/*
+ * emer_cache_record_kind_from_type_string:
+ * @type_string: the type string of a variant to be stored
+ *
+ * Returns: the kind of record in which a variant of the given type is stored;
+ *   %EMER_CACHE_RECORD_TYPED if the type has no kind of its own
+ */
+EmerCacheRecordKind
+emer_cache_record_kind_from_type_string (const gchar *type_string)
+{
+  for (gsize i = 0; i < G_N_ELEMENTS (kind_type_strings); i++)
+    {
+      if (kind_type_strings[i] != NULL &&
+          strcmp (kind_type_strings[i], type_string) == 0)
+        return i;
+    }
+
+  return EMER_CACHE_RECORD_TYPED;
+}
+
+/*
+ * emer_cache_record_kind_to_type_string:
+ * @kind: a record kind, as read from the cache
+ *
+ * Returns: the type string of the variants stored in records of the given
+ *   kind, or %NULL if records of that kind carry their own type string or the
+ *   kind is not known
+ */
+const gchar *
+emer_cache_record_kind_to_type_string (EmerCacheRecordKind kind)
+{
+  if (kind >= G_N_ELEMENTS (kind_type_strings))
+    return NULL;
+
+  return kind_type_strings[kind];
+}
+
+/*
+ * emer_cache_record_header_size:
+ * @type_string: the type string of a variant to be stored
+ *
+ * Returns: the number of bytes that precede the serialized variant in its
+ *   record: the kind byte, and the type string and its terminating nul byte
+ *   if the type has no kind of its own
+ */
+gsize
+emer_cache_record_header_size (const gchar *type_string)
+{
+  if (emer_cache_record_kind_from_type_string (type_string) !=
+      EMER_CACHE_RECORD_TYPED)
+    return sizeof (guint8);
+
+  return sizeof (guint8) + strlen (type_string) + 1;
+}
@@ -0,0 +1,54 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * EmerCacheRecordKind:
+ * @EMER_CACHE_RECORD_TYPED: the kind byte is followed by the nul-terminated
+ *   type string of the variant, for variants of any other type
+ * @EMER_CACHE_RECORD_SINGULAR: a singular event, of type (aysxmv)
+ * @EMER_CACHE_RECORD_AGGREGATE: an aggregate event, of type (ayssumv)
+ *
+ * The first byte of each record in the persistent cache, which tells the type
+ * of the serialized variant that follows it. The values are stored on disk,
+ * so they must not be renumbered.
+ */
+typedef enum
+{
+  EMER_CACHE_RECORD_TYPED = 0,
+  EMER_CACHE_RECORD_SINGULAR = 1,
+  EMER_CACHE_RECORD_AGGREGATE = 2,
+  EMER_CACHE_RECORD_N_KINDS,
+} EmerCacheRecordKind;
+
+EmerCacheRecordKind emer_cache_record_kind_from_type_string (const gchar         *type_string);
+
+const gchar        *emer_cache_record_kind_to_type_string   (EmerCacheRecordKind  kind);
+
+gsize               emer_cache_record_header_size           (const gchar         *type_string);
+
+G_END_DECLS
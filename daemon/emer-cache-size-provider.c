@@ -34,6 +34,45 @@
 
 #define CACHE_SIZE_GROUP "persistent_cache_size"
 #define MAX_CACHE_SIZE_KEY "maximum"
+#define COMPRESSED_KEY "compressed"
+#define STORE_BATCHES_KEY "store_batches"
+#define SEGMENTED_KEY "segmented"
+
+/* Loads the configuration file at path, or the default one if path is NULL.
+ * Returns NULL and logs a warning if the file is malformed; returns NULL
+ * silently if it doesn't exist.
+ */
+static GKeyFile *
+load_key_file (const gchar *path)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GError) error = NULL;
+
+  if (path == NULL)
+    path = DEFAULT_CACHE_SIZE_FILE_PATH;
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error reading cache size from %s: %s", path,
+                   error->message);
+
+      return NULL;
+    }
+
+  return g_steal_pointer (&key_file);
+}
+
+/* Returns TRUE if error is set and is anything but a missing group or key. */
+static gboolean
+is_unexpected_key_error (const GError *error)
+{
+  return error != NULL &&
+    !g_error_matches (error, G_KEY_FILE_ERROR,
+                      G_KEY_FILE_ERROR_GROUP_NOT_FOUND) &&
+    !g_error_matches (error, G_KEY_FILE_ERROR,
+                      G_KEY_FILE_ERROR_KEY_NOT_FOUND);
+}
 
 /*
  * emer_cache_size_provider_get_max_cache_size:
@@ -48,36 +87,103 @@
 guint64
 emer_cache_size_provider_get_max_cache_size (const gchar *path)
 {
-  g_autoptr(GKeyFile) key_file = g_key_file_new ();
-  guint64 cache_size = 0;
+  g_autoptr(GKeyFile) key_file = load_key_file (path);
   g_autoptr(GError) error = NULL;
 
-  if (path == NULL)
-    path = DEFAULT_CACHE_SIZE_FILE_PATH;
+  if (key_file == NULL)
+    return DEFAULT_MAX_CACHE_SIZE;
 
-  if (g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+  guint64 cache_size = g_key_file_get_uint64 (key_file, CACHE_SIZE_GROUP,
+                                              MAX_CACHE_SIZE_KEY, &error);
+  if (error != NULL)
     {
-      cache_size = g_key_file_get_uint64 (key_file, CACHE_SIZE_GROUP,
-                                          MAX_CACHE_SIZE_KEY, &error);
+      /* If the group or key is missing, silently use the default. Otherwise,
+       * something was badly wrong with the file:
+       */
+      if (is_unexpected_key_error (error))
+        g_warning ("Error reading cache size from %s: %s",
+                   path != NULL ? path : DEFAULT_CACHE_SIZE_FILE_PATH,
+                   error->message);
+
+      return DEFAULT_MAX_CACHE_SIZE;
     }
 
+  return cache_size;
+}
+
+/* Returns the value of the boolean key in the configuration file at path, or
+ * FALSE if the file doesn't exist, is corrupt, or does not contain the key.
+ * setting describes the key in warnings.
+ */
+static gboolean
+get_boolean (const gchar *path,
+             const gchar *key,
+             const gchar *setting)
+{
+  g_autoptr(GKeyFile) key_file = load_key_file (path);
+  g_autoptr(GError) error = NULL;
+
+  if (key_file == NULL)
+    return FALSE;
+
+  gboolean value = g_key_file_get_boolean (key_file, CACHE_SIZE_GROUP, key,
+                                           &error);
   if (error != NULL)
     {
-      /* If the file doesn't exist, silently create it. If the key is missing,
-       * silently add it. Otherwise, something was badly wrong with the file:
-       */
-      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT) &&
-          !g_error_matches (error, G_KEY_FILE_ERROR,
-                            G_KEY_FILE_ERROR_GROUP_NOT_FOUND) &&
-          !g_error_matches (error, G_KEY_FILE_ERROR,
-                            G_KEY_FILE_ERROR_KEY_NOT_FOUND))
-        {
-          g_warning ("Error reading cache size from %s: %s", path,
-                     error->message);
-        }
-
-      cache_size = DEFAULT_MAX_CACHE_SIZE;
+      if (is_unexpected_key_error (error))
+        g_warning ("Error reading %s from %s: %s", setting,
+                   path != NULL ? path : DEFAULT_CACHE_SIZE_FILE_PATH,
+                   error->message);
+
+      return FALSE;
     }
 
-  return cache_size;
+  return value;
+}
+
+/*
+ * emer_cache_size_provider_get_compressed:
+ * @path: (allow-none): the path to the persistent cache configuration file.
+ *  If %NULL, defaults to DEFAULT_CACHE_SIZE_FILE_PATH.
+ *
+ * Returns whether the persistent cache should store events in compressed
+ * blocks. If the underlying configuration file doesn't exist, is corrupt, or
+ * does not contain this key, %FALSE is returned.
+ */
+gboolean
+emer_cache_size_provider_get_compressed (const gchar *path)
+{
+  return get_boolean (path, COMPRESSED_KEY, "cache compression setting");
+}
+
+/*
+ * emer_cache_size_provider_get_store_batches:
+ * @path: (allow-none): the path to the persistent cache configuration file.
+ *  If %NULL, defaults to DEFAULT_CACHE_SIZE_FILE_PATH.
+ *
+ * Returns whether events which can't be uploaded should be stored in the
+ * persistent cache as complete, compressed upload requests, rather than one
+ * at a time. If the underlying configuration file doesn't exist, is corrupt,
+ * or does not contain this key, %FALSE is returned.
+ */
+gboolean
+emer_cache_size_provider_get_store_batches (const gchar *path)
+{
+  return get_boolean (path, STORE_BATCHES_KEY, "cache batching setting");
+}
+
+/*
+ * emer_cache_size_provider_get_segmented:
+ * @path: (allow-none): the path to the persistent cache configuration file.
+ *  If %NULL, defaults to DEFAULT_CACHE_SIZE_FILE_PATH.
+ *
+ * Returns whether the persistent cache should keep its data in a series of
+ * segment files rather than in a single circular file. If the underlying
+ * configuration file doesn't exist, is corrupt, or does not contain this key,
+ * %FALSE is returned.
+ */
+gboolean
+emer_cache_size_provider_get_segmented (const gchar *path)
+{
+  return get_boolean (path, SEGMENTED_KEY, "cache segmentation setting");
 }
@@ -29,6 +29,12 @@ G_BEGIN_DECLS
 
 guint64                emer_cache_size_provider_get_max_cache_size    (const gchar           *path);
 
+gboolean               emer_cache_size_provider_get_compressed        (const gchar           *path);
+
+gboolean               emer_cache_size_provider_get_store_batches     (const gchar           *path);
+
+gboolean               emer_cache_size_provider_get_segmented         (const gchar           *path);
+
 G_END_DECLS
 
 #endif /* EMER_CACHE_SIZE_PROVIDER_H */
@@ -23,9 +23,16 @@
 #include "config.h"
 #include "emer-circular-file.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <gio/gio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 
+#include "emer-crc32c.h"
 #include "shared/metrics-util.h"
 
 #define METADATA_GROUP_NAME "metadata"
@@ -33,26 +40,99 @@
 #define SIZE_KEY "size"
 #define HEAD_KEY "head"
 
+/* In the original format of the data file, each element was preceded only by
+ * its length, as a little-endian guint64. A data file in this format is
+ * described by a metadata file, and is converted to the current format when
+ * it is opened.
+ */
+#define LEGACY_FORMAT 0
+
+/* In the current format, each element is preceded by a header made up of its
+ * length and a CRC-32C checksum, each a little-endian guint32. The checksum
+ * covers the logical position of the element, as a little-endian guint64,
+ * followed by its length and the element itself. The logical position of an
+ * element is that of the head, which advances by the size of everything
+ * removed, plus the element's offset from the head. The checksum lets a
+ * damaged element be detected and skipped without losing the elements around
+ * it, and since an element left behind from an earlier lap around the file was
+ * written at a different logical position, it doesn't match its checksum
+ * where a current element is expected, so skipping damaged data can't resume
+ * at it.
+ */
+#define CURRENT_FORMAT 1
+
+#define ELEM_HEADER_SIZE (2 * sizeof (guint32))
+
+/* The data file begins with a header recording the state of the circular
+ * file: its maximum size, the logical size of the data in it and the physical
+ * offset of its head. The header has two slots, which are written in turn, so
+ * that each change of state takes a single write which leaves the previous
+ * state intact should it be interrupted. Each slot fills a disk sector, so
+ * that a torn write to one can't damage the other. A slot holds a magic
+ * number and the format of the elements, each a little-endian guint32; a
+ * generation count, which increases with every write, followed by the maximum
+ * size, size, head and logical position of the head, each a little-endian
+ * guint64; and a CRC-32C checksum of all of those, as a little-endian guint32.
+ * The intact slot with the highest generation holds the current state.
+ * Physical offsets count from the end of the header.
+ *
+ * The state used to be kept in a key file alongside the data file, whose name
+ * is that of the data file plus METADATA_EXTENSION, and the elements used to
+ * start at the beginning of the data file. A data file with such a metadata
+ * file and no header is converted when it is opened.
+ */
+#define HEADER_MAGIC 0x46434d45 /* "EMCF" */
+#define HEADER_SLOT_SIZE 512
+#define HEADER_SIZE (2 * HEADER_SLOT_SIZE)
+#define HEADER_FIELDS_SIZE (2 * sizeof (guint32) + 5 * sizeof (guint64))
+#define HEADER_RECORD_SIZE (HEADER_FIELDS_SIZE + sizeof (guint32))
+
+/* Changing the maximum size of the circular file copies its elements to a new
+ * data file, whose name is that of the data file plus TEMP_EXTENSION, this
+ * many bytes at a time, so that the memory it takes doesn't grow with the
+ * size of the file. Each chunk holds whole elements, so one is only ever
+ * larger than this to fit an element which is larger itself.
+ */
+#define COPY_CHUNK_SIZE (256 * 1024)
+
+typedef struct
+{
+  guint32 format;
+  guint64 generation;
+  guint64 max_size;
+  guint64 size;
+  guint64 head;
+  guint64 position;
+} Header;
+
 typedef struct _EmerCircularFilePrivate
 {
   GFile *data_file;
-  GKeyFile *metadata_key_file;
+  gint fd;
   gchar *metadata_filepath;
+  gchar *temp_filepath;
 
   GByteArray *write_buffer;
+  gboolean have_reservation; /* last element of write_buffer not committed */
+  guint reservation_offset; /* offset of its header in write_buffer */
 
   guint64 max_size;
   guint64 size;
   goffset head;
+  guint64 position; /* logical position of the head */
+  guint64 generation;
 
   gboolean reinitialize;
+  gboolean sync;
 } EmerCircularFilePrivate;
 
 static void emer_circular_file_initable_iface_init (GInitableIface *iface);
+static void emer_circular_file_element_store_iface_init (EmerElementStoreInterface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (EmerCircularFile, emer_circular_file, G_TYPE_OBJECT,
                          G_ADD_PRIVATE (EmerCircularFile)
-                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, emer_circular_file_initable_iface_init))
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, emer_circular_file_initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (EMER_TYPE_ELEMENT_STORE, emer_circular_file_element_store_iface_init))
 
 enum
 {
@@ -60,309 +140,833 @@ enum
   PROP_PATH,
   PROP_MAX_SIZE,
   PROP_REINITIALIZE,
+  PROP_SYNC,
   NPROPS
 };
 
 static GParamSpec *emer_circular_file_props[NPROPS] = { NULL, };
 
-static gboolean
-save_metadata_file (EmerCircularFile *self,
-                    GError          **error)
+/* Opens the file at filepath for reading and writing, creating it if it
+ * doesn't already exist, and passing flags to open() besides. Returns the file
+ * descriptor, or -1 on error. Space for the header and priv->max_size bytes of
+ * elements is allocated up front, so that the file isn't fragmented as it
+ * grows, and so that saving elements doesn't change its size, which would
+ * otherwise have to be synced to the disk along with them. Failing to allocate
+ * the space isn't an error; it is allocated as the file is written instead.
+ */
+static gint
+open_file (EmerCircularFile *self,
+           const gchar      *filepath,
+           gint              flags,
+           GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  return g_key_file_save_to_file (priv->metadata_key_file,
-                                  priv->metadata_filepath, error);
+  gint fd = g_open (filepath, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0666);
+  if (fd < 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not open %s: %s", filepath,
+                   g_strerror (saved_errno));
+      return -1;
+    }
+
+  if (fallocate (fd, 0, 0, HEADER_SIZE + priv->max_size) != 0)
+    g_debug ("Could not allocate space for %s: %s", filepath,
+             g_strerror (errno));
+
+  return fd;
 }
 
+/* Opens the data file. Its file descriptor is kept open for the lifetime of
+ * the circular file.
+ */
 static gboolean
-add_to_size (EmerCircularFile *self,
-             guint64           delta,
-             GError          **error)
+open_data_file (EmerCircularFile *self,
+                GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  guint64 new_size = priv->size + delta;
-  g_key_file_set_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME, SIZE_KEY,
-                         new_size);
-  if (!save_metadata_file (self, error))
+  g_autofree gchar *data_filepath = g_file_get_path (priv->data_file);
+  priv->fd = open_file (self, data_filepath, 0, error);
+  return priv->fd >= 0;
+}
+
+static void
+encode_header_slot (guint8  *slot,
+                    guint64  generation,
+                    guint64  max_size,
+                    guint64  size,
+                    goffset  head,
+                    guint64  position)
+{
+  guint32 little_endian_magic = GUINT32_TO_LE (HEADER_MAGIC);
+  guint32 little_endian_format = GUINT32_TO_LE (CURRENT_FORMAT);
+  guint64 little_endian_fields[] = {
+    GUINT64_TO_LE (generation),
+    GUINT64_TO_LE (max_size),
+    GUINT64_TO_LE (size),
+    GUINT64_TO_LE ((guint64) head),
+    GUINT64_TO_LE (position),
+  };
+
+  memcpy (slot, &little_endian_magic, sizeof (little_endian_magic));
+  memcpy (slot + sizeof (guint32), &little_endian_format,
+          sizeof (little_endian_format));
+  memcpy (slot + 2 * sizeof (guint32), little_endian_fields,
+          sizeof (little_endian_fields));
+
+  guint32 little_endian_checksum =
+    GUINT32_TO_LE (emer_crc32c (0, slot, HEADER_FIELDS_SIZE));
+  memcpy (slot + HEADER_FIELDS_SIZE, &little_endian_checksum,
+          sizeof (little_endian_checksum));
+}
+
+/* Reads the header slot at the start of slot into header. Returns FALSE if the
+ * slot doesn't hold an intact header.
+ */
+static gboolean
+decode_header_slot (const guint8 *slot,
+                    Header       *header)
+{
+  guint32 little_endian_magic, little_endian_format, little_endian_checksum;
+  memcpy (&little_endian_magic, slot, sizeof (little_endian_magic));
+  memcpy (&little_endian_format, slot + sizeof (guint32),
+          sizeof (little_endian_format));
+  memcpy (&little_endian_checksum, slot + HEADER_FIELDS_SIZE,
+          sizeof (little_endian_checksum));
+  if (GUINT32_FROM_LE (little_endian_magic) != HEADER_MAGIC ||
+      GUINT32_FROM_LE (little_endian_checksum) !=
+        emer_crc32c (0, slot, HEADER_FIELDS_SIZE))
     return FALSE;
 
-  priv->size = new_size;
+  guint64 little_endian_fields[5];
+  memcpy (little_endian_fields, slot + 2 * sizeof (guint32),
+          sizeof (little_endian_fields));
+
+  header->format = GUINT32_FROM_LE (little_endian_format);
+  header->generation = GUINT64_FROM_LE (little_endian_fields[0]);
+  header->max_size = GUINT64_FROM_LE (little_endian_fields[1]);
+  header->size = GUINT64_FROM_LE (little_endian_fields[2]);
+  header->head = GUINT64_FROM_LE (little_endian_fields[3]);
+  header->position = GUINT64_FROM_LE (little_endian_fields[4]);
+  return TRUE;
+}
+
+static gboolean
+write_at (gint           fd,
+          gconstpointer  buffer,
+          gsize          num_bytes,
+          goffset        offset,
+          GError       **error)
+{
+  const guint8 *remaining = buffer;
+  while (num_bytes > 0)
+    {
+      gssize bytes_written = pwrite (fd, remaining, num_bytes, offset);
+      if (bytes_written < 0)
+        {
+          gint saved_errno = errno;
+          if (saved_errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Could not write to circular file: %s",
+                       g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      remaining += bytes_written;
+      num_bytes -= bytes_written;
+      offset += bytes_written;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_at (gint      fd,
+         gpointer  buffer,
+         gsize     num_bytes,
+         goffset   offset,
+         GError  **error)
+{
+  guint8 *remaining = buffer;
+  while (num_bytes > 0)
+    {
+      gssize bytes_read = pread (fd, remaining, num_bytes, offset);
+      if (bytes_read < 0)
+        {
+          gint saved_errno = errno;
+          if (saved_errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Could not read from circular file: %s",
+                       g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      if (bytes_read == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Circular file is shorter than expected. Reached end "
+                       "of file at byte %" G_GOFFSET_FORMAT ".", offset);
+          return FALSE;
+        }
+
+      remaining += bytes_read;
+      num_bytes -= bytes_read;
+      offset += bytes_read;
+    }
+
   return TRUE;
 }
 
+/* Waits for everything written to the file open as fd to reach the disk,
+ * unless the :sync property is FALSE.
+ */
+static gboolean
+sync_file (EmerCircularFile *self,
+           gint              fd,
+           GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  if (!priv->sync || fdatasync (fd) == 0)
+    return TRUE;
+
+  gint saved_errno = errno;
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+               "Could not sync circular file: %s", g_strerror (saved_errno));
+  return FALSE;
+}
+
+/* Records the given state in the header slot which doesn't hold the current
+ * state. Any elements the new state covers must already have reached the disk,
+ * since the disk may reorder writes between syncs; otherwise, a crash could
+ * leave a header which covers elements that never got there.
+ */
 static gboolean
 set_metadata (EmerCircularFile *self,
               guint64           size,
               goffset           head,
+              guint64           position,
               GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  g_key_file_set_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME, SIZE_KEY,
-                         size);
-  g_key_file_set_int64 (priv->metadata_key_file, METADATA_GROUP_NAME, HEAD_KEY,
-                        head);
+  guint8 slot[HEADER_RECORD_SIZE];
+  guint64 generation = priv->generation + 1;
+  encode_header_slot (slot, generation, priv->max_size, size, head, position);
 
-  if (!save_metadata_file (self, error))
+  goffset slot_offset = (generation % 2) * HEADER_SLOT_SIZE;
+  if (!write_at (priv->fd, slot, sizeof (slot), slot_offset, error) ||
+      !sync_file (self, priv->fd, error))
     return FALSE;
 
+  priv->generation = generation;
   priv->size = size;
   priv->head = head;
+  priv->position = position;
+  return TRUE;
+}
+
+static gboolean
+add_to_size (EmerCircularFile *self,
+             guint64           delta,
+             GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  return set_metadata (self, priv->size + delta, priv->head, priv->position,
+                       error);
+}
+
+/* Returns a logical position at which to start a data file whose previous
+ * contents, if any, are unknown. It is chosen at random, so that an element
+ * left behind from before is very unlikely to have been written at the same
+ * logical position as the element which takes its place.
+ */
+static guint64
+get_random_position (void)
+{
+  return ((guint64) g_random_int () << 32) | g_random_int ();
+}
+
+/* Makes the circular file empty, writing both slots of the header so that no
+ * earlier state can be mistaken for the current one.
+ */
+static gboolean
+initialize (EmerCircularFile *self,
+            GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  guint64 position = get_random_position ();
+  guint8 header[HEADER_SIZE] = { 0, };
+  encode_header_slot (header + HEADER_SLOT_SIZE, 1, priv->max_size, 0, 0,
+                      position);
+  if (!write_at (priv->fd, header, sizeof (header), 0, error) ||
+      !sync_file (self, priv->fd, error))
+    return FALSE;
+
+  priv->generation = 1;
+  priv->size = 0;
+  priv->head = 0;
+  priv->position = position;
   return TRUE;
 }
 
+/* Reads num_bytes bytes, starting offset bytes after the head, of a circular
+ * file whose elements start at the physical offset data_start of the data
+ * file, and whose maximum size is max_size, into buffer.
+ */
 static gboolean
 read_disk_bytes (EmerCircularFile *self,
                  guint8           *buffer,
+                 guint64           offset,
                  gsize             num_bytes,
                  gsize             max_size,
+                 goffset           data_start,
                  GError          **error)
 {
-  g_autoptr(GFileInputStream) file_input_stream = NULL;
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  if (num_bytes == 0)
-    return TRUE;
+  goffset start = (priv->head + offset) % max_size;
+  gsize bytes_end = MIN (num_bytes, max_size - start);
+  gsize bytes_start = num_bytes - bytes_end;
 
-  file_input_stream = g_file_read (priv->data_file, NULL /* GCancellable */, error);
-  if (file_input_stream == NULL)
-    return FALSE;
+  return read_at (priv->fd, buffer, bytes_end, data_start + start, error) &&
+    read_at (priv->fd, buffer + bytes_end, bytes_start, data_start, error);
+}
 
-  GInputStream *input_stream = G_INPUT_STREAM (file_input_stream);
-  gsize head_to_end = max_size - priv->head;
-  gsize bytes_head = MIN(num_bytes, head_to_end);
-  gsize bytes_start = num_bytes - bytes_head;
-  if (bytes_start > 0)
-    {
-      gpointer copy_to = buffer + bytes_head;
-      gboolean read_succeeded =
-        g_input_stream_read_all (input_stream, copy_to, bytes_start,
-                                 NULL /* bytes read */, NULL /* GCancellable */,
-                                 error);
-      if (!read_succeeded)
-        return FALSE;
-    }
+/* Returns the checksum of an element at the given logical position, whose
+ * header, holding the length of the element, is at the start of header, and
+ * whose contents are elem_data.
+ */
+static guint32
+compute_checksum (const guint8 *header,
+                  const guint8 *elem_data,
+                  gsize         elem_size,
+                  guint64       position)
+{
+  guint64 little_endian_position = GUINT64_TO_LE (position);
+  guint32 checksum =
+    emer_crc32c (0, &little_endian_position, sizeof (little_endian_position));
+  checksum = emer_crc32c (checksum, header, sizeof (guint32));
+  return emer_crc32c (checksum, elem_data, elem_size);
+}
 
-  GSeekable *seekable = G_SEEKABLE (file_input_stream);
-  gboolean seek_succeeded =
-    g_seekable_seek (seekable, priv->head, G_SEEK_SET, NULL /* GCancellable */,
-                     error);
-  if (!seek_succeeded)
-    return FALSE;
+static guint32
+get_stored_checksum (const guint8 *header)
+{
+  guint32 little_endian_checksum;
+  memcpy (&little_endian_checksum, header + sizeof (guint32),
+          sizeof (little_endian_checksum));
+  return GUINT32_FROM_LE (little_endian_checksum);
+}
 
-  gboolean read_succeeded =
-    g_input_stream_read_all (input_stream, buffer, bytes_head,
-                             NULL /* bytes read */, NULL /* GCancellable */,
-                             error);
+static void
+set_stored_checksum (guint8  *header,
+                     guint32  checksum)
+{
+  guint32 little_endian_checksum = GUINT32_TO_LE (checksum);
+  memcpy (header + sizeof (guint32), &little_endian_checksum,
+          sizeof (little_endian_checksum));
+}
 
-  return read_succeeded;
+/* Fills in the header at the start of record, which must be followed by the
+ * elem_size bytes of the element itself, for an element at the given logical
+ * position.
+ */
+static void
+write_elem_header (guint8  *record,
+                   guint32  elem_size,
+                   guint64  position)
+{
+  guint32 little_endian_elem_size = GUINT32_TO_LE (elem_size);
+  memcpy (record, &little_endian_elem_size, sizeof (little_endian_elem_size));
+  set_stored_checksum (record, compute_checksum (record,
+                                                 record + ELEM_HEADER_SIZE,
+                                                 elem_size, position));
 }
 
-/* Returns the size of a length-encoded buffer excluding any truncated trailing
- * element. Assumes each element in the buffer is preceded by its length in
- * bytes encoded as a little-endian guint64. Also assumes that each length,
- * element pair is concatenated to the next.
- *
- * Since the encoded length of each buffer might contain an arbitrary value,
- * we need to be careful about doing unaligned accesses to avoid SIGBUS on ARM.
- * Use memcpy() to do this.
+/* Fills in the checksums of the elements at the start of buffer, which holds
+ * num_bytes bytes of whole elements whose lengths are already filled in, and
+ * the first of which is at the given logical position.
  */
-static guint64
-get_trimmed_size (const guint8 *buffer,
-                  gsize         num_bytes)
+static void
+write_checksums (guint8  *buffer,
+                 gsize    num_bytes,
+                 guint64  position)
 {
-  guint64 curr_pos = 0;
-  while ((curr_pos + sizeof (curr_pos)) < num_bytes)
+  gsize curr_pos = 0;
+  while (curr_pos < num_bytes)
     {
-      guint64 little_endian_elem_size, elem_size, next_pos;
+      guint32 little_endian_elem_size;
+      memcpy (&little_endian_elem_size, buffer + curr_pos,
+              sizeof (little_endian_elem_size));
+      guint32 elem_size = GUINT32_FROM_LE (little_endian_elem_size);
+      write_elem_header (buffer + curr_pos, elem_size, position + curr_pos);
+      curr_pos += ELEM_HEADER_SIZE + elem_size;
+    }
+}
+
+/* Converts the elements at the start of buffer, which holds num_bytes bytes
+ * of a data file in the legacy format, to the current format, up to the last
+ * element which lies wholly in buffer. The legacy and current element headers
+ * are the same size, so each is rewritten in place. bytes_left is the number
+ * of bytes of saved data from the start of buffer on, and position is the
+ * logical position of its start. An element whose length is zero or runs past
+ * the end of the saved data is treated as the start of invalid data, which
+ * sets invalid. Returns the number of bytes of elements converted.
+ */
+static gsize
+upgrade_elems (guint8   *buffer,
+               gsize     num_bytes,
+               guint64   bytes_left,
+               guint64   position,
+               gboolean *invalid)
+{
+  G_STATIC_ASSERT (ELEM_HEADER_SIZE == sizeof (guint64));
 
-      memcpy (&little_endian_elem_size, buffer + curr_pos, sizeof (little_endian_elem_size));
-      elem_size = swap_bytes_64_if_big_endian (little_endian_elem_size);
-      next_pos = curr_pos + sizeof (curr_pos) + elem_size;
-      if (next_pos > num_bytes)
+  *invalid = FALSE;
+
+  gsize curr_pos = 0;
+  while (curr_pos + sizeof (guint64) < num_bytes)
+    {
+      guint64 little_endian_elem_size;
+      memcpy (&little_endian_elem_size, buffer + curr_pos,
+              sizeof (little_endian_elem_size));
+      guint64 elem_size = swap_bytes_64_if_big_endian (little_endian_elem_size);
+      if (elem_size == 0 || elem_size > G_MAXUINT32 ||
+          elem_size > bytes_left - curr_pos - sizeof (guint64))
+        {
+          *invalid = TRUE;
+          break;
+        }
+
+      if (elem_size > num_bytes - curr_pos - sizeof (guint64))
         break;
-      curr_pos = next_pos;
+
+      write_elem_header (buffer + curr_pos, elem_size, position + curr_pos);
+      curr_pos += ELEM_HEADER_SIZE + elem_size;
     }
 
   return curr_pos;
 }
 
-/* Replace the data file with the contents of the given buffer, and update the
- * metadata file accordingly. In the event of an error, the circular file may
- * instead be left logically empty, but the data and metadata files will never
- * be left in an inconsistent state.
+/* Keeps the intact elements at the start of buffer, which holds num_bytes
+ * bytes of a data file in the current format, up to the last
+ * element which lies wholly in buffer. bytes_left is the number of bytes of
+ * saved data from the start of buffer on, read_position is the logical
+ * position of its start, and write_position is the logical position at which
+ * the kept elements will start. As in emer_circular_file_read, an element
+ * whose length is impossible or which doesn't match its checksum is skipped
+ * one byte at a time, and counted in bytes_skipped. The kept elements are
+ * moved to the start of buffer, with checksums for their new positions, until
+ * one doesn't fit in space_left bytes, which sets full.
+ * Sets bytes_read to the number of bytes of buffer consumed, and returns the
+ * number of bytes of elements kept.
+ */
+static gsize
+keep_intact_elems (guint8   *buffer,
+                   gsize     num_bytes,
+                   guint64   bytes_left,
+                   guint64   read_position,
+                   guint64   write_position,
+                   guint64   space_left,
+                   gsize    *bytes_read,
+                   guint64  *bytes_skipped,
+                   gboolean *full)
+{
+  *full = FALSE;
+
+  gsize read_pos = 0, write_pos = 0;
+  while (read_pos + ELEM_HEADER_SIZE < num_bytes)
+    {
+      guint8 *record = buffer + read_pos;
+      guint32 little_endian_elem_size;
+      memcpy (&little_endian_elem_size, record,
+              sizeof (little_endian_elem_size));
+      guint32 elem_size = GUINT32_FROM_LE (little_endian_elem_size);
+      if (elem_size == 0 ||
+          elem_size > bytes_left - read_pos - ELEM_HEADER_SIZE)
+        {
+          (*bytes_skipped)++;
+          read_pos++;
+          continue;
+        }
+
+      if (elem_size > num_bytes - read_pos - ELEM_HEADER_SIZE)
+        break;
+
+      guint8 *elem_data = record + ELEM_HEADER_SIZE;
+      guint32 checksum = compute_checksum (record, elem_data, elem_size,
+                                           read_position + read_pos);
+      if (checksum != get_stored_checksum (record))
+        {
+          (*bytes_skipped)++;
+          read_pos++;
+          continue;
+        }
+
+      gsize record_size = ELEM_HEADER_SIZE + elem_size;
+      if (write_pos + record_size > space_left)
+        {
+          *full = TRUE;
+          break;
+        }
+
+      /* Elements which haven't moved already have the right checksums. */
+      if (write_position + write_pos != read_position + read_pos)
+        {
+          memmove (buffer + write_pos, record, record_size);
+          write_elem_header (buffer + write_pos, elem_size,
+                             write_position + write_pos);
+        }
+
+      read_pos += record_size;
+      write_pos += record_size;
+    }
+
+  *bytes_read = read_pos;
+  return write_pos;
+}
+
+/* Copies the elements of the circular file, whose maximum size was
+ * prev_max_size and which start at the physical offset data_start of the data
+ * file, to the start of the elements of the file open as fd, converting them
+ * to the current format from the given format. Copies as many elements from
+ * the head as fit in priv->max_size bytes, and sets new_size to the number of
+ * bytes copied. In the legacy format, which has no checksums, copying stops at
+ * any invalid data; otherwise, damaged data is left out, and the elements
+ * after it are given checksums for their new logical positions. Every other
+ * element keeps its logical position.
  */
 static gboolean
-overwrite (EmerCircularFile *self,
-           gconstpointer     buffer,
-           gsize             num_bytes,
-           guint64           prev_max_size,
-           GError          **error)
+copy_elems (EmerCircularFile *self,
+            gint              fd,
+            guint64           prev_max_size,
+            goffset           data_start,
+            guint32           format,
+            guint64          *new_size,
+            GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  /* The size of the data file may not exceed the maximum size stored in the
-   * metadata file.
-   */
-  if (priv->max_size > prev_max_size)
-    g_key_file_set_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME,
-                           MAX_SIZE_KEY, priv->max_size);
-  if (!set_metadata (self, 0, 0, error))
-    return FALSE;
+  /* Elements in the legacy format can't be checked, so their lengths are
+   * trusted, and only those which fit in the new size are read. */
+  guint64 bytes_to_read = format == LEGACY_FORMAT ?
+    MIN (priv->size, priv->max_size) : priv->size;
+  gsize buffer_size = COPY_CHUNK_SIZE;
+  g_autofree guint8 *buffer = g_malloc (buffer_size);
+  guint64 bytes_read = 0;
+  guint64 bytes_skipped = 0;
+  gboolean stop = FALSE;
+
+  *new_size = 0;
+  while (bytes_read + ELEM_HEADER_SIZE < bytes_to_read)
+    {
+      guint64 bytes_left = bytes_to_read - bytes_read;
+      gsize chunk_size = MIN (buffer_size, bytes_left);
+      if (!read_disk_bytes (self, buffer, bytes_read, chunk_size,
+                            prev_max_size, data_start, error))
+        return FALSE;
 
-  gboolean write_succeeded =
-    g_file_replace_contents (priv->data_file, buffer, num_bytes, NULL, FALSE,
-                             G_FILE_CREATE_NONE, NULL, NULL, error);
-  if (!write_succeeded)
+      gsize chunk_bytes_read, elems_size;
+      if (format == LEGACY_FORMAT)
+        {
+          elems_size = upgrade_elems (buffer, chunk_size, bytes_left,
+                                      priv->position + bytes_read, &stop);
+          chunk_bytes_read = elems_size;
+        }
+      else
+        {
+          elems_size =
+            keep_intact_elems (buffer, chunk_size, bytes_left,
+                               priv->position + bytes_read,
+                               priv->position + *new_size,
+                               priv->max_size - *new_size,
+                               &chunk_bytes_read, &bytes_skipped, &stop);
+        }
+
+      if (elems_size > 0 &&
+          !write_at (fd, buffer, elems_size, HEADER_SIZE + *new_size, error))
+        return FALSE;
+
+      *new_size += elems_size;
+      bytes_read += chunk_bytes_read;
+      if (stop)
+        break;
+
+      if (chunk_bytes_read > 0)
+        continue;
+
+      /* No element lies wholly in the chunk. If it is the last one, there are
+       * no more to copy; otherwise, the element at its start is larger than
+       * it, so make room for that, unless it runs past the data to be copied.
+       */
+      if (chunk_size == bytes_left)
+        break;
+
+      guint64 elem_size;
+      if (format == LEGACY_FORMAT)
+        {
+          guint64 little_endian_elem_size;
+          memcpy (&little_endian_elem_size, buffer,
+                  sizeof (little_endian_elem_size));
+          elem_size = swap_bytes_64_if_big_endian (little_endian_elem_size);
+        }
+      else
+        {
+          guint32 little_endian_elem_size;
+          memcpy (&little_endian_elem_size, buffer,
+                  sizeof (little_endian_elem_size));
+          elem_size = GUINT32_FROM_LE (little_endian_elem_size);
+        }
+
+      if (elem_size > bytes_left - ELEM_HEADER_SIZE)
+        break;
+
+      buffer_size = ELEM_HEADER_SIZE + elem_size;
+      buffer = g_realloc (buffer, buffer_size);
+    }
+
+  /* Trailing bytes too short to hold an element can only be damaged data. */
+  if (format != LEGACY_FORMAT && !stop && bytes_read < bytes_to_read)
+    bytes_skipped += bytes_to_read - bytes_read;
+
+  if (bytes_skipped > 0)
+    g_warning ("Skipping %" G_GUINT64_FORMAT " bytes of invalid data found "
+               "while rewriting the elements", bytes_skipped);
+
+  return TRUE;
+}
+
+/* Replaces the data file with one holding the elements of the circular file,
+ * starting at the head, as copy_elems does. The new data file is written
+ * alongside the data file, with its header last, and only renamed over the
+ * data file once it is complete, so if this fails or is interrupted, the data
+ * file is left as it was.
+ */
+static gboolean
+rewrite (EmerCircularFile *self,
+         guint64           prev_max_size,
+         goffset           data_start,
+         guint32           format,
+         GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  gint fd = open_file (self, priv->temp_filepath, O_TRUNC, error);
+  if (fd < 0)
     return FALSE;
 
-  /* We only need to update the maximum size if we didn't already. */
-  if (priv->max_size < prev_max_size)
-    g_key_file_set_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME,
-                           MAX_SIZE_KEY, priv->max_size);
+  guint64 new_size;
+  guint64 generation = priv->generation + 1;
+  guint8 header[HEADER_SIZE] = { 0, };
+  g_autofree gchar *data_filepath = g_file_get_path (priv->data_file);
+  gboolean rewrite_succeeded =
+    copy_elems (self, fd, prev_max_size, data_start, format, &new_size,
+                error) &&
+    sync_file (self, fd, error);
+  if (rewrite_succeeded)
+    {
+      encode_header_slot (header + (generation % 2) * HEADER_SLOT_SIZE,
+                          generation, priv->max_size, new_size, 0,
+                          priv->position);
+      rewrite_succeeded = write_at (fd, header, sizeof (header), 0, error) &&
+        sync_file (self, fd, error);
+    }
+
+  if (rewrite_succeeded && g_rename (priv->temp_filepath, data_filepath) != 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not rename %s to %s: %s", priv->temp_filepath,
+                   data_filepath, g_strerror (saved_errno));
+      rewrite_succeeded = FALSE;
+    }
+
+  if (!rewrite_succeeded)
+    {
+      close (fd);
+      g_unlink (priv->temp_filepath);
+      return FALSE;
+    }
 
-  return add_to_size (self, num_bytes, error);
+  close (priv->fd);
+  priv->fd = fd;
+  priv->generation = generation;
+  priv->size = new_size;
+  priv->head = 0;
+  return TRUE;
 }
 
 /* Change the maximum size of the circular file from prev_max_size to
  * priv->max_size. If the new maximum is less than the amount of data currently
  * in the buffer, then any data that doesn't fit will be removed. Also
- * reorganizes the circular file so that its head is at the start of the file.
+ * reorganizes the circular file so that its head is at the start of the file,
+ * moves its elements to follow the header if they start at data_start
+ * instead, and converts them to the current format from the given format.
  */
 static gboolean
 resize (EmerCircularFile *self,
         guint64           prev_max_size,
+        goffset           data_start,
+        guint32           format,
         GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  if (prev_max_size == priv->max_size)
+  if (prev_max_size == priv->max_size && data_start == HEADER_SIZE &&
+      format == CURRENT_FORMAT)
     return TRUE;
 
-  gsize bytes_to_read = MIN (priv->size, priv->max_size);
-  guint8 buffer[bytes_to_read];
-  gboolean read_succeeded =
-    read_disk_bytes (self, buffer, bytes_to_read, prev_max_size, error);
-  if (!read_succeeded)
-    return FALSE;
-
-  guint64 new_size = get_trimmed_size (buffer, bytes_to_read);
-  return overwrite (self, buffer, new_size, prev_max_size, error);
+  return rewrite (self, prev_max_size, data_start, format, error);
 }
 
+/* Copies num_bytes bytes of the data file, starting at the physical offset
+ * offset and wrapping around to the start of the file if need be, from the
+ * mapped contents of the file to dest.
+ */
 static gboolean
-continue_reading_from_start (EmerCircularFile *self,
-                             GInputStream     *input_stream,
-                             guint8           *partially_filled_buffer,
-                             gsize             total_bytes_to_read,
-                             gsize             bytes_read_end,
-                             GError          **error)
+copy_disk_bytes (EmerCircularFile *self,
+                 const guint8     *data,
+                 gsize             data_length,
+                 guint64           offset,
+                 guint8           *dest,
+                 gsize             num_bytes,
+                 GError          **error)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  if (bytes_read_end == total_bytes_to_read)
-    return TRUE;
+  gsize bytes_end = MIN (num_bytes, priv->max_size - offset);
+  gsize bytes_start = num_bytes - bytes_end;
 
-  GSeekable *seekable = G_SEEKABLE (input_stream);
-  goffset curr_position = g_seekable_tell (seekable);
-  if (curr_position < 0 || (guint64) curr_position != priv->max_size)
+  /* Anything past the maximum size, such as space allocated for a larger
+   * maximum, is ignored.
+   */
+  if (bytes_start > 0 && data_length < priv->max_size)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                   "Circular file has a physical size of %" G_GOFFSET_FORMAT
-                   "bytes, but expected physical size to be %" G_GUINT64_FORMAT
-                   " bytes.", curr_position, priv->max_size);
+                   "Circular file has a physical size of %" G_GSIZE_FORMAT
+                   " bytes, but expected physical size to be %" G_GUINT64_FORMAT
+                   " bytes.", data_length, priv->max_size);
       return FALSE;
     }
 
-  gboolean seek_succeeded =
-    g_seekable_seek (seekable, 0, G_SEEK_SET, NULL /* GCancellable */, error);
-  if (!seek_succeeded)
-    return FALSE;
-
-  guint8 *copy_to = partially_filled_buffer + bytes_read_end;
-  gsize bytes_remaining = total_bytes_to_read - bytes_read_end;
-  gsize bytes_read_start;
-  gboolean read_succeeded =
-    g_input_stream_read_all (input_stream, copy_to, bytes_remaining,
-                             &bytes_read_start, NULL /* GCancellable */, error);
-  if (!read_succeeded)
-    return FALSE;
-
-  if (bytes_remaining != bytes_read_start)
+  if (offset + bytes_end > data_length)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
                    "Circular file is shorter than expected. Reached end of "
-                   "file at byte %" G_GSIZE_FORMAT ".", bytes_read_start);
+                   "file at byte %" G_GSIZE_FORMAT ".", data_length);
       return FALSE;
     }
 
+  memcpy (dest, data + offset, bytes_end);
+  memcpy (dest + bytes_end, data, bytes_start);
   return TRUE;
 }
 
+/* Sets elem to the element of elem_size bytes at the physical offset offset.
+ * An element which lies in one piece in the file is a slice of the file's
+ * contents, rather than a copy; only an element which wraps around the end of
+ * the file is copied, to stitch its two halves together.
+ */
 static gboolean
-read_elem_size (EmerCircularFile *self,
-                GInputStream     *input_stream,
-                guint64          *elem_size,
-                GError          **error)
+get_elem (EmerCircularFile *self,
+          GBytes           *contents,
+          guint64           offset,
+          guint64           elem_size,
+          GBytes          **elem,
+          GError          **error)
 {
-  guint64 little_endian_elem_size;
-  gsize bytes_read;
-  gboolean read_succeeded =
-    g_input_stream_read_all (input_stream,
-                             &little_endian_elem_size,
-                             sizeof (little_endian_elem_size),
-                             &bytes_read,
-                             NULL /* GCancellable */,
-                             error);
-  if (!read_succeeded)
-    return FALSE;
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  gsize data_length;
+  const guint8 *data = g_bytes_get_data (contents, &data_length);
 
-  read_succeeded =
-    continue_reading_from_start (self,
-                                 input_stream,
-                                 (guint8 *) &little_endian_elem_size,
-                                 sizeof (little_endian_elem_size),
-                                 bytes_read,
-                                 error);
+  if (offset + elem_size <= MIN (priv->max_size, data_length))
+    {
+      *elem = g_bytes_new_from_bytes (contents, offset, elem_size);
+      return TRUE;
+    }
+
+  g_autofree guint8 *elem_data = g_malloc (elem_size);
+  gboolean read_succeeded =
+    copy_disk_bytes (self, data, data_length, offset, elem_data, elem_size,
+                     error);
   if (!read_succeeded)
     return FALSE;
 
-  *elem_size = swap_bytes_64_if_big_endian (little_endian_elem_size);
+  *elem = g_bytes_new_take (g_steal_pointer (&elem_data), elem_size);
   return TRUE;
 }
 
+/* Reads the header at the physical offset offset, and the element following
+ * it, which together may take up at most max_record_size bytes. Sets elem to
+ * the element if the header is intact and the element matches its checksum at
+ * the given logical position, or to NULL otherwise. Returns FALSE and sets
+ * error only if the data file could not be read at all.
+ */
 static gboolean
-append_elem_to_array (EmerCircularFile *self,
-                      GInputStream     *input_stream,
-                      GPtrArray        *elem_array,
-                      guint64           elem_size,
-                      GError          **error)
-{
-  guint8 elem_data[elem_size];
-  gsize bytes_read;
-  gboolean read_succeeded =
-    g_input_stream_read_all (input_stream, elem_data, elem_size, &bytes_read,
-                             NULL /* GCancellable */, error);
-  if (!read_succeeded)
+read_record (EmerCircularFile *self,
+             GBytes           *contents,
+             guint64           offset,
+             guint64           position,
+             guint64           max_record_size,
+             GBytes          **elem,
+             GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  *elem = NULL;
+
+  if (max_record_size <= ELEM_HEADER_SIZE)
+    return TRUE;
+
+  gsize data_length;
+  const guint8 *data = g_bytes_get_data (contents, &data_length);
+  guint8 header[ELEM_HEADER_SIZE];
+  if (!copy_disk_bytes (self, data, data_length, offset, header,
+                        ELEM_HEADER_SIZE, error))
     return FALSE;
 
-  read_succeeded =
-    continue_reading_from_start (self, input_stream, elem_data, elem_size,
-                                 bytes_read, error);
-  if (!read_succeeded)
+  guint32 little_endian_elem_size;
+  memcpy (&little_endian_elem_size, header, sizeof (little_endian_elem_size));
+  guint32 elem_size = GUINT32_FROM_LE (little_endian_elem_size);
+
+  if (elem_size == 0 || elem_size > max_record_size - ELEM_HEADER_SIZE)
+    return TRUE;
+
+  g_autoptr(GBytes) candidate = NULL;
+  guint64 elem_offset = (offset + ELEM_HEADER_SIZE) % priv->max_size;
+  if (!get_elem (self, contents, elem_offset, elem_size, &candidate, error))
     return FALSE;
 
-  GBytes *elem = g_bytes_new (elem_data, elem_size);
-  g_ptr_array_add (elem_array, elem);
+  guint32 checksum = compute_checksum (header,
+                                       g_bytes_get_data (candidate, NULL),
+                                       elem_size, position);
+  if (checksum == get_stored_checksum (header))
+    *elem = g_steal_pointer (&candidate);
+
   return TRUE;
 }
 
@@ -376,6 +980,7 @@ set_path (EmerCircularFile *self,
   priv->data_file = g_file_new_for_path (data_filepath);
   priv->metadata_filepath =
     g_strconcat (data_filepath, METADATA_EXTENSION, NULL);
+  priv->temp_filepath = g_strconcat (data_filepath, TEMP_EXTENSION, NULL);
 }
 
 static void
@@ -412,6 +1017,10 @@ emer_circular_file_set_property (GObject      *object,
       priv->reinitialize = g_value_get_boolean (value);
       break;
 
+    case PROP_SYNC:
+      priv->sync = g_value_get_boolean (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -425,8 +1034,10 @@ emer_circular_file_finalize (GObject *object)
     emer_circular_file_get_instance_private (self);
 
   g_clear_object (&priv->data_file);
-  g_clear_pointer (&priv->metadata_key_file, g_key_file_unref);
+  if (priv->fd >= 0)
+    close (priv->fd);
   g_clear_pointer (&priv->metadata_filepath, g_free);
+  g_clear_pointer (&priv->temp_filepath, g_free);
   g_clear_pointer (&priv->write_buffer, g_byte_array_unref);
 
   G_OBJECT_CLASS (emer_circular_file_parent_class)->finalize (object);
@@ -450,8 +1061,8 @@ emer_circular_file_class_init (EmerCircularFileClass *klass)
   emer_circular_file_props[PROP_MAX_SIZE] =
     g_param_spec_uint64 ("max-size", "Max size",
                          "The maximum permitted physical size of the "
-                         "underlying data file. Does not include the overhead "
-                         "of the metadata file.",
+                         "underlying data file. Does not include the header "
+                         "at the start of the file.",
                          0, G_MAXUINT64, 0,
                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
                          G_PARAM_STATIC_STRINGS);
@@ -466,6 +1077,16 @@ emer_circular_file_class_init (EmerCircularFileClass *klass)
                           G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
                           G_PARAM_STATIC_STRINGS);
 
+  emer_circular_file_props[PROP_SYNC] =
+    g_param_spec_boolean ("sync", "Sync",
+                          "Wait for each change to the circular file to reach "
+                          "the disk. Otherwise, a crash may undo the most "
+                          "recent changes, but won't leave the file "
+                          "inconsistent.",
+                          TRUE,
+                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                          G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, NPROPS,
                                      emer_circular_file_props);
 }
@@ -476,74 +1097,156 @@ emer_circular_file_init (EmerCircularFile *self)
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
+  priv->fd = -1;
   priv->write_buffer = g_byte_array_new ();
 }
 
+/* Reads the header of the data file into header, setting found to FALSE if it
+ * has none. Returns FALSE if the data file could not be read, or if it has a
+ * header but neither slot of it is intact.
+ */
 static gboolean
-emer_circular_file_initable_init (GInitable    *initable,
-                                  GCancellable *cancellable,
-                                  GError      **error)
+read_header (EmerCircularFile *self,
+             Header           *header,
+             gboolean         *found,
+             GError          **error)
 {
-  EmerCircularFile *self = EMER_CIRCULAR_FILE (initable);
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  /* Create data file if it doesn't already exist. */
-  GFileOutputStream *data_file_output_stream =
-    g_file_append_to (priv->data_file, G_FILE_CREATE_NONE,
-                      NULL /* GCancellable */, error);
-  if (data_file_output_stream == NULL)
-    return FALSE;
+  *found = FALSE;
 
-  g_object_unref (data_file_output_stream);
+  guint8 buffer[HEADER_SIZE];
+  gssize bytes_read;
+  do
+    bytes_read = pread (priv->fd, buffer, sizeof (buffer), 0);
+  while (bytes_read < 0 && errno == EINTR);
 
-  priv->metadata_key_file = g_key_file_new ();
-  g_autoptr(GError) local_error = NULL;
+  if (bytes_read < 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not read header of circular file: %s",
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
 
-  if (!priv->reinitialize)
+  /* The header is written in full when the file is created, so a shorter
+   * file predates it.
+   */
+  if (bytes_read < HEADER_SIZE)
+    return TRUE;
+
+  gboolean has_magic = FALSE;
+  for (gsize i = 0; i < 2; i++)
     {
-      if (!g_key_file_load_from_file (priv->metadata_key_file,
-                                      priv->metadata_filepath, G_KEY_FILE_NONE,
-                                      &local_error))
+      const guint8 *slot = buffer + i * HEADER_SLOT_SIZE;
+      guint32 little_endian_magic;
+      memcpy (&little_endian_magic, slot, sizeof (little_endian_magic));
+      if (GUINT32_FROM_LE (little_endian_magic) == HEADER_MAGIC)
+        has_magic = TRUE;
+
+      Header slot_header;
+      if (decode_header_slot (slot, &slot_header) &&
+          (!*found || slot_header.generation > header->generation))
         {
-          /* If the metadata file just doesn't exist, this is fine: we just
-           * need to initialize it.
-           */
-          if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
-            {
-              g_propagate_error (error, g_steal_pointer (&local_error));
-              return FALSE;
-            }
-
-          g_clear_error (&local_error);
-          priv->reinitialize = TRUE;
+          *header = slot_header;
+          *found = TRUE;
         }
-      else
+    }
+
+  if (has_magic && !*found)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Both slots of the circular file's header are damaged.");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Takes the state of the circular file from the given header, and resizes it
+ * if its maximum size has changed.
+ */
+static gboolean
+load_header (EmerCircularFile *self,
+             const Header     *header,
+             GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  if (header->format != CURRENT_FORMAT)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Circular "
+                   "file has unknown format %u.", header->format);
+      return FALSE;
+    }
+
+  if (header->size > header->max_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Logical size "
+                   "of circular file must be at most %" G_GUINT64_FORMAT ", "
+                   "but was %" G_GUINT64_FORMAT ".", header->max_size,
+                   header->size);
+      return FALSE;
+    }
+
+  if (header->head >= header->max_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Pointer to "
+                   "head of circular file must lie in range [0, %"
+                   G_GUINT64_FORMAT "), but was %" G_GUINT64_FORMAT ".",
+                   header->max_size, header->head);
+      return FALSE;
+    }
+
+  priv->generation = header->generation;
+  priv->size = header->size;
+  priv->head = header->head;
+  priv->position = header->position;
+  return resize (self, header->max_size, HEADER_SIZE, CURRENT_FORMAT, error);
+}
+
+/* Takes the state of a circular file which predates the header from its
+ * metadata file, and converts the data file to have a header. If there is no
+ * metadata file, or it is empty, the circular file is initialized as a new
+ * one.
+ */
+static gboolean
+load_metadata_file (EmerCircularFile *self,
+                    GError          **error)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  g_autoptr(GKeyFile) metadata_key_file = g_key_file_new ();
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_key_file_load_from_file (metadata_key_file, priv->metadata_filepath,
+                                  G_KEY_FILE_NONE, &local_error))
+    {
+      /* If the metadata file just doesn't exist, this is fine: we just
+       * need to initialize the circular file.
+       */
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
         {
-          /* If the metadata file exists but is empty, treat this as if it
-           * didn't exist yet. This can occur if the system crashed after the
-           * file was first initialized, but before any events were logged to
-           * the file.
-           */
-          if (!g_key_file_has_group (priv->metadata_key_file, METADATA_GROUP_NAME))
-            priv->reinitialize = TRUE;
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return FALSE;
         }
+
+      return initialize (self, error);
     }
 
-  /* Either the :reinitialize construct-time property was set to TRUE, or one
-   * of the cases above told us that we need to initialize the metadata file.
-   * We don't need to modify the data file: we ensured it existed above, which
-   * is enough.
+  /* If the metadata file exists but is empty, treat this as if it didn't
+   * exist yet. This can occur if the system crashed after the file was first
+   * initialized, but before any events were logged to the file.
    */
-  if (priv->reinitialize)
-    {
-      g_key_file_set_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME,
-                             MAX_SIZE_KEY, priv->max_size);
-      return set_metadata (self, 0, 0, error);
-    }
+  if (!g_key_file_has_group (metadata_key_file, METADATA_GROUP_NAME))
+    return initialize (self, error);
 
   guint64 prev_max_size =
-    g_key_file_get_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME,
+    g_key_file_get_uint64 (metadata_key_file, METADATA_GROUP_NAME,
                            MAX_SIZE_KEY, &local_error);
   if (local_error != NULL)
     {
@@ -552,7 +1255,7 @@ emer_circular_file_initable_init (GInitable    *initable,
     }
 
   priv->size =
-    g_key_file_get_uint64 (priv->metadata_key_file, METADATA_GROUP_NAME,
+    g_key_file_get_uint64 (metadata_key_file, METADATA_GROUP_NAME,
                            SIZE_KEY, &local_error);
   if (local_error != NULL)
     {
@@ -569,7 +1272,7 @@ emer_circular_file_initable_init (GInitable    *initable,
     }
 
   priv->head =
-    g_key_file_get_int64 (priv->metadata_key_file, METADATA_GROUP_NAME,
+    g_key_file_get_int64 (metadata_key_file, METADATA_GROUP_NAME,
                           HEAD_KEY, &local_error);
   if (local_error != NULL)
     {
@@ -586,7 +1289,60 @@ emer_circular_file_initable_init (GInitable    *initable,
       return FALSE;
     }
 
-  return resize (self, prev_max_size, error);
+  /* Data files with a metadata file predate the header, and their elements
+   * predate checksums and logical positions, so each gets them as it is
+   * converted.
+   */
+  priv->position = get_random_position ();
+  return rewrite (self, prev_max_size, 0, LEGACY_FORMAT, error);
+}
+
+static gboolean
+emer_circular_file_initable_init (GInitable    *initable,
+                                  GCancellable *cancellable,
+                                  GError      **error)
+{
+  EmerCircularFile *self = EMER_CIRCULAR_FILE (initable);
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  /* A new data file left behind by an interrupted resize is incomplete, so the
+   * data file still holds the current state.
+   */
+  if (g_unlink (priv->temp_filepath) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", priv->temp_filepath,
+               g_strerror (errno));
+
+  if (!open_data_file (self, error))
+    return FALSE;
+
+  /* If the :reinitialize construct-time property was set to TRUE, the
+   * existing contents of the data file are disregarded; they are overwritten
+   * as new elements are saved.
+   */
+  gboolean init_succeeded;
+  if (priv->reinitialize)
+    {
+      init_succeeded = initialize (self, error);
+    }
+  else
+    {
+      Header header;
+      gboolean found;
+      if (!read_header (self, &header, &found, error))
+        return FALSE;
+
+      init_succeeded = found ?
+        load_header (self, &header, error) : load_metadata_file (self, error);
+    }
+
+  /* Once the data file has a header, its metadata file is no longer read. */
+  if (init_succeeded && g_unlink (priv->metadata_filepath) != 0 &&
+      errno != ENOENT)
+    g_warning ("Could not delete %s: %s", priv->metadata_filepath,
+               g_strerror (errno));
+
+  return init_succeeded;
 }
 
 static void
@@ -595,6 +1351,27 @@ emer_circular_file_initable_iface_init (GInitableIface *iface)
   iface->init = emer_circular_file_initable_init;
 }
 
+static void
+emer_circular_file_element_store_iface_init (EmerElementStoreInterface *iface)
+{
+  iface->reserve = (gpointer (*) (EmerElementStore *, guint64))
+    emer_circular_file_reserve;
+  iface->commit = (void (*) (EmerElementStore *)) emer_circular_file_commit;
+  iface->save = (gboolean (*) (EmerElementStore *, GError **))
+    emer_circular_file_save;
+  iface->read = (gboolean (*) (EmerElementStore *, GBytes ***, gsize, gsize *,
+                               guint64 *, gboolean *, GError **))
+    emer_circular_file_read;
+  iface->has_more = (gboolean (*) (EmerElementStore *, guint64))
+    emer_circular_file_has_more;
+  iface->remove = (gboolean (*) (EmerElementStore *, guint64, GError **))
+    emer_circular_file_remove;
+  iface->purge = (gboolean (*) (EmerElementStore *, GError **))
+    emer_circular_file_purge;
+  iface->get_fill_ratio = (gdouble (*) (EmerElementStore *))
+    emer_circular_file_get_fill_ratio;
+}
+
 /* Returns a new circular file or NULL on error. If a circular file does not
  * already exist at the given path, a new one is created. Limits the physical
  * size of the underlying data file to max_size bytes. If a circular file with a
@@ -626,22 +1403,71 @@ gboolean
 emer_circular_file_append (EmerCircularFile *self,
                            gconstpointer     elem,
                            guint64           elem_size)
+{
+  gpointer reserved = emer_circular_file_reserve (self, elem_size);
+  if (reserved == NULL)
+    return FALSE;
+
+  memcpy (reserved, elem, elem_size);
+  emer_circular_file_commit (self);
+
+  return TRUE;
+}
+
+/* Like emer_circular_file_append, but rather than copying an existing element,
+ * returns a pointer to elem_size bytes of the write buffer into which the
+ * caller should write the element itself, or NULL if an element of that size
+ * would not fit. The pointer is only valid until emer_circular_file_commit is
+ * called, which must be done before anything else is appended or saved.
+ */
+gpointer
+emer_circular_file_reserve (EmerCircularFile *self,
+                            guint64           elem_size)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  guint64 elem_size_on_disk = sizeof (elem_size) + elem_size;
+  g_return_val_if_fail (!priv->have_reservation, NULL);
+
+  if (elem_size > G_MAXUINT32)
+    return NULL;
+
+  guint64 elem_size_on_disk = ELEM_HEADER_SIZE + elem_size;
   guint64 total_size = priv->size + priv->write_buffer->len + elem_size_on_disk;
   if (total_size > priv->max_size)
-    return FALSE;
+    return NULL;
 
-  guint64 little_endian_elem_size = swap_bytes_64_if_big_endian (elem_size);
-  g_byte_array_append (priv->write_buffer,
-                       (const guint8 *) &little_endian_elem_size,
-                       sizeof (little_endian_elem_size));
-  g_byte_array_append (priv->write_buffer, elem, elem_size);
+  /* The header is filled in by emer_circular_file_commit and
+   * emer_circular_file_save, once the element's contents and logical position
+   * are known.
+   */
+  guint offset = priv->write_buffer->len;
+  g_byte_array_set_size (priv->write_buffer, offset + elem_size_on_disk);
+  priv->reservation_offset = offset;
+  priv->have_reservation = TRUE;
 
-  return TRUE;
+  return priv->write_buffer->data + offset + ELEM_HEADER_SIZE;
+}
+
+/* Completes the element whose space was returned by the last call to
+ * emer_circular_file_reserve, which is then appended as if by
+ * emer_circular_file_append. The element's checksum is computed when it is
+ * saved, so it must not be modified afterwards.
+ */
+void
+emer_circular_file_commit (EmerCircularFile *self)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  g_return_if_fail (priv->have_reservation);
+
+  guint8 *record = priv->write_buffer->data + priv->reservation_offset;
+  gsize elem_size =
+    priv->write_buffer->len - priv->reservation_offset - ELEM_HEADER_SIZE;
+  guint32 little_endian_elem_size = GUINT32_TO_LE (elem_size);
+  memcpy (record, &little_endian_elem_size, sizeof (little_endian_elem_size));
+  priv->have_reservation = FALSE;
 }
 
 /* Flushes all elements successfully appended via emer_circular_file_append
@@ -652,60 +1478,33 @@ gboolean
 emer_circular_file_save (EmerCircularFile *self,
                          GError          **error)
 {
-  g_autoptr(GFileIOStream) file_io_stream = NULL;
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
+  g_return_val_if_fail (!priv->have_reservation, FALSE);
+
   if (priv->write_buffer->len == 0)
     return TRUE;
 
-  file_io_stream = g_file_open_readwrite (priv->data_file, NULL /* GCancellable */, error);
-  if (file_io_stream == NULL)
-    return FALSE;
-
-  GIOStream *io_stream = G_IO_STREAM (file_io_stream);
-  GOutputStream *output_stream = g_io_stream_get_output_stream (io_stream);
-  GSeekable *seekable = G_SEEKABLE (output_stream);
+  /* The elements follow the tail, whose logical position only moves back when
+   * damaged data there is discarded, so their checksums are only computed
+   * now.
+   */
+  write_checksums (priv->write_buffer->data, priv->write_buffer->len,
+                   priv->position + priv->size);
 
+  /* Elements which wrap around the end of the file are written in two parts,
+   * the second at the start of the file.
+   */
   goffset tail = (priv->head + priv->size) % priv->max_size;
   gsize space_available_at_tail = priv->max_size - tail;
-  gsize bytes_tail = MIN(priv->write_buffer->len, space_available_at_tail);
+  gsize bytes_tail = MIN (priv->write_buffer->len, space_available_at_tail);
   gsize bytes_start = priv->write_buffer->len - bytes_tail;
-  if (bytes_start > 0)
-    {
-      gboolean seek_succeeded =
-        g_seekable_seek (seekable, 0, G_SEEK_SET, NULL /* GCancellable */,
-                         error);
-      if (!seek_succeeded)
-        return FALSE;
-
-      const guint8 *copy_from = priv->write_buffer->data + bytes_tail;
-      gboolean write_succeeded =
-        g_output_stream_write_all (output_stream,
-                                   copy_from,
-                                   bytes_start,
-                                   NULL /* bytes written */,
-                                   NULL /* GCancellable */,
-                                   error);
-      if (!write_succeeded)
-        return FALSE;
-    }
-
-  gboolean seek_succeeded =
-    g_seekable_seek (seekable, tail, G_SEEK_SET, NULL /* GCancellable */,
-                     error);
-
-  if (!seek_succeeded)
-    return FALSE;
-
-  gboolean write_succeeded =
-    g_output_stream_write_all (output_stream,
-                               priv->write_buffer->data,
-                               bytes_tail,
-                               NULL /* bytes written */,
-                               NULL /* GCancellable */,
-                               error);
-  if (!write_succeeded)
+  if (!write_at (priv->fd, priv->write_buffer->data, bytes_tail,
+                 HEADER_SIZE + tail, error) ||
+      !write_at (priv->fd, priv->write_buffer->data + bytes_tail, bytes_start,
+                 HEADER_SIZE, error) ||
+      !sync_file (self, priv->fd, error))
     return FALSE;
 
   if (!add_to_size (self, priv->write_buffer->len, error))
@@ -727,6 +1526,17 @@ emer_circular_file_save (EmerCircularFile *self,
  * successful call to emer_circular_file_remove invalidates any outstanding
  * tokens. If no elements were read but the read succeeded, then elems is set to
  * NULL. Returns TRUE on success and FALSE on error.
+ *
+ * Each element is checked against the checksum stored with it. A run of
+ * damaged data is skipped, up to the next intact element, and sets
+ * has_invalid; its bytes are covered by the token, so they are removed along
+ * with the elements around them. Damaged data at the end of the file is
+ * removed straight away.
+ *
+ * The data file is memory-mapped for reading, so the elements are generally
+ * slices of the mapping rather than copies. Their contents are only guaranteed
+ * until they are removed with emer_circular_file_remove, after which their
+ * space in the data file may be reused.
  */
 gboolean
 emer_circular_file_read (EmerCircularFile *self,
@@ -737,7 +1547,8 @@ emer_circular_file_read (EmerCircularFile *self,
                          gboolean         *has_invalid,
                          GError          **error)
 {
-  g_autoptr(GFileInputStream) file_input_stream = NULL;
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autoptr(GBytes) contents = NULL;
   g_autoptr(GPtrArray) elem_array = NULL;
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
@@ -752,57 +1563,87 @@ emer_circular_file_read (EmerCircularFile *self,
       return TRUE;
     }
 
-  file_input_stream = g_file_read (priv->data_file, NULL /* GCancellable */, error);
-  if (file_input_stream == NULL)
+  mapped_file = g_mapped_file_new_from_fd (priv->fd, FALSE /* writable */,
+                                           error);
+  if (mapped_file == NULL)
     return FALSE;
 
-  elem_array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+  g_autoptr(GBytes) file_contents = g_mapped_file_get_bytes (mapped_file);
+  gsize file_length = g_bytes_get_size (file_contents);
+  if (file_length < HEADER_SIZE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Circular file is shorter than its header.");
+      return FALSE;
+    }
 
-  gboolean seek_succeeded =
-    g_seekable_seek (G_SEEKABLE (file_input_stream), priv->head, G_SEEK_SET,
-                     NULL /* GCancellable */, error);
-  if (!seek_succeeded)
-    return FALSE;
+  contents = g_bytes_new_from_bytes (file_contents, HEADER_SIZE,
+                                     file_length - HEADER_SIZE);
+  elem_array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
 
   guint64 curr_data_bytes = 0;
   guint64 curr_disk_bytes = 0;
-  GInputStream *input_stream = G_INPUT_STREAM (file_input_stream);
+
+  /* The logical offset of the start of the run of damaged data we are
+   * currently skipping, if any.
+   */
+  gboolean skipping = FALSE;
+  guint64 skip_start = 0;
 
   while (curr_disk_bytes < priv->size)
     {
-      guint64 elem_size;
-      if (!read_elem_size (self, input_stream, &elem_size, error))
+      g_autoptr(GBytes) elem = NULL;
+      guint64 offset = (priv->head + curr_disk_bytes) % priv->max_size;
+      if (!read_record (self, contents, offset,
+                        priv->position + curr_disk_bytes,
+                        priv->size - curr_disk_bytes, &elem, error))
         return FALSE;
 
-      /* Reading a zero-sized element here means that we have invalid
-       * data ahead, in which case we need to update the priv->size
-       * pointer so that the next time this is run it does not include
-       * the region of invalid data existing after this point.
-       */
-      if (elem_size == 0)
+      /* Look for the next intact element one byte further on. */
+      if (elem == NULL)
         {
-          g_warning ("Discarding invalid data found after byte %" G_GINT64_FORMAT,
-                     (priv->head + curr_disk_bytes) % priv->max_size);
-          set_metadata (self, curr_disk_bytes, priv->head, error);
-          *has_invalid = TRUE;
-          break;
+          if (!skipping)
+            {
+              skipping = TRUE;
+              skip_start = curr_disk_bytes;
+              *has_invalid = TRUE;
+            }
+
+          curr_disk_bytes++;
+          continue;
         }
 
+      if (skipping)
+        {
+          g_warning ("Skipping %" G_GUINT64_FORMAT " bytes of invalid data "
+                     "found after byte %" G_GUINT64_FORMAT,
+                     curr_disk_bytes - skip_start,
+                     (priv->head + skip_start) % priv->max_size);
+          skipping = FALSE;
+        }
+
+      gsize elem_size = g_bytes_get_size (elem);
       guint64 next_data_bytes = curr_data_bytes + elem_size;
       if (next_data_bytes > data_bytes_to_read)
         break;
 
-      gboolean append_succeeded =
-        append_elem_to_array (self, input_stream, elem_array, elem_size, error);
-      if (!append_succeeded)
-        return FALSE;
-
+      g_ptr_array_add (elem_array, g_steal_pointer (&elem));
       curr_data_bytes = next_data_bytes;
+      curr_disk_bytes += ELEM_HEADER_SIZE + elem_size;
+    }
 
-      /* sizeof (elem_size) gives the number of bytes used to record the
-       * element's length on disk.
-       */
-      curr_disk_bytes += sizeof (elem_size) + elem_size;
+  /* If there is no intact element after the damaged data, we update the
+   * priv->size pointer so that the next time this is run it does not include
+   * the region of invalid data.
+   */
+  if (skipping)
+    {
+      g_warning ("Discarding invalid data found after byte %" G_GUINT64_FORMAT,
+                 (priv->head + skip_start) % priv->max_size);
+      if (!set_metadata (self, skip_start, priv->head, priv->position, error))
+        return FALSE;
+
+      curr_disk_bytes = skip_start;
     }
 
   *num_elems = elem_array->len;
@@ -830,6 +1671,21 @@ emer_circular_file_has_more (EmerCircularFile *self,
   return token < priv->size;
 }
 
+/* Returns the fraction of the file's maximum size that is in use, counting
+ * elements which have been appended but not yet saved.
+ */
+gdouble
+emer_circular_file_get_fill_ratio (EmerCircularFile *self)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  if (priv->max_size == 0)
+    return 1.0;
+
+  return (gdouble) (priv->size + priv->write_buffer->len) / priv->max_size;
+}
+
 /* Removes the elements that were read in the call to emer_circular_file_read
  * that produced the given token. Tokens may not be reused, and any successful
  * call to emer_circular_file_remove invalidates any outstanding tokens. A token
@@ -849,7 +1705,8 @@ emer_circular_file_remove (EmerCircularFile *self,
 
   guint64 new_size = priv->size - token;
   goffset new_head = (priv->head + token) % priv->max_size;
-  return set_metadata (self, new_size, new_head, error);
+  return set_metadata (self, new_size, new_head, priv->position + token,
+                       error);
 }
 
 /* Removes all data stored in the circular file. Does not remove any data that
@@ -862,5 +1719,10 @@ emer_circular_file_purge (EmerCircularFile *self,
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  return priv->size == 0 ? TRUE : set_metadata (self, 0, 0, error);
+  /* The head moves to the start of the file, but its logical position moves
+   * to the tail, so that elements saved from now on aren't mistaken for those
+   * saved before.
+   */
+  return priv->size == 0 ? TRUE :
+    set_metadata (self, 0, 0, priv->position + priv->size, error);
 }
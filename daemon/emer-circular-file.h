@@ -26,6 +26,8 @@
 #include <gio/gio.h>
 #include <glib-object.h>
 
+#include "emer-element-store.h"
+
 G_BEGIN_DECLS
 
 #define EMER_TYPE_CIRCULAR_FILE emer_circular_file_get_type()
@@ -51,6 +53,7 @@ G_BEGIN_DECLS
   EMER_TYPE_CIRCULAR_FILE, EmerCircularFileClass))
 
 #define METADATA_EXTENSION ".metadata"
+#define TEMP_EXTENSION ".new"
 
 typedef struct _EmerCircularFile EmerCircularFile;
 typedef struct _EmerCircularFileClass EmerCircularFileClass;
@@ -78,6 +81,11 @@ gboolean          emer_circular_file_append   (EmerCircularFile *self,
                                                gconstpointer     elem,
                                                guint64           elem_size);
 
+gpointer          emer_circular_file_reserve  (EmerCircularFile *self,
+                                               guint64           elem_size);
+
+void              emer_circular_file_commit   (EmerCircularFile *self);
+
 gboolean          emer_circular_file_save     (EmerCircularFile *self,
                                                GError          **error);
 
@@ -99,6 +107,8 @@ gboolean          emer_circular_file_remove   (EmerCircularFile *self,
 gboolean          emer_circular_file_purge    (EmerCircularFile *self,
                                                GError          **error);
 
+gdouble           emer_circular_file_get_fill_ratio (EmerCircularFile *self);
+
 G_END_DECLS
 
 #endif /* EMER_CIRCULAR_FILE_H */
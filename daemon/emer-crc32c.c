@@ -0,0 +1,219 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-crc32c.h"
+
+#include <string.h>
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC32C 1
+#elif defined (__aarch64__) && defined (__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_ARM_CRC32C 1
+#endif
+
+/* The Castagnoli polynomial, bit-reversed. */
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+typedef guint32 (*Crc32cFunc) (guint32       crc,
+                               const guint8 *data,
+                               gsize         length);
+
+static guint32 crc32c_table[8][256];
+
+static void
+init_table (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  for (guint i = 0; i < 256; i++)
+    {
+      guint32 crc = i;
+      for (guint j = 0; j < 8; j++)
+        crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & -(crc & 1));
+
+      crc32c_table[0][i] = crc;
+    }
+
+  for (guint i = 0; i < 256; i++)
+    {
+      for (guint k = 1; k < G_N_ELEMENTS (crc32c_table); k++)
+        {
+          guint32 prev = crc32c_table[k - 1][i];
+          crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+
+  g_once_init_leave (&initialized, 1);
+}
+
+/* Processes eight bytes at a time, with a table lookup for each byte
+ * ("slicing-by-8").
+ */
+static guint32
+crc32c_generic (guint32       crc,
+                const guint8 *data,
+                gsize         length)
+{
+  for (; length >= sizeof (guint64); data += sizeof (guint64),
+                                      length -= sizeof (guint64))
+    {
+      guint64 word;
+      memcpy (&word, data, sizeof (word));
+      word = GUINT64_FROM_LE (word);
+
+      guint32 low = (guint32) word ^ crc;
+      guint32 high = word >> 32;
+      crc = crc32c_table[7][low & 0xff] ^
+            crc32c_table[6][(low >> 8) & 0xff] ^
+            crc32c_table[5][(low >> 16) & 0xff] ^
+            crc32c_table[4][low >> 24] ^
+            crc32c_table[3][high & 0xff] ^
+            crc32c_table[2][(high >> 8) & 0xff] ^
+            crc32c_table[1][(high >> 16) & 0xff] ^
+            crc32c_table[0][high >> 24];
+    }
+
+  for (; length > 0; data++, length--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data) & 0xff];
+
+  return crc;
+}
+
+#ifdef HAVE_SSE42_CRC32C
+__attribute__ ((target ("sse4.2")))
+static guint32
+crc32c_sse42 (guint32       crc,
+              const guint8 *data,
+              gsize         length)
+{
+  guint64 crc64 = crc;
+  for (; length >= sizeof (guint64); data += sizeof (guint64),
+                                      length -= sizeof (guint64))
+    {
+      guint64 word;
+      memcpy (&word, data, sizeof (word));
+      crc64 = _mm_crc32_u64 (crc64, word);
+    }
+
+  crc = (guint32) crc64;
+  for (; length > 0; data++, length--)
+    crc = _mm_crc32_u8 (crc, *data);
+
+  return crc;
+}
+#endif /* HAVE_SSE42_CRC32C */
+
+#ifdef HAVE_ARM_CRC32C
+static guint32
+crc32c_arm (guint32       crc,
+            const guint8 *data,
+            gsize         length)
+{
+  for (; length >= sizeof (guint64); data += sizeof (guint64),
+                                      length -= sizeof (guint64))
+    {
+      guint64 word;
+      memcpy (&word, data, sizeof (word));
+      crc = __crc32cd (crc, word);
+    }
+
+  for (; length > 0; data++, length--)
+    crc = __crc32cb (crc, *data);
+
+  return crc;
+}
+#endif /* HAVE_ARM_CRC32C */
+
+static Crc32cFunc
+get_crc32c_func (void)
+{
+  static gsize func = 0;
+
+  if (g_once_init_enter (&func))
+    {
+      Crc32cFunc impl = crc32c_generic;
+
+#if defined (HAVE_SSE42_CRC32C)
+      if (__builtin_cpu_supports ("sse4.2"))
+        impl = crc32c_sse42;
+#elif defined (HAVE_ARM_CRC32C)
+      impl = crc32c_arm;
+#endif
+
+      if (impl == crc32c_generic)
+        init_table ();
+
+      g_once_init_leave (&func, (gsize) impl);
+    }
+
+  return (Crc32cFunc) func;
+}
+
+/*
+ * emer_crc32c:
+ * @crc: the checksum of the data preceding @data, or 0 to start a new checksum
+ * @data: (array length=length): the data to checksum
+ * @length: the number of bytes in @data
+ *
+ * Computes the CRC-32C (Castagnoli) checksum of @data, using the processor's
+ * CRC instructions where they are available. A checksum may be computed in
+ * several pieces by passing the result for one piece as @crc for the next.
+ *
+ * Returns: the checksum of all the data so far
+ */
+guint32
+emer_crc32c (guint32       crc,
+             gconstpointer data,
+             gsize         length)
+{
+  Crc32cFunc impl = get_crc32c_func ();
+
+  return ~impl (~crc, data, length);
+}
+
+/*
+ * emer_crc32c_generic:
+ * @crc: the checksum of the data preceding @data, or 0 to start a new checksum
+ * @data: (array length=length): the data to checksum
+ * @length: the number of bytes in @data
+ *
+ * Like emer_crc32c(), but always uses the portable implementation which
+ * emer_crc32c() falls back to when the processor has no CRC instructions, so
+ * that it can be tested against them.
+ *
+ * Returns: the checksum of all the data so far
+ */
+guint32
+emer_crc32c_generic (guint32       crc,
+                     gconstpointer data,
+                     gsize         length)
+{
+  init_table ();
+
+  return ~crc32c_generic (~crc, data, length);
+}
@@ -24,9 +24,14 @@
 #include "emer-daemon.h"
 
 #include <math.h>
+#include <string.h>
 #include <time.h>
 #include <uuid/uuid.h>
 
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib-object.h>
@@ -38,11 +43,12 @@
 #include "eins-boottime-source.h"
 #include "emer-aggregate-tally.h"
 #include "emer-aggregate-timer-impl.h"
+#include "emer-event-buffer.h"
+#include "emer-event-policy.h"
 #include "emer-gzip.h"
-#include "emer-image-id-provider.h"
 #include "emer-permissions-provider.h"
 #include "emer-persistent-cache.h"
-#include "emer-site-id-provider.h"
+#include "emer-system-identity.h"
 #include "emer-types.h"
 #include "shared/metrics-util.h"
 
@@ -79,8 +85,17 @@
 #define SINGULAR_TYPE_STRING "(aysxmv)"
 #define AGGREGATE_TYPE_STRING "(ayssumv)"
 
+/* An event sequence as stored in the buffer and persistent cache: the event ID,
+ * OS version and corrected relative timestamp of the first event, the offset of
+ * each event from the previous one, packed by append_delta(), and each event's
+ * payload. Sequences are expanded into singular events when a network request
+ * is built.
+ */
+#define SEQUENCE_TYPE_STRING "(aysxayamv)"
+
 #define SINGULAR_TYPE G_VARIANT_TYPE (SINGULAR_TYPE_STRING)
 #define AGGREGATE_TYPE G_VARIANT_TYPE (AGGREGATE_TYPE_STRING)
+#define SEQUENCE_TYPE G_VARIANT_TYPE (SEQUENCE_TYPE_STRING)
 
 #define SINGULAR_ARRAY_TYPE_STRING "a" SINGULAR_TYPE_STRING
 #define AGGREGATE_ARRAY_TYPE_STRING "a" AGGREGATE_TYPE_STRING
@@ -88,17 +103,64 @@
 #define SINGULAR_ARRAY_TYPE G_VARIANT_TYPE (SINGULAR_ARRAY_TYPE_STRING)
 #define AGGREGATE_ARRAY_TYPE G_VARIANT_TYPE (AGGREGATE_ARRAY_TYPE_STRING)
 
+/* The events accepted by emer_daemon_record_singular_events(). */
+#define SINGULAR_BATCH_TYPE G_VARIANT_TYPE ("a(uayxbv)")
+
 #define REQUEST_TYPE_STRING "(xxs@a{ss}y" SINGULAR_ARRAY_TYPE_STRING \
   AGGREGATE_ARRAY_TYPE_STRING ")"
 
 #define RETRY_TYPE_STRING "(xxs@a{ss}y@" SINGULAR_ARRAY_TYPE_STRING "@" \
   AGGREGATE_ARRAY_TYPE_STRING ")"
 
+#define STORED_REQUEST_TYPE G_VARIANT_TYPE ("(xxsa{ss}y" \
+  SINGULAR_ARRAY_TYPE_STRING AGGREGATE_ARRAY_TYPE_STRING ")")
+
+/*
+ * A request body built ahead of time and stored in the persistent cache: the
+ * number of events in it, the length of the serialized request, and the
+ * request compressed with emer_gzip_compress_with_prefix(). The timestamps
+ * of the request, which make up the prefix, are filled in when it is sent.
+ */
+#define STORED_BATCH_TYPE_STRING "(uuay)"
+#define STORED_BATCH_TYPE G_VARIANT_TYPE (STORED_BATCH_TYPE_STRING)
+#define STORED_BATCH_TIMESTAMPS_SIZE (2 * sizeof (gint64))
+
+/* The events in a stored batch cost at most MAX_REQUEST_PAYLOAD, and the
+ * serialized request only adds its header and framing to them. A stored batch
+ * claiming to be longer than this is damaged, and its length is not to be
+ * trusted for an allocation.
+ */
+#define MAX_STORED_BATCH_LENGTH (2 * MAX_REQUEST_PAYLOAD)
+
 /* This limit only applies to timer-driven uploads, not explicitly
  * requested uploads.
  */
 #define MAX_REQUEST_PAYLOAD 100000 /* 100 kB */
 
+/* Events marked as high-priority by the event policy are kept in a separate
+ * buffer of at most this size, and uploaded this long after the first of them
+ * is recorded, so that a burst of them goes in a single request. Once the
+ * buffer is full, further high-priority events are buffered as usual.
+ */
+#define MAX_PRIORITY_BYTES_BUFFERED MAX_REQUEST_PAYLOAD
+#define PRIORITY_UPLOAD_DELAY_SEC 2
+
+/*
+ * The memory the daemon's buffers, request bodies and aggregate tally may use
+ * between them. Requests built from the persistent cache for an explicit
+ * upload are sized to fit in whatever the buffers leave over. The budget only
+ * caps the size of requests: the buffers are bounded by max_bytes_buffered
+ * and MAX_PRIORITY_BYTES_BUFFERED instead, and no event is refused for the
+ * sake of it.
+ */
+#define MEMORY_BUDGET (16u * 1024u * 1024u) /* 16 MiB */
+
+/*
+ * After a low-memory warning, requests are kept to MAX_REQUEST_PAYLOAD for
+ * this long, regardless of the budget.
+ */
+#define LOW_MEMORY_HOLDOFF_USEC (10 * G_TIME_SPAN_MINUTE)
+
 #define METRICS_DISABLED_MESSAGE "Could not upload events because the " \
   "metrics system is disabled. You may enable the metrics system via " \
   "Settings > Privacy > Metrics"
@@ -110,11 +172,15 @@
 
 typedef struct _NetworkCallbackData
 {
+  /* Either a request body, or a stored batch to be sent as it is */
   GVariant *request_body;
   guint64 token;
   gsize max_upload_size;
+  gboolean priority_only;
+  gsize num_priority_events;
   gsize num_stored_events;
   gsize num_buffer_events;
+  guint discard_count; /* EmerDaemon.discard_count when the request was built */
   gint attempt_num;
   guint backoff_timeout_source_id;
 } NetworkCallbackData;
@@ -137,12 +203,24 @@ struct _EmerDaemon
    */
   GCancellable *current_upload_cancellable;
 
+  /* Incremented whenever the buffered and cached events are discarded, so that
+   * an upload which was in flight at the time doesn't remove events from the
+   * head of the buffers which it didn't carry.
+   */
+  guint discard_count;
+
   SoupSession *http_session;
 
-  GPtrArray *variant_array;
-  gsize num_bytes_buffered;
+  EmerEventBuffer *event_buffer;
   gboolean have_logged_overflow;
 
+  EmerEventBuffer *priority_buffer;
+  guint priority_upload_source_id;
+
+  EmerMemoryBudget *memory_budget;
+  gsize request_bytes; /* serialized and compressed body of current upload */
+  gint64 low_memory_time; /* monotonic time of last low-memory warning */
+
   GHashTable *aggregate_timers;
   GHashTable *monitored_senders;
 
@@ -153,22 +231,67 @@ struct _EmerDaemon
   guint upload_events_timeout_source_id;
   guint report_invalid_cache_data_source_id;
   guint dispatch_aggregate_timers_daily_source_id;
+  guint late_aggregates_source_id;
+  guint spill_source_id;
+  gboolean spill_blocked; /* last spill stored nothing; see spill_to_persistent_cache() */
 
   GDateTime *current_aggregate_tally_date;
 
   EmerAggregateTally *aggregate_tally;
   EmerPermissionsProvider *permissions_provider;
+  EmerSystemIdentity *system_identity;
+  EmerEventPolicy *event_policy;
+  gchar *event_policy_path;
 
   gchar *persistent_cache_directory;
   EmerPersistentCache *persistent_cache;
+  gboolean store_batches;
 
   gboolean recording_enabled;
 
   gsize max_bytes_buffered;
+
+  /* Published with hysteresis; see update_pressure() */
+  gdouble buffer_fill;
+  gdouble cache_fill;
+  EmerPressure pressure;
 };
 
 G_DEFINE_TYPE (EmerDaemon, emer_daemon, G_TYPE_OBJECT)
 
+/*
+ * The fill ratios of the buffer and persistent cache are only republished
+ * when they have changed by at least this much, so that recording an event
+ * doesn't usually cause a D-Bus property change notification.
+ */
+#define FILL_REPORTING_STEP 0.05
+
+/*
+ * The fill ratio, of the buffer or of the persistent cache, at which the
+ * pressure rises to each level. The pressure only falls back to a lower level
+ * once the fill ratio is PRESSURE_HYSTERESIS below the threshold, so that it
+ * doesn't flap while the fill ratio hovers around the threshold.
+ */
+static const gdouble pressure_thresholds[] = {
+  [EMER_PRESSURE_NONE] = 0.0,
+  [EMER_PRESSURE_ELEVATED] = 0.75,
+  [EMER_PRESSURE_CRITICAL] = 0.9,
+};
+#define PRESSURE_HYSTERESIS 0.15
+
+/*
+ * Once the in-memory buffer is filled past the high watermark (as a fraction
+ * of max_bytes_buffered), the oldest events are spilled to the persistent
+ * cache in the background until it is back under the low watermark, so that
+ * bursts of events between uploads are absorbed by the disk rather than
+ * dropped. Each spill is a synced write to the persistent cache, so the
+ * watermarks are far enough apart for it to move a good share of the buffer
+ * at once. The high watermark is below the elevated pressure threshold, so
+ * that steady spilling doesn't raise the pressure.
+ */
+#define SPILL_HIGH_WATERMARK 0.7
+#define SPILL_LOW_WATERMARK 0.4
+
 enum
 {
   PROP_0,
@@ -179,6 +302,11 @@ enum
   PROP_PERSISTENT_CACHE,
   PROP_AGGREGATE_TALLY,
   PROP_MAX_BYTES_BUFFERED,
+  PROP_EVENT_POLICY_PATH,
+  PROP_STORE_BATCHES,
+  PROP_BUFFER_FILL,
+  PROP_CACHE_FILL,
+  PROP_PRESSURE,
   NPROPS
 };
 
@@ -194,10 +322,16 @@ enum
 static guint emer_daemon_signals[NSIGNALS] = { 0u, };
 
 static gboolean handle_upload_timer (EmerDaemon *self);
+static void maybe_schedule_spill (EmerDaemon *self);
+static void schedule_priority_upload (EmerDaemon *self);
 
 static void handle_http_response (GObject      *source_object,
                                   GAsyncResult *result,
                                   GTask        *upload_task);
+static void add_events_to_builders (GVariant       **events,
+                                    gsize            num_events,
+                                    GVariantBuilder *singulars,
+                                    GVariantBuilder *aggregates);
 
 static void
 aggregate_timer_sender_data_free (AggregateTimerSenderData *sender_data)
@@ -219,12 +353,53 @@ network_callback_data_free (NetworkCallbackData *callback_data)
   g_free (callback_data);
 }
 
+/* Republishes the memory used by each component to the budget. Rather than
+ * after every event, this is done just before the budget is consulted or
+ * handed out, and when memory is released, so the usage it reports may lag
+ * behind in between. */
+static void
+update_memory_usage (EmerDaemon *self)
+{
+  emer_memory_budget_set_usage (self->memory_budget,
+                                EMER_MEMORY_COMPONENT_BUFFER,
+                                emer_event_buffer_get_memory_usage (self->event_buffer));
+  emer_memory_budget_set_usage (self->memory_budget,
+                                EMER_MEMORY_COMPONENT_PRIORITY_BUFFER,
+                                emer_event_buffer_get_memory_usage (self->priority_buffer));
+  emer_memory_budget_set_usage (self->memory_budget,
+                                EMER_MEMORY_COMPONENT_REQUEST,
+                                self->request_bytes);
+
+  if (self->aggregate_tally != NULL)
+    emer_memory_budget_set_usage (self->memory_budget,
+                                  EMER_MEMORY_COMPONENT_AGGREGATE_TALLY,
+                                  emer_aggregate_tally_get_memory_usage (self->aggregate_tally));
+}
+
+/* Returns the largest request body which may be built from the buffers and
+ * persistent cache, given how much of the memory budget is in use. */
+static gsize
+get_request_budget (EmerDaemon *self)
+{
+  if (self->low_memory_time != 0 &&
+      g_get_monotonic_time () - self->low_memory_time < LOW_MEMORY_HOLDOFF_USEC)
+    return MAX_REQUEST_PAYLOAD;
+
+  update_memory_usage (self);
+
+  /* The body is held both serialized and compressed while it is sent */
+  gsize available = emer_memory_budget_get_available (self->memory_budget);
+  return MAX (available / 2, MAX_REQUEST_PAYLOAD);
+}
+
 static void
 finish_network_callback (GTask *upload_task)
 {
   EmerDaemon *self = g_task_get_source_object (upload_task);
 
   g_clear_object (&self->current_upload_cancellable);
+  self->request_bytes = 0;
+  update_memory_usage (self);
 
   g_signal_emit (self, emer_daemon_signals[SIGNAL_UPLOAD_FINISHED], 0u);
   g_object_unref (upload_task);
@@ -240,25 +415,106 @@ is_uuid (GVariant *variant)
   return g_variant_n_children (variant) == UUID_LENGTH;
 }
 
+/* Returns TRUE if the event policy allows events with the given ID, which must
+ * be a UUID, to be recorded on this machine. */
+static gboolean
+is_allowed_by_policy (EmerDaemon *self,
+                      GVariant   *event_id)
+{
+  gsize event_id_length;
+  const guchar *event_id_bytes =
+    g_variant_get_fixed_array (event_id, &event_id_length, 1);
+
+  return emer_event_policy_should_record (self->event_policy, event_id_bytes);
+}
+
+/* Returns TRUE if a fill ratio has moved far enough from the published value
+ * to be worth republishing. Becoming empty or full always is. */
+static gboolean
+fill_changed (gdouble published_fill,
+              gdouble fill)
+{
+  if ((fill == 0) != (published_fill == 0) ||
+      (fill >= 1) != (published_fill >= 1))
+    return TRUE;
+
+  return fabs (fill - published_fill) >= FILL_REPORTING_STEP;
+}
+
+static EmerPressure
+get_next_pressure (EmerPressure pressure,
+                   gdouble      fill)
+{
+  while (pressure < EMER_PRESSURE_CRITICAL &&
+         fill >= pressure_thresholds[pressure + 1])
+    pressure++;
+
+  while (pressure > EMER_PRESSURE_NONE &&
+         fill < pressure_thresholds[pressure] - PRESSURE_HYSTERESIS)
+    pressure--;
+
+  return pressure;
+}
+
+/* Recomputes the fill ratios of the buffer and persistent cache, and the
+ * pressure, and notifies of any which have changed enough to republish. Must
+ * be called whenever events are added to or removed from either, except while
+ * finalizing. */
 static void
-buffer_event (EmerDaemon *self,
-              GVariant   *event)
+update_pressure (EmerDaemon *self)
 {
-  g_variant_ref_sink (event);
-  gsize event_cost = emer_persistent_cache_cost (event);
-  gsize new_bytes_buffered = self->num_bytes_buffered + event_cost;
-  if (event_cost > MAX_REQUEST_PAYLOAD || /* Don't get wedged by large event. */
-      new_bytes_buffered > self->max_bytes_buffered)
+  gdouble buffer_fill = self->max_bytes_buffered == 0 ? 1.0 :
+    (gdouble) emer_event_buffer_get_cost (self->event_buffer) /
+    self->max_bytes_buffered;
+  gdouble cache_fill = self->persistent_cache == NULL ? 0.0 :
+    emer_persistent_cache_get_fill_ratio (self->persistent_cache);
+  EmerPressure pressure =
+    get_next_pressure (self->pressure, MAX (buffer_fill, cache_fill));
+
+  if (fill_changed (self->buffer_fill, buffer_fill))
     {
-      g_variant_unref (event);
-      if (event_cost > MAX_REQUEST_PAYLOAD)
-        {
-          g_warning ("Dropping %" G_GSIZE_FORMAT "-byte event. The maximum "
-                     "permissible event size (including type string with "
-                     "null-terminating byte) is %d bytes.",
-                     event_cost, MAX_REQUEST_PAYLOAD);
-        }
-      else if (!self->have_logged_overflow)
+      self->buffer_fill = buffer_fill;
+      g_object_notify_by_pspec (G_OBJECT (self),
+                                emer_daemon_props[PROP_BUFFER_FILL]);
+    }
+
+  if (fill_changed (self->cache_fill, cache_fill))
+    {
+      self->cache_fill = cache_fill;
+      g_object_notify_by_pspec (G_OBJECT (self),
+                                emer_daemon_props[PROP_CACHE_FILL]);
+    }
+
+  if (pressure != self->pressure)
+    {
+      self->pressure = pressure;
+      g_object_notify_by_pspec (G_OBJECT (self),
+                                emer_daemon_props[PROP_PRESSURE]);
+    }
+}
+
+/* Returns TRUE if an event of the given cost may be appended to the in-memory
+ * buffer. Events which are too large to ever be uploaded, or which do not fit
+ * in the remaining buffer space, must be dropped.
+ */
+static gboolean
+can_buffer_event (EmerDaemon *self,
+                  gsize       event_cost)
+{
+  /* Don't get wedged by large event. */
+  if (event_cost > MAX_REQUEST_PAYLOAD)
+    {
+      g_warning ("Dropping %" G_GSIZE_FORMAT "-byte event. The maximum "
+                 "permissible event size (including type string with "
+                 "null-terminating byte) is %d bytes.",
+                 event_cost, MAX_REQUEST_PAYLOAD);
+      return FALSE;
+    }
+
+  gsize bytes_buffered = emer_event_buffer_get_cost (self->event_buffer);
+  if (bytes_buffered + event_cost > self->max_bytes_buffered)
+    {
+      if (!self->have_logged_overflow)
         {
           g_warning ("The event buffer overflowed for the first time in the "
                      "life of this event recorder daemon. The maximum number "
@@ -266,44 +522,254 @@ buffer_event (EmerDaemon *self,
                      self->max_bytes_buffered);
           self->have_logged_overflow = TRUE;
         }
+
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Appends a singular event to the in-memory buffer without building a
+ * GVariant for it. @event_id must be a valid UUID. Floating references to
+ * @payload are consumed.
+ */
+static void
+buffer_singular (EmerDaemon  *self,
+                 GVariant    *event_id,
+                 const gchar *os_version,
+                 gint64       relative_timestamp,
+                 GVariant    *payload)
+{
+  g_autoptr(GVariant) owned_payload =
+    payload != NULL ? g_variant_ref_sink (payload) : NULL;
+  gsize event_cost = emer_event_buffer_singular_cost (os_version, payload);
+  gsize event_id_length;
+  const guchar *event_id_data =
+    g_variant_get_fixed_array (event_id, &event_id_length, sizeof (guchar));
+
+  if (event_cost <= MAX_REQUEST_PAYLOAD &&
+      emer_event_policy_is_high_priority (self->event_policy, event_id_data) &&
+      emer_event_buffer_get_cost (self->priority_buffer) + event_cost <=
+        MAX_PRIORITY_BYTES_BUFFERED)
+    {
+      emer_event_buffer_append_singular (self->priority_buffer, event_id_data,
+                                         os_version, relative_timestamp,
+                                         payload);
+      schedule_priority_upload (self);
       return;
     }
 
-  g_ptr_array_add (self->variant_array, event);
-  self->num_bytes_buffered = new_bytes_buffered;
+  if (!can_buffer_event (self, event_cost))
+    return;
+
+  emer_event_buffer_append_singular (self->event_buffer, event_id_data,
+                                     os_version, relative_timestamp, payload);
+  update_pressure (self);
+  maybe_schedule_spill (self);
+}
+
+static void
+buffer_event (EmerDaemon *self,
+              GVariant   *event)
+{
+  g_autoptr(GVariant) owned_event = g_variant_ref_sink (event);
+
+  if (!can_buffer_event (self, emer_persistent_cache_cost (event)))
+    return;
+
+  emer_event_buffer_append_variant (self->event_buffer, event);
+  update_pressure (self);
+  maybe_schedule_spill (self);
 }
 
 static void
 remove_events (EmerDaemon *self,
                gsize       num_events)
 {
-  if (num_events == 0)
-    return;
+  emer_event_buffer_remove_head (self->event_buffer, num_events);
+}
+
+/* Returns the cost of @event once it is added to a network request. This is
+ * its cost in the persistent cache, except for sequences, which are expanded
+ * into one singular event per element, each repeating the event ID and OS
+ * version. */
+static gsize
+get_request_cost (GVariant *event)
+{
+  if (!g_variant_is_of_type (event, SEQUENCE_TYPE))
+    return emer_persistent_cache_cost (event);
+
+  g_autoptr(GVariantIter) payloads = NULL;
+  const gchar *os_version;
+  g_variant_get (event, "(@ay&sx@ayamv)", NULL /* event ID */, &os_version,
+                 NULL /* relative timestamp */, NULL /* deltas */, &payloads);
+
+  gsize cost = 0;
+  GVariant *payload;
+  while (g_variant_iter_next (payloads, "@mv", &payload))
+    {
+      g_autoptr(GVariant) child = g_variant_get_maybe (payload);
+      cost += emer_event_buffer_singular_cost (os_version, child);
+      g_variant_unref (payload);
+    }
+
+  return cost;
+}
+
+/* Returns the number of events from the head of @buffer which fit in a
+ * network request of @max_bytes, and sets @request_cost, unless it is NULL,
+ * to their total cost in the request. As sequences cost more in a request
+ * than in @buffer, this may be fewer than emer_event_buffer_count_within_cost()
+ * returns. */
+static gsize
+count_within_request_cost (EmerEventBuffer *buffer,
+                           gsize            max_bytes,
+                           gsize           *request_cost)
+{
+  gsize max_num_events =
+    emer_event_buffer_count_within_cost (buffer, max_bytes);
+
+  gsize num_events = 0, cost = 0;
+  for (; num_events < max_num_events; num_events++)
+    {
+      g_autoptr(GVariant) curr_event =
+        emer_event_buffer_get_event (buffer, num_events);
+      gsize event_cost = get_request_cost (curr_event);
+      if (cost + event_cost > max_bytes)
+        break;
+
+      cost += event_cost;
+    }
+
+  if (request_cost != NULL)
+    *request_cost = cost;
+
+  return num_events;
+}
+
+/* Returns a request body holding the first @num_events events from @buffer,
+ * compressed and ready to be stored in the persistent cache as a stored batch.
+ * Its timestamps are left as zero until it is sent. */
+static GVariant *
+build_stored_batch (EmerDaemon      *self,
+                    EmerEventBuffer *buffer,
+                    gsize            num_events,
+                    GError         **error)
+{
+  GVariantBuilder singulars, aggregates;
+  g_variant_builder_init (&singulars, SINGULAR_ARRAY_TYPE);
+  g_variant_builder_init (&aggregates, AGGREGATE_ARRAY_TYPE);
 
   for (gsize i = 0; i < num_events; i++)
     {
-      GVariant *curr_variant = g_ptr_array_index (self->variant_array, i);
-      self->num_bytes_buffered -= emer_persistent_cache_cost (curr_variant);
+      g_autoptr(GVariant) curr_event = emer_event_buffer_get_event (buffer, i);
+      add_events_to_builders (&curr_event, 1, &singulars, &aggregates);
     }
 
-  g_ptr_array_remove_range (self->variant_array, 0u, num_events);
+  const gchar *image_version =
+    emer_system_identity_get_image_version (self->system_identity);
+  GVariant *site_id =
+    emer_system_identity_get_site_id (self->system_identity);
+  guint8 boot_type =
+    emer_system_identity_get_boot_type (self->system_identity);
+
+  GVariant *request_body =
+    g_variant_new (REQUEST_TYPE_STRING, G_GINT64_CONSTANT (0),
+                   G_GINT64_CONSTANT (0), image_version, site_id, boot_type,
+                   &singulars, &aggregates);
+
+  g_variant_ref_sink (request_body);
+  g_autoptr(GVariant) little_endian_request_body =
+    swap_bytes_if_big_endian (request_body);
+  g_variant_unref (request_body);
+
+  gsize request_body_length = g_variant_get_size (little_endian_request_body);
+  gsize compressed_length;
+  g_autofree gpointer compressed_request_body =
+    emer_gzip_compress_with_prefix (g_variant_get_data (little_endian_request_body),
+                                    request_body_length,
+                                    STORED_BATCH_TIMESTAMPS_SIZE,
+                                    &compressed_length, error);
+  if (compressed_request_body == NULL)
+    return NULL;
+
+  GVariant *compressed =
+    g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, compressed_request_body,
+                               compressed_length, sizeof (guint8));
+  return g_variant_ref_sink (g_variant_new (STORED_BATCH_TYPE_STRING,
+                                            (guint32) num_events,
+                                            (guint32) request_body_length,
+                                            compressed));
 }
 
-static void
-flush_to_persistent_cache (EmerDaemon *self)
+/* Stores the first @num_events events from @buffer in the persistent cache as
+ * stored batches of up to one request each, and removes those which were
+ * stored from @buffer. Returns the number of events stored. */
+static gsize
+store_buffered_batches (EmerDaemon      *self,
+                        EmerEventBuffer *buffer,
+                        gsize            num_events)
 {
-  if (!self->recording_enabled)
-    return;
+  gsize num_events_stored = 0;
+  while (num_events_stored < num_events)
+    {
+      gsize batch_length =
+        count_within_request_cost (buffer, MAX_REQUEST_PAYLOAD, NULL);
+      batch_length = CLAMP (batch_length, 1, num_events - num_events_stored);
 
-  if (self->variant_array->len == 0)
-    return;
+      GError *error = NULL;
+      g_autoptr(GVariant) batch =
+        build_stored_batch (self, buffer, batch_length, &error);
+      gsize num_batches_stored = 0;
+      if (batch == NULL ||
+          !emer_persistent_cache_store (self->persistent_cache, &batch, 1,
+                                        &num_batches_stored, &error))
+        {
+          g_warning ("Failed to flush buffer to persistent cache: %s.",
+                     error->message);
+          g_error_free (error);
+          break;
+        }
+
+      if (num_batches_stored == 0)
+        break;
+
+      emer_event_buffer_remove_head (buffer, batch_length);
+      num_events_stored += batch_length;
+    }
+
+  if (num_events_stored > 0)
+    g_message ("Flushed %" G_GSIZE_FORMAT " events to persistent cache.",
+               num_events_stored);
+
+  return num_events_stored;
+}
+
+/* Stores the first @num_events events from @buffer in the persistent cache in
+ * a single batch, and removes those which were stored from @buffer. Returns
+ * the number of events stored. */
+static gsize
+store_buffered_events (EmerDaemon      *self,
+                       EmerEventBuffer *buffer,
+                       gsize            num_events)
+{
+  if (num_events == 0)
+    return 0;
+
+  if (self->store_batches)
+    return store_buffered_batches (self, buffer, num_events);
+
+  g_autoptr(GPtrArray) events =
+    g_ptr_array_new_full (num_events, (GDestroyNotify) g_variant_unref);
+  for (gsize i = 0; i < num_events; i++)
+    g_ptr_array_add (events, emer_event_buffer_get_event (buffer, i));
 
   gsize num_events_stored;
   GError *error = NULL;
   gboolean store_succeeded =
     emer_persistent_cache_store (self->persistent_cache,
-                                 (GVariant **) self->variant_array->pdata,
-                                 self->variant_array->len,
+                                 (GVariant **) events->pdata,
+                                 events->len,
                                  &num_events_stored,
                                  &error);
   if (!store_succeeded)
@@ -311,12 +777,78 @@ flush_to_persistent_cache (EmerDaemon *self)
       g_warning ("Failed to flush buffer to persistent cache: %s.",
                  error->message);
       g_error_free (error);
-      return;
+      return 0;
     }
 
+  if (num_events_stored == 0)
+    return 0;
+
   g_message ("Flushed %" G_GSIZE_FORMAT " events to persistent cache.",
              num_events_stored);
-  remove_events (self, num_events_stored);
+  emer_event_buffer_remove_head (buffer, num_events_stored);
+  return num_events_stored;
+}
+
+static void
+flush_to_persistent_cache (EmerDaemon *self)
+{
+  if (!self->recording_enabled)
+    return;
+
+  store_buffered_events (self, self->event_buffer,
+                         emer_event_buffer_get_length (self->event_buffer));
+}
+
+static gboolean
+spill_to_persistent_cache (EmerDaemon *self)
+{
+  self->spill_source_id = 0;
+
+  /* An in-flight upload refers to the events at the head of the buffer, and
+   * the rest of the buffer is flushed when it completes. */
+  if (!self->recording_enabled || self->current_upload_cancellable != NULL)
+    return G_SOURCE_REMOVE;
+
+  gsize low_watermark = self->max_bytes_buffered * SPILL_LOW_WATERMARK;
+  gsize cost = emer_event_buffer_get_cost (self->event_buffer);
+  if (cost <= low_watermark)
+    return G_SOURCE_REMOVE;
+
+  /* Spill the fewest events whose combined cost is at least the excess */
+  gsize excess = cost - low_watermark;
+  gsize num_events_to_spill =
+    emer_event_buffer_count_within_cost (self->event_buffer, excess);
+  if (emer_event_buffer_get_head_cost (self->event_buffer,
+                                       num_events_to_spill) < excess)
+    num_events_to_spill++;
+
+  /* If the persistent cache is full, every event appended from now on would
+   * schedule another spill which stores nothing, so hold off until something
+   * is removed from the cache. */
+  if (store_buffered_events (self, self->event_buffer,
+                             num_events_to_spill) == 0)
+    self->spill_blocked = TRUE;
+
+  update_pressure (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Schedules a spill to the persistent cache if the buffer has been filled past
+ * the high watermark, unless the last spill stored nothing. Must be called
+ * after appending to the buffer. */
+static void
+maybe_schedule_spill (EmerDaemon *self)
+{
+  if (self->spill_source_id != 0 || self->spill_blocked)
+    return;
+
+  gsize high_watermark = self->max_bytes_buffered * SPILL_HIGH_WATERMARK;
+  if (emer_event_buffer_get_cost (self->event_buffer) < high_watermark)
+    return;
+
+  self->spill_source_id =
+    g_idle_add ((GSourceFunc) spill_to_persistent_cache, self);
 }
 
 static void
@@ -326,7 +858,12 @@ remove_from_persistent_cache (EmerDaemon *self,
   GError *error = NULL;
   gboolean remove_succeeded =
     emer_persistent_cache_remove (self->persistent_cache, token, &error);
-  if (!remove_succeeded)
+  if (remove_succeeded)
+    {
+      /* There may be room for another spill now. */
+      self->spill_blocked = FALSE;
+    }
+  else
     {
       g_warning ("Failed to remove events from persistent cache with token %"
                  G_GUINT64_FORMAT ". They may be resent to the server. Error: "
@@ -438,38 +975,159 @@ get_updated_request_body (EmerDaemon *self,
                         singulars, aggregates);
 }
 
+/* Returns FALSE, and sets @error, if the request body length recorded in
+ * @stored_batch can't be right. */
+static gboolean
+check_stored_batch_length (GVariant  *stored_batch,
+                           GError   **error)
+{
+  guint32 request_body_length;
+  g_variant_get (stored_batch, "(uu@ay)", NULL /* number of events */,
+                 &request_body_length, NULL /* compressed request body */);
+
+  if (request_body_length > MAX_STORED_BATCH_LENGTH)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Stored batch claims a %" G_GUINT32_FORMAT "-byte request "
+                   "body, more than the maximum of %d bytes",
+                   request_body_length, MAX_STORED_BATCH_LENGTH);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Returns the serialized request body held in @stored_batch, and sets
+ * @compressed_data to the compressed form in which it is held there. Returns
+ * NULL if it is damaged. */
+static guint8 *
+decompress_stored_batch (GVariant      *stored_batch,
+                         gsize         *length,
+                         const guint8 **compressed_data,
+                         gsize         *compressed_length,
+                         GError       **error)
+{
+  if (!check_stored_batch_length (stored_batch, error))
+    return NULL;
+
+  guint32 request_body_length;
+  g_autoptr(GVariant) compressed = NULL;
+  g_variant_get (stored_batch, "(uu@ay)", NULL /* number of events */,
+                 &request_body_length, &compressed);
+
+  /* Points into the data of stored_batch, which outlives compressed */
+  *compressed_data =
+    g_variant_get_fixed_array (compressed, compressed_length, sizeof (guint8));
+  *length = request_body_length;
+  return emer_gzip_decompress (*compressed_data, *compressed_length,
+                               request_body_length, error);
+}
+
+/* Fills in the timestamps of @stored_batch without compressing it again. Sets
+ * @request_body to the serialized request and @compressed_request_body to its
+ * compressed form, both to be freed with g_free(). */
+static gboolean
+stamp_stored_batch (EmerDaemon *self,
+                    GVariant   *stored_batch,
+                    guint8    **request_body,
+                    gsize      *request_body_length,
+                    gpointer   *compressed_request_body,
+                    gsize      *compressed_request_body_length,
+                    GError    **error)
+{
+  gsize length, compressed_length;
+  const guint8 *compressed_data;
+  g_autofree guint8 *data =
+    decompress_stored_batch (stored_batch, &length, &compressed_data,
+                             &compressed_length, error);
+  if (data == NULL)
+    return FALSE;
+
+  // Wait until the last possible moment to get the time of the network request
+  // so that it can be used to measure network latency.
+  gint64 relative_timestamp, absolute_timestamp;
+  if (!get_offset_timestamps (self, &relative_timestamp, &absolute_timestamp,
+                              error))
+    return FALSE;
+
+  gint64 little_endian_timestamps[] = {
+    swap_bytes_64_if_big_endian (relative_timestamp),
+    swap_bytes_64_if_big_endian (absolute_timestamp),
+  };
+  G_STATIC_ASSERT (sizeof (little_endian_timestamps) ==
+                   STORED_BATCH_TIMESTAMPS_SIZE);
+  memcpy (data, little_endian_timestamps, STORED_BATCH_TIMESTAMPS_SIZE);
+
+  /* The checksum in the URL covers the timestamps, so it must be computed
+   * again, but only the gzip trailer's checksum of the compressed form is. */
+  g_autofree gpointer compressed = g_memdup2 (compressed_data,
+                                              compressed_length);
+  if (!emer_gzip_replace_prefix (compressed, compressed_length, data, length,
+                                 STORED_BATCH_TIMESTAMPS_SIZE, error))
+    return FALSE;
+
+  *request_body = g_steal_pointer (&data);
+  *request_body_length = length;
+  *compressed_request_body = g_steal_pointer (&compressed);
+  *compressed_request_body_length = compressed_length;
+  return TRUE;
+}
+
 static void
 queue_http_request (GTask *upload_task)
 {
   EmerDaemon *self = g_task_get_source_object (upload_task);
   NetworkCallbackData *callback_data = g_task_get_task_data (upload_task);
 
-  gconstpointer serialized_request_body =
-    g_variant_get_data (callback_data->request_body);
-  if (serialized_request_body == NULL)
+  gconstpointer serialized_request_body;
+  gsize serialized_request_body_length;
+  g_autofree guint8 *stamped_request_body = NULL;
+  gpointer compressed_request_body;
+  gsize compressed_request_body_length;
+  GError *error = NULL;
+  if (g_variant_is_of_type (callback_data->request_body, STORED_BATCH_TYPE))
     {
-      g_task_return_new_error (upload_task, G_IO_ERROR,
-                               G_IO_ERROR_INVALID_DATA,
-                               "Could not serialize network request body");
-      finish_network_callback (upload_task);
-      return;
+      if (!stamp_stored_batch (self, callback_data->request_body,
+                               &stamped_request_body,
+                               &serialized_request_body_length,
+                               &compressed_request_body,
+                               &compressed_request_body_length,
+                               &error))
+        {
+          g_task_return_error (upload_task, error);
+          finish_network_callback (upload_task);
+          return;
+        }
+
+      serialized_request_body = stamped_request_body;
     }
+  else
+    {
+      serialized_request_body =
+        g_variant_get_data (callback_data->request_body);
+      if (serialized_request_body == NULL)
+        {
+          g_task_return_new_error (upload_task, G_IO_ERROR,
+                                   G_IO_ERROR_INVALID_DATA,
+                                   "Could not serialize network request body");
+          finish_network_callback (upload_task);
+          return;
+        }
 
-  gsize serialized_request_body_length =
-    g_variant_get_size (callback_data->request_body);
+      serialized_request_body_length =
+        g_variant_get_size (callback_data->request_body);
 
-  gsize compressed_request_body_length;
-  GError *error = NULL;
-  gpointer compressed_request_body =
-    emer_gzip_compress (serialized_request_body,
-                        serialized_request_body_length,
-                        &compressed_request_body_length,
-                        &error);
-  if (compressed_request_body == NULL)
-    {
-      g_task_return_error (upload_task, error);
-      finish_network_callback (upload_task);
-      return;
+      compressed_request_body =
+        emer_gzip_compress (serialized_request_body,
+                            serialized_request_body_length,
+                            &compressed_request_body_length,
+                            &error);
+      if (compressed_request_body == NULL)
+        {
+          g_task_return_error (upload_task, error);
+          finish_network_callback (upload_task);
+          return;
+        }
     }
 
   g_autoptr(GUri) http_request_url =
@@ -481,7 +1139,11 @@ queue_http_request (GTask *upload_task)
   soup_message_headers_append (soup_message_get_request_headers (http_message),
                                "X-Endless-Content-Encoding", "gzip");
 
-  g_autoptr(GBytes) request_body = g_bytes_new (compressed_request_body, compressed_request_body_length);
+  self->request_bytes =
+    serialized_request_body_length + compressed_request_body_length;
+  update_memory_usage (self);
+
+  g_autoptr(GBytes) request_body = g_bytes_new_take (compressed_request_body, compressed_request_body_length);
   soup_message_set_request_body_from_bytes (http_message, "application/octet-stream", request_body);
 
   soup_session_send_async (self->http_session, http_message, G_PRIORITY_DEFAULT, NULL,
@@ -497,6 +1159,13 @@ handle_backoff_timer (GTask *upload_task)
   NetworkCallbackData *callback_data = g_task_get_task_data (upload_task);
   callback_data->backoff_timeout_source_id = 0;
 
+  /* Stored batches are stamped afresh each time they are sent */
+  if (g_variant_is_of_type (callback_data->request_body, STORED_BATCH_TYPE))
+    {
+      queue_http_request (upload_task);
+      return G_SOURCE_REMOVE;
+    }
+
   GError *error = NULL;
   GVariant *updated_request_body =
     get_updated_request_body (self, callback_data->request_body, &error);
@@ -515,6 +1184,23 @@ handle_backoff_timer (GTask *upload_task)
   return G_SOURCE_REMOVE;
 }
 
+/* Removes the events carried by a successful upload from the buffers and the
+ * persistent cache. If they were discarded while it was in flight, the buffers
+ * may since have been refilled with events it didn't carry, so nothing is
+ * removed. */
+static void
+remove_uploaded_events (EmerDaemon          *self,
+                        NetworkCallbackData *callback_data)
+{
+  if (callback_data->discard_count != self->discard_count)
+    return;
+
+  emer_event_buffer_remove_head (self->priority_buffer,
+                                 callback_data->num_priority_events);
+  remove_from_persistent_cache (self, callback_data->token);
+  remove_events (self, callback_data->num_buffer_events);
+}
+
 // Handles HTTP or HTTPS responses.
 static void
 handle_http_response (GObject      *source_object,
@@ -546,9 +1232,9 @@ handle_http_response (GObject      *source_object,
         }
       else
         {
-          remove_from_persistent_cache (self, callback_data->token);
-          remove_events (self, callback_data->num_buffer_events);
+          remove_uploaded_events (self, callback_data);
           flush_to_persistent_cache (self);
+          update_pressure (self);
         }
 
       /* Log URL without checksum */
@@ -557,8 +1243,10 @@ handle_http_response (GObject      *source_object,
       g_autofree gchar *base_str = g_uri_to_string (base);
 
       g_message ("Uploaded "
+                 "%" G_GSIZE_FORMAT " high-priority events, "
                  "%" G_GSIZE_FORMAT " events from persistent cache, "
                  "%" G_GSIZE_FORMAT " events from buffer to %s.",
+                 callback_data->num_priority_events,
                  callback_data->num_stored_events,
                  callback_data->num_buffer_events,
                  base_str);
@@ -612,6 +1300,120 @@ handle_http_response (GObject      *source_object,
   finish_network_callback (upload_task);
 }
 
+/* Reads the offset packed by append_delta() at *@offset in @deltas, which is
+ * @length bytes long, into @delta, and moves *@offset past it. Returns %FALSE
+ * if @deltas ends before the offset does.
+ */
+static gboolean
+read_delta (const guint8 *deltas,
+            gsize         length,
+            gsize        *offset,
+            gint64       *delta)
+{
+  guint64 zigzag = 0;
+  for (guint shift = 0; shift < 64 && *offset < length; shift += 7)
+    {
+      guint8 byte = deltas[(*offset)++];
+      zigzag |= (guint64) (byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        {
+          *delta = (gint64) ((zigzag >> 1) ^ -(zigzag & 1));
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Adds one singular event to @singulars for each event in @sequence. */
+static void
+add_sequence_to_builder (GVariant        *sequence,
+                         GVariantBuilder *singulars)
+{
+  g_autoptr(GVariant) event_id = NULL;
+  g_autoptr(GVariant) deltas = NULL;
+  g_autoptr(GVariantIter) payloads = NULL;
+  const gchar *os_version;
+  gint64 relative_timestamp, delta;
+  GVariant *payload;
+
+  g_variant_get (sequence, "(@ay&sx@ayamv)", &event_id, &os_version,
+                 &relative_timestamp, &deltas, &payloads);
+
+  gsize deltas_length, offset = 0;
+  const guint8 *delta_bytes =
+    g_variant_get_fixed_array (deltas, &deltas_length, 1);
+  while (g_variant_iter_next (payloads, "@mv", &payload))
+    {
+      if (!read_delta (delta_bytes, deltas_length, &offset, &delta))
+        {
+          g_warning ("Event sequence has more payloads than offsets. Dropping "
+                     "the rest of the event sequence.");
+          g_variant_unref (payload);
+          return;
+        }
+
+      /* Offsets wrap around, as they were taken, so this can't overflow. */
+      relative_timestamp = (guint64) relative_timestamp + (guint64) delta;
+      g_variant_builder_add (singulars, "(@aysx@mv)", event_id, os_version,
+                             relative_timestamp, payload);
+      g_variant_unref (payload);
+    }
+}
+
+/* Adds the events in @stored_batch to the builders, for when it can't be
+ * sent on its own. */
+static void
+add_stored_batch_to_builders (GVariant        *stored_batch,
+                              GVariantBuilder *singulars,
+                              GVariantBuilder *aggregates)
+{
+  gsize length, compressed_length;
+  const guint8 *compressed_data;
+  GError *error = NULL;
+  guint8 *data =
+    decompress_stored_batch (stored_batch, &length, &compressed_data,
+                             &compressed_length, &error);
+  if (data == NULL)
+    {
+      g_warning ("Discarding a damaged batch from the persistent cache: %s.",
+                 error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_autoptr(GBytes) bytes = g_bytes_new_take (data, length);
+  GVariant *request_body =
+    g_variant_new_from_bytes (STORED_REQUEST_TYPE, bytes, FALSE);
+  g_variant_ref_sink (request_body);
+  g_autoptr(GVariant) native_endian_request_body =
+    swap_bytes_if_big_endian (request_body);
+  g_variant_unref (request_body);
+
+  g_autoptr(GVariant) batch_singulars = NULL;
+  g_autoptr(GVariant) batch_aggregates = NULL;
+  g_variant_get (native_endian_request_body, RETRY_TYPE_STRING,
+                 NULL /* relative time */, NULL /* absolute time */,
+                 NULL /* image version */, NULL /* site ID */,
+                 NULL /* boot type */, &batch_singulars, &batch_aggregates);
+
+  GVariantIter iter;
+  GVariant *curr_event;
+  g_variant_iter_init (&iter, batch_singulars);
+  while ((curr_event = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      g_variant_builder_add_value (singulars, curr_event);
+      g_variant_unref (curr_event);
+    }
+
+  g_variant_iter_init (&iter, batch_aggregates);
+  while ((curr_event = g_variant_iter_next_value (&iter)) != NULL)
+    {
+      g_variant_builder_add_value (aggregates, curr_event);
+      g_variant_unref (curr_event);
+    }
+}
+
 static void
 add_events_to_builders (GVariant       **events,
                         gsize            num_events,
@@ -626,17 +1428,61 @@ add_events_to_builders (GVariant       **events,
         g_variant_builder_add_value (singulars, curr_event);
       else if (g_variant_type_equal (event_type, AGGREGATE_TYPE))
         g_variant_builder_add_value (aggregates, curr_event);
+      else if (g_variant_type_equal (event_type, SEQUENCE_TYPE))
+        add_sequence_to_builder (curr_event, singulars);
+      else if (g_variant_type_equal (event_type, STORED_BATCH_TYPE))
+        add_stored_batch_to_builders (curr_event, singulars, aggregates);
       else
         g_error ("An event has an unexpected variant type.");
     }
 }
 
+/* Reads the first @num_wanted of the @num_variants variants which were just
+ * read from the persistent cache again, so that a token covers them alone,
+ * and replaces @variants and @token with them. Returns FALSE, changing
+ * nothing, if the persistent cache can't read exactly those variants by
+ * themselves. */
+static gboolean
+reread_stored_events (EmerDaemon  *self,
+                      GVariant  ***variants,
+                      gsize       *num_variants,
+                      gsize        num_wanted,
+                      guint64     *token)
+{
+  gsize cost = 0;
+  for (gsize i = 0; i < num_wanted; i++)
+    cost += emer_persistent_cache_cost ((*variants)[i]);
+
+  GVariant **reread_variants;
+  gsize num_reread;
+  guint64 reread_token;
+  gboolean has_invalid = FALSE;
+  if (!emer_persistent_cache_read (self->persistent_cache, &reread_variants,
+                                   cost, &num_reread, &reread_token,
+                                   &has_invalid, NULL))
+    return FALSE;
+
+  if (num_reread != num_wanted || has_invalid)
+    {
+      destroy_variants (reread_variants, num_reread);
+      return FALSE;
+    }
+
+  destroy_variants (*variants, *num_variants);
+  *variants = reread_variants;
+  *num_variants = num_reread;
+  *token = reread_token;
+  return TRUE;
+}
+
 /* Populates the given variant builders with at most max_bytes of data from the
  * persistent cache. Returns TRUE if the current network request should also
  * include data from the in-memory buffer and FALSE otherwise. Sets read_bytes
  * to the number of bytes of data that were read and token to a value that can
  * be passed to emer_persistent_cache_remove to remove the events that were
- * added to the variant builders from the persistent cache.
+ * added to the variant builders from the persistent cache. If the persistent
+ * cache begins with a stored batch, sets stored_batch to it instead, and
+ * read_variants to the number of events in it.
  */
 static gboolean
 add_stored_events_to_builders (EmerDaemon        *self,
@@ -644,6 +1490,7 @@ add_stored_events_to_builders (EmerDaemon        *self,
                                gsize             *read_variants,
                                gsize             *read_bytes,
                                guint64           *token,
+                               GVariant         **stored_batch,
                                GVariantBuilder   *singulars,
                                GVariantBuilder   *aggregates)
 {
@@ -651,6 +1498,8 @@ add_stored_events_to_builders (EmerDaemon        *self,
   gsize num_variants;
   GError *error = NULL;
   gboolean has_invalid = FALSE;
+
+  *stored_batch = NULL;
   gboolean read_succeeded =
     emer_persistent_cache_read (self->persistent_cache, &variants, max_bytes,
                                 &num_variants, token, &has_invalid, &error);
@@ -664,6 +1513,10 @@ add_stored_events_to_builders (EmerDaemon        *self,
               g_warning ("Error removing data from the persistent cache: %s", local_error->message);
               g_error_free (local_error);
             }
+          else
+            {
+              self->spill_blocked = FALSE;
+            }
 
           g_warning ("Corrupt data read from the persistent cache. All cleared");
         }
@@ -686,13 +1539,80 @@ add_stored_events_to_builders (EmerDaemon        *self,
                  num_variants, *token);
     }
 
+  /* A stored batch is sent on its own, as it was built, so stop just before
+   * the first one unless it comes first. If the cache can't separate it from
+   * the variants around it, its events are added like any others. */
+  gsize num_before_batch = 0;
+  while (num_before_batch < num_variants &&
+         !g_variant_is_of_type (variants[num_before_batch], STORED_BATCH_TYPE))
+    num_before_batch++;
+
+  gboolean send_batch = FALSE;
+  if (num_before_batch < num_variants)
+    send_batch = reread_stored_events (self, &variants, &num_variants,
+                                       MAX (num_before_batch, 1), token) &&
+      num_before_batch == 0;
+
+  /* A damaged batch would fail every upload it was sent in, so it is added
+   * like any other variant instead, which discards it, and it is removed
+   * along with the rest of the request. */
+  if (send_batch && !check_stored_batch_length (variants[0], NULL))
+    send_batch = FALSE;
+
+  if (send_batch)
+    {
+      /* It may share memory with the cache's data file, which may be written
+       * to before it is sent */
+      GVariant *batch = variants[0];
+      g_autoptr(GBytes) bytes =
+        g_bytes_new (g_variant_get_data (batch), g_variant_get_size (batch));
+      *stored_batch =
+        g_variant_ref_sink (g_variant_new_from_bytes (STORED_BATCH_TYPE,
+                                                      bytes, TRUE));
+      destroy_variants (variants, num_variants);
+
+      guint32 num_events;
+      g_variant_get (*stored_batch, "(uu@ay)", &num_events,
+                     NULL /* request body length */,
+                     NULL /* compressed request body */);
+      *read_variants = num_events;
+      *read_bytes = 0;
+      return FALSE;
+    }
+
+  /* Sequences are expanded in the request, so the variants which fit in
+   * max_bytes in the cache may not fit in the request. If the cache can't
+   * separate those which do from the rest, they are all added. */
+  gsize num_within_cost = 0, curr_read_bytes = 0;
+  for (; num_within_cost < num_variants; num_within_cost++)
+    {
+      gsize event_cost = get_request_cost (variants[num_within_cost]);
+      if (curr_read_bytes + event_cost > max_bytes)
+        break;
+
+      curr_read_bytes += event_cost;
+    }
+
+  if (num_within_cost == 0 && num_variants > 0)
+    {
+      destroy_variants (variants, num_variants);
+      *read_variants = 0;
+      *read_bytes = 0;
+      *token = 0;
+      return FALSE;
+    }
+
+  if (num_within_cost < num_variants &&
+      !reread_stored_events (self, &variants, &num_variants, num_within_cost,
+                             token))
+    {
+      for (gsize i = num_within_cost; i < num_variants; i++)
+        curr_read_bytes += get_request_cost (variants[i]);
+    }
+
   add_events_to_builders (variants, num_variants,
                           singulars, aggregates);
 
-  gsize curr_read_bytes = 0;
-  for (gsize i = 0; i < num_variants; i++)
-    curr_read_bytes += emer_persistent_cache_cost (variants[i]);
-
   g_free (variants);
 
   *read_variants = num_variants;
@@ -701,31 +1621,40 @@ add_stored_events_to_builders (EmerDaemon        *self,
   return !emer_persistent_cache_has_more (self->persistent_cache, *token);
 }
 
-static void
-add_buffered_events_to_builders (EmerDaemon      *self,
+/* Adds as many events from the head of @buffer as fit in @num_bytes of the
+ * request to the builders. Returns the total cost of the events added, as
+ * counted by get_request_cost(). */
+static gsize
+add_buffered_events_to_builders (EmerEventBuffer *buffer,
                                  gsize            num_bytes,
                                  gsize           *num_variants,
                                  GVariantBuilder *singulars,
                                  GVariantBuilder *aggregates)
 {
-  gsize curr_bytes = 0, curr_num_variants = 0;
-  for (; curr_num_variants < self->variant_array->len; curr_num_variants++)
+  gsize request_cost;
+  gsize curr_num_variants =
+    count_within_request_cost (buffer, num_bytes, &request_cost);
+
+  for (gsize i = 0; i < curr_num_variants; i++)
     {
-      GVariant *curr_event =
-        g_ptr_array_index (self->variant_array, curr_num_variants);
-      curr_bytes += emer_persistent_cache_cost (curr_event);
-      if (curr_bytes > num_bytes)
-        break;
+      g_autoptr(GVariant) curr_event = emer_event_buffer_get_event (buffer, i);
+      add_events_to_builders (&curr_event, 1, singulars, aggregates);
     }
 
-  add_events_to_builders ((GVariant **) self->variant_array->pdata,
-                          curr_num_variants, singulars, aggregates);
   *num_variants = curr_num_variants;
+  return request_cost;
 }
 
+/* High-priority events always go first. If @priority_only is TRUE, the
+ * request contains nothing else, so that uploading them early doesn't drain
+ * the other events in small batches. Otherwise, if the persistent cache
+ * begins with a stored batch, returns that instead, to be sent as it is, and
+ * leaves the high-priority events for an upload of their own. */
 static GVariant *
 create_request_body (EmerDaemon *self,
                      gsize       max_bytes,
+                     gboolean    priority_only,
+                     gsize      *num_priority_events,
                      guint64    *token,
                      gsize      *num_stored_events,
                      gsize      *num_buffer_events,
@@ -735,20 +1664,53 @@ create_request_body (EmerDaemon *self,
   g_variant_builder_init (&singulars, SINGULAR_ARRAY_TYPE);
   g_variant_builder_init (&aggregates, AGGREGATE_ARRAY_TYPE);
 
-  g_autofree gchar *image_version = emer_image_id_provider_get_version ();
-  GVariant *site_id = emer_site_id_provider_get_id ();
-  guint8 boot_type = emer_boot_id_provider_get_boot_type ();
+  const gchar *image_version =
+    emer_system_identity_get_image_version (self->system_identity);
+  GVariant *site_id =
+    emer_system_identity_get_site_id (self->system_identity);
+  guint8 boot_type =
+    emer_system_identity_get_boot_type (self->system_identity);
+
+  gsize num_priority_bytes =
+    add_buffered_events_to_builders (self->priority_buffer, max_bytes,
+                                     num_priority_events,
+                                     &singulars, &aggregates);
+  max_bytes -= num_priority_bytes;
 
   gsize num_bytes_read;
-  gboolean add_from_buffer =
-    add_stored_events_to_builders (self, max_bytes, num_stored_events,
-                                   &num_bytes_read, token,
-                                   &singulars, &aggregates);
+  gboolean add_from_buffer;
+  if (priority_only)
+    {
+      *num_stored_events = 0;
+      *token = 0;
+      add_from_buffer = FALSE;
+    }
+  else
+    {
+      GVariant *stored_batch;
+      add_from_buffer =
+        add_stored_events_to_builders (self, max_bytes, num_stored_events,
+                                       &num_bytes_read, token, &stored_batch,
+                                       &singulars, &aggregates);
+      if (stored_batch != NULL)
+        {
+          g_variant_builder_clear (&singulars);
+          g_variant_builder_clear (&aggregates);
+
+          if (*num_priority_events > 0)
+            schedule_priority_upload (self);
+
+          *num_priority_events = 0;
+          *num_buffer_events = 0;
+          return stored_batch;
+        }
+    }
 
   if (add_from_buffer)
     {
       gsize space_remaining = max_bytes - num_bytes_read;
-      add_buffered_events_to_builders (self, space_remaining, num_buffer_events,
+      add_buffered_events_to_builders (self->event_buffer, space_remaining,
+                                       num_buffer_events,
                                        &singulars, &aggregates);
     }
   else
@@ -805,18 +1767,24 @@ handle_network_monitor_can_reach (GNetworkMonitor *network_monitor,
   if (!g_network_monitor_can_reach_finish (network_monitor, result, &error))
     {
       flush_to_persistent_cache (self);
+      update_pressure (self);
       g_task_return_error (upload_task, error);
       g_signal_emit (self, emer_daemon_signals[SIGNAL_UPLOAD_FINISHED], 0u);
       return;
     }
 
   NetworkCallbackData *callback_data = g_task_get_task_data (upload_task);
+  gsize max_upload_size =
+    MIN (callback_data->max_upload_size, get_request_budget (self));
+  gsize num_priority_events;
   guint64 token;
   gsize num_stored_events;
   gsize num_buffer_events;
   GVariant *request_body =
-    create_request_body (self, callback_data->max_upload_size, &token,
-                         &num_stored_events, &num_buffer_events, &error);
+    create_request_body (self, max_upload_size,
+                         callback_data->priority_only, &num_priority_events,
+                         &token, &num_stored_events, &num_buffer_events,
+                         &error);
   if (request_body == NULL)
     {
       g_task_return_error (upload_task, error);
@@ -828,9 +1796,11 @@ handle_network_monitor_can_reach (GNetworkMonitor *network_monitor,
     g_task_get_cancellable (upload_task));
 
   callback_data->request_body = request_body;
+  callback_data->num_priority_events = num_priority_events;
   callback_data->token = token;
   callback_data->num_stored_events = num_stored_events;
   callback_data->num_buffer_events = num_buffer_events;
+  callback_data->discard_count = self->discard_count;
   callback_data->attempt_num = 0;
 
   queue_http_request (upload_task);
@@ -887,6 +1857,7 @@ upload_permitted (EmerDaemon *self,
   if (!uploading_enabled)
     {
       flush_to_persistent_cache (self);
+      update_pressure (self);
       g_set_error (error, EMER_ERROR, EMER_ERROR_UPLOADING_DISABLED,
                    UPLOADING_DISABLED_MESSAGE);
       return FALSE;
@@ -919,6 +1890,7 @@ dequeue_and_do_upload (EmerDaemon  *self)
 static void
 upload_events (EmerDaemon         *self,
                gsize               max_upload_size,
+               gboolean            priority_only,
                GAsyncReadyCallback callback,
                gpointer            user_data)
 {
@@ -927,6 +1899,7 @@ upload_events (EmerDaemon         *self,
   // The rest of the fields will be populated when the request is dequeued
   NetworkCallbackData *callback_data = g_new0 (NetworkCallbackData, 1);
   callback_data->max_upload_size = max_upload_size;
+  callback_data->priority_only = priority_only;
   g_task_set_task_data (upload_task, callback_data,
                         (GDestroyNotify) network_callback_data_free);
   g_queue_push_tail (self->upload_queue, upload_task);
@@ -958,13 +1931,40 @@ handle_upload_timer (EmerDaemon *self)
   gchar *environment =
     emer_permissions_provider_get_environment (self->permissions_provider);
   schedule_upload (self, environment);
-  upload_events (self, MAX_REQUEST_PAYLOAD,
+  upload_events (self, MAX_REQUEST_PAYLOAD, FALSE /* priority_only */,
                  (GAsyncReadyCallback) log_upload_error, NULL /* user_data */);
   g_free (environment);
 
   return G_SOURCE_REMOVE;
 }
 
+static gboolean
+handle_priority_upload_timer (EmerDaemon *self)
+{
+  self->priority_upload_source_id = 0;
+
+  /* A periodic upload may have carried them in the meantime */
+  if (emer_event_buffer_get_length (self->priority_buffer) > 0)
+    upload_events (self, MAX_REQUEST_PAYLOAD, TRUE /* priority_only */,
+                   (GAsyncReadyCallback) log_upload_error,
+                   NULL /* user_data */);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Schedules an upload of the high-priority events shortly, unless one is
+ * already scheduled. Must be called after appending to the priority buffer. */
+static void
+schedule_priority_upload (EmerDaemon *self)
+{
+  if (self->priority_upload_source_id != 0)
+    return;
+
+  self->priority_upload_source_id =
+    g_timeout_add_seconds (PRIORITY_UPLOAD_DELAY_SEC,
+                           (GSourceFunc) handle_priority_upload_timer, self);
+}
+
 static void
 handle_upload_finished (EmerDaemon *self)
 {
@@ -989,7 +1989,13 @@ on_permissions_changed (EmerPermissionsProvider *permissions_provider,
       /* Discard any outstanding events */
       GError *error = NULL;
 
-      remove_events (self, self->variant_array->len);
+      gsize num_priority_events =
+        emer_event_buffer_get_length (self->priority_buffer);
+
+      remove_events (self, emer_event_buffer_get_length (self->event_buffer));
+      emer_event_buffer_remove_head (self->priority_buffer,
+                                     num_priority_events);
+      self->discard_count++;
       g_hash_table_remove_all (self->monitored_senders);
       g_hash_table_remove_all (self->aggregate_timers);
 
@@ -998,6 +2004,11 @@ on_permissions_changed (EmerPermissionsProvider *permissions_provider,
           g_warning ("failed to clear persistent cache: %s", error->message);
           g_clear_error (&error);
         }
+      else
+        {
+          self->spill_blocked = FALSE;
+        }
+      update_pressure (self);
 
       if (!emer_aggregate_tally_clear (self->aggregate_tally, &error))
         {
@@ -1078,6 +2089,20 @@ set_max_bytes_buffered (EmerDaemon *self,
   self->max_bytes_buffered = max_bytes_buffered;
 }
 
+static void
+set_event_policy_path (EmerDaemon  *self,
+                       const gchar *event_policy_path)
+{
+  self->event_policy_path = g_strdup (event_policy_path);
+}
+
+static void
+set_store_batches (EmerDaemon *self,
+                   gboolean    store_batches)
+{
+  self->store_batches = store_batches;
+}
+
 static void schedule_next_midnight_tick (EmerDaemon *self);
 
 static void
@@ -1315,24 +2340,44 @@ sender_name_vanished_cb (GDBusConnection *connection,
 }
 
 static void
-buffer_past_aggregate_events (EmerDaemon *self)
+buffer_aggregate_events_before (EmerDaemon *self,
+                                GDateTime  *datetime)
 {
-  g_autoptr(GDateTime) now = g_date_time_new_now_local ();
-
   emer_aggregate_tally_iter_before (self->aggregate_tally,
                                     EMER_TALLY_DAILY_EVENTS,
-                                    now,
+                                    datetime,
                                     EMER_TALLY_ITER_FLAG_DELETE,
                                     buffer_aggregate_event_to_queue,
                                     self);
 
   emer_aggregate_tally_iter_before (self->aggregate_tally,
                                     EMER_TALLY_MONTHLY_EVENTS,
-                                    now,
+                                    datetime,
                                     EMER_TALLY_ITER_FLAG_DELETE,
                                     buffer_aggregate_event_to_queue,
                                     self);
+}
+
+static void
+buffer_past_aggregate_events (EmerDaemon *self)
+{
+  g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+
+  buffer_aggregate_events_before (self, now);
+}
+
+/* Aggregate events dated before the current tally date arrive after their
+ * day's tally has been buffered, so they are buffered in a batch from here.
+ */
+static gboolean
+buffer_late_aggregate_events_cb (gpointer user_data)
+{
+  EmerDaemon *self = EMER_DAEMON (user_data);
 
+  self->late_aggregates_source_id = 0;
+  buffer_aggregate_events_before (self, self->current_aggregate_tally_date);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
@@ -1340,16 +2385,25 @@ emer_daemon_constructed (GObject *object)
 {
   EmerDaemon *self = EMER_DAEMON (object);
 
+  self->event_policy = emer_event_policy_new (self->event_policy_path);
+
   if (self->persistent_cache == NULL)
     {
       guint64 max_cache_size =
         emer_cache_size_provider_get_max_cache_size (NULL);
+      EmerPersistentCacheFlags flags = EMER_PERSISTENT_CACHE_FLAG_DEFAULT;
+      /* Stored batches are compressed already */
+      if (!self->store_batches &&
+          emer_cache_size_provider_get_compressed (NULL))
+        flags |= EMER_PERSISTENT_CACHE_FLAG_COMPRESSED;
+      if (emer_cache_size_provider_get_segmented (NULL))
+        flags |= EMER_PERSISTENT_CACHE_FLAG_SEGMENTED;
       g_autoptr(GError) error = NULL;
 
       self->persistent_cache =
         emer_persistent_cache_new (self->persistent_cache_directory,
                                    max_cache_size,
-                                   FALSE,
+                                   flags,
                                    &error);
 
       if (self->persistent_cache == NULL &&
@@ -1364,7 +2418,7 @@ emer_daemon_constructed (GObject *object)
           self->persistent_cache =
             emer_persistent_cache_new (self->persistent_cache_directory,
                                        max_cache_size,
-                                       TRUE,
+                                       flags | EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE,
                                        &error);
         }
 
@@ -1379,6 +2433,7 @@ emer_daemon_constructed (GObject *object)
         emer_aggregate_tally_new (self->persistent_cache_directory ?: g_get_user_cache_dir ());
     }
   buffer_past_aggregate_events (self);
+  update_pressure (self);
 
   gchar *environment =
     emer_permissions_provider_get_environment (self->permissions_provider);
@@ -1406,6 +2461,18 @@ emer_daemon_get_property (GObject      *object,
       g_value_set_object (value, self->aggregate_tally);
       break;
 
+    case PROP_BUFFER_FILL:
+      g_value_set_double (value, self->buffer_fill);
+      break;
+
+    case PROP_CACHE_FILL:
+      g_value_set_double (value, self->cache_fill);
+      break;
+
+    case PROP_PRESSURE:
+      g_value_set_uint (value, self->pressure);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -1449,6 +2516,14 @@ emer_daemon_set_property (GObject      *object,
       set_max_bytes_buffered (self, g_value_get_ulong (value));
       break;
 
+    case PROP_EVENT_POLICY_PATH:
+      set_event_policy_path (self, g_value_get_string (value));
+      break;
+
+    case PROP_STORE_BATCHES:
+      set_store_batches (self, g_value_get_boolean (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -1473,8 +2548,18 @@ emer_daemon_finalize (GObject *object)
   if (self->dispatch_aggregate_timers_daily_source_id != 0)
     g_source_remove (self->dispatch_aggregate_timers_daily_source_id);
 
+  g_clear_handle_id (&self->late_aggregates_source_id, g_source_remove);
+
+  g_clear_handle_id (&self->spill_source_id, g_source_remove);
+  g_clear_handle_id (&self->priority_upload_source_id, g_source_remove);
+
   g_clear_pointer (&self->current_aggregate_tally_date, g_date_time_unref);
 
+  /* High-priority events go first, so they are uploaded first next time */
+  gsize num_priority_events =
+    emer_event_buffer_get_length (self->priority_buffer);
+  if (self->recording_enabled)
+    store_buffered_events (self, self->priority_buffer, num_priority_events);
   flush_to_persistent_cache (self);
   g_clear_object (&self->persistent_cache);
 
@@ -1483,11 +2568,16 @@ emer_daemon_finalize (GObject *object)
   soup_session_abort (self->http_session);
   g_clear_object (&self->http_session);
 
-  g_clear_pointer (&self->variant_array, g_ptr_array_unref);
+  g_clear_pointer (&self->event_buffer, emer_event_buffer_free);
+  g_clear_pointer (&self->priority_buffer, emer_event_buffer_free);
+  g_clear_pointer (&self->memory_budget, emer_memory_budget_unref);
 
   g_rand_free (self->rand);
   g_clear_object (&self->permissions_provider);
   g_clear_object (&self->aggregate_tally);
+  g_clear_object (&self->system_identity);
+  g_clear_pointer (&self->event_policy, emer_event_policy_free);
+  g_clear_pointer (&self->event_policy_path, g_free);
   g_clear_pointer (&self->persistent_cache_directory, g_free);
 
   G_OBJECT_CLASS (emer_daemon_parent_class)->finalize (object);
@@ -1603,6 +2693,75 @@ emer_daemon_class_init (EmerDaemonClass *klass)
                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
                         G_PARAM_STATIC_STRINGS);
 
+  /*
+   * EmerDaemon:event-policy-path:
+   *
+   * The path to the file of rules deciding which events are recorded, and
+   * which are uploaded early. If %NULL, the default path is used.
+   */
+  emer_daemon_props[PROP_EVENT_POLICY_PATH] =
+    g_param_spec_string ("event-policy-path", "Event policy path",
+                         "Path to the event policy configuration file",
+                         NULL,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                         G_PARAM_STATIC_STRINGS);
+
+  /*
+   * EmerDaemon:store-batches:
+   *
+   * Whether events which can't be uploaded are stored in the persistent cache
+   * as complete, compressed requests, so that they can be sent later without
+   * being serialized and compressed again. Only their timestamps are filled
+   * in when they are sent. Stored batches are uploaded whether or not this is
+   * set.
+   */
+  emer_daemon_props[PROP_STORE_BATCHES] =
+    g_param_spec_boolean ("store-batches", "Store batches",
+                          "Whether to store events as ready-made requests",
+                          FALSE,
+                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                          G_PARAM_STATIC_STRINGS);
+
+  /*
+   * EmerDaemon:buffer-fill:
+   *
+   * The fraction of #EmerDaemon:max-bytes-buffered in use, updated whenever
+   * it changes by a few percent.
+   */
+  emer_daemon_props[PROP_BUFFER_FILL] =
+    g_param_spec_double ("buffer-fill", "Buffer fill",
+                         "Fraction of the in-memory event buffer in use",
+                         0.0, G_MAXDOUBLE, 0.0,
+                         G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /*
+   * EmerDaemon:cache-fill:
+   *
+   * The fraction of the persistent cache in use, updated whenever it changes
+   * by a few percent.
+   */
+  emer_daemon_props[PROP_CACHE_FILL] =
+    g_param_spec_double ("cache-fill", "Cache fill",
+                         "Fraction of the persistent cache in use",
+                         0.0, G_MAXDOUBLE, 0.0,
+                         G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY |
+                         G_PARAM_STATIC_STRINGS);
+
+  /*
+   * EmerDaemon:pressure:
+   *
+   * An #EmerPressure summarizing how close the daemon is to dropping events,
+   * so that producers can shed load before that happens.
+   */
+  emer_daemon_props[PROP_PRESSURE] =
+    g_param_spec_uint ("pressure", "Pressure",
+                       "How close the daemon is to dropping events",
+                       EMER_PRESSURE_NONE, EMER_PRESSURE_CRITICAL,
+                       EMER_PRESSURE_NONE,
+                       G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY |
+                       G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, NPROPS, emer_daemon_props);
 
   emer_daemon_signals[SIGNAL_UPLOAD_FINISHED] =
@@ -1635,8 +2794,11 @@ emer_daemon_init (EmerDaemon *self)
     g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
                            (GDestroyNotify)aggregate_timer_sender_data_free);
 
-  self->variant_array =
-    g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  self->event_buffer = emer_event_buffer_new ();
+  self->priority_buffer = emer_event_buffer_new ();
+  self->memory_budget = emer_memory_budget_new (MEMORY_BUDGET);
+
+  self->system_identity = emer_system_identity_new ();
 
   /* Start aggregate timers now so it can buffer previously stored events */
   schedule_next_midnight_tick (self);
@@ -1645,7 +2807,8 @@ emer_daemon_init (EmerDaemon *self)
 /*
  * emer_daemon_new:
  *
- * Returns: (transfer full): a new #EmerDaemon with the default configuration.
+ * Returns: (transfer full): a new #EmerDaemon with the default configuration,
+ * which stores batches if the persistent cache configuration file says so.
  */
 EmerDaemon *
 emer_daemon_new (const gchar             *persistent_cache_directory,
@@ -1654,6 +2817,8 @@ emer_daemon_new (const gchar             *persistent_cache_directory,
   return g_object_new (EMER_TYPE_DAEMON,
                        "persistent-cache-directory", persistent_cache_directory,
                        "permissions-provider", permissions_provider,
+                       "store-batches",
+                       emer_cache_size_provider_get_store_batches (NULL),
                        NULL);
 }
 
@@ -1705,7 +2870,7 @@ emer_daemon_record_singular_event (EmerDaemon *self,
 {
   g_return_if_fail (g_variant_is_of_type (payload, G_VARIANT_TYPE_VARIANT));
 
-  g_autofree gchar *os_version = emer_image_id_provider_get_os_version();
+  g_autoptr(GVariant) owned_event_id = g_variant_ref_sink (event_id);
 
   if (!self->recording_enabled)
     return;
@@ -1717,6 +2882,12 @@ emer_daemon_record_singular_event (EmerDaemon *self,
       return;
     }
 
+  if (!is_allowed_by_policy (self, event_id))
+    return;
+
+  const gchar *os_version =
+    emer_system_identity_get_os_version (self->system_identity);
+
   gint64 boot_offset;
   GError *error = NULL;
   if (!emer_persistent_cache_get_boot_time_offset (self->persistent_cache,
@@ -1730,10 +2901,180 @@ emer_daemon_record_singular_event (EmerDaemon *self,
   relative_timestamp += boot_offset;
 
   GVariant *nullable_payload = get_nullable_payload (payload, has_payload);
-  GVariant *singular =
-    g_variant_new ("(@aysxm@v)", event_id, os_version, relative_timestamp,
+  buffer_singular (self, event_id, os_version, relative_timestamp,
                    nullable_payload);
-  buffer_event (self, singular);
+}
+
+/*
+ * emer_daemon_record_singular_events:
+ * @self: the daemon
+ * @events: an array of type a(uayxbv), each element of which holds the
+ *   arguments that would otherwise be passed to
+ *   emer_daemon_record_singular_event(), preceded by the ID of the user who
+ *   triggered the event (which is currently ignored)
+ *
+ * Records a batch of singular events. This is equivalent to calling
+ * emer_daemon_record_singular_event() for each element of @events, but the OS
+ * version and boot offset are only looked up once for the whole batch.
+ */
+void
+emer_daemon_record_singular_events (EmerDaemon *self,
+                                    GVariant   *events)
+{
+  g_return_if_fail (g_variant_is_of_type (events, SINGULAR_BATCH_TYPE));
+
+  if (!self->recording_enabled)
+    return;
+
+  gsize num_events = g_variant_n_children (events);
+  if (num_events == 0)
+    return;
+
+  gint64 boot_offset;
+  GError *error = NULL;
+  if (!emer_persistent_cache_get_boot_time_offset (self->persistent_cache,
+                                                   &boot_offset, &error))
+    {
+      g_warning ("Unable to correct events' relative timestamps. Dropping %"
+                 G_GSIZE_FORMAT " events. Error: %s.", num_events,
+                 error->message);
+      g_error_free (error);
+      return;
+    }
+
+  const gchar *os_version =
+    emer_system_identity_get_os_version (self->system_identity);
+
+  GVariantIter iter;
+  GVariant *event_id, *payload;
+  gint64 relative_timestamp;
+  gboolean has_payload;
+  g_variant_iter_init (&iter, events);
+  while (g_variant_iter_next (&iter, "(u@ayxb@v)", NULL /* user ID */,
+                              &event_id, &relative_timestamp, &has_payload,
+                              &payload))
+    {
+      if (!is_uuid (event_id))
+        {
+          g_warning ("Event ID must be a UUID represented as an array of %"
+                     G_GSIZE_FORMAT " bytes. Dropping event.", UUID_LENGTH);
+        }
+      else if (is_allowed_by_policy (self, event_id))
+        {
+          buffer_singular (self, event_id, os_version,
+                           relative_timestamp + boot_offset,
+                           has_payload ? payload : NULL);
+        }
+
+      g_variant_unref (event_id);
+      g_variant_unref (payload);
+    }
+}
+
+/*
+ * Returns the local time at which an event with the given (uncorrected)
+ * relative timestamp occurred, or the current time if that can't be
+ * determined.
+ */
+static GDateTime *
+get_datetime_for_relative_timestamp (gint64 relative_timestamp)
+{
+  GDateTime *now = g_date_time_new_now_local ();
+  gint64 current_relative_timestamp;
+
+  if (!emtr_util_get_current_time (CLOCK_BOOTTIME, &current_relative_timestamp) ||
+      relative_timestamp < 0 ||
+      relative_timestamp > current_relative_timestamp)
+    return now;
+
+  GTimeSpan age = (current_relative_timestamp - relative_timestamp) / 1000;
+  GDateTime *datetime = g_date_time_add (now, -age);
+  g_date_time_unref (now);
+
+  return datetime;
+}
+
+/*
+ * emer_daemon_record_aggregate_event:
+ * @self: the daemon
+ * @unix_user_id: the user who triggered the event
+ * @event_id: the event ID, a 16-byte UUID
+ * @count: the number of times the event occurred
+ * @relative_timestamp: the relative timestamp at which the event occurred
+ * @has_payload: whether @payload should be recorded
+ * @payload: the event's payload, of type 'v'
+ *
+ * Adds @count to the daily and monthly tallies for the event. The tallies are
+ * accumulated in memory by the #EmerAggregateTally, and enqueued for upload
+ * once the day or month is over, in the same way as aggregate timers. An
+ * event from a day which is already over is enqueued from an idle callback,
+ * along with any others which arrive before it runs.
+ */
+void
+emer_daemon_record_aggregate_event (EmerDaemon *self,
+                                    guint32     unix_user_id,
+                                    GVariant   *event_id,
+                                    gint64      count,
+                                    gint64      relative_timestamp,
+                                    gboolean    has_payload,
+                                    GVariant   *payload)
+{
+  g_return_if_fail (g_variant_is_of_type (payload, G_VARIANT_TYPE_VARIANT));
+
+  g_autoptr(GVariant) nullable_payload =
+    get_nullable_payload (payload, has_payload);
+  if (nullable_payload != NULL)
+    g_variant_ref_sink (nullable_payload);
+
+  if (!self->recording_enabled)
+    return;
+
+  if (!is_uuid (event_id))
+    {
+      g_warning ("Event ID must be a UUID represented as an array of %"
+                 G_GSIZE_FORMAT " bytes. Dropping event.", UUID_LENGTH);
+      return;
+    }
+
+  if (count <= 0 || !is_allowed_by_policy (self, event_id))
+    return;
+
+  uuid_t daily_event_id, monthly_event_id;
+  gsize event_id_length;
+  gconstpointer event_id_bytes =
+    g_variant_get_fixed_array (event_id, &event_id_length, 1);
+  memcpy (daily_event_id, event_id_bytes, UUID_LENGTH);
+  uuid_generate_sha1 (monthly_event_id, daily_event_id, "monthly",
+                      strlen ("monthly"));
+
+  guint32 counter = MIN (count, G_MAXUINT32);
+  g_autoptr(GDateTime) datetime =
+    get_datetime_for_relative_timestamp (relative_timestamp);
+
+  emer_aggregate_tally_add_event (self->aggregate_tally,
+                                  EMER_TALLY_DAILY_EVENTS,
+                                  unix_user_id,
+                                  daily_event_id,
+                                  nullable_payload,
+                                  counter,
+                                  datetime);
+  emer_aggregate_tally_add_event (self->aggregate_tally,
+                                  EMER_TALLY_MONTHLY_EVENTS,
+                                  unix_user_id,
+                                  monthly_event_id,
+                                  nullable_payload,
+                                  counter,
+                                  datetime);
+
+  /* The tally for an earlier day has been buffered already, at midnight or
+   * on startup, so this event's would otherwise wait for the next restart.
+   */
+  g_autofree gchar *date = g_date_time_format (datetime, "%Y-%m-%d");
+  g_autofree gchar *tally_date =
+    g_date_time_format (self->current_aggregate_tally_date, "%Y-%m-%d");
+  if (g_strcmp0 (date, tally_date) < 0 && self->late_aggregates_source_id == 0)
+    self->late_aggregates_source_id =
+      g_idle_add (buffer_late_aggregate_events_cb, self);
 }
 
 void
@@ -1745,8 +3086,6 @@ emer_daemon_enqueue_aggregate_event (EmerDaemon *self,
 {
   g_return_if_fail (payload == NULL || g_variant_is_of_type (payload, G_VARIANT_TYPE_VARIANT));
 
-  g_autofree gchar *os_version = emer_image_id_provider_get_os_version();
-
   if (!self->recording_enabled)
     return;
 
@@ -1757,18 +3096,151 @@ emer_daemon_enqueue_aggregate_event (EmerDaemon *self,
       return;
     }
 
+  if (!is_allowed_by_policy (self, event_id))
+    return;
+
+  const gchar *os_version =
+    emer_system_identity_get_os_version (self->system_identity);
   GVariant *aggregate =
     g_variant_new ("(@ayssum@v)", event_id, os_version, period_start, count,
                    payload);
   buffer_event (self, aggregate);
 }
 
+/* Appends @delta to @deltas as a base-128 varint, least significant group of
+ * seven bits first, with the top bit of each byte but the last set. The sign
+ * is moved to the lowest bit first ("zigzag" encoding), so that offsets of
+ * either sign take one byte per seven bits of magnitude. Any #gint64 takes at
+ * most ten bytes, and offsets of up to a few seconds, in nanoseconds, take
+ * five.
+ */
+static void
+append_delta (GByteArray *deltas,
+              gint64      delta)
+{
+  guint64 zigzag = ((guint64) delta << 1) ^ (guint64) (delta < 0 ? -1 : 0);
+  guint8 byte;
+
+  while (zigzag >= 0x80)
+    {
+      byte = (zigzag & 0x7f) | 0x80;
+      g_byte_array_append (deltas, &byte, 1);
+      zigzag >>= 7;
+    }
+
+  byte = zigzag;
+  g_byte_array_append (deltas, &byte, 1);
+}
+
+/*
+ * emer_daemon_record_event_sequence:
+ * @self: the daemon
+ * @user_id: the ID of the user who triggered the sequence (currently ignored)
+ * @event_id: the event ID, a 16-byte UUID
+ * @event_values: an array of type a(xmv), each element of which holds the
+ *   relative timestamp and optional payload of one event in the sequence
+ *
+ * Records a sequence of events which share an event ID, such as the start and
+ * end of a session. Rather than being split into one singular event per
+ * element, the sequence is buffered and stored as a single record holding the
+ * event ID and OS version once, the corrected timestamp of the first event,
+ * and for each event its payload and the time elapsed since the previous one,
+ * packed into a variable number of bytes. An offset which doesn't fit in a
+ * #gint64 wraps around, and is unwrapped when the sequence is expanded.
+ * The sequence is only expanded into singular events when a network request
+ * is built, and it is dropped if it would not fit in one once expanded.
+ */
 void
 emer_daemon_record_event_sequence (EmerDaemon *self,
                                    guint32     user_id,
                                    GVariant   *event_id,
                                    GVariant   *event_values)
 {
+  g_return_if_fail (g_variant_is_of_type (event_values, EVENT_VALUE_ARRAY_TYPE));
+
+  g_autoptr(GVariant) owned_event_id = g_variant_ref_sink (event_id);
+  g_autoptr(GVariant) owned_event_values = g_variant_ref_sink (event_values);
+
+  if (!self->recording_enabled)
+    return;
+
+  if (!is_uuid (event_id))
+    {
+      g_warning ("Event ID must be a UUID represented as an array of %"
+                 G_GSIZE_FORMAT " bytes. Dropping event sequence.",
+                 UUID_LENGTH);
+      return;
+    }
+
+  if (!is_allowed_by_policy (self, event_id))
+    return;
+
+  gsize num_events = g_variant_n_children (event_values);
+  if (num_events == 0)
+    {
+      g_warning ("Event sequence must contain at least one event. Dropping "
+                 "event sequence.");
+      return;
+    }
+
+  gint64 boot_offset;
+  GError *error = NULL;
+  if (!emer_persistent_cache_get_boot_time_offset (self->persistent_cache,
+                                                   &boot_offset, &error))
+    {
+      g_warning ("Unable to correct event sequence's relative timestamps. "
+                 "Dropping event sequence. Error: %s.", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  const gchar *os_version =
+    emer_system_identity_get_os_version (self->system_identity);
+
+  g_autoptr(GByteArray) deltas = g_byte_array_new ();
+  GVariantBuilder payloads;
+  g_variant_builder_init (&payloads, G_VARIANT_TYPE ("amv"));
+
+  GVariantIter iter;
+  GVariant *payload;
+  gint64 relative_timestamp, first_timestamp = 0, previous_timestamp = 0;
+  gsize expanded_cost = 0;
+  g_variant_iter_init (&iter, event_values);
+  for (gsize i = 0;
+       g_variant_iter_next (&iter, "(x@mv)", &relative_timestamp, &payload);
+       i++)
+    {
+      if (i == 0)
+        first_timestamp = previous_timestamp = relative_timestamp;
+
+      append_delta (deltas, (guint64) relative_timestamp -
+                            (guint64) previous_timestamp);
+      g_variant_builder_add_value (&payloads, payload);
+      previous_timestamp = relative_timestamp;
+
+      g_autoptr(GVariant) child = g_variant_get_maybe (payload);
+      expanded_cost += emer_event_buffer_singular_cost (os_version, child);
+      g_variant_unref (payload);
+    }
+
+  /* It must fit in a network request once expanded into singular events. */
+  if (expanded_cost > MAX_REQUEST_PAYLOAD)
+    {
+      g_warning ("Dropping event sequence of %" G_GSIZE_FORMAT " events, "
+                 "which would take %" G_GSIZE_FORMAT " bytes once expanded. "
+                 "The maximum permissible size is %d bytes.",
+                 num_events, expanded_cost, MAX_REQUEST_PAYLOAD);
+      g_variant_builder_clear (&payloads);
+      return;
+    }
+
+  GVariant *sequence =
+    g_variant_new ("(@aysx@ay@amv)", event_id, os_version,
+                   first_timestamp + boot_offset,
+                   g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, deltas->data,
+                                              deltas->len, 1),
+                   g_variant_builder_end (&payloads));
+  buffer_event (self, sequence);
 }
 
 /* emer_daemon_upload_events:
@@ -1789,7 +3261,8 @@ emer_daemon_upload_events (EmerDaemon         *self,
                            GAsyncReadyCallback callback,
                            gpointer            user_data)
 {
-  upload_events (self, G_MAXSIZE, callback, user_data);
+  upload_events (self, G_MAXSIZE, FALSE /* priority_only */, callback,
+                 user_data);
 }
 
 /* emer_daemon_upload_events_finish:
@@ -1825,6 +3298,100 @@ emer_daemon_get_permissions_provider (EmerDaemon *self)
   return self->permissions_provider;
 }
 
+/*
+ * emer_daemon_get_buffer_fill:
+ * @self: the daemon
+ *
+ * Returns: the value of #EmerDaemon:buffer-fill
+ */
+gdouble
+emer_daemon_get_buffer_fill (EmerDaemon *self)
+{
+  return self->buffer_fill;
+}
+
+/*
+ * emer_daemon_get_cache_fill:
+ * @self: the daemon
+ *
+ * Returns: the value of #EmerDaemon:cache-fill
+ */
+gdouble
+emer_daemon_get_cache_fill (EmerDaemon *self)
+{
+  return self->cache_fill;
+}
+
+/*
+ * emer_daemon_get_pressure:
+ * @self: the daemon
+ *
+ * Returns: the value of #EmerDaemon:pressure
+ */
+EmerPressure
+emer_daemon_get_pressure (EmerDaemon *self)
+{
+  return self->pressure;
+}
+
+/*
+ * emer_daemon_get_memory_budget:
+ * @self: the daemon
+ *
+ * Brings the usage recorded in the daemon's memory budget up to date. The
+ * daemon otherwise only does so when it sizes an upload or releases memory.
+ *
+ * Returns: (transfer none): the budget against which the daemon accounts its
+ *   memory use. Unlike the daemon itself, it may be queried from any thread.
+ */
+EmerMemoryBudget *
+emer_daemon_get_memory_budget (EmerDaemon *self)
+{
+  update_memory_usage (self);
+  return self->memory_budget;
+}
+
+/*
+ * emer_daemon_release_memory:
+ * @self: the daemon
+ *
+ * Gives back as much memory as possible, for use when the system is low on
+ * it: buffered events are moved to the persistent cache, the buffers and the
+ * aggregate tally's page cache are shrunk, and free heap memory is returned to
+ * the kernel. For a while afterwards, uploads are kept small.
+ */
+void
+emer_daemon_release_memory (EmerDaemon *self)
+{
+  update_memory_usage (self);
+  gsize usage = emer_memory_budget_get_total_usage (self->memory_budget);
+
+  self->low_memory_time = g_get_monotonic_time ();
+
+  /* An in-flight upload refers to the events at the head of the buffer */
+  if (self->current_upload_cancellable == NULL)
+    {
+      g_clear_handle_id (&self->spill_source_id, g_source_remove);
+      flush_to_persistent_cache (self);
+      update_pressure (self);
+    }
+
+  emer_event_buffer_trim (self->event_buffer);
+  emer_event_buffer_trim (self->priority_buffer);
+
+  if (self->aggregate_tally != NULL)
+    emer_aggregate_tally_release_memory (self->aggregate_tally);
+
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim (0);
+#endif
+
+  update_memory_usage (self);
+  g_message ("Released memory on request; usage went from %" G_GSIZE_FORMAT
+             " to %" G_GSIZE_FORMAT " bytes.", usage,
+             emer_memory_budget_get_total_usage (self->memory_budget));
+}
+
 gboolean
 emer_daemon_start_aggregate_timer (EmerDaemon       *self,
                                    GDBusConnection  *connection,
@@ -28,11 +28,27 @@
 
 #include "emer-aggregate-tally.h"
 #include "emer-event-recorder-server.h"
+#include "emer-memory-budget.h"
 #include "emer-permissions-provider.h"
 #include "emer-persistent-cache.h"
 
 G_BEGIN_DECLS
 
+/*
+ * EmerPressure:
+ * @EMER_PRESSURE_NONE: events are being recorded normally
+ * @EMER_PRESSURE_ELEVATED: the buffer or persistent cache is filling up, so
+ *   producers should batch their events or record fewer of them
+ * @EMER_PRESSURE_CRITICAL: the buffer or persistent cache is nearly full, so
+ *   further events are likely to be dropped
+ */
+typedef enum
+{
+  EMER_PRESSURE_NONE,
+  EMER_PRESSURE_ELEVATED,
+  EMER_PRESSURE_CRITICAL,
+} EmerPressure;
+
 #define EMER_TYPE_DAEMON emer_daemon_get_type()
 G_DECLARE_FINAL_TYPE (EmerDaemon, emer_daemon, EMER, DAEMON, GObject)
 
@@ -52,6 +68,17 @@ void                     emer_daemon_record_singular_event    (EmerDaemon
                                                                gboolean                 has_payload,
                                                                GVariant                *payload);
 
+void                     emer_daemon_record_singular_events   (EmerDaemon              *self,
+                                                               GVariant                *events);
+
+void                     emer_daemon_record_aggregate_event   (EmerDaemon              *self,
+                                                               guint32                  unix_user_id,
+                                                               GVariant                *event_id,
+                                                               gint64                   count,
+                                                               gint64                   relative_timestamp,
+                                                               gboolean                 has_payload,
+                                                               GVariant                *payload);
+
 void                     emer_daemon_enqueue_aggregate_event  (EmerDaemon              *self,
                                                                GVariant                *event_id,
                                                                const char              *period_start,
@@ -73,6 +100,16 @@ gboolean                 emer_daemon_upload_events_finish     (EmerDaemon
                                                                GError                 **error);
 EmerPermissionsProvider *emer_daemon_get_permissions_provider (EmerDaemon              *self);
 
+gdouble                  emer_daemon_get_buffer_fill          (EmerDaemon              *self);
+
+gdouble                  emer_daemon_get_cache_fill           (EmerDaemon              *self);
+
+EmerPressure             emer_daemon_get_pressure             (EmerDaemon              *self);
+
+EmerMemoryBudget *       emer_daemon_get_memory_budget        (EmerDaemon              *self);
+
+void                     emer_daemon_release_memory           (EmerDaemon              *self);
+
 gboolean                 emer_daemon_start_aggregate_timer    (EmerDaemon              *self,
                                                                GDBusConnection         *connection,
                                                                const gchar             *sender_name,
@@ -0,0 +1,161 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-element-store.h"
+
+#include <string.h>
+
+/* SECTION:emer-element-store.c
+ * @title: Element Store
+ * @short_description: A persistent FIFO of byte strings
+ *
+ * The interface through which the persistent cache stores its elements, so
+ * that it can keep them either in a single #EmerCircularFile or in an
+ * #EmerSegmentedFile. Elements are appended in memory and written to disk
+ * together when saved. They are read back in the order in which they were
+ * saved, and removed from the front using the token returned by the read
+ * which produced them. See #EmerCircularFile for the details of each
+ * operation, which every implementation shares.
+ */
+
+G_DEFINE_INTERFACE (EmerElementStore, emer_element_store, G_TYPE_OBJECT)
+
+static void
+emer_element_store_default_init (EmerElementStoreInterface *iface)
+{
+  /* Nothing to do */
+}
+
+/* Appends the given element in memory only, as emer_circular_file_append
+ * does. Returns FALSE if it would not fit.
+ */
+gboolean
+emer_element_store_append (EmerElementStore *self,
+                           gconstpointer     elem,
+                           guint64           elem_size)
+{
+  gpointer reserved = emer_element_store_reserve (self, elem_size);
+  if (reserved == NULL)
+    return FALSE;
+
+  memcpy (reserved, elem, elem_size);
+  emer_element_store_commit (self);
+
+  return TRUE;
+}
+
+/* Returns a pointer to elem_size bytes of memory to write an element into,
+ * which is appended once emer_element_store_commit is called, or NULL if the
+ * element would not fit. See emer_circular_file_reserve.
+ */
+gpointer
+emer_element_store_reserve (EmerElementStore *self,
+                            guint64           elem_size)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), NULL);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->reserve (self, elem_size);
+}
+
+void
+emer_element_store_commit (EmerElementStore *self)
+{
+  g_return_if_fail (EMER_IS_ELEMENT_STORE (self));
+
+  EMER_ELEMENT_STORE_GET_IFACE (self)->commit (self);
+}
+
+/* Writes the elements appended since the last save to disk. */
+gboolean
+emer_element_store_save (EmerElementStore *self,
+                         GError          **error)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), FALSE);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->save (self, error);
+}
+
+/* Reads saved elements from the front of the store, totalling at most
+ * num_bytes bytes. See emer_circular_file_read.
+ */
+gboolean
+emer_element_store_read (EmerElementStore *self,
+                         GBytes         ***elems,
+                         gsize             num_bytes,
+                         gsize            *num_elems,
+                         guint64          *token,
+                         gboolean         *has_invalid,
+                         GError          **error)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), FALSE);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->read (self, elems, num_bytes,
+                                                    num_elems, token,
+                                                    has_invalid, error);
+}
+
+/* Returns TRUE if removing the elements read with the given token would leave
+ * any behind. See emer_circular_file_has_more.
+ */
+gboolean
+emer_element_store_has_more (EmerElementStore *self,
+                             guint64           token)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), FALSE);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->has_more (self, token);
+}
+
+/* Removes the elements read with the given token. See
+ * emer_circular_file_remove.
+ */
+gboolean
+emer_element_store_remove (EmerElementStore *self,
+                           guint64           token,
+                           GError          **error)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), FALSE);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->remove (self, token, error);
+}
+
+/* Removes all saved elements. */
+gboolean
+emer_element_store_purge (EmerElementStore *self,
+                          GError          **error)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), FALSE);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->purge (self, error);
+}
+
+/* Returns the fraction of the store's capacity in use, counting elements
+ * which have been appended but not yet saved.
+ */
+gdouble
+emer_element_store_get_fill_ratio (EmerElementStore *self)
+{
+  g_return_val_if_fail (EMER_IS_ELEMENT_STORE (self), 1.0);
+
+  return EMER_ELEMENT_STORE_GET_IFACE (self)->get_fill_ratio (self);
+}
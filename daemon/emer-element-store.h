@@ -0,0 +1,112 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMER_ELEMENT_STORE_H
+#define EMER_ELEMENT_STORE_H
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EMER_TYPE_ELEMENT_STORE emer_element_store_get_type()
+
+#define EMER_ELEMENT_STORE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  EMER_TYPE_ELEMENT_STORE, EmerElementStore))
+
+#define EMER_IS_ELEMENT_STORE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  EMER_TYPE_ELEMENT_STORE))
+
+#define EMER_ELEMENT_STORE_GET_IFACE(obj) \
+  (G_TYPE_INSTANCE_GET_INTERFACE ((obj), \
+  EMER_TYPE_ELEMENT_STORE, EmerElementStoreInterface))
+
+typedef struct _EmerElementStore EmerElementStore;
+typedef struct _EmerElementStoreInterface EmerElementStoreInterface;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerElementStore, g_object_unref)
+
+struct _EmerElementStoreInterface
+{
+  GTypeInterface parent_iface;
+
+  gpointer (*reserve)        (EmerElementStore *self,
+                              guint64           elem_size);
+  void     (*commit)         (EmerElementStore *self);
+  gboolean (*save)           (EmerElementStore *self,
+                              GError          **error);
+  gboolean (*read)           (EmerElementStore *self,
+                              GBytes         ***elems,
+                              gsize             num_bytes,
+                              gsize            *num_elems,
+                              guint64          *token,
+                              gboolean         *has_invalid,
+                              GError          **error);
+  gboolean (*has_more)       (EmerElementStore *self,
+                              guint64           token);
+  gboolean (*remove)         (EmerElementStore *self,
+                              guint64           token,
+                              GError          **error);
+  gboolean (*purge)          (EmerElementStore *self,
+                              GError          **error);
+  gdouble  (*get_fill_ratio) (EmerElementStore *self);
+};
+
+GType    emer_element_store_get_type       (void) G_GNUC_CONST;
+
+gboolean emer_element_store_append         (EmerElementStore *self,
+                                            gconstpointer     elem,
+                                            guint64           elem_size);
+
+gpointer emer_element_store_reserve        (EmerElementStore *self,
+                                            guint64           elem_size);
+
+void     emer_element_store_commit         (EmerElementStore *self);
+
+gboolean emer_element_store_save           (EmerElementStore *self,
+                                            GError          **error);
+
+gboolean emer_element_store_read           (EmerElementStore *self,
+                                            GBytes         ***elems,
+                                            gsize             num_bytes,
+                                            gsize            *num_elems,
+                                            guint64          *token,
+                                            gboolean         *has_invalid,
+                                            GError          **error);
+
+gboolean emer_element_store_has_more       (EmerElementStore *self,
+                                            guint64           token);
+
+gboolean emer_element_store_remove         (EmerElementStore *self,
+                                            guint64           token,
+                                            GError          **error);
+
+gboolean emer_element_store_purge          (EmerElementStore *self,
+                                            GError          **error);
+
+gdouble  emer_element_store_get_fill_ratio (EmerElementStore *self);
+
+G_END_DECLS
+
+#endif /* EMER_ELEMENT_STORE_H */
@@ -0,0 +1,647 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-event-buffer.h"
+
+#include <string.h>
+
+#include "emer-cache-record.h"
+#include "shared/metrics-util.h"
+
+/*
+ * EmerEventBuffer:
+ *
+ * An in-memory FIFO of events waiting to be uploaded or written to the
+ * persistent cache. Rather than keeping a GVariant tree per event, each event
+ * is stored as a small fixed-size header in a contiguous array, with any
+ * variable-length data appended to a shared byte arena. Event IDs, OS versions
+ * and type strings, which are repeated across most events, are interned and
+ * referred to by index.
+ *
+ * Singular events, which are by far the most common, are stored as their
+ * components: the event ID, OS version, relative timestamp and serialized
+ * payload. All other events are stored as their type string and serialized
+ * form. A GVariant is only built when an event is read back with
+ * emer_event_buffer_get_event().
+ *
+ * The cost of each event is the same as emer_persistent_cache_cost() would
+ * return for the corresponding GVariant. It is computed once when the event
+ * is appended, and each header also records the running total of the costs
+ * of all events appended up to and including it. The cost of any run of
+ * events from the head of the buffer is then a subtraction, and the number of
+ * events which fit in a given cost is a binary search.
+ */
+
+#define SINGULAR_TYPE_STRING "(aysxmv)"
+
+/* Once at least this many events have been removed from the head of the
+ * buffer, and they make up at least half of the buffer, the remaining events
+ * are moved to the front of the header array and arena.
+ */
+#define MIN_EVENTS_TO_COMPACT 64
+
+typedef enum
+{
+  EVENT_KIND_SINGULAR,
+  EVENT_KIND_SERIALIZED,
+} EventKind;
+
+typedef struct
+{
+  /* Singular events only */
+  gint64 relative_timestamp;
+
+  /* The event's data in the arena: the serialized payload (empty if there is
+   * none) for singular events, or the whole serialized event otherwise.
+   */
+  gsize data_offset;
+  guint32 data_size;
+
+  guint32 cost;
+
+  /* The sum of the costs of this event and all events appended before it
+   * since the buffer was last emptied.
+   */
+  guint64 end_cost;
+
+  /* Singular events only; an index into event_ids */
+  guint32 event_id_index;
+
+  /* An index into strings: the OS version for singular events, or the type
+   * string otherwise.
+   */
+  guint32 string_index;
+
+  EventKind kind;
+} EventHeader;
+
+struct _EmerEventBuffer
+{
+  /* Array of EventHeader. Entries before first_event have been removed but
+   * not yet compacted away.
+   */
+  GArray *headers;
+  guint first_event;
+
+  GByteArray *arena;
+
+  /* Interned UUIDs, as UUID_LENGTH-byte blocks, and a map from each to its
+   * index plus one.
+   */
+  GPtrArray *event_ids;
+  GHashTable *event_id_indices;
+
+  /* Interned OS versions and type strings, and a map from each to its index
+   * plus one.
+   */
+  GPtrArray *strings;
+  GHashTable *string_indices;
+
+  /* The sum of the costs of all events appended since the buffer was last
+   * emptied, and of those which have since been removed.
+   */
+  guint64 appended_cost;
+  guint64 removed_cost;
+};
+
+static guint
+event_id_hash (gconstpointer key)
+{
+  const guchar *event_id = key;
+  guint hash = 0;
+
+  for (gsize i = 0; i < UUID_LENGTH; i++)
+    hash = (hash << 5) - hash + event_id[i];
+
+  return hash;
+}
+
+static gboolean
+event_id_equal (gconstpointer a,
+                gconstpointer b)
+{
+  return memcmp (a, b, UUID_LENGTH) == 0;
+}
+
+static guint32
+intern_event_id (EmerEventBuffer *self,
+                 const guchar    *event_id)
+{
+  gpointer index_plus_one = g_hash_table_lookup (self->event_id_indices,
+                                                 event_id);
+  if (index_plus_one != NULL)
+    return GPOINTER_TO_UINT (index_plus_one) - 1;
+
+  guchar *copy = g_memdup2 (event_id, UUID_LENGTH);
+  g_ptr_array_add (self->event_ids, copy);
+  g_hash_table_insert (self->event_id_indices, copy,
+                       GUINT_TO_POINTER (self->event_ids->len));
+
+  return self->event_ids->len - 1;
+}
+
+static guint32
+intern_string (EmerEventBuffer *self,
+               const gchar     *string)
+{
+  gpointer index_plus_one = g_hash_table_lookup (self->string_indices,
+                                                 string);
+  if (index_plus_one != NULL)
+    return GPOINTER_TO_UINT (index_plus_one) - 1;
+
+  gchar *copy = g_strdup (string);
+  g_ptr_array_add (self->strings, copy);
+  g_hash_table_insert (self->string_indices, copy,
+                       GUINT_TO_POINTER (self->strings->len));
+
+  return self->strings->len - 1;
+}
+
+/* Appends the serialized form of @variant to the arena, and sets the location
+ * of the data in @header.
+ */
+static void
+store_in_arena (EmerEventBuffer *self,
+                GVariant        *variant,
+                EventHeader     *header)
+{
+  gsize size = g_variant_get_size (variant);
+
+  header->data_offset = self->arena->len;
+  header->data_size = size;
+
+  g_byte_array_set_size (self->arena, self->arena->len + size);
+  g_variant_store (variant, self->arena->data + header->data_offset);
+}
+
+/* Returns a new floating GVariant of the given type holding a copy of the
+ * data described by @header.
+ */
+static GVariant *
+load_from_arena (EmerEventBuffer    *self,
+                 const GVariantType *type,
+                 const EventHeader  *header)
+{
+  gpointer data = g_memdup2 (self->arena->data + header->data_offset,
+                             header->data_size);
+
+  return g_variant_new_from_data (type, data, header->data_size,
+                                  FALSE /* trusted */, g_free, data);
+}
+
+static void
+append_header (EmerEventBuffer *self,
+               EventHeader     *header)
+{
+  self->appended_cost += header->cost;
+  header->end_cost = self->appended_cost;
+  g_array_append_vals (self->headers, header, 1);
+}
+
+static inline EventHeader *
+get_header (EmerEventBuffer *self,
+            gsize            index)
+{
+  return &g_array_index (self->headers, EventHeader, self->first_event + index);
+}
+
+static void
+reset (EmerEventBuffer *self)
+{
+  g_array_set_size (self->headers, 0);
+  self->first_event = 0;
+  g_byte_array_set_size (self->arena, 0);
+
+  /* The interned values are owned by the arrays */
+  g_hash_table_remove_all (self->event_id_indices);
+  g_ptr_array_set_size (self->event_ids, 0);
+  g_hash_table_remove_all (self->string_indices);
+  g_ptr_array_set_size (self->strings, 0);
+
+  self->appended_cost = 0;
+  self->removed_cost = 0;
+}
+
+/* Moves the remaining events to the front of the header array and arena. */
+static void
+compact (EmerEventBuffer *self)
+{
+  gsize base = get_header (self, 0)->data_offset;
+
+  memmove (self->arena->data, self->arena->data + base,
+           self->arena->len - base);
+  g_byte_array_set_size (self->arena, self->arena->len - base);
+
+  g_array_remove_range (self->headers, 0, self->first_event);
+  self->first_event = 0;
+
+  for (guint i = 0; i < self->headers->len; i++)
+    g_array_index (self->headers, EventHeader, i).data_offset -= base;
+}
+
+/*
+ * emer_event_buffer_new:
+ *
+ * Returns: (transfer full): a new, empty #EmerEventBuffer
+ */
+EmerEventBuffer *
+emer_event_buffer_new (void)
+{
+  EmerEventBuffer *self = g_new0 (EmerEventBuffer, 1);
+
+  self->headers = g_array_new (FALSE, FALSE, sizeof (EventHeader));
+  self->arena = g_byte_array_new ();
+  self->event_ids = g_ptr_array_new_with_free_func (g_free);
+  self->event_id_indices = g_hash_table_new (event_id_hash, event_id_equal);
+  self->strings = g_ptr_array_new_with_free_func (g_free);
+  self->string_indices = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return self;
+}
+
+void
+emer_event_buffer_free (EmerEventBuffer *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_array_unref (self->headers);
+  g_byte_array_unref (self->arena);
+  g_hash_table_unref (self->event_id_indices);
+  g_ptr_array_unref (self->event_ids);
+  g_hash_table_unref (self->string_indices);
+  g_ptr_array_unref (self->strings);
+  g_free (self);
+}
+
+/*
+ * emer_event_buffer_get_length:
+ * @self: the buffer
+ *
+ * Returns: the number of events in the buffer
+ */
+gsize
+emer_event_buffer_get_length (EmerEventBuffer *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->headers->len - self->first_event;
+}
+
+/*
+ * emer_event_buffer_get_cost:
+ * @self: the buffer
+ *
+ * Returns: the sum of the costs of all events in the buffer
+ */
+gsize
+emer_event_buffer_get_cost (EmerEventBuffer *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->appended_cost - self->removed_cost;
+}
+
+/*
+ * emer_event_buffer_get_head_cost:
+ * @self: the buffer
+ * @num_events: a number of events, at most the length of the buffer
+ *
+ * Returns: the sum of the costs of the oldest @num_events events, computed
+ *   in constant time
+ */
+gsize
+emer_event_buffer_get_head_cost (EmerEventBuffer *self,
+                                 gsize            num_events)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (num_events <= emer_event_buffer_get_length (self), 0);
+
+  if (num_events == 0)
+    return 0;
+
+  return get_header (self, num_events - 1)->end_cost - self->removed_cost;
+}
+
+/*
+ * emer_event_buffer_count_within_cost:
+ * @self: the buffer
+ * @max_cost: a cost
+ *
+ * Finds how many events, starting from the oldest, can be taken without
+ * their total cost exceeding @max_cost, in logarithmic time.
+ *
+ * Returns: the largest n such that emer_event_buffer_get_head_cost(n) is at
+ *   most @max_cost
+ */
+gsize
+emer_event_buffer_count_within_cost (EmerEventBuffer *self,
+                                     gsize            max_cost)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  gsize low = 0, high = emer_event_buffer_get_length (self);
+
+  /* Invariant: the first low events fit, and events at or after high don't */
+  while (low < high)
+    {
+      gsize mid = low + (high - low) / 2;
+
+      if (get_header (self, mid)->end_cost - self->removed_cost <= max_cost)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  return low;
+}
+
+/*
+ * emer_event_buffer_get_memory_usage:
+ * @self: the buffer
+ *
+ * Returns: approximately how many bytes of memory the buffer holds, including
+ *   interned values and events removed from the head but not yet compacted
+ *   away
+ */
+gsize
+emer_event_buffer_get_memory_usage (EmerEventBuffer *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  gsize usage = sizeof (EmerEventBuffer) +
+    self->headers->len * sizeof (EventHeader) +
+    self->arena->len +
+    self->event_ids->len * UUID_LENGTH;
+
+  for (guint i = 0; i < self->strings->len; i++)
+    usage += strlen (g_ptr_array_index (self->strings, i)) + 1;
+
+  return usage;
+}
+
+/*
+ * emer_event_buffer_trim:
+ * @self: the buffer
+ *
+ * Releases any memory the buffer holds beyond what its events need: events
+ * removed from the head are compacted away, and the header array and arena,
+ * which only ever grow, are reallocated to fit.
+ */
+void
+emer_event_buffer_trim (EmerEventBuffer *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (emer_event_buffer_get_length (self) == 0)
+    reset (self);
+  else if (self->first_event > 0)
+    compact (self);
+
+  GArray *headers = g_array_sized_new (FALSE, FALSE, sizeof (EventHeader),
+                                       self->headers->len);
+  g_array_append_vals (headers, self->headers->data, self->headers->len);
+  g_array_unref (self->headers);
+  self->headers = headers;
+
+  GByteArray *arena = g_byte_array_sized_new (self->arena->len);
+  g_byte_array_append (arena, self->arena->data, self->arena->len);
+  g_byte_array_unref (self->arena);
+  self->arena = arena;
+}
+
+/*
+ * emer_event_buffer_get_event_cost:
+ * @self: the buffer
+ * @index: the index of an event, counting from the oldest
+ *
+ * Returns: the cost of the event, as emer_persistent_cache_cost() would
+ *   return for the result of emer_event_buffer_get_event()
+ */
+gsize
+emer_event_buffer_get_event_cost (EmerEventBuffer *self,
+                                  gsize            index)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (index < emer_event_buffer_get_length (self), 0);
+
+  return get_header (self, index)->cost;
+}
+
+/*
+ * emer_event_buffer_get_event:
+ * @self: the buffer
+ * @index: the index of an event, counting from the oldest
+ *
+ * Builds a GVariant for an event in the buffer. The result does not share
+ * any memory with the buffer, so it remains valid after the buffer is
+ * modified.
+ *
+ * Returns: (transfer full): the event
+ */
+GVariant *
+emer_event_buffer_get_event (EmerEventBuffer *self,
+                             gsize            index)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < emer_event_buffer_get_length (self), NULL);
+
+  const EventHeader *header = get_header (self, index);
+  const gchar *string = g_ptr_array_index (self->strings, header->string_index);
+
+  if (header->kind == EVENT_KIND_SERIALIZED)
+    return g_variant_ref_sink (load_from_arena (self, G_VARIANT_TYPE (string),
+                                                header));
+
+  const guchar *event_id =
+    g_ptr_array_index (self->event_ids, header->event_id_index);
+  GVariant *payload = NULL;
+
+  if (header->data_size > 0)
+    payload = load_from_arena (self, G_VARIANT_TYPE_VARIANT, header);
+
+  GVariant *singular =
+    g_variant_new ("(@aysxm@v)",
+                   g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, event_id,
+                                              UUID_LENGTH, sizeof (guchar)),
+                   string, header->relative_timestamp, payload);
+
+  return g_variant_ref_sink (singular);
+}
+
+/*
+ * emer_event_buffer_singular_cost:
+ * @os_version: the OS version recorded with the event
+ * @payload: (nullable): the event's payload, of type 'v'
+ *
+ * Computes the cost of a singular event from its components, without
+ * building the GVariant. The result is the same as emer_persistent_cache_cost()
+ * for the corresponding (aysxmv) GVariant, which is laid out as follows: the
+ * event ID at offset 0; the OS version and its nul terminator; the timestamp,
+ * aligned to 8 bytes; the payload followed by a zero byte, or nothing if
+ * there is no payload; and finally the framing offsets of the event ID and OS
+ * version, each of which is 1, 2, 4 or 8 bytes depending on the size of the
+ * rest of the tuple.
+ *
+ * Returns: the cost of the event
+ */
+gsize
+emer_event_buffer_singular_cost (const gchar *os_version,
+                                 GVariant    *payload)
+{
+  const gsize num_framing_offsets = 2;
+  gsize body_size = UUID_LENGTH + strlen (os_version) + 1;
+
+  body_size = (body_size + 7) & ~((gsize) 7);
+  body_size += sizeof (gint64);
+
+  if (payload != NULL)
+    body_size += g_variant_get_size (payload) + 1;
+
+  gsize variant_size;
+  if (body_size + 1 * num_framing_offsets <= G_MAXUINT8)
+    variant_size = body_size + 1 * num_framing_offsets;
+  else if (body_size + 2 * num_framing_offsets <= G_MAXUINT16)
+    variant_size = body_size + 2 * num_framing_offsets;
+  else if (body_size + 4 * num_framing_offsets <= G_MAXUINT32)
+    variant_size = body_size + 4 * num_framing_offsets;
+  else
+    variant_size = body_size + 8 * num_framing_offsets;
+
+  return emer_cache_record_header_size (SINGULAR_TYPE_STRING) + variant_size;
+}
+
+/*
+ * emer_event_buffer_append_singular:
+ * @self: the buffer
+ * @event_id: the event ID, a UUID of UUID_LENGTH bytes
+ * @os_version: the OS version to record with the event
+ * @relative_timestamp: the event's (corrected) relative timestamp
+ * @payload: (nullable): the event's payload, of type 'v'. If this is a
+ *   floating reference, it is consumed.
+ *
+ * Appends a singular event to the buffer. This is equivalent to appending
+ * the (aysxmv) GVariant made up of these components with
+ * emer_event_buffer_append_variant(), but doesn't build that GVariant.
+ */
+void
+emer_event_buffer_append_singular (EmerEventBuffer *self,
+                                   const guchar    *event_id,
+                                   const gchar     *os_version,
+                                   gint64           relative_timestamp,
+                                   GVariant        *payload)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (event_id != NULL);
+  g_return_if_fail (os_version != NULL);
+  g_return_if_fail (payload == NULL || g_variant_is_of_type (payload, G_VARIANT_TYPE_VARIANT));
+
+  gsize cost = emer_event_buffer_singular_cost (os_version, payload);
+  g_return_if_fail (cost <= G_MAXUINT32);
+
+  EventHeader header =
+    {
+      .relative_timestamp = relative_timestamp,
+      .data_offset = self->arena->len,
+      .data_size = 0,
+      .cost = cost,
+      .event_id_index = intern_event_id (self, event_id),
+      .string_index = intern_string (self, os_version),
+      .kind = EVENT_KIND_SINGULAR,
+    };
+
+  if (payload != NULL)
+    {
+      g_variant_ref_sink (payload);
+      store_in_arena (self, payload, &header);
+      g_variant_unref (payload);
+    }
+
+  append_header (self, &header);
+}
+
+/*
+ * emer_event_buffer_append_variant:
+ * @self: the buffer
+ * @event: the event. If this is a floating reference, it is consumed.
+ *
+ * Appends an event of any type to the buffer.
+ */
+void
+emer_event_buffer_append_variant (EmerEventBuffer *self,
+                                  GVariant        *event)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (event != NULL);
+
+  g_variant_ref_sink (event);
+
+  const gchar *type_string = g_variant_get_type_string (event);
+  gsize cost =
+    emer_cache_record_header_size (type_string) + g_variant_get_size (event);
+
+  if (cost > G_MAXUINT32)
+    {
+      g_critical ("%s: event is too large to buffer", G_STRFUNC);
+      g_variant_unref (event);
+      return;
+    }
+
+  EventHeader header =
+    {
+      .cost = cost,
+      .string_index = intern_string (self, type_string),
+      .kind = EVENT_KIND_SERIALIZED,
+    };
+
+  store_in_arena (self, event, &header);
+  append_header (self, &header);
+
+  g_variant_unref (event);
+}
+
+/*
+ * emer_event_buffer_remove_head:
+ * @self: the buffer
+ * @num_events: the number of events to remove
+ *
+ * Removes the oldest @num_events events from the buffer.
+ */
+void
+emer_event_buffer_remove_head (EmerEventBuffer *self,
+                               gsize            num_events)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (num_events <= emer_event_buffer_get_length (self));
+
+  if (num_events == 0)
+    return;
+
+  self->removed_cost = get_header (self, num_events - 1)->end_cost;
+  self->first_event += num_events;
+
+  if (self->first_event == self->headers->len)
+    reset (self);
+  else if (self->first_event >= MIN_EVENTS_TO_COMPACT &&
+           self->first_event * 2 >= self->headers->len)
+    compact (self);
+}
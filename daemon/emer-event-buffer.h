@@ -0,0 +1,72 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmerEventBuffer EmerEventBuffer;
+
+EmerEventBuffer *emer_event_buffer_new               (void);
+
+void             emer_event_buffer_free              (EmerEventBuffer *self);
+
+gsize            emer_event_buffer_get_length        (EmerEventBuffer *self);
+
+gsize            emer_event_buffer_get_cost          (EmerEventBuffer *self);
+
+gsize            emer_event_buffer_get_memory_usage  (EmerEventBuffer *self);
+
+void             emer_event_buffer_trim              (EmerEventBuffer *self);
+
+gsize            emer_event_buffer_get_event_cost    (EmerEventBuffer *self,
+                                                      gsize            index);
+
+gsize            emer_event_buffer_get_head_cost     (EmerEventBuffer *self,
+                                                      gsize            num_events);
+
+gsize            emer_event_buffer_count_within_cost (EmerEventBuffer *self,
+                                                      gsize            max_cost);
+
+GVariant        *emer_event_buffer_get_event         (EmerEventBuffer *self,
+                                                      gsize            index);
+
+gsize            emer_event_buffer_singular_cost     (const gchar     *os_version,
+                                                      GVariant        *payload);
+
+void             emer_event_buffer_append_singular   (EmerEventBuffer *self,
+                                                      const guchar    *event_id,
+                                                      const gchar     *os_version,
+                                                      gint64           relative_timestamp,
+                                                      GVariant        *payload);
+
+void             emer_event_buffer_append_variant    (EmerEventBuffer *self,
+                                                      GVariant        *event);
+
+void             emer_event_buffer_remove_head       (EmerEventBuffer *self,
+                                                      gsize            num_events);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerEventBuffer, emer_event_buffer_free)
+
+G_END_DECLS
@@ -0,0 +1,341 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-event-policy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <uuid/uuid.h>
+
+#include "shared/metrics-util.h"
+
+/*
+ * EmerEventPolicy:
+ *
+ * Decides which events to record, according to rules in a configuration file,
+ * so that the volume of chatty events can be cut without changing the
+ * clients which record them. The file has one group per event ID:
+ *
+ *   [350ac4ff-3026-4c25-9e7e-e8103b4fd5d8]
+ *   action=allow
+ *   sample_rate=0.1
+ *   priority=high
+ *
+ * where action is "allow" (the default) or "deny", and sample_rate is the
+ * fraction of machines which should record an allowed event, defaulting to 1.
+ * Events whose IDs aren't listed are always recorded. priority is "normal"
+ * (the default) or "high"; high-priority events are uploaded within seconds
+ * of being recorded, rather than with the next periodic upload.
+ *
+ * Sampling is per machine rather than per event: a hash of the machine ID and
+ * event ID decides once and for all whether this machine records the event,
+ * so sampled events can still be correlated with each other. Since the
+ * decision only depends on the event ID, it is made when the file is loaded,
+ * and the rules are compiled into an array sorted by event ID so that
+ * checking an event is a binary search over 16-byte keys, without any
+ * allocation.
+ *
+ * A rule's action and sample rate also apply to the monthly tallies of that
+ * event recorded as aggregate events, whose IDs are derived from it. Its
+ * priority doesn't, since tallies are only reported once a day anyway.
+ */
+
+#define DEFAULT_EVENT_POLICY_FILE_PATH CONFIG_DIR "/event-policy.conf"
+#define MACHINE_ID_FILE_PATH SYSCONFDIR "/machine-id"
+
+#define ACTION_KEY "action"
+#define SAMPLE_RATE_KEY "sample_rate"
+#define PRIORITY_KEY "priority"
+
+typedef struct
+{
+  uuid_t event_id;
+  gboolean record;
+  gboolean high_priority;
+} PolicyRule;
+
+struct _EmerEventPolicy
+{
+  /* Sorted by event ID */
+  PolicyRule *rules;
+  gsize num_rules;
+};
+
+static gint
+compare_rules (gconstpointer a,
+               gconstpointer b)
+{
+  const PolicyRule *rule_a = a;
+  const PolicyRule *rule_b = b;
+
+  return memcmp (rule_a->event_id, rule_b->event_id, UUID_LENGTH);
+}
+
+static gchar *
+read_machine_id (void)
+{
+  g_autofree gchar *contents = NULL;
+  g_autoptr(GError) error = NULL;
+
+  if (!g_file_get_contents (MACHINE_ID_FILE_PATH, &contents, NULL, &error))
+    {
+      g_debug ("%s: Sampling without a machine ID: %s", G_STRFUNC,
+               error->message);
+      return g_strdup ("");
+    }
+
+  return g_strstrip (g_steal_pointer (&contents));
+}
+
+/* Returns whether this machine falls within the sample of machines recording
+ * the event, based on a hash of the machine ID and event ID which is uniformly
+ * distributed over machines. */
+static gboolean
+is_sampled (const gchar  *machine_id,
+            const guchar *event_id,
+            gdouble       sample_rate)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  guint8 digest[32];
+  gsize digest_len = sizeof (digest);
+  guint32 hash;
+
+  if (sample_rate >= 1)
+    return TRUE;
+
+  if (sample_rate <= 0)
+    return FALSE;
+
+  g_checksum_update (checksum, (const guchar *) machine_id, -1);
+  g_checksum_update (checksum, event_id, UUID_LENGTH);
+  g_checksum_get_digest (checksum, digest, &digest_len);
+
+  hash = ((guint32) digest[0] << 24) | ((guint32) digest[1] << 16) |
+    ((guint32) digest[2] << 8) | digest[3];
+
+  return hash < sample_rate * ((gdouble) G_MAXUINT32 + 1);
+}
+
+/* Returns whether the rule in @group allows this machine to record the
+ * event. */
+static gboolean
+parse_rule (GKeyFile     *key_file,
+            const gchar  *group,
+            const gchar  *machine_id,
+            const guchar *event_id)
+{
+  g_autofree gchar *action = NULL;
+  g_autoptr(GError) error = NULL;
+  gdouble sample_rate;
+
+  action = g_key_file_get_string (key_file, group, ACTION_KEY, NULL);
+  if (g_strcmp0 (action, "deny") == 0)
+    return FALSE;
+
+  if (action != NULL && g_strcmp0 (action, "allow") != 0)
+    {
+      g_warning ("Unknown action '%s' for event %s in event policy. Allowing "
+                 "event.", action, group);
+      return TRUE;
+    }
+
+  sample_rate =
+    g_key_file_get_double (key_file, group, SAMPLE_RATE_KEY, &error);
+  if (error != NULL)
+    {
+      if (!g_error_matches (error, G_KEY_FILE_ERROR,
+                            G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+        g_warning ("Invalid sample rate for event %s in event policy. "
+                   "Allowing event. Error: %s.", group, error->message);
+      return TRUE;
+    }
+
+  return is_sampled (machine_id, event_id, CLAMP (sample_rate, 0, 1));
+}
+
+/* Returns whether the rule in @group marks the event as high-priority. */
+static gboolean
+parse_priority (GKeyFile    *key_file,
+                const gchar *group)
+{
+  g_autofree gchar *priority =
+    g_key_file_get_string (key_file, group, PRIORITY_KEY, NULL);
+
+  if (g_strcmp0 (priority, "high") == 0)
+    return TRUE;
+
+  if (priority != NULL && g_strcmp0 (priority, "normal") != 0)
+    g_warning ("Unknown priority '%s' for event %s in event policy. Using "
+               "normal priority.", priority, group);
+
+  return FALSE;
+}
+
+static void
+load_rules (EmerEventPolicy *self,
+            const gchar     *path,
+            const gchar     *machine_id)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autoptr(GError) error = NULL;
+  g_auto(GStrv) groups = NULL;
+  gsize num_groups;
+  GArray *rules;
+
+  if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Error reading event policy from %s: %s", path,
+                   error->message);
+      return;
+    }
+
+  groups = g_key_file_get_groups (key_file, &num_groups);
+  rules = g_array_sized_new (FALSE, FALSE, sizeof (PolicyRule), 2 * num_groups);
+
+  for (gsize i = 0; i < num_groups; i++)
+    {
+      PolicyRule rule, monthly_rule;
+
+      if (uuid_parse (groups[i], rule.event_id) != 0)
+        {
+          g_warning ("Ignoring event policy group '%s', which is not an event "
+                     "ID.", groups[i]);
+          continue;
+        }
+
+      rule.record = parse_rule (key_file, groups[i], machine_id, rule.event_id);
+      rule.high_priority = parse_priority (key_file, groups[i]);
+      g_array_append_val (rules, rule);
+
+      uuid_generate_sha1 (monthly_rule.event_id, rule.event_id, "monthly",
+                          strlen ("monthly"));
+      monthly_rule.record = rule.record;
+      monthly_rule.high_priority = FALSE;
+      g_array_append_val (rules, monthly_rule);
+    }
+
+  g_array_sort (rules, compare_rules);
+
+  self->num_rules = rules->len;
+  self->rules = (PolicyRule *) g_array_free (rules, FALSE);
+}
+
+/*
+ * emer_event_policy_new:
+ * @path: (nullable): the path to the event policy file, or %NULL to use the
+ *   default
+ *
+ * Loads the event policy, sampling with this machine's ID. If the file
+ * doesn't exist, every event is recorded.
+ *
+ * Returns: (transfer full): a new event policy
+ */
+EmerEventPolicy *
+emer_event_policy_new (const gchar *path)
+{
+  g_autofree gchar *machine_id = read_machine_id ();
+
+  return emer_event_policy_new_full (path, machine_id);
+}
+
+/*
+ * emer_event_policy_new_full:
+ * @path: (nullable): the path to the event policy file, or %NULL to use the
+ *   default
+ * @machine_id: the ID of this machine, which decides which sampled events it
+ *   records
+ *
+ * Returns: (transfer full): a new event policy
+ */
+EmerEventPolicy *
+emer_event_policy_new_full (const gchar *path,
+                            const gchar *machine_id)
+{
+  EmerEventPolicy *self;
+
+  g_return_val_if_fail (machine_id != NULL, NULL);
+
+  self = g_new0 (EmerEventPolicy, 1);
+  if (path == NULL)
+    path = DEFAULT_EVENT_POLICY_FILE_PATH;
+
+  load_rules (self, path, machine_id);
+
+  return self;
+}
+
+static const PolicyRule *
+find_rule (EmerEventPolicy *self,
+           const guchar    *event_id)
+{
+  PolicyRule key;
+
+  if (self->num_rules == 0)
+    return NULL;
+
+  memcpy (key.event_id, event_id, UUID_LENGTH);
+  return bsearch (&key, self->rules, self->num_rules, sizeof (PolicyRule),
+                  compare_rules);
+}
+
+/*
+ * emer_event_policy_should_record:
+ * @self: the event policy
+ * @event_id: an event ID of %UUID_LENGTH bytes
+ *
+ * Returns: %TRUE if this machine should record events with ID @event_id
+ */
+gboolean
+emer_event_policy_should_record (EmerEventPolicy *self,
+                                 const guchar    *event_id)
+{
+  const PolicyRule *rule = find_rule (self, event_id);
+
+  return rule == NULL || rule->record;
+}
+
+/*
+ * emer_event_policy_is_high_priority:
+ * @self: the event policy
+ * @event_id: an event ID of %UUID_LENGTH bytes
+ *
+ * Returns: %TRUE if singular events with ID @event_id should be uploaded as
+ *   soon as possible
+ */
+gboolean
+emer_event_policy_is_high_priority (EmerEventPolicy *self,
+                                    const guchar    *event_id)
+{
+  const PolicyRule *rule = find_rule (self, event_id);
+
+  return rule != NULL && rule->high_priority;
+}
+
+void
+emer_event_policy_free (EmerEventPolicy *self)
+{
+  g_free (self->rules);
+  g_free (self);
+}
@@ -0,0 +1,46 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmerEventPolicy EmerEventPolicy;
+
+EmerEventPolicy *emer_event_policy_new              (const gchar     *path);
+
+EmerEventPolicy *emer_event_policy_new_full         (const gchar     *path,
+                                                     const gchar     *machine_id);
+
+gboolean         emer_event_policy_should_record    (EmerEventPolicy *self,
+                                                     const guchar    *event_id);
+
+gboolean         emer_event_policy_is_high_priority (EmerEventPolicy *self,
+                                                     const guchar    *event_id);
+
+void             emer_event_policy_free             (EmerEventPolicy *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerEventPolicy, emer_event_policy_free)
+
+G_END_DECLS
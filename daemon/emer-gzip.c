@@ -25,50 +25,111 @@
 
 #include <gio/gio.h>
 #include <glib.h>
+#include <string.h>
 
 /* 9 is the highest compression level, meaning it typically achieves the best
  * compression ratio but takes the longest time to run.
  */
 #define COMPRESSION_LEVEL 9
 
+/* Layout of the gzip data written by emer_gzip_compress_with_prefix. The
+ * prefix is kept in a stored (uncompressed) deflate block of its own, right
+ * after the gzip header, and is followed by the rest of the data as ordinary
+ * compressed blocks, then by the gzip trailer.
+ */
+#define GZIP_HEADER_SIZE 10
+#define STORED_BLOCK_HEADER_SIZE 5
+#define GZIP_TRAILER_SIZE 8
+
+/* The IEEE 802.3 polynomial used by gzip, bit-reversed. */
+#define CRC32_POLYNOMIAL 0xedb88320
+
+static const guint8 gzip_header[GZIP_HEADER_SIZE] = {
+  0x1f, 0x8b, /* magic number */
+  8, /* deflate */
+  0, /* no flags */
+  0, 0, 0, 0, /* no modification time */
+  0, /* no extra flags */
+  255, /* unknown operating system */
+};
+
+static guint32 crc32_table[256];
+
 /*
  * SECTION:emer-gzip
  * @title: gzip
  * @short_description: Compresses data using the gzip algorithm.
  *
  * Provides a simplified interface to GZlibCompressor that only supports
- * compression level 9, the gzip algorithm, and non-streaming compression.
+ * compression level 9, the gzip algorithm, and non-streaming compression, and
+ * to GZlibDecompressor for data whose decompressed length is known.
  */
 
-/*
- * emer_gzip_compress:
- * @input_data: the data to compress.
- * @input_length: the length of the data to compress in bytes.
- * @compressed_length: (out): the length of the compressed data.
- * @error: (out) (optional): if compression failed, error will be set to a GError
- * describing the failure; otherwise it won't be modified. Pass NULL to ignore
- * this value.
- *
- * Compresses input_data with the gzip algorithm at compression level 9. Returns
- * NULL and sets error if compression fails. Sets compressed_length to the
- * length of the compressed data in bytes.
- *
- * Returns: the compressed data or NULL if compression fails. Free with g_free.
+/* Returns the gzip checksum of data. */
+static guint32
+gzip_crc32 (const guint8 *data,
+            gsize         length)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      for (guint i = 0; i < G_N_ELEMENTS (crc32_table); i++)
+        {
+          guint32 crc = i;
+          for (guint j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & -(crc & 1));
+
+          crc32_table[i] = crc;
+        }
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  guint32 crc = 0xffffffff;
+  for (; length > 0; data++, length--)
+    crc = (crc >> 8) ^ crc32_table[(crc ^ *data) & 0xff];
+
+  return ~crc;
+}
+
+static void
+write_uint32_le (guint8 *data,
+                 guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+static guint32
+read_uint32_le (const guint8 *data)
+{
+  guint32 value;
+  memcpy (&value, data, sizeof (value));
+  return GUINT32_FROM_LE (value);
+}
+
+/* Compresses input_data in the given format, after leaving the first
+ * reserved_length bytes of the output for the caller to fill in. Returns a
+ * byte array whose length is reserved_length plus the length of the
+ * compressed data, or NULL if compression fails.
  */
-gpointer
-emer_gzip_compress (gconstpointer input_data,
-                    gsize         input_length,
-                    gsize        *compressed_length,
-                    GError      **error)
+static GByteArray *
+compress_data (GZlibCompressorFormat format,
+               gconstpointer         input_data,
+               gsize                 input_length,
+               gsize                 reserved_length,
+               GError              **error)
 {
   GZlibCompressor *zlib_compressor =
-    g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, COMPRESSION_LEVEL);
+    g_zlib_compressor_new (format, COMPRESSION_LEVEL);
   GConverter *converter = G_CONVERTER (zlib_compressor);
 
-  gsize allocated_space = input_length + 1;
+  gsize allocated_space = reserved_length + input_length + 1;
   GByteArray *byte_array = g_byte_array_sized_new (allocated_space);
+  g_byte_array_set_size (byte_array, allocated_space);
   gsize total_bytes_read = 0;
-  gsize total_bytes_written = 0;
+  gsize total_bytes_written = reserved_length;
   while (TRUE)
     {
       gsize bytes_left_in_buffer = allocated_space - total_bytes_written;
@@ -126,8 +187,243 @@ emer_gzip_compress (gconstpointer input_data,
     }
 
   g_object_unref (zlib_compressor);
-  gpointer compressed_data = g_memdup2 (byte_array->data, total_bytes_written);
+  g_byte_array_set_size (byte_array, total_bytes_written);
+  return byte_array;
+}
+
+/*
+ * emer_gzip_compress:
+ * @input_data: the data to compress.
+ * @input_length: the length of the data to compress in bytes.
+ * @compressed_length: (out): the length of the compressed data.
+ * @error: (out) (optional): if compression failed, error will be set to a GError
+ * describing the failure; otherwise it won't be modified. Pass NULL to ignore
+ * this value.
+ *
+ * Compresses input_data with the gzip algorithm at compression level 9. Returns
+ * NULL and sets error if compression fails. Sets compressed_length to the
+ * length of the compressed data in bytes.
+ *
+ * Returns: the compressed data or NULL if compression fails. Free with g_free.
+ */
+gpointer
+emer_gzip_compress (gconstpointer input_data,
+                    gsize         input_length,
+                    gsize        *compressed_length,
+                    GError      **error)
+{
+  GByteArray *byte_array =
+    compress_data (G_ZLIB_COMPRESSOR_FORMAT_GZIP, input_data, input_length, 0,
+                   error);
+  if (byte_array == NULL)
+    return NULL;
+
+  gpointer compressed_data = g_memdup2 (byte_array->data, byte_array->len);
+  *compressed_length = byte_array->len;
   g_byte_array_free (byte_array, TRUE);
-  *compressed_length = total_bytes_written;
   return compressed_data;
 }
+
+/*
+ * emer_gzip_compress_with_prefix:
+ * @input_data: the data to compress.
+ * @input_length: the length of the data to compress in bytes.
+ * @prefix_length: the number of bytes at the start of input_data which may
+ * later be replaced; at most G_MAXUINT16 and at most input_length.
+ * @compressed_length: (out): the length of the compressed data.
+ * @error: (out) (optional): if compression failed, error will be set to a GError
+ * describing the failure; otherwise it won't be modified. Pass NULL to ignore
+ * this value.
+ *
+ * Like emer_gzip_compress, but leaves the first prefix_length bytes of
+ * input_data uncompressed, so that they may be replaced later with
+ * emer_gzip_replace_prefix without compressing the rest of the data again. The
+ * result is ordinary gzip data which any gzip decompressor accepts.
+ *
+ * Returns: the compressed data or NULL if compression fails. Free with g_free.
+ */
+gpointer
+emer_gzip_compress_with_prefix (gconstpointer input_data,
+                                gsize         input_length,
+                                gsize         prefix_length,
+                                gsize        *compressed_length,
+                                GError      **error)
+{
+  g_return_val_if_fail (prefix_length <= input_length, NULL);
+  g_return_val_if_fail (prefix_length <= G_MAXUINT16, NULL);
+
+  const guint8 *input_bytes = input_data;
+  gsize reserved_length =
+    GZIP_HEADER_SIZE + STORED_BLOCK_HEADER_SIZE + prefix_length;
+
+  /* Raw deflate data may follow a stored block directly, since stored blocks
+   * end on a byte boundary. */
+  GByteArray *byte_array =
+    compress_data (G_ZLIB_COMPRESSOR_FORMAT_RAW, input_bytes + prefix_length,
+                   input_length - prefix_length, reserved_length, error);
+  if (byte_array == NULL)
+    return NULL;
+
+  guint8 *block_header = byte_array->data + GZIP_HEADER_SIZE;
+  guint16 stored_length = GUINT16_TO_LE (prefix_length);
+  guint16 stored_length_complement = ~stored_length;
+
+  memcpy (byte_array->data, gzip_header, GZIP_HEADER_SIZE);
+  block_header[0] = 0; /* not the final block; stored */
+  memcpy (block_header + 1, &stored_length, sizeof (stored_length));
+  memcpy (block_header + 3, &stored_length_complement,
+          sizeof (stored_length_complement));
+  memcpy (block_header + STORED_BLOCK_HEADER_SIZE, input_bytes, prefix_length);
+
+  guint8 trailer[GZIP_TRAILER_SIZE];
+  write_uint32_le (trailer, gzip_crc32 (input_bytes, input_length));
+  write_uint32_le (trailer + 4, input_length);
+  g_byte_array_append (byte_array, trailer, GZIP_TRAILER_SIZE);
+
+  *compressed_length = byte_array->len;
+  return g_byte_array_free (byte_array, FALSE);
+}
+
+/*
+ * emer_gzip_replace_prefix:
+ * @compressed_data: data returned by emer_gzip_compress_with_prefix.
+ * @compressed_length: the length of compressed_data in bytes.
+ * @data: the complete data which compressed_data should now hold once
+ * decompressed.
+ * @length: the length of data in bytes.
+ * @prefix_length: the prefix_length passed to emer_gzip_compress_with_prefix.
+ * @error: (out) (optional): if the prefix could not be replaced, error will be
+ * set to a GError describing the failure; otherwise it won't be modified. Pass
+ * NULL to ignore this value.
+ *
+ * Replaces the uncompressed prefix of compressed_data in place with the first
+ * prefix_length bytes of data. The rest of data must be the same as the data
+ * that was compressed; only the prefix is copied, but the checksum in the gzip
+ * trailer is computed over all of data. Returns FALSE and sets error if
+ * compressed_data was not written by emer_gzip_compress_with_prefix with the
+ * same prefix_length, or holds data of a different length.
+ *
+ * Returns: TRUE if the prefix was replaced, FALSE otherwise.
+ */
+gboolean
+emer_gzip_replace_prefix (gpointer      compressed_data,
+                          gsize         compressed_length,
+                          gconstpointer data,
+                          gsize         length,
+                          gsize         prefix_length,
+                          GError      **error)
+{
+  g_return_val_if_fail (prefix_length <= length, FALSE);
+  g_return_val_if_fail (prefix_length <= G_MAXUINT16, FALSE);
+
+  guint8 *compressed_bytes = compressed_data;
+  guint8 *block_header = compressed_bytes + GZIP_HEADER_SIZE;
+  gsize min_length = GZIP_HEADER_SIZE + STORED_BLOCK_HEADER_SIZE +
+    prefix_length + GZIP_TRAILER_SIZE;
+  guint16 stored_length = GUINT16_TO_LE (prefix_length);
+  guint16 stored_length_complement = ~stored_length;
+  if (compressed_length < min_length ||
+      memcmp (compressed_bytes, gzip_header, 4) != 0 ||
+      block_header[0] != 0 ||
+      memcmp (block_header + 1, &stored_length, sizeof (stored_length)) != 0 ||
+      memcmp (block_header + 3, &stored_length_complement,
+              sizeof (stored_length_complement)) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Compressed data does not begin with a replaceable prefix "
+                   "of %" G_GSIZE_FORMAT " bytes", prefix_length);
+      return FALSE;
+    }
+
+  guint8 *trailer = compressed_bytes + compressed_length - GZIP_TRAILER_SIZE;
+  guint32 stored_size = read_uint32_le (trailer + 4);
+  if (stored_size != (guint32) length)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Compressed data holds %" G_GUINT32_FORMAT " bytes, not %"
+                   G_GSIZE_FORMAT, stored_size, length);
+      return FALSE;
+    }
+
+  memcpy (block_header + STORED_BLOCK_HEADER_SIZE, data, prefix_length);
+  write_uint32_le (trailer, gzip_crc32 (data, length));
+  return TRUE;
+}
+
+/*
+ * emer_gzip_decompress:
+ * @input_data: the gzip data to decompress.
+ * @input_length: the length of the data to decompress in bytes.
+ * @decompressed_length: the exact length of the data once decompressed.
+ * @error: (out) (optional): if decompression failed, error will be set to a
+ * GError describing the failure; otherwise it won't be modified. Pass NULL to
+ * ignore this value.
+ *
+ * Decompresses input_data, which must have been compressed with
+ * emer_gzip_compress. Returns NULL and sets error if decompression fails, or
+ * if the decompressed data is not exactly decompressed_length bytes long.
+ *
+ * Returns: the decompressed data or NULL if decompression fails. Free with
+ * g_free.
+ */
+gpointer
+emer_gzip_decompress (gconstpointer input_data,
+                      gsize         input_length,
+                      gsize         decompressed_length,
+                      GError      **error)
+{
+  g_autoptr(GZlibDecompressor) zlib_decompressor =
+    g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  GConverter *converter = G_CONVERTER (zlib_decompressor);
+
+  /* One spare byte, since converters can't be given an empty buffer, and so
+   * that data longer than expected is caught below.
+   */
+  gsize output_size = decompressed_length + 1;
+  g_autofree guint8 *output = g_malloc (output_size);
+  gsize total_bytes_read = 0;
+  gsize total_bytes_written = 0;
+  while (TRUE)
+    {
+      const guint8 *curr_input =
+        ((const guint8 *) input_data) + total_bytes_read;
+      gsize curr_bytes_read, curr_bytes_written;
+      GConverterResult conversion_result =
+        g_converter_convert (converter,
+                             curr_input, input_length - total_bytes_read,
+                             output + total_bytes_written,
+                             output_size - total_bytes_written,
+                             G_CONVERTER_INPUT_AT_END,
+                             &curr_bytes_read, &curr_bytes_written,
+                             error);
+
+      /* This includes running out of space for data much longer than
+       * expected. */
+      if (conversion_result == G_CONVERTER_ERROR)
+        return NULL;
+
+      total_bytes_read += curr_bytes_read;
+      total_bytes_written += curr_bytes_written;
+
+      if (conversion_result == G_CONVERTER_FINISHED)
+        break;
+
+      if (curr_bytes_read == 0 && curr_bytes_written == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                       "Compressed data ended unexpectedly");
+          return NULL;
+        }
+    }
+
+  if (total_bytes_written != decompressed_length)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Expected %" G_GSIZE_FORMAT " bytes of decompressed data, "
+                   "but got %" G_GSIZE_FORMAT, decompressed_length,
+                   total_bytes_written);
+      return NULL;
+    }
+
+  return g_steal_pointer (&output);
+}
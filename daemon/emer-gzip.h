@@ -30,4 +30,22 @@ gpointer emer_gzip_compress (gconstpointer input_data,
                              gsize        *compressed_length,
                              GError      **error);
 
+gpointer emer_gzip_compress_with_prefix (gconstpointer input_data,
+                                         gsize         input_length,
+                                         gsize         prefix_length,
+                                         gsize        *compressed_length,
+                                         GError      **error);
+
+gboolean emer_gzip_replace_prefix (gpointer      compressed_data,
+                                   gsize         compressed_length,
+                                   gconstpointer data,
+                                   gsize         length,
+                                   gsize         prefix_length,
+                                   GError      **error);
+
+gpointer emer_gzip_decompress (gconstpointer input_data,
+                               gsize         input_length,
+                               gsize         decompressed_length,
+                               GError      **error);
+
 #endif /* EMER_GZIP_H */
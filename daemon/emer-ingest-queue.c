@@ -0,0 +1,227 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-ingest-queue.h"
+
+/*
+ * EmerIngestQueue:
+ *
+ * A multi-producer, single-consumer queue which hands items pushed from any
+ * thread to a function running in a particular GMainContext.
+ *
+ * Producers push onto a lock-free stack with a compare-and-swap on its head.
+ * Only the push which finds the stack empty wakes the consumer, by marking a
+ * GSource attached to the context as ready, so while the consumer is busy any
+ * number of items can be pushed without taking a lock. The consumer detaches
+ * the whole stack with a single atomic exchange, then reverses it to recover
+ * the order in which the items were pushed.
+ */
+
+typedef struct _Node Node;
+
+struct _Node
+{
+  gpointer item;
+  Node *next;
+};
+
+typedef struct
+{
+  GSource source;
+  EmerIngestQueue *queue;
+} QueueSource;
+
+struct _EmerIngestQueue
+{
+  /* The most recently pushed node, accessed atomically */
+  Node *head;
+
+  GSource *source;
+
+  EmerIngestQueueFunc func;
+  gpointer user_data;
+  GDestroyNotify item_free_func;
+};
+
+/* Detaches all pushed nodes, and returns them oldest first. */
+static Node *
+take_all (EmerIngestQueue *self)
+{
+  Node *node = g_atomic_pointer_exchange (&self->head, NULL);
+  Node *reversed = NULL;
+
+  while (node != NULL)
+    {
+      Node *next = node->next;
+
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+
+  return reversed;
+}
+
+static gboolean
+queue_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  EmerIngestQueue *self = ((QueueSource *) source)->queue;
+
+  /* Clear the ready time before taking the nodes, so that a push which finds
+   * the stack empty after this point wakes the context again.
+   */
+  g_source_set_ready_time (source, -1);
+  emer_ingest_queue_drain (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs queue_source_funcs =
+{
+  NULL, /* prepare */
+  NULL, /* check */
+  queue_source_dispatch,
+  NULL, /* finalize */
+};
+
+/*
+ * emer_ingest_queue_new:
+ * @context: (nullable): the context in which @func should be called, or %NULL
+ *   for the global default context
+ * @func: the function to call for each item
+ * @user_data: data to pass to @func
+ * @item_free_func: (nullable): a function to free items which are still
+ *   queued when the queue is freed
+ *
+ * Returns: (transfer full): a new, empty #EmerIngestQueue
+ */
+EmerIngestQueue *
+emer_ingest_queue_new (GMainContext        *context,
+                       EmerIngestQueueFunc  func,
+                       gpointer             user_data,
+                       GDestroyNotify       item_free_func)
+{
+  g_return_val_if_fail (func != NULL, NULL);
+
+  EmerIngestQueue *self = g_new0 (EmerIngestQueue, 1);
+
+  self->func = func;
+  self->user_data = user_data;
+  self->item_free_func = item_free_func;
+
+  self->source = g_source_new (&queue_source_funcs, sizeof (QueueSource));
+  ((QueueSource *) self->source)->queue = self;
+  g_source_set_static_name (self->source, "EmerIngestQueue");
+  g_source_attach (self->source, context);
+
+  return self;
+}
+
+/*
+ * emer_ingest_queue_push:
+ * @self: the queue
+ * @item: the item, which the queue takes ownership of
+ *
+ * Pushes @item onto the queue. This may be called from any thread. It only
+ * takes a lock, to wake the consumer, when the queue was empty.
+ */
+void
+emer_ingest_queue_push (EmerIngestQueue *self,
+                        gpointer         item)
+{
+  g_return_if_fail (self != NULL);
+
+  Node *node = g_new (Node, 1);
+  Node *old_head;
+
+  node->item = item;
+
+  do
+    {
+      old_head = g_atomic_pointer_get (&self->head);
+      node->next = old_head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange (&self->head, old_head, node));
+
+  if (old_head == NULL)
+    g_source_set_ready_time (self->source, 0);
+}
+
+/*
+ * emer_ingest_queue_drain:
+ * @self: the queue
+ *
+ * Calls the queue's function for every item pushed so far. This must be
+ * called in the queue's context; it happens automatically when the context
+ * is iterated, but may be called explicitly (for example before shutting
+ * down) to avoid waiting for that.
+ */
+void
+emer_ingest_queue_drain (EmerIngestQueue *self)
+{
+  g_return_if_fail (self != NULL);
+
+  Node *node = take_all (self);
+
+  while (node != NULL)
+    {
+      Node *next = node->next;
+
+      self->func (node->item, self->user_data);
+      g_free (node);
+      node = next;
+    }
+}
+
+/*
+ * emer_ingest_queue_free:
+ * @self: the queue
+ *
+ * Frees the queue, along with any items which have not yet been passed to its
+ * function. No other thread may push onto the queue during or after this call.
+ */
+void
+emer_ingest_queue_free (EmerIngestQueue *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_source_destroy (self->source);
+  g_source_unref (self->source);
+
+  Node *node = take_all (self);
+
+  while (node != NULL)
+    {
+      Node *next = node->next;
+
+      if (self->item_free_func != NULL)
+        self->item_free_func (node->item);
+
+      g_free (node);
+      node = next;
+    }
+
+  g_free (self);
+}
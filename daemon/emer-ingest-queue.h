@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmerIngestQueue EmerIngestQueue;
+
+/*
+ * EmerIngestQueueFunc:
+ * @item: an item pushed onto the queue, which the function takes ownership of
+ * @user_data: the data passed to emer_ingest_queue_new()
+ *
+ * Called in the queue's main context for each item, in the order in which the
+ * items were pushed.
+ */
+typedef void (*EmerIngestQueueFunc) (gpointer item,
+                                     gpointer user_data);
+
+EmerIngestQueue *emer_ingest_queue_new   (GMainContext        *context,
+                                          EmerIngestQueueFunc  func,
+                                          gpointer             user_data,
+                                          GDestroyNotify       item_free_func);
+
+void             emer_ingest_queue_push  (EmerIngestQueue     *self,
+                                          gpointer             item);
+
+void             emer_ingest_queue_drain (EmerIngestQueue     *self);
+
+void             emer_ingest_queue_free  (EmerIngestQueue     *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerIngestQueue, emer_ingest_queue_free)
+
+G_END_DECLS
@@ -31,6 +31,9 @@
 
 #include "emer-daemon.h"
 #include "emer-event-recorder-server.h"
+#include "emer-ingest.h"
+#include "emer-ingest-queue.h"
+#include "emer-rate-limiter.h"
 #include "shared/metrics-util.h"
 
 typedef struct _DBusCallbackData
@@ -39,6 +42,235 @@ typedef struct _DBusCallbackData
   GDBusMethodInvocation *invocation;
 } DBusCallbackData;
 
+typedef struct _AuthorizationCache AuthorizationCache;
+
+typedef struct
+{
+  EmerDaemon *daemon;
+  EmerIngestQueue *record_queue;
+  EmerRateLimiter *rate_limiter;
+  AuthorizationCache *authorization_cache;
+} BusData;
+
+/*
+ * Both D-Bus interfaces are exported with
+ * G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD, so all
+ * method handlers run in GDBus worker threads rather than the main thread.
+ *
+ * The recording methods are the hot path, and their callers don't care about
+ * the outcome, so their handlers drop any events over the caller's rate limit,
+ * push the call's parameters onto a lock-free queue and return to the caller
+ * immediately. The main thread drains the queue
+ * into the daemon when it is next idle, so recording calls don't wait for
+ * uploads, cache flushes or tally updates in progress on the main thread.
+ *
+ * Every other method needs the daemon's state, so its handler is bounced to
+ * the main thread with invoke_in_main_context(), or, for the Ingest interface,
+ * with g_main_context_invoke() directly. The exception is GetRateLimitDrops,
+ * which only reports counters kept under the rate limiter's lock.
+ */
+
+typedef enum
+{
+  RECORD_SINGULAR_EVENT,
+  RECORD_SINGULAR_EVENTS,
+  RECORD_AGGREGATE_EVENT,
+  RECORD_EVENT_SEQUENCE,
+} RecordMethod;
+
+typedef struct
+{
+  RecordMethod method;
+  GVariant *parameters;
+} RecordCall;
+
+static void
+record_call_free (RecordCall *call)
+{
+  g_variant_unref (call->parameters);
+  g_free (call);
+}
+
+/*
+ * Called in a worker thread. Returns the parameters of a RecordSingularEvents
+ * call with any events over the rate limit removed, or %NULL if none remain.
+ */
+static GVariant *
+admit_singular_events (EmerRateLimiter *rate_limiter,
+                       const gchar     *sender,
+                       GVariant        *parameters,
+                       gint64           now)
+{
+  g_autoptr(GVariant) events = g_variant_get_child_value (parameters, 0);
+  gsize num_events = g_variant_n_children (events);
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a(uayxbv)"));
+  gsize num_admitted = 0;
+  gboolean dropped_any = FALSE;
+
+  for (gsize i = 0; i < num_events; i++)
+    {
+      g_autoptr(GVariant) event = g_variant_get_child_value (events, i);
+      guint32 user_id;
+
+      g_variant_get_child (event, 0, "u", &user_id);
+      if (!emer_rate_limiter_admit (rate_limiter, sender, user_id,
+                                    g_variant_get_size (event), now))
+        {
+          /* Only copy the batch once it turns out to need filtering. */
+          if (!dropped_any)
+            {
+              for (gsize j = 0; j < i; j++)
+                {
+                  g_autoptr(GVariant) admitted_event =
+                    g_variant_get_child_value (events, j);
+                  g_variant_builder_add_value (&builder, admitted_event);
+                }
+              dropped_any = TRUE;
+            }
+          continue;
+        }
+
+      if (dropped_any)
+        g_variant_builder_add_value (&builder, event);
+      num_admitted++;
+    }
+
+  if (num_admitted == 0)
+    return NULL;
+
+  if (!dropped_any)
+    return g_variant_ref (parameters);
+
+  return g_variant_ref_sink (g_variant_new ("(a(uayxbv))", &builder));
+}
+
+/* Called in a worker thread. */
+static void
+queue_record_call (BusData               *bus_data,
+                   RecordMethod           method,
+                   GDBusMethodInvocation *invocation)
+{
+  const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+  GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+  gint64 now = g_get_monotonic_time ();
+  g_autoptr(GVariant) admitted = NULL;
+
+  if (method == RECORD_SINGULAR_EVENTS)
+    {
+      admitted = admit_singular_events (bus_data->rate_limiter, sender,
+                                        parameters, now);
+    }
+  else
+    {
+      guint32 user_id;
+
+      g_variant_get_child (parameters, 0, "u", &user_id);
+      if (emer_rate_limiter_admit (bus_data->rate_limiter, sender, user_id,
+                                   g_variant_get_size (parameters), now))
+        admitted = g_variant_ref (parameters);
+    }
+
+  if (admitted == NULL)
+    return;
+
+  RecordCall *call = g_new (RecordCall, 1);
+
+  call->method = method;
+  call->parameters = g_steal_pointer (&admitted);
+  emer_ingest_queue_push (bus_data->record_queue, call);
+}
+
+/* Called in the main thread for each call queued by queue_record_call(). */
+static void
+handle_record_call (gpointer item,
+                    gpointer user_data)
+{
+  RecordCall *call = item;
+  EmerDaemon *daemon = EMER_DAEMON (user_data);
+  g_autoptr(GVariant) event_id = NULL;
+  g_autoptr(GVariant) payload = NULL;
+  g_autoptr(GVariant) events = NULL;
+  guint32 user_id;
+  gint64 relative_timestamp, count;
+  gboolean has_payload;
+
+  switch (call->method)
+    {
+    case RECORD_SINGULAR_EVENT:
+      g_variant_get (call->parameters, "(u@ayxb@v)", NULL /* user ID */,
+                     &event_id, &relative_timestamp, &has_payload, &payload);
+      emer_daemon_record_singular_event (daemon, event_id, relative_timestamp,
+                                         has_payload, payload);
+      break;
+
+    case RECORD_SINGULAR_EVENTS:
+      g_variant_get (call->parameters, "(@a(uayxbv))", &events);
+      emer_daemon_record_singular_events (daemon, events);
+      break;
+
+    case RECORD_AGGREGATE_EVENT:
+      g_variant_get (call->parameters, "(u@ayxxb@v)", &user_id, &event_id,
+                     &count, &relative_timestamp, &has_payload, &payload);
+      emer_daemon_record_aggregate_event (daemon, user_id, event_id, count,
+                                          relative_timestamp, has_payload,
+                                          payload);
+      break;
+
+    case RECORD_EVENT_SEQUENCE:
+      g_variant_get (call->parameters, "(u@ay@a(xmv))", &user_id, &event_id,
+                     &events);
+      emer_daemon_record_event_sequence (daemon, user_id, event_id, events);
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  record_call_free (call);
+}
+
+typedef void (*MainContextHandler) (EmerEventRecorderServer *server,
+                                    GDBusMethodInvocation   *invocation,
+                                    EmerDaemon              *daemon);
+
+typedef struct
+{
+  MainContextHandler handler;
+  EmerEventRecorderServer *server;
+  GDBusMethodInvocation *invocation;
+  EmerDaemon *daemon;
+} MainContextCall;
+
+static gboolean
+dispatch_main_context_call (gpointer user_data)
+{
+  MainContextCall *call = user_data;
+
+  call->handler (call->server, call->invocation, call->daemon);
+
+  g_object_unref (call->server);
+  g_object_unref (call->invocation);
+  g_free (call);
+  return G_SOURCE_REMOVE;
+}
+
+/* Called in a worker thread to run @handler in the main thread. */
+static void
+invoke_in_main_context (MainContextHandler       handler,
+                        EmerEventRecorderServer *server,
+                        GDBusMethodInvocation   *invocation,
+                        EmerDaemon              *daemon)
+{
+  MainContextCall *call = g_new (MainContextCall, 1);
+
+  call->handler = handler;
+  call->server = g_object_ref (server);
+  call->invocation = g_object_ref (invocation);
+  call->daemon = daemon;
+  g_main_context_invoke (NULL /* default context */,
+                         dispatch_main_context_call, call);
+}
+
 static gboolean
 on_record_singular_event (EmerEventRecorderServer *server,
                           GDBusMethodInvocation   *invocation,
@@ -47,15 +279,25 @@ on_record_singular_event (EmerEventRecorderServer *server,
                           gint64                   relative_timestamp,
                           gboolean                 has_payload,
                           GVariant                *payload,
-                          EmerDaemon              *daemon)
+                          BusData                 *bus_data)
 {
-  emer_daemon_record_singular_event (daemon, event_id, relative_timestamp,
-                                     has_payload, payload);
+  queue_record_call (bus_data, RECORD_SINGULAR_EVENT, invocation);
   emer_event_recorder_server_complete_record_singular_event (server,
                                                              invocation);
   return TRUE;
 }
 
+static gboolean
+on_record_singular_events (EmerIngest            *ingest,
+                           GDBusMethodInvocation *invocation,
+                           GVariant              *events,
+                           BusData               *bus_data)
+{
+  queue_record_call (bus_data, RECORD_SINGULAR_EVENTS, invocation);
+  emer_ingest_complete_record_singular_events (ingest, invocation);
+  return TRUE;
+}
+
 static gboolean
 on_record_aggregate_event (EmerEventRecorderServer *server,
                            GDBusMethodInvocation   *invocation,
@@ -65,8 +307,9 @@ on_record_aggregate_event (EmerEventRecorderServer *server,
                            gint64                   relative_timestamp,
                            gboolean                 has_payload,
                            GVariant                *payload,
-                           EmerDaemon              *daemon)
+                           BusData                 *bus_data)
 {
+  queue_record_call (bus_data, RECORD_AGGREGATE_EVENT, invocation);
   emer_event_recorder_server_complete_record_aggregate_event (server,
                                                               invocation);
   return TRUE;
@@ -78,42 +321,128 @@ on_record_event_sequence (EmerEventRecorderServer *server,
                           guint32                  user_id,
                           GVariant                *event_id,
                           GVariant                *events,
-                          EmerDaemon              *daemon)
+                          BusData                 *bus_data)
 {
-  emer_daemon_record_event_sequence (daemon, user_id, event_id, events);
+  queue_record_call (bus_data, RECORD_EVENT_SEQUENCE, invocation);
   emer_event_recorder_server_complete_record_event_sequence (server,
                                                              invocation);
   return TRUE;
 }
 
 static gboolean
-on_set_enabled (EmerEventRecorderServer *server,
-                GDBusMethodInvocation   *invocation,
-                gboolean                 enabled,
-                EmerDaemon              *daemon)
+on_get_rate_limit_drops (EmerIngest            *ingest,
+                         GDBusMethodInvocation *invocation,
+                         EmerRateLimiter       *rate_limiter)
+{
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{st}"));
+
+  for (EmerRateLimitKind kind = 0; kind < EMER_RATE_LIMIT_N_KINDS; kind++)
+    g_variant_builder_add (&builder, "{st}",
+                           emer_rate_limit_kind_to_string (kind),
+                           emer_rate_limiter_get_drop_count (rate_limiter,
+                                                             kind));
+
+  emer_ingest_complete_get_rate_limit_drops (ingest, invocation,
+                                             g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+typedef struct
+{
+  EmerIngest *ingest;
+  GDBusMethodInvocation *invocation;
+  EmerDaemon *daemon;
+} MemoryUsageCall;
+
+/* Called in the main thread, where the daemon can bring the usage up to
+ * date before it is reported. */
+static gboolean
+complete_get_memory_usage (gpointer user_data)
+{
+  MemoryUsageCall *call = user_data;
+  EmerMemoryBudget *memory_budget =
+    emer_daemon_get_memory_budget (call->daemon);
+  g_auto(GVariantBuilder) builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("a{st}"));
+
+  for (EmerMemoryComponent component = 0;
+       component < EMER_MEMORY_N_COMPONENTS;
+       component++)
+    g_variant_builder_add (&builder, "{st}",
+                           emer_memory_component_to_string (component),
+                           emer_memory_budget_get_usage (memory_budget,
+                                                         component));
+
+  g_variant_builder_add (&builder, "{st}", "budget",
+                         emer_memory_budget_get_budget (memory_budget));
+
+  emer_ingest_complete_get_memory_usage (call->ingest, call->invocation,
+                                         g_variant_builder_end (&builder));
+
+  g_object_unref (call->ingest);
+  g_object_unref (call->invocation);
+  g_free (call);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_get_memory_usage (EmerIngest            *ingest,
+                     GDBusMethodInvocation *invocation,
+                     EmerDaemon            *daemon)
+{
+  MemoryUsageCall *call = g_new (MemoryUsageCall, 1);
+
+  call->ingest = g_object_ref (ingest);
+  call->invocation = g_object_ref (invocation);
+  call->daemon = daemon;
+  g_main_context_invoke (NULL /* default context */,
+                         complete_get_memory_usage, call);
+  return TRUE;
+}
+
+static void
+set_enabled (EmerEventRecorderServer *server,
+             GDBusMethodInvocation   *invocation,
+             EmerDaemon              *daemon)
 {
   EmerPermissionsProvider *permissions =
     emer_daemon_get_permissions_provider (daemon);
+  gboolean enabled;
+
+  g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(b)",
+                 &enabled);
 
   emer_permissions_provider_set_daemon_enabled (permissions, enabled);
   emer_permissions_provider_set_uploading_enabled (permissions, enabled);
   emer_event_recorder_server_complete_set_enabled (server, invocation);
-  return TRUE;
 }
 
 static gboolean
-on_start_aggregate_timer (EmerEventRecorderServer *object,
-                          GDBusMethodInvocation   *invocation,
-                          guint32                  unix_user_id,
-                          GVariant                *event_id,
-                          gboolean                 has_payload,
-                          GVariant                *payload,
-                          EmerDaemon              *daemon)
+on_set_enabled (EmerEventRecorderServer *server,
+                GDBusMethodInvocation   *invocation,
+                gboolean                 enabled,
+                EmerDaemon              *daemon)
+{
+  invoke_in_main_context (set_enabled, server, invocation, daemon);
+  return TRUE;
+}
+
+static void
+start_aggregate_timer (EmerEventRecorderServer *object,
+                       GDBusMethodInvocation   *invocation,
+                       EmerDaemon              *daemon)
 {
   g_autofree gchar *timer_object_path = NULL;
   g_autoptr(GError) error = NULL;
+  g_autoptr(GVariant) event_id = NULL;
+  g_autoptr(GVariant) payload = NULL;
   GDBusConnection *system_bus;
   const gchar *sender;
+  guint32 unix_user_id;
+  gboolean has_payload;
+
+  g_variant_get (g_dbus_method_invocation_get_parameters (invocation),
+                 "(u@ayb@v)", &unix_user_id, &event_id, &has_payload,
+                 &payload);
 
   system_bus = g_dbus_method_invocation_get_connection (invocation);
   sender = g_dbus_method_invocation_get_sender (invocation);
@@ -131,13 +460,24 @@ on_start_aggregate_timer (EmerEventRecorderServer *object,
   if (error)
     {
       g_dbus_method_invocation_return_gerror (invocation, error);
-      return TRUE;
+      return;
     }
 
   emer_event_recorder_server_complete_start_aggregate_timer (object,
                                                              invocation,
                                                              timer_object_path);
+}
 
+static gboolean
+on_start_aggregate_timer (EmerEventRecorderServer *object,
+                          GDBusMethodInvocation   *invocation,
+                          guint32                  unix_user_id,
+                          GVariant                *event_id,
+                          gboolean                 has_payload,
+                          GVariant                *payload,
+                          EmerDaemon              *daemon)
+{
+  invoke_in_main_context (start_aggregate_timer, object, invocation, daemon);
   return TRUE;
 }
 
@@ -160,10 +500,10 @@ handle_upload_finished (EmerDaemon       *daemon,
   g_free (callback_data);
 }
 
-static gboolean
-on_upload_events (EmerEventRecorderServer *server,
-                  GDBusMethodInvocation   *invocation,
-                  EmerDaemon              *daemon)
+static void
+upload_events (EmerEventRecorderServer *server,
+               GDBusMethodInvocation   *invocation,
+               EmerDaemon              *daemon)
 {
   DBusCallbackData *callback_data = g_new (DBusCallbackData, 1);
   callback_data->server = g_object_ref (server);
@@ -171,6 +511,14 @@ on_upload_events (EmerEventRecorderServer *server,
   emer_daemon_upload_events (daemon,
                              (GAsyncReadyCallback) handle_upload_finished,
                              callback_data);
+}
+
+static gboolean
+on_upload_events (EmerEventRecorderServer *server,
+                  GDBusMethodInvocation   *invocation,
+                  EmerDaemon              *daemon)
+{
+  invoke_in_main_context (upload_events, server, invocation, daemon);
   return TRUE;
 }
 
@@ -178,18 +526,21 @@ typedef struct {
     const gchar *method_name;
     const gchar *method_full_name;
     const gchar *error_message;
+    MainContextHandler handler;
 } AuthorizedMethod;
 
 static const AuthorizedMethod authorized_methods[] = {
    {
      "SetEnabled",
      "com.endlessm.Metrics.SetEnabled",
-     "Disabling metrics is only allowed from system settings"
+     "Disabling metrics is only allowed from system settings",
+     set_enabled
    },
    {
      "ResetTrackingId",
      "com.endlessm.Metrics.ResetTrackingId",
-     "Only privileged users can reset the tracking ID"
+     "Only privileged users can reset the tracking ID",
+     NULL
    },
    { NULL }
 };
@@ -209,68 +560,281 @@ lookup_authorized_method (const gchar *method_name)
 }
 
 /*
- * This handler is run in a separate thread, so all operations can be
- * synchronous.
+ * Positive PolicyKit results are cached per sender so that repeated calls
+ * from the same client don't each cost a round trip to polkitd. Each cached
+ * sender is watched on the bus, and forgotten as soon as it disconnects;
+ * unique names are never reused, so this is enough to keep the cache from
+ * granting anything to a different client.
+ *
+ * The cache is read from the GDBus worker threads running
+ * on_authorize_method_check(), and written from the main thread.
  */
+struct _AuthorizationCache
+{
+  GMutex lock;
+  /* Owned unique bus name → AuthorizedSender */
+  GHashTable *senders;
+  /* Only accessed from the main thread. */
+  PolkitAuthority *authority;
+};
+
+typedef struct
+{
+  /* Bitmask of indices into authorized_methods */
+  guint authorized_methods;
+  guint watch_id;
+} AuthorizedSender;
+
+static void
+authorized_sender_free (AuthorizedSender *authorized_sender)
+{
+  g_bus_unwatch_name (authorized_sender->watch_id);
+  g_free (authorized_sender);
+}
+
+static guint
+authorized_method_flag (const AuthorizedMethod *authorized_method)
+{
+  return 1u << (authorized_method - authorized_methods);
+}
+
+static AuthorizationCache *
+authorization_cache_new (void)
+{
+  AuthorizationCache *cache = g_new0 (AuthorizationCache, 1);
+
+  g_mutex_init (&cache->lock);
+  cache->senders =
+    g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                           (GDestroyNotify) authorized_sender_free);
+  return cache;
+}
+
+/* Called in a worker thread. */
 static gboolean
-on_authorize_method_check (GDBusInterfaceSkeleton *interface,
-                           GDBusMethodInvocation  *invocation,
-                           EmerDaemon             *daemon)
+authorization_cache_lookup (AuthorizationCache     *cache,
+                            const gchar            *sender_name,
+                            const AuthorizedMethod *authorized_method)
 {
-  const gchar *method_name =
-    g_dbus_method_invocation_get_method_name (invocation);
-  const AuthorizedMethod *authorized_method = lookup_authorized_method (method_name);
+  AuthorizedSender *authorized_sender;
+  gboolean authorized = FALSE;
 
-  if (authorized_method == NULL)
-    return TRUE;
+  g_mutex_lock (&cache->lock);
+  authorized_sender = g_hash_table_lookup (cache->senders, sender_name);
+  if (authorized_sender != NULL)
+    authorized = (authorized_sender->authorized_methods &
+                  authorized_method_flag (authorized_method)) != 0;
+  g_mutex_unlock (&cache->lock);
 
-  GError *error = NULL;
-  PolkitAuthority *authority =
-    polkit_authority_get_sync (NULL /*GCancellable*/, &error);
-  if (authority == NULL)
+  return authorized;
+}
+
+static void
+on_authorized_sender_vanished (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               gpointer         user_data)
+{
+  AuthorizationCache *cache = user_data;
+
+  g_mutex_lock (&cache->lock);
+  g_hash_table_remove (cache->senders, sender_name);
+  g_mutex_unlock (&cache->lock);
+}
+
+static void
+authorization_cache_insert (AuthorizationCache     *cache,
+                            GDBusConnection        *connection,
+                            const gchar            *sender_name,
+                            const AuthorizedMethod *authorized_method)
+{
+  AuthorizedSender *authorized_sender;
+
+  g_mutex_lock (&cache->lock);
+
+  authorized_sender = g_hash_table_lookup (cache->senders, sender_name);
+  if (authorized_sender == NULL)
     {
-      g_critical ("Could not get PolicyKit authority: %s.", error->message);
-      g_dbus_method_invocation_return_gerror (invocation, error);
-      g_error_free (error);
-      return FALSE;
+      authorized_sender = g_new0 (AuthorizedSender, 1);
+      authorized_sender->watch_id =
+        g_bus_watch_name_on_connection (connection, sender_name,
+                                        G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                        NULL /* name appeared */,
+                                        on_authorized_sender_vanished,
+                                        cache, NULL /* free func */);
+      g_hash_table_insert (cache->senders, g_strdup (sender_name),
+                           authorized_sender);
     }
 
-  const gchar *sender_name = g_dbus_method_invocation_get_sender (invocation);
-  PolkitSubject *subject = polkit_system_bus_name_new (sender_name);
-  PolkitCheckAuthorizationFlags flags = POLKIT_CHECK_AUTHORIZATION_FLAGS_NONE;
-  GDBusMessage *message = g_dbus_method_invocation_get_message (invocation);
+  authorized_sender->authorized_methods |=
+    authorized_method_flag (authorized_method);
 
-  if (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION)
-    flags |= POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION;
+  g_mutex_unlock (&cache->lock);
+}
 
-  PolkitAuthorizationResult *result =
-    polkit_authority_check_authorization_sync (authority,
-                                               subject,
-                                               authorized_method->method_full_name,
-                                               NULL /*PolkitDetails*/,
-                                               flags,
-                                               NULL /*GCancellable*/,
-                                               &error);
-  g_object_unref (authority);
-  g_object_unref (subject);
+typedef struct
+{
+  const AuthorizedMethod *authorized_method;
+  EmerEventRecorderServer *server;
+  GDBusMethodInvocation *invocation;
+  EmerDaemon *daemon;
+  AuthorizationCache *cache;
+} AuthorizationCheck;
+
+static void
+authorization_check_free (AuthorizationCheck *check)
+{
+  g_object_unref (check->server);
+  g_object_unref (check->invocation);
+  g_free (check);
+}
+
+static void
+on_authorization_checked (PolkitAuthority    *authority,
+                          GAsyncResult       *res,
+                          AuthorizationCheck *check)
+{
+  const AuthorizedMethod *authorized_method = check->authorized_method;
+  GDBusMethodInvocation *invocation = check->invocation;
+  g_autoptr(PolkitAuthorizationResult) result = NULL;
+  g_autoptr(GError) error = NULL;
+
+  result = polkit_authority_check_authorization_finish (authority, res,
+                                                        &error);
   if (result == NULL)
     {
       g_critical ("Could not get PolicyKit authorization result: %s.",
                   error->message);
       g_dbus_method_invocation_return_gerror (invocation, error);
-      g_error_free (error);
+    }
+  else if (!polkit_authorization_result_get_is_authorized (result))
+    {
+      g_dbus_method_invocation_return_error_literal (invocation,
+                                                     G_DBUS_ERROR,
+                                                     G_DBUS_ERROR_AUTH_FAILED,
+                                                     authorized_method->error_message);
+    }
+  else
+    {
+      authorization_cache_insert (check->cache,
+                                  g_dbus_method_invocation_get_connection (invocation),
+                                  g_dbus_method_invocation_get_sender (invocation),
+                                  authorized_method);
+
+      authorized_method->handler (check->server, invocation, check->daemon);
+    }
+
+  authorization_check_free (check);
+}
+
+static void
+check_authorization (AuthorizationCheck *check)
+{
+  GDBusMessage *message = g_dbus_method_invocation_get_message (check->invocation);
+  const gchar *sender_name =
+    g_dbus_method_invocation_get_sender (check->invocation);
+  g_autoptr(PolkitSubject) subject = polkit_system_bus_name_new (sender_name);
+  PolkitCheckAuthorizationFlags flags = POLKIT_CHECK_AUTHORIZATION_FLAGS_NONE;
+
+  if (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION)
+    flags |= POLKIT_CHECK_AUTHORIZATION_FLAGS_ALLOW_USER_INTERACTION;
+
+  polkit_authority_check_authorization (check->cache->authority,
+                                        subject,
+                                        check->authorized_method->method_full_name,
+                                        NULL /*PolkitDetails*/,
+                                        flags,
+                                        NULL /*GCancellable*/,
+                                        (GAsyncReadyCallback) on_authorization_checked,
+                                        check);
+}
+
+static void
+on_authority_ready (GObject            *source_object,
+                    GAsyncResult       *res,
+                    AuthorizationCheck *check)
+{
+  g_autoptr(GError) error = NULL;
+  PolkitAuthority *authority = polkit_authority_get_finish (res, &error);
+
+  if (authority == NULL)
+    {
+      g_critical ("Could not get PolicyKit authority: %s.", error->message);
+      g_dbus_method_invocation_return_gerror (check->invocation, error);
+      authorization_check_free (check);
+      return;
+    }
+
+  /* Several checks may have raced to fetch the authority. */
+  if (check->cache->authority == NULL)
+    check->cache->authority = authority;
+  else
+    g_object_unref (authority);
+
+  check_authorization (check);
+}
+
+static gboolean
+start_authorization_check (gpointer user_data)
+{
+  AuthorizationCheck *check = user_data;
+
+  if (check->cache->authority == NULL)
+    polkit_authority_get_async (NULL /*GCancellable*/,
+                                (GAsyncReadyCallback) on_authority_ready,
+                                check);
+  else
+    check_authorization (check);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * This handler is run in a GDBus worker thread, and must decide
+ * synchronously whether the method handler should run. Callers with a
+ * cached authorization go straight through; for anyone else, the call is
+ * held back while PolicyKit is asked asynchronously from the main thread,
+ * which then runs the method's main-thread handler itself if the caller is
+ * authorized. Either way, neither this thread nor the main thread waits for
+ * polkitd. Methods with no handler are rejected before PolicyKit is asked, as
+ * GDBus would reject them, since authorizing them would achieve nothing.
+ */
+static gboolean
+on_authorize_method_check (GDBusInterfaceSkeleton *interface,
+                           GDBusMethodInvocation  *invocation,
+                           BusData                *bus_data)
+{
+  const gchar *method_name =
+    g_dbus_method_invocation_get_method_name (invocation);
+  const AuthorizedMethod *authorized_method = lookup_authorized_method (method_name);
+
+  if (authorized_method == NULL)
+    return TRUE;
+
+  if (authorized_method->handler == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_UNKNOWN_METHOD,
+                                             "Method %s is not implemented on "
+                                             "interface %s", method_name,
+                                             g_dbus_method_invocation_get_interface_name (invocation));
       return FALSE;
     }
 
-  gboolean authorized = polkit_authorization_result_get_is_authorized (result);
-  if (!authorized)
-    g_dbus_method_invocation_return_error_literal (invocation,
-                                                   G_DBUS_ERROR,
-                                                   G_DBUS_ERROR_AUTH_FAILED,
-                                                   authorized_method->error_message);
+  const gchar *sender_name = g_dbus_method_invocation_get_sender (invocation);
+  if (authorization_cache_lookup (bus_data->authorization_cache, sender_name,
+                                  authorized_method))
+    return TRUE;
 
-  g_object_unref (result);
-  return authorized;
+  AuthorizationCheck *check = g_new (AuthorizationCheck, 1);
+  check->authorized_method = authorized_method;
+  check->server = g_object_ref (EMER_EVENT_RECORDER_SERVER (interface));
+  check->invocation = g_object_ref (invocation);
+  check->daemon = bus_data->daemon;
+  check->cache = bus_data->authorization_cache;
+  g_main_context_invoke (NULL /* default context */,
+                         start_authorization_check, check);
+
+  return FALSE;
 }
 
 typedef struct {
@@ -336,15 +900,19 @@ on_bus_acquired (GDBusConnection *system_bus,
                  const gchar     *name,
                  gpointer         user_data)
 {
-  EmerDaemon *daemon = EMER_DAEMON (user_data);
+  BusData *bus_data = user_data;
+  EmerDaemon *daemon = bus_data->daemon;
   EmerEventRecorderServer *server = emer_event_recorder_server_skeleton_new ();
 
+  g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (server),
+                                       G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+
   g_signal_connect (server, "handle-record-singular-event",
-                    G_CALLBACK (on_record_singular_event), daemon);
+                    G_CALLBACK (on_record_singular_event), bus_data);
   g_signal_connect (server, "handle-record-aggregate-event",
-                    G_CALLBACK (on_record_aggregate_event), daemon);
+                    G_CALLBACK (on_record_aggregate_event), bus_data);
   g_signal_connect (server, "handle-record-event-sequence",
-                    G_CALLBACK (on_record_event_sequence), daemon);
+                    G_CALLBACK (on_record_event_sequence), bus_data);
   g_signal_connect (server, "handle-set-enabled",
                     G_CALLBACK (on_set_enabled), daemon);
   g_signal_connect (server, "handle-upload-events",
@@ -352,7 +920,7 @@ on_bus_acquired (GDBusConnection *system_bus,
   g_signal_connect (server, "handle-start-aggregate-timer",
                     G_CALLBACK (on_start_aggregate_timer), daemon);
   g_signal_connect (server, "g-authorize-method",
-                    G_CALLBACK (on_authorize_method_check), daemon);
+                    G_CALLBACK (on_authorize_method_check), bus_data);
 
   EmerPermissionsProvider *permissions =
     emer_daemon_get_permissions_provider (daemon);
@@ -372,6 +940,33 @@ on_bus_acquired (GDBusConnection *system_bus,
                                          &error))
     g_error ("Could not export metrics interface on system bus: %s.",
              error->message);
+
+  EmerIngest *ingest = emer_ingest_skeleton_new ();
+
+  g_dbus_interface_skeleton_set_flags (G_DBUS_INTERFACE_SKELETON (ingest),
+                                       G_DBUS_INTERFACE_SKELETON_FLAGS_HANDLE_METHOD_INVOCATIONS_IN_THREAD);
+
+  g_signal_connect (ingest, "handle-record-singular-events",
+                    G_CALLBACK (on_record_singular_events), bus_data);
+  g_signal_connect (ingest, "handle-get-rate-limit-drops",
+                    G_CALLBACK (on_get_rate_limit_drops),
+                    bus_data->rate_limiter);
+  g_signal_connect (ingest, "handle-get-memory-usage",
+                    G_CALLBACK (on_get_memory_usage), bus_data->daemon);
+
+  g_object_bind_property (daemon, "buffer-fill", ingest, "buffer-fill",
+                          G_BINDING_SYNC_CREATE);
+  g_object_bind_property (daemon, "cache-fill", ingest, "cache-fill",
+                          G_BINDING_SYNC_CREATE);
+  g_object_bind_property (daemon, "pressure", ingest, "pressure",
+                          G_BINDING_SYNC_CREATE);
+
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (ingest),
+                                         system_bus,
+                                         "/com/endlessm/Metrics",
+                                         &error))
+    g_error ("Could not export ingest interface on system bus: %s.",
+             error->message);
 }
 
 /*
@@ -394,6 +989,14 @@ on_name_lost (GDBusConnection *system_bus,
   g_error ("Could not acquire name '%s' on system bus.", name);
 }
 
+static void
+on_low_memory_warning (GMemoryMonitor             *memory_monitor,
+                       GMemoryMonitorWarningLevel  level,
+                       EmerDaemon                 *daemon)
+{
+  emer_daemon_release_memory (daemon);
+}
+
 static EmerDaemon *
 make_daemon (gint                argc,
              const gchar * const argv[])
@@ -452,6 +1055,24 @@ main (gint                argc,
   GMainLoop *main_loop = g_main_loop_new (NULL, TRUE);
   ShutdownSignalData data = { daemon, main_loop };
 
+  EmerIngestQueue *record_queue =
+    emer_ingest_queue_new (NULL /* default context */, handle_record_call,
+                           daemon, (GDestroyNotify) record_call_free);
+  EmerRateLimit sender_limit, user_limit;
+  emer_permissions_provider_get_rate_limits (emer_daemon_get_permissions_provider (daemon),
+                                             &sender_limit, &user_limit);
+  EmerRateLimiter *rate_limiter =
+    emer_rate_limiter_new (&sender_limit, &user_limit);
+
+  AuthorizationCache *authorization_cache = authorization_cache_new ();
+  BusData bus_data = {
+    daemon, record_queue, rate_limiter, authorization_cache
+  };
+
+  GMemoryMonitor *memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (memory_monitor, "low-memory-warning",
+                    G_CALLBACK (on_low_memory_warning), daemon);
+
   // Shut down on any of these signals.
   g_unix_signal_add (SIGHUP, (GSourceFunc) quit_main_loop, &data);
   g_unix_signal_add (SIGINT, (GSourceFunc) quit_main_loop, &data);
@@ -464,10 +1085,21 @@ main (gint                argc,
                                   on_bus_acquired,
                                   NULL /* name_acquired_callback */,
                                   on_name_lost,
-                                  daemon, NULL /* user data free func */);
+                                  &bus_data, NULL /* user data free func */);
 
   g_main_loop_run (main_loop);
 
+  /* Record any events which were received before the main loop quit. Worker
+   * threads may still be handling method calls, so the queue, the rate
+   * limiter and the authorization cache are deliberately leaked rather than
+   * freed.
+   */
+  emer_ingest_queue_drain (record_queue);
+
+  g_signal_handlers_disconnect_by_func (memory_monitor, on_low_memory_warning,
+                                        daemon);
+  g_object_unref (memory_monitor);
+
   g_object_unref (daemon);
   g_bus_unown_name (name_id);
   g_main_loop_unref (main_loop);
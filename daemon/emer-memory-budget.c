@@ -0,0 +1,202 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-memory-budget.h"
+
+/*
+ * EmerMemoryBudget:
+ *
+ * Accounts for the memory held by each part of the daemon which grows with the
+ * number of events, against a single budget for the whole daemon. The daemon
+ * brings each component's usage up to date from the main thread whenever it
+ * uses what remains of the budget to decide how large an upload it may
+ * assemble, and when it releases memory, rather than after every event.
+ * The usage may be read from any thread, so that it can be reported over
+ * D-Bus without waiting for the main thread; a D-Bus worker thread may hold
+ * its own reference for the same reason.
+ */
+
+struct _EmerMemoryBudget
+{
+  GMutex lock;
+
+  gsize budget;
+  gsize usage[EMER_MEMORY_N_COMPONENTS];
+};
+
+static const gchar * const component_names[] = {
+  [EMER_MEMORY_COMPONENT_BUFFER] = "buffer",
+  [EMER_MEMORY_COMPONENT_PRIORITY_BUFFER] = "priority-buffer",
+  [EMER_MEMORY_COMPONENT_REQUEST] = "request",
+  [EMER_MEMORY_COMPONENT_AGGREGATE_TALLY] = "aggregate-tally",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (component_names) == EMER_MEMORY_N_COMPONENTS);
+
+/*
+ * emer_memory_budget_new:
+ * @budget: the number of bytes the daemon should aim to stay within
+ *
+ * Returns: (transfer full): a new memory budget, with nothing in use
+ */
+EmerMemoryBudget *
+emer_memory_budget_new (gsize budget)
+{
+  EmerMemoryBudget *self = g_atomic_rc_box_new0 (EmerMemoryBudget);
+
+  g_mutex_init (&self->lock);
+  self->budget = budget;
+
+  return self;
+}
+
+/*
+ * emer_memory_budget_get_budget:
+ * @self: the memory budget
+ *
+ * Returns: the number of bytes the daemon should aim to stay within
+ */
+gsize
+emer_memory_budget_get_budget (EmerMemoryBudget *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->budget;
+}
+
+/*
+ * emer_memory_budget_set_usage:
+ * @self: the memory budget
+ * @component: a component of the daemon
+ * @usage: the number of bytes @component now holds
+ */
+void
+emer_memory_budget_set_usage (EmerMemoryBudget    *self,
+                              EmerMemoryComponent  component,
+                              gsize                usage)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (component < EMER_MEMORY_N_COMPONENTS);
+
+  g_mutex_lock (&self->lock);
+  self->usage[component] = usage;
+  g_mutex_unlock (&self->lock);
+}
+
+/*
+ * emer_memory_budget_get_usage:
+ * @self: the memory budget
+ * @component: a component of the daemon
+ *
+ * Returns: the number of bytes @component last reported holding
+ */
+gsize
+emer_memory_budget_get_usage (EmerMemoryBudget    *self,
+                              EmerMemoryComponent  component)
+{
+  gsize usage;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (component < EMER_MEMORY_N_COMPONENTS, 0);
+
+  g_mutex_lock (&self->lock);
+  usage = self->usage[component];
+  g_mutex_unlock (&self->lock);
+
+  return usage;
+}
+
+/*
+ * emer_memory_budget_get_total_usage:
+ * @self: the memory budget
+ *
+ * Returns: the number of bytes held by all components together
+ */
+gsize
+emer_memory_budget_get_total_usage (EmerMemoryBudget *self)
+{
+  gsize total = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  for (EmerMemoryComponent component = 0;
+       component < EMER_MEMORY_N_COMPONENTS;
+       component++)
+    total += self->usage[component];
+  g_mutex_unlock (&self->lock);
+
+  return total;
+}
+
+/*
+ * emer_memory_budget_get_available:
+ * @self: the memory budget
+ *
+ * Returns: the number of bytes left in the budget, or 0 if it is exhausted
+ */
+gsize
+emer_memory_budget_get_available (EmerMemoryBudget *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  gsize total = emer_memory_budget_get_total_usage (self);
+
+  return total < self->budget ? self->budget - total : 0;
+}
+
+/*
+ * emer_memory_component_to_string:
+ * @component: a component of the daemon
+ *
+ * Returns: a short name for @component, such as "buffer"
+ */
+const gchar *
+emer_memory_component_to_string (EmerMemoryComponent component)
+{
+  g_return_val_if_fail (component < EMER_MEMORY_N_COMPONENTS, NULL);
+
+  return component_names[component];
+}
+
+EmerMemoryBudget *
+emer_memory_budget_ref (EmerMemoryBudget *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return g_atomic_rc_box_acquire (self);
+}
+
+static void
+memory_budget_clear (EmerMemoryBudget *self)
+{
+  g_mutex_clear (&self->lock);
+}
+
+void
+emer_memory_budget_unref (EmerMemoryBudget *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_atomic_rc_box_release_full (self, (GDestroyNotify) memory_budget_clear);
+}
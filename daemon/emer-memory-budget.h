@@ -0,0 +1,74 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * EmerMemoryComponent:
+ * @EMER_MEMORY_COMPONENT_BUFFER: the in-memory event buffer
+ * @EMER_MEMORY_COMPONENT_PRIORITY_BUFFER: the buffer of high-priority events
+ * @EMER_MEMORY_COMPONENT_REQUEST: the body of the upload in flight, and its
+ *   compressed copy
+ * @EMER_MEMORY_COMPONENT_AGGREGATE_TALLY: increments to the aggregate tally
+ *   not yet written to its database, and SQLite's page cache for it
+ *
+ * The parts of the daemon whose memory use is accounted against the budget.
+ */
+typedef enum
+{
+  EMER_MEMORY_COMPONENT_BUFFER,
+  EMER_MEMORY_COMPONENT_PRIORITY_BUFFER,
+  EMER_MEMORY_COMPONENT_REQUEST,
+  EMER_MEMORY_COMPONENT_AGGREGATE_TALLY,
+  EMER_MEMORY_N_COMPONENTS,
+} EmerMemoryComponent;
+
+typedef struct _EmerMemoryBudget EmerMemoryBudget;
+
+EmerMemoryBudget *emer_memory_budget_new             (gsize                budget);
+
+gsize             emer_memory_budget_get_budget      (EmerMemoryBudget    *self);
+
+void              emer_memory_budget_set_usage       (EmerMemoryBudget    *self,
+                                                      EmerMemoryComponent  component,
+                                                      gsize                usage);
+
+gsize             emer_memory_budget_get_usage       (EmerMemoryBudget    *self,
+                                                      EmerMemoryComponent  component);
+
+gsize             emer_memory_budget_get_total_usage (EmerMemoryBudget    *self);
+
+gsize             emer_memory_budget_get_available   (EmerMemoryBudget    *self);
+
+const gchar      *emer_memory_component_to_string    (EmerMemoryComponent  component);
+
+EmerMemoryBudget *emer_memory_budget_ref             (EmerMemoryBudget    *self);
+
+void              emer_memory_budget_unref           (EmerMemoryBudget    *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerMemoryBudget, emer_memory_budget_unref)
+
+G_END_DECLS
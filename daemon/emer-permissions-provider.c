@@ -56,6 +56,20 @@ G_DEFINE_TYPE (EmerPermissionsProvider, emer_permissions_provider, G_TYPE_OBJECT
 #define DAEMON_ENVIRONMENT_KEY_NAME "environment"
 #define DAEMON_SERVER_URL_KEY_NAME "server_url"
 
+#define RATE_LIMITS_GROUP_NAME "rate_limits"
+#define EVENTS_PER_SECOND_KEY_SUFFIX "events_per_second"
+#define EVENT_BURST_KEY_SUFFIX "event_burst"
+#define BYTES_PER_HOUR_KEY_SUFFIX "bytes_per_hour"
+
+/* Generous enough that well-behaved clients never hit them, while stopping a
+ * single runaway client from filling the 10 MB persistent cache. */
+#define DEFAULT_SENDER_EVENTS_PER_SECOND 20.0
+#define DEFAULT_SENDER_EVENT_BURST 500
+#define DEFAULT_SENDER_BYTES_PER_HOUR (1024 * 1024)
+#define DEFAULT_USER_EVENTS_PER_SECOND 50.0
+#define DEFAULT_USER_EVENT_BURST 1000
+#define DEFAULT_USER_BYTES_PER_HOUR (2 * 1024 * 1024)
+
 #define FALLBACK_CONFIG_FILE_DATA \
   "[" DAEMON_GLOBAL_GROUP_NAME "]\n" \
   DAEMON_ENABLED_KEY_NAME "=true\n" \
@@ -662,3 +676,78 @@ emer_permissions_provider_get_server_url (EmerPermissionsProvider *self)
 
   return g_steal_pointer (&server_url);
 }
+
+static void
+read_rate_limit (EmerPermissionsProvider *self,
+                 const gchar             *prefix,
+                 EmerRateLimit           *limit)
+{
+  g_autofree gchar *events_per_second_key =
+    g_strconcat (prefix, "_", EVENTS_PER_SECOND_KEY_SUFFIX, NULL);
+  g_autofree gchar *event_burst_key =
+    g_strconcat (prefix, "_", EVENT_BURST_KEY_SUFFIX, NULL);
+  g_autofree gchar *bytes_per_hour_key =
+    g_strconcat (prefix, "_", BYTES_PER_HOUR_KEY_SUFFIX, NULL);
+  g_autoptr(GError) error = NULL;
+  gdouble events_per_second;
+  gint event_burst;
+  guint64 bytes_per_hour;
+
+  events_per_second =
+    g_key_file_get_double (self->permissions, RATE_LIMITS_GROUP_NAME,
+                           events_per_second_key, &error);
+  if (error == NULL && events_per_second >= 0)
+    limit->events_per_second = events_per_second;
+  else
+    g_debug ("%s: Using default for '%s'", G_STRFUNC, events_per_second_key);
+  g_clear_error (&error);
+
+  event_burst =
+    g_key_file_get_integer (self->permissions, RATE_LIMITS_GROUP_NAME,
+                            event_burst_key, &error);
+  if (error == NULL && event_burst >= 0)
+    limit->event_burst = event_burst;
+  else
+    g_debug ("%s: Using default for '%s'", G_STRFUNC, event_burst_key);
+  g_clear_error (&error);
+
+  bytes_per_hour =
+    g_key_file_get_uint64 (self->permissions, RATE_LIMITS_GROUP_NAME,
+                           bytes_per_hour_key, &error);
+  if (error == NULL)
+    limit->bytes_per_hour = bytes_per_hour;
+  else
+    g_debug ("%s: Using default for '%s'", G_STRFUNC, bytes_per_hour_key);
+}
+
+/*
+ * emer_permissions_provider_get_rate_limits:
+ * @self: the permissions provider
+ * @sender_limit: (out caller-allocates): return location for the limit on
+ *   each D-Bus client
+ * @user_limit: (out caller-allocates): return location for the limit on
+ *   each Unix user
+ *
+ * Gets the limits on how quickly events may be recorded, from the
+ * "rate_limits" group of the configuration file. Any limit not given there
+ * takes its default value; a rate or quota of 0 means no limit.
+ */
+void
+emer_permissions_provider_get_rate_limits (EmerPermissionsProvider *self,
+                                           EmerRateLimit           *sender_limit,
+                                           EmerRateLimit           *user_limit)
+{
+  *sender_limit = (EmerRateLimit) {
+    DEFAULT_SENDER_EVENTS_PER_SECOND,
+    DEFAULT_SENDER_EVENT_BURST,
+    DEFAULT_SENDER_BYTES_PER_HOUR,
+  };
+  *user_limit = (EmerRateLimit) {
+    DEFAULT_USER_EVENTS_PER_SECOND,
+    DEFAULT_USER_EVENT_BURST,
+    DEFAULT_USER_BYTES_PER_HOUR,
+  };
+
+  read_rate_limit (self, "sender", sender_limit);
+  read_rate_limit (self, "user", user_limit);
+}
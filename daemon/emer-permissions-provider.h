@@ -25,6 +25,8 @@
 
 #include <glib-object.h>
 
+#include "emer-rate-limiter.h"
+
 G_BEGIN_DECLS
 
 #define EMER_TYPE_PERMISSIONS_PROVIDER emer_permissions_provider_get_type()
@@ -53,6 +55,10 @@ gchar                   *emer_permissions_provider_get_environment       (EmerPe
 
 gchar                   *emer_permissions_provider_get_server_url        (EmerPermissionsProvider *self);
 
+void                     emer_permissions_provider_get_rate_limits       (EmerPermissionsProvider *self,
+                                                                          EmerRateLimit           *sender_limit,
+                                                                          EmerRateLimit           *user_limit);
+
 G_END_DECLS
 
 #endif /* EMER_PERMISSIONS_PROVIDER_H */
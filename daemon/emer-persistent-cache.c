@@ -34,10 +34,16 @@
 
 #include <eosmetrics/eosmetrics.h>
 
+#include "emer-cache-record.h"
 #include "emer-circular-file.h"
+#include "emer-gzip.h"
+#include "emer-segmented-file.h"
 #include "shared/metrics-util.h"
 
 #define VARIANT_FILENAME "variants.dat"
+#define BLOCK_FILENAME "blocks.dat"
+#define VARIANT_SEGMENTS_DIRNAME "variant-segments"
+#define BLOCK_SEGMENTS_DIRNAME "block-segments"
 #define DEFAULT_VERSION_FILENAME "local_version_file"
 
 /* SECTION:emer-persistent-cache.c
@@ -46,14 +52,73 @@
  *
  * Uses a machine-independent storage format that may only be modified in a
  * backwards-incompatible manner when CURRENT_CACHE_VERSION is incremented.
+ * When it is, a step should be added to cache_migrations which converts
+ * variants stored by the previous version, so that they aren't discarded.
+ *
+ * Each variant is stored as a record which begins with a single byte giving
+ * its kind (see #EmerCacheRecordKind). Singular and aggregate events, which
+ * make up nearly everything the daemon stores, are identified by the kind
+ * alone; a variant of any other type is followed by its nul-terminated type
+ * string. The serialized variant, in little-endian normal form, makes up the
+ * rest of the record.
+ *
+ * By default, each record is an element of its own in VARIANT_FILENAME. In
+ * compressed mode, records are instead grouped into blocks of up to about
+ * BLOCK_TARGET_SIZE bytes, each of which is an element of BLOCK_FILENAME. A
+ * block begins with a byte giving its encoding (see #BlockEncoding), followed
+ * by the size of its uncompressed payload and the number of records in it,
+ * each a little-endian guint32. The payload, compressed or not, follows; in it
+ * each record is preceded by its length as a little-endian guint32. Blocks
+ * are read and removed whole.
+ *
+ * The elements are kept in an #EmerCircularFile by default. In segmented mode
+ * they are instead kept in an #EmerSegmentedFile, in VARIANT_SEGMENTS_DIRNAME
+ * or BLOCK_SEGMENTS_DIRNAME, which frees disk space as elements are removed and
+ * never copies them when the cache size changes. Switching between any of
+ * these storage layouts moves any variants from the other layouts' files into
+ * the current one.
+ */
+
+typedef enum
+{
+  BLOCK_ENCODING_STORED = 0,
+  BLOCK_ENCODING_GZIP = 1,
+} BlockEncoding;
+
+#define BLOCK_HEADER_SIZE (sizeof (guint8) + 2 * sizeof (guint32))
+#define RECORD_LENGTH_SIZE sizeof (guint32)
+
+/* Records are added to a block until its payload would grow past this many
+ * bytes. Since blocks are read whole, this should be comfortably less than the
+ * amount the daemon reads from the cache at once.
  */
+#define BLOCK_TARGET_SIZE 16384
+
+/* The ways in which the cache may lay out its data on disk, of which it uses
+ * the one matching its compressed and segmented properties.
+ */
+typedef struct
+{
+  const gchar *filename;
+  gboolean compressed;
+  gboolean segmented;
+} StorageLayout;
+
+static const StorageLayout storage_layouts[] = {
+  { VARIANT_FILENAME, FALSE, FALSE },
+  { BLOCK_FILENAME, TRUE, FALSE },
+  { VARIANT_SEGMENTS_DIRNAME, FALSE, TRUE },
+  { BLOCK_SEGMENTS_DIRNAME, TRUE, TRUE },
+};
 
 typedef struct _EmerPersistentCachePrivate
 {
   guint64 cache_size;
+  gboolean compressed;
+  gboolean segmented;
   EmerBootIdProvider *boot_id_provider;
   EmerCacheVersionProvider *cache_version_provider;
-  EmerCircularFile *variant_file;
+  EmerElementStore *variant_file;
 
   guint boot_offset_update_timeout_source_id;
 
@@ -78,10 +143,16 @@ G_DEFINE_TYPE_WITH_CODE (EmerPersistentCache, emer_persistent_cache, G_TYPE_OBJE
                          G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, emer_persistent_cache_initable_iface_init))
 
 /* If this version is greater than the version of the persisted variants,
- * they will be removed, and the file in which the version number is stored
- * will be updated.
+ * they will be migrated to the current format if cache_migrations has a step
+ * from each version in between, and removed otherwise; either way, the file in
+ * which the version number is stored will be updated.
+ */
+#define CURRENT_CACHE_VERSION 6
+
+/* Migrations read and rewrite this many bytes of variants at a time, so that
+ * migrating a full cache needs little memory and loses little if interrupted.
  */
-#define CURRENT_CACHE_VERSION 5
+#define MIGRATION_CHUNK_SIZE 65536
 
 /*
  * The expected size in bytes of the file located at SYSTEM_BOOT_ID_FILE.
@@ -111,6 +182,8 @@ enum
   PROP_0,
   PROP_CACHE_DIRECTORY,
   PROP_CACHE_SIZE,
+  PROP_COMPRESSED,
+  PROP_SEGMENTED,
   PROP_BOOT_ID_PROVIDER,
   PROP_CACHE_VERSION_PROVIDER,
   PROP_BOOT_OFFSET_UPDATE_INTERVAL,
@@ -285,7 +358,7 @@ reset_boot_offset_metadata_file (EmerPersistentCache *self,
   gchar system_boot_id_string[BOOT_ID_FILE_LENGTH];
   uuid_unparse_lower (system_boot_id, system_boot_id_string);
 
-  if (!emer_circular_file_purge (priv->variant_file, error))
+  if (!emer_element_store_purge (priv->variant_file, error))
     return FALSE;
 
   gint64 reset_offset = 0;
@@ -581,10 +654,874 @@ regularize_post_storage (GVariant *variant)
   return floating_variant;
 }
 
+/* Writes the header of a record holding a serialized variant of the given
+ * type, which takes up header_size bytes at the start of the record.
+ */
+static void
+write_record_header (guint8      *record,
+                     const gchar *type_string,
+                     gsize        header_size)
+{
+  EmerCacheRecordKind kind =
+    emer_cache_record_kind_from_type_string (type_string);
+
+  record[0] = kind;
+  if (kind == EMER_CACHE_RECORD_TYPED)
+    memcpy (record + 1, type_string, header_size - 1);
+}
+
+/* Reserves space in the variant file for a record holding a serialized variant
+ * of the given type and size, and writes the record's header. Returns a
+ * pointer to where the serialized variant should be written, which must be
+ * followed by a call to emer_element_store_commit, or NULL if the record does
+ * not fit.
+ */
+static guint8 *
+reserve_record (EmerElementStore *variant_file,
+                const gchar      *type_string,
+                gsize             variant_size)
+{
+  gsize header_size = emer_cache_record_header_size (type_string);
+
+  guint8 *record =
+    emer_element_store_reserve (variant_file, header_size + variant_size);
+  if (record == NULL)
+    return NULL;
+
+  write_record_header (record, type_string, header_size);
+  return record + header_size;
+}
+
+/* Appends space for a record of the given size to the payload of the block
+ * being built, preceded by its length, and returns a pointer to it. The pointer
+ * is only valid until the payload is next modified.
+ */
+static guint8 *
+add_block_record (GByteArray *payload,
+                  gsize       record_size)
+{
+  guint32 length = GUINT32_TO_LE (record_size);
+  g_byte_array_append (payload, (const guint8 *) &length, sizeof (length));
+
+  gsize offset = payload->len;
+  g_byte_array_set_size (payload, offset + record_size);
+  return payload->data + offset;
+}
+
+/* Compresses the given payload, which holds num_records records, and appends
+ * it to the block file as a single element. The payload is stored as it is if
+ * compressing it fails or doesn't make it any smaller. Returns FALSE if the
+ * block does not fit.
+ */
+static gboolean
+append_block (EmerElementStore *block_file,
+              GByteArray       *payload,
+              guint32           num_records)
+{
+  g_autoptr(GError) error = NULL;
+  gsize compressed_length = 0;
+  g_autofree guint8 *compressed =
+    emer_gzip_compress (payload->data, payload->len, &compressed_length,
+                        &error);
+  if (compressed == NULL)
+    g_warning ("Could not compress block for persistent cache; storing it "
+               "uncompressed: %s", error->message);
+
+  guint8 encoding = BLOCK_ENCODING_GZIP;
+  const guint8 *data = compressed;
+  gsize data_length = compressed_length;
+  if (compressed == NULL || compressed_length >= payload->len)
+    {
+      encoding = BLOCK_ENCODING_STORED;
+      data = payload->data;
+      data_length = payload->len;
+    }
+
+  guint8 *block =
+    emer_element_store_reserve (block_file, BLOCK_HEADER_SIZE + data_length);
+  if (block == NULL)
+    return FALSE;
+
+  guint32 payload_size = GUINT32_TO_LE (payload->len);
+  guint32 le_num_records = GUINT32_TO_LE (num_records);
+  block[0] = encoding;
+  memcpy (block + sizeof (guint8), &payload_size, sizeof (payload_size));
+  memcpy (block + sizeof (guint8) + sizeof (payload_size), &le_num_records,
+          sizeof (le_num_records));
+  memcpy (block + BLOCK_HEADER_SIZE, data, data_length);
+  emer_element_store_commit (block_file);
+
+  return TRUE;
+}
+
+/* Appends the block being built to the block file, if it holds any records,
+ * and empties it, adding the number of records it held to num_stored. Returns
+ * FALSE if the block does not fit.
+ */
+static gboolean
+flush_block (EmerElementStore *block_file,
+             GByteArray       *payload,
+             guint32          *num_pending,
+             gsize            *num_stored)
+{
+  if (*num_pending == 0)
+    return TRUE;
+
+  if (!append_block (block_file, payload, *num_pending))
+    return FALSE;
+
+  *num_stored += *num_pending;
+  *num_pending = 0;
+  g_byte_array_set_size (payload, 0);
+  return TRUE;
+}
+
+/* Returns TRUE if a record of the given size should go in a new block rather
+ * than the one being built.
+ */
+static gboolean
+block_is_full (GByteArray *payload,
+               guint32     num_pending,
+               gsize       record_size)
+{
+  return num_pending > 0 &&
+    payload->len + RECORD_LENGTH_SIZE + record_size > BLOCK_TARGET_SIZE;
+}
+
+/* Appends the given records, each already in the current format, to the data
+ * file in the cache's storage mode. Returns the number of records appended,
+ * which is less than num_records if they did not all fit.
+ */
+static gsize
+append_records (EmerPersistentCache *self,
+                GBytes             **records,
+                gsize                num_records)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  if (!priv->compressed)
+    {
+      for (gsize i = 0; i < num_records; i++)
+        {
+          gsize record_size;
+          gconstpointer record_data =
+            g_bytes_get_data (records[i], &record_size);
+          if (!emer_element_store_append (priv->variant_file, record_data,
+                                          record_size))
+            return i;
+        }
+
+      return num_records;
+    }
+
+  g_autoptr(GByteArray) payload = g_byte_array_sized_new (BLOCK_TARGET_SIZE);
+  guint32 num_pending = 0;
+  gsize num_stored = 0;
+  for (gsize i = 0; i < num_records; i++)
+    {
+      gsize record_size;
+      gconstpointer record_data = g_bytes_get_data (records[i], &record_size);
+
+      if (block_is_full (payload, num_pending, record_size) &&
+          !flush_block (priv->variant_file, payload, &num_pending, &num_stored))
+        return num_stored;
+
+      memcpy (add_block_record (payload, record_size), record_data,
+              record_size);
+      num_pending++;
+    }
+
+  flush_block (priv->variant_file, payload, &num_pending, &num_stored);
+  return num_stored;
+}
+
+/* Returns a new floating variant holding the serialized variant in the given
+ * record, or NULL if the record is malformed, setting problem, unless it is
+ * NULL, to a description of what is wrong. Unless trusted is TRUE, a variant
+ * which is not in normal form also makes the record malformed.
+ */
+static GVariant *
+parse_record (GBytes   *record,
+              gboolean  trusted,
+              gchar   **problem)
+{
+  gsize record_size;
+  const guint8 *record_data = g_bytes_get_data (record, &record_size);
+  if (record_data == NULL)
+    {
+      if (problem != NULL)
+        *problem = g_strdup ("A record in the persistent cache had size 0.");
+      return NULL;
+    }
+
+  EmerCacheRecordKind kind = record_data[0];
+  const gchar *type_string;
+  gsize header_size;
+  if (kind == EMER_CACHE_RECORD_TYPED)
+    {
+      type_string = (const gchar *) record_data + 1;
+      const gchar *end_of_type =
+        memchr (type_string, '\0', record_size - 1);
+      if (end_of_type == NULL)
+        {
+          if (problem != NULL)
+            *problem = g_strdup ("A record in the persistent cache did not "
+                                 "contain a null byte indicating the end of a "
+                                 "variant type string.");
+          return NULL;
+        }
+
+      if (!g_variant_type_string_is_valid (type_string))
+        {
+          if (problem != NULL)
+            *problem = g_strdup ("A record in the persistent cache did not "
+                                 "begin with a valid variant type string.");
+          return NULL;
+        }
+
+      header_size = end_of_type + 1 - (const gchar *) record_data;
+    }
+  else
+    {
+      type_string = emer_cache_record_kind_to_type_string (kind);
+      if (type_string == NULL)
+        {
+          if (problem != NULL)
+            *problem = g_strdup_printf ("A record in the persistent cache had "
+                                        "unknown kind %u.", kind);
+          return NULL;
+        }
+
+      header_size = sizeof (guint8);
+    }
+
+  g_autoptr(GBytes) variant_bytes =
+    g_bytes_new_from_bytes (record, header_size, record_size - header_size);
+  GVariant *variant =
+    g_variant_new_from_bytes (G_VARIANT_TYPE (type_string), variant_bytes,
+                              trusted);
+  if (!trusted && !g_variant_is_normal_form (variant))
+    {
+      if (problem != NULL)
+        *problem = g_strdup_printf ("A record in the persistent cache held a "
+                                    "variant of type %s which was not in "
+                                    "normal form.", type_string);
+      g_variant_unref (variant);
+      return NULL;
+    }
+
+  return variant;
+}
+
+/* Returns a new record in the current format holding the variant in the given
+ * version 5 element, which is a nul-terminated type string followed by a
+ * serialized variant, or NULL if the element doesn't begin with a valid type
+ * string or the variant isn't in normal form, as version 5 stored them all.
+ */
+static GBytes *
+record_from_version_5 (GBytes *elem)
+{
+  gsize elem_size;
+  const gchar *elem_data = g_bytes_get_data (elem, &elem_size);
+  const gchar *end_of_type =
+    elem_data == NULL ? NULL : memchr (elem_data, '\0', elem_size);
+  if (end_of_type == NULL || !g_variant_type_string_is_valid (elem_data))
+    return NULL;
+
+  gsize type_length = end_of_type + 1 - elem_data;
+  gsize variant_size = elem_size - type_length;
+  g_autoptr(GBytes) variant_bytes =
+    g_bytes_new_from_bytes (elem, type_length, variant_size);
+  g_autoptr(GVariant) variant =
+    g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (elem_data),
+                                                  variant_bytes,
+                                                  FALSE /* trusted */));
+  if (!g_variant_is_normal_form (variant))
+    return NULL;
+
+  gsize header_size = emer_cache_record_header_size (elem_data);
+  guint8 *record = g_malloc (header_size + variant_size);
+  write_record_header (record, elem_data, header_size);
+  memcpy (record + header_size, end_of_type + 1, variant_size);
+
+  return g_bytes_new_take (record, header_size + variant_size);
+}
+
+/* Reads the header of the given block into the out parameters. Returns FALSE if
+ * the block is too short to have a header, or its payload is too small to hold
+ * as many records as the header says.
+ */
+static gboolean
+read_block_header (GBytes  *block,
+                   guint8  *encoding,
+                   guint32 *payload_size,
+                   guint32 *num_records)
+{
+  gsize block_size;
+  const guint8 *block_data = g_bytes_get_data (block, &block_size);
+  if (block_size < BLOCK_HEADER_SIZE)
+    return FALSE;
+
+  *encoding = block_data[0];
+  memcpy (payload_size, block_data + sizeof (guint8), sizeof (*payload_size));
+  memcpy (num_records, block_data + sizeof (guint8) + sizeof (*payload_size),
+          sizeof (*num_records));
+  *payload_size = GUINT32_FROM_LE (*payload_size);
+  *num_records = GUINT32_FROM_LE (*num_records);
+
+  return (guint64) *num_records * RECORD_LENGTH_SIZE <= *payload_size;
+}
+
+/* Returns the total cost, as defined by emer_persistent_cache_cost, of the
+ * variants in the given block, which is the size of its payload less the
+ * lengths preceding each record; or 0 if its header is malformed.
+ */
+static gsize
+get_block_cost (GBytes *block)
+{
+  guint8 encoding;
+  guint32 payload_size, num_records;
+  if (!read_block_header (block, &encoding, &payload_size, &num_records))
+    return 0;
+
+  return payload_size - num_records * RECORD_LENGTH_SIZE;
+}
+
+/* Decompresses the given block and adds each of the records in it to the given
+ * array. Returns FALSE with a warning, without adding any records, if the block
+ * is malformed.
+ */
+static gboolean
+get_block_records (GBytes    *block,
+                   GPtrArray *records)
+{
+  guint8 encoding;
+  guint32 payload_size, num_records;
+  if (!read_block_header (block, &encoding, &payload_size, &num_records))
+    {
+      g_warning ("A block in the persistent cache had a malformed header.");
+      return FALSE;
+    }
+
+  gsize block_size;
+  const guint8 *block_data = g_bytes_get_data (block, &block_size);
+  g_autoptr(GBytes) payload = NULL;
+  switch (encoding)
+    {
+    case BLOCK_ENCODING_STORED:
+      if (block_size - BLOCK_HEADER_SIZE != payload_size)
+        {
+          g_warning ("A block in the persistent cache was %" G_GSIZE_FORMAT
+                     " bytes long, but its header gave a payload of %u "
+                     "bytes.", block_size, payload_size);
+          return FALSE;
+        }
+
+      payload = g_bytes_new_from_bytes (block, BLOCK_HEADER_SIZE,
+                                        payload_size);
+      break;
+
+    case BLOCK_ENCODING_GZIP:
+      {
+        g_autoptr(GError) error = NULL;
+        gpointer payload_data =
+          emer_gzip_decompress (block_data + BLOCK_HEADER_SIZE,
+                                block_size - BLOCK_HEADER_SIZE,
+                                payload_size, &error);
+        if (payload_data == NULL)
+          {
+            g_warning ("A block in the persistent cache could not be "
+                       "decompressed: %s", error->message);
+            return FALSE;
+          }
+
+        payload = g_bytes_new_take (payload_data, payload_size);
+        break;
+      }
+
+    default:
+      g_warning ("A block in the persistent cache had unknown encoding %u.",
+                 encoding);
+      return FALSE;
+    }
+
+  const guint8 *payload_data = g_bytes_get_data (payload, NULL);
+  g_autoptr(GPtrArray) block_records =
+    g_ptr_array_new_full (num_records, (GDestroyNotify) g_bytes_unref);
+  gsize offset = 0;
+  for (guint32 i = 0; i < num_records; i++)
+    {
+      guint32 record_size;
+      if (payload_size - offset < RECORD_LENGTH_SIZE)
+        break;
+
+      memcpy (&record_size, payload_data + offset, sizeof (record_size));
+      record_size = GUINT32_FROM_LE (record_size);
+      offset += RECORD_LENGTH_SIZE;
+      if (payload_size - offset < record_size)
+        break;
+
+      g_ptr_array_add (block_records,
+                       g_bytes_new_from_bytes (payload, offset, record_size));
+      offset += record_size;
+    }
+
+  if (block_records->len != num_records || offset != payload_size)
+    {
+      g_warning ("A block in the persistent cache did not hold the %u records "
+                 "its header gave.", num_records);
+      return FALSE;
+    }
+
+  for (guint i = 0; i < block_records->len; i++)
+    g_ptr_array_add (records,
+                     g_bytes_ref (g_ptr_array_index (block_records, i)));
+
+  return TRUE;
+}
+
+/* Adds the records in the given elements of a data file to the given array,
+ * decompressing the elements of a block file. Malformed elements are skipped.
+ * Returns FALSE if any were.
+ */
+static gboolean
+get_records (GBytes    **elems,
+             gsize       num_elems,
+             gboolean    compressed,
+             GPtrArray  *records)
+{
+  gboolean all_valid = TRUE;
+  for (gsize i = 0; i < num_elems; i++)
+    {
+      if (compressed)
+        {
+          if (!get_block_records (elems[i], records))
+            all_valid = FALSE;
+        }
+      else
+        {
+          g_ptr_array_add (records, g_bytes_ref (elems[i]));
+        }
+    }
+
+  return all_valid;
+}
+
+static void
+free_elems (GBytes **elems,
+            gsize    num_elems)
+{
+  for (gsize i = 0; i < num_elems; i++)
+    g_bytes_unref (elems[i]);
+  g_free (elems);
+}
+
+static gboolean
+is_current_layout (EmerPersistentCache *self,
+                   const StorageLayout *layout)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  return layout->compressed == priv->compressed &&
+    layout->segmented == priv->segmented;
+}
+
+/* Returns the path of the data file, or directory, of the given layout. */
+static gchar *
+get_layout_path (EmerPersistentCache *self,
+                 const StorageLayout *layout)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  return g_build_filename (priv->cache_directory, layout->filename, NULL);
+}
+
+/* Deletes the circular file at the given path, along with its metadata and
+ * any unfinished copy of it.
+ */
+static void
+delete_circular_file (const gchar *path)
+{
+  g_autofree gchar *metadata_path = g_strconcat (path, METADATA_EXTENSION,
+                                                 NULL);
+  g_autofree gchar *temp_path = g_strconcat (path, TEMP_EXTENSION, NULL);
+
+  if (g_unlink (path) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", path, g_strerror (errno));
+  if (g_unlink (metadata_path) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", metadata_path, g_strerror (errno));
+  if (g_unlink (temp_path) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", temp_path, g_strerror (errno));
+}
+
+/* Opens the element store of the given layout, kept at the given path. */
+static EmerElementStore *
+open_element_store (const StorageLayout *layout,
+                    const gchar         *path,
+                    guint64              max_size,
+                    gboolean             reinitialize,
+                    GError             **error)
+{
+  if (layout->segmented)
+    return EMER_ELEMENT_STORE (emer_segmented_file_new (path, max_size,
+                                                        reinitialize, error));
+
+  return EMER_ELEMENT_STORE (emer_circular_file_new (path, max_size,
+                                                     reinitialize, error));
+}
+
+static void
+delete_element_store (const StorageLayout *layout,
+                      const gchar         *path)
+{
+  if (layout->segmented)
+    emer_segmented_file_delete (path);
+  else
+    delete_circular_file (path);
+}
+
+/* Reads elements from the front of the given element store totalling at most
+ * MIGRATION_CHUNK_SIZE bytes, or just the first if it is larger than that.
+ * Reads no elements only if there are none left. Returns TRUE on success and
+ * FALSE on error.
+ */
+static gboolean
+read_chunk (EmerElementStore *file,
+            GBytes         ***elems,
+            gsize            *num_elems,
+            guint64          *token,
+            GError          **error)
+{
+  for (gsize chunk_size = MIGRATION_CHUNK_SIZE; ; chunk_size *= 2)
+    {
+      gboolean has_invalid;
+      if (!emer_element_store_read (file, elems, chunk_size, num_elems, token,
+                                    &has_invalid, error))
+        return FALSE;
+
+      if (*num_elems > 0 || !emer_element_store_has_more (file, *token))
+        return TRUE;
+
+      free_elems (*elems, *num_elems);
+    }
+}
+
+/* Returns TRUE if the given element of a variant file is a valid record in
+ * the current format. Version 5 elements begin with a type string, whose first
+ * character is never a valid record kind. Version 5 caches may have been kept
+ * in the legacy circular file format, which has no checksums, so an element
+ * which only looks like a record, but doesn't hold a variant in normal form,
+ * is taken to be a damaged version 5 element.
+ */
+static gboolean
+is_current_record (GBytes *elem)
+{
+  gsize elem_size;
+  const guint8 *elem_data = g_bytes_get_data (elem, &elem_size);
+  if (elem_size == 0 || elem_data[0] >= EMER_CACHE_RECORD_N_KINDS)
+    return FALSE;
+
+  g_autoptr(GVariant) variant = parse_record (elem, FALSE, NULL);
+  return variant != NULL;
+}
+
+/* A step which rewrites the elements of a variant file from the format of one
+ * cache version to that of the next.
+ */
+typedef struct
+{
+  gint from_version;
+
+  /* Returns a new element in the format of the next version holding the same
+   * variant as the given one, or NULL if the given one is malformed. The new
+   * element must not refer to the memory of the given one.
+   */
+  GBytes *(*migrate_elem) (GBytes *elem);
+
+  /* Returns TRUE if the given element is already in the format of the next
+   * version.
+   */
+  gboolean (*elem_is_migrated) (GBytes *elem);
+} CacheMigration;
+
+static const CacheMigration cache_migrations[] = {
+  { 5, record_from_version_5, is_current_record },
+};
+
+static const CacheMigration *
+find_migration (gint from_version)
+{
+  for (gsize i = 0; i < G_N_ELEMENTS (cache_migrations); i++)
+    {
+      if (cache_migrations[i].from_version == from_version)
+        return &cache_migrations[i];
+    }
+
+  return NULL;
+}
+
+/* Returns TRUE if the cache can be brought from the given version to the
+ * current one by a series of migrations.
+ */
+static gboolean
+can_migrate_from (gint version)
+{
+  if (version > CURRENT_CACHE_VERSION)
+    return FALSE;
+
+  for (; version < CURRENT_CACHE_VERSION; version++)
+    {
+      if (find_migration (version) == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Applies the given migration to every element of the given variant file, a
+ * chunk at a time: each chunk is removed from the front of the file and its
+ * migrated elements are appended to the back, so only one chunk is held in
+ * memory however large the file is. The migration is finished once the element
+ * at the front has already been migrated. Hence if the daemon stops part way
+ * through, the migration carries on where it left off on the next start,
+ * having lost at most the chunk it was working on. Malformed elements, and any
+ * which no longer fit once migrated, are dropped with a warning. Returns TRUE
+ * on success and FALSE on error.
+ */
+static gboolean
+migrate_elems (EmerElementStore     *variant_file,
+               const CacheMigration *migration,
+               GError              **error)
+{
+  gsize num_migrated = 0, num_dropped = 0;
+  while (TRUE)
+    {
+      GBytes **elems;
+      gsize num_elems;
+      guint64 token;
+      if (!read_chunk (variant_file, &elems, &num_elems, &token, error))
+        return FALSE;
+
+      gsize num_unmigrated = 0, unmigrated_size = 0;
+      while (num_unmigrated < num_elems &&
+             !migration->elem_is_migrated (elems[num_unmigrated]))
+        unmigrated_size += g_bytes_get_size (elems[num_unmigrated++]);
+
+      if (num_unmigrated == 0)
+        {
+          free_elems (elems, num_elems);
+          break;
+        }
+
+      /* Leave the elements which have already been migrated where they are,
+       * so that they stay behind those which haven't.
+       */
+      if (num_unmigrated < num_elems)
+        {
+          gboolean has_invalid;
+          free_elems (elems, num_elems);
+          if (!emer_element_store_read (variant_file, &elems, unmigrated_size,
+                                        &num_elems, &token, &has_invalid,
+                                        error))
+            return FALSE;
+        }
+
+      g_autoptr(GPtrArray) migrated =
+        g_ptr_array_new_full (num_elems, (GDestroyNotify) g_bytes_unref);
+      for (gsize i = 0; i < num_elems; i++)
+        {
+          GBytes *elem = migration->elem_is_migrated (elems[i]) ?
+            g_bytes_new (g_bytes_get_data (elems[i], NULL),
+                         g_bytes_get_size (elems[i])) :
+            migration->migrate_elem (elems[i]);
+          if (elem == NULL)
+            num_dropped++;
+          else
+            g_ptr_array_add (migrated, elem);
+        }
+
+      free_elems (elems, num_elems);
+
+      if (!emer_element_store_remove (variant_file, token, error))
+        return FALSE;
+
+      for (guint i = 0; i < migrated->len; i++)
+        {
+          GBytes *elem = g_ptr_array_index (migrated, i);
+          gsize elem_size;
+          gconstpointer elem_data = g_bytes_get_data (elem, &elem_size);
+          if (emer_element_store_append (variant_file, elem_data, elem_size))
+            num_migrated++;
+          else
+            num_dropped++;
+        }
+
+      if (!emer_element_store_save (variant_file, error))
+        return FALSE;
+    }
+
+  if (num_dropped > 0)
+    g_warning ("Dropped %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " variants "
+               "while migrating the persistent cache from version %d.",
+               num_dropped, num_migrated + num_dropped,
+               migration->from_version);
+
+  return TRUE;
+}
+
+/* Migrates the variant file from the given version to the current one, one
+ * version at a time, recording each version reached as it goes. Caches which
+ * need migrating predate compressed and segmented modes, so in either mode
+ * their variants are in VARIANT_FILENAME, from which they are imported
+ * afterwards. A variant file which can't be opened is deleted with a warning.
+ * Returns TRUE on success and FALSE on error.
+ */
+static gboolean
+migrate_variant_file (EmerPersistentCache *self,
+                      gint                 version,
+                      GError             **error)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  if (version == CURRENT_CACHE_VERSION)
+    return TRUE;
+
+  EmerElementStore *variant_file = priv->variant_file;
+  g_autoptr(EmerCircularFile) other_file = NULL;
+  if (priv->compressed || priv->segmented)
+    {
+      g_autofree gchar *variant_path =
+        g_build_filename (priv->cache_directory, VARIANT_FILENAME, NULL);
+      if (g_file_test (variant_path, G_FILE_TEST_EXISTS))
+        {
+          g_autoptr(GError) local_error = NULL;
+          other_file = emer_circular_file_new (variant_path, priv->cache_size,
+                                               FALSE, &local_error);
+          if (other_file == NULL)
+            {
+              g_warning ("Discarding persistent cache data in %s, which "
+                         "could not be read: %s", variant_path,
+                         local_error->message);
+              delete_circular_file (variant_path);
+            }
+        }
+
+      variant_file = EMER_ELEMENT_STORE (other_file);
+    }
+
+  for (; version < CURRENT_CACHE_VERSION; version++)
+    {
+      if (variant_file != NULL &&
+          !migrate_elems (variant_file, find_migration (version), error))
+        return FALSE;
+
+      if (!emer_cache_version_provider_set_version (priv->cache_version_provider,
+                                                    version + 1, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* If a data file was left behind in the given storage layout, for instance
+ * because compression has just been turned on, moves the variants in it to the
+ * current data file a chunk at a time, and deletes it. An unreadable data file
+ * is deleted with a warning. Returns FALSE only if the current data file could
+ * not be saved.
+ */
+static gboolean
+import_other_mode_file (EmerPersistentCache *self,
+                        const StorageLayout *layout,
+                        GError             **error)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  g_autofree gchar *other_path = get_layout_path (self, layout);
+  if (!g_file_test (other_path, G_FILE_TEST_EXISTS))
+    return TRUE;
+
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(EmerElementStore) other_file =
+    open_element_store (layout, other_path, priv->cache_size, FALSE,
+                        &local_error);
+  gsize num_records = 0, num_imported = 0;
+  while (other_file != NULL)
+    {
+      GBytes **elems;
+      gsize num_elems;
+      guint64 token;
+      if (!read_chunk (other_file, &elems, &num_elems, &token, &local_error))
+        break;
+
+      if (num_elems == 0)
+        {
+          free_elems (elems, num_elems);
+          break;
+        }
+
+      g_autoptr(GPtrArray) records =
+        g_ptr_array_new_full (num_elems, (GDestroyNotify) g_bytes_unref);
+      get_records (elems, num_elems, layout->compressed, records);
+      free_elems (elems, num_elems);
+
+      num_records += records->len;
+      num_imported +=
+        append_records (self, (GBytes **) records->pdata, records->len);
+
+      /* If the daemon stops before the chunk is removed from the other file,
+       * its variants will be moved again on the next start; a few duplicates
+       * are better than losing them.
+       */
+      if (!emer_element_store_save (priv->variant_file, error))
+        return FALSE;
+
+      if (!emer_element_store_remove (other_file, token, &local_error))
+        break;
+    }
+
+  if (local_error != NULL)
+    g_warning ("Discarding persistent cache data in %s, which could not be "
+               "read: %s", other_path, local_error->message);
+  if (num_imported < num_records)
+    g_warning ("Dropped %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " variants "
+               "while moving them from %s.", num_records - num_imported,
+               num_records, other_path);
+
+  g_clear_object (&other_file);
+  delete_element_store (layout, other_path);
+  return TRUE;
+}
+
+/* Imports the variants left behind in each storage layout other than the
+ * current one. Returns FALSE only if the current data file could not be saved.
+ */
+static gboolean
+import_other_mode_files (EmerPersistentCache *self,
+                         GError             **error)
+{
+  for (gsize i = 0; i < G_N_ELEMENTS (storage_layouts); i++)
+    {
+      const StorageLayout *layout = &storage_layouts[i];
+      if (!is_current_layout (self, layout) &&
+          !import_other_mode_file (self, layout, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 /*
- * Attempts to wipe the persistent cache if the cache version file is out of
- * date or not found. Updates the cache version file as specified by the cache
- * provider if successful. Returns %TRUE on success and %FALSE on failure.
+ * Attempts to migrate the persistent cache to the current format if there is a
+ * series of migrations from the version in the cache version file, or to wipe
+ * it if there isn't or the version file is not found. Variants left in the data
+ * files of the other storage layouts are moved to the current one. Updates the
+ * cache version file as specified by the cache provider if successful. Returns
+ * %TRUE on success and %FALSE on failure.
  */
 static gboolean
 apply_cache_versioning (EmerPersistentCache *self,
@@ -598,26 +1535,45 @@ apply_cache_versioning (EmerPersistentCache *self,
     emer_cache_version_provider_get_version (priv->cache_version_provider,
                                              &old_version);
 
-  if (!read_succeeded || CURRENT_CACHE_VERSION != old_version)
+  if (read_succeeded && can_migrate_from (old_version))
     {
-      if (!emer_circular_file_purge (priv->variant_file, error))
+      if (!migrate_variant_file (self, old_version, error))
         {
-          g_prefix_error (error, "Will not update version number. ");
+          g_prefix_error (error, "Failed to migrate cache from version %d. ",
+                          old_version);
           return FALSE;
         }
 
-      gboolean set_succeeded =
-        emer_cache_version_provider_set_version (priv->cache_version_provider,
-                                                 CURRENT_CACHE_VERSION, error);
-      if (!set_succeeded)
+      return import_other_mode_files (self, error);
+    }
+
+  if (!emer_element_store_purge (priv->variant_file, error))
+    {
+      g_prefix_error (error, "Will not update version number. ");
+      return FALSE;
+    }
+
+  for (gsize i = 0; i < G_N_ELEMENTS (storage_layouts); i++)
+    {
+      const StorageLayout *layout = &storage_layouts[i];
+      if (!is_current_layout (self, layout))
         {
-          g_prefix_error (error,
-                          "Failed to update cache version number to %d. ",
-                          CURRENT_CACHE_VERSION);
-          return FALSE;
+          g_autofree gchar *other_path = get_layout_path (self, layout);
+          delete_element_store (layout, other_path);
         }
     }
 
+  gboolean set_succeeded =
+    emer_cache_version_provider_set_version (priv->cache_version_provider,
+                                             CURRENT_CACHE_VERSION, error);
+  if (!set_succeeded)
+    {
+      g_prefix_error (error,
+                      "Failed to update cache version number to %d. ",
+                      CURRENT_CACHE_VERSION);
+      return FALSE;
+    }
+
   return TRUE;
 }
 
@@ -721,6 +1677,14 @@ emer_persistent_cache_set_property (GObject      *object,
       set_cache_size (self, g_value_get_uint64 (value));
       break;
 
+    case PROP_COMPRESSED:
+      priv->compressed = g_value_get_boolean (value);
+      break;
+
+    case PROP_SEGMENTED:
+      priv->segmented = g_value_get_boolean (value);
+      break;
+
     case PROP_BOOT_ID_PROVIDER:
       set_boot_id_provider (self, g_value_get_object (value));
       break;
@@ -797,6 +1761,23 @@ emer_persistent_cache_class_init (EmerPersistentCacheClass *klass)
                          0, G_MAXUINT64, 0,
                          G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
+  /* Blurb string is good enough default documentation for this. */
+  emer_persistent_cache_props[PROP_COMPRESSED] =
+    g_param_spec_boolean ("compressed", "Compressed",
+                          "Whether to store variants in compressed blocks.",
+                          FALSE,
+                          G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+
+  /* Blurb string is good enough default documentation for this. */
+  emer_persistent_cache_props[PROP_SEGMENTED] =
+    g_param_spec_boolean ("segmented", "Segmented",
+                          "Whether to store data in a series of segment files "
+                          "rather than in a single circular file.",
+                          FALSE,
+                          G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY |
+                          G_PARAM_STATIC_STRINGS);
+
   /* Blurb string is good enough default documentation for this. */
   emer_persistent_cache_props[PROP_BOOT_ID_PROVIDER] =
     g_param_spec_object ("boot-id-provider", "Boot id provider",
@@ -826,9 +1807,9 @@ emer_persistent_cache_class_init (EmerPersistentCacheClass *klass)
   /* Blurb string is good enough default documentation for this. */
   emer_persistent_cache_props[PROP_REINITIALIZE_CACHE] =
     g_param_spec_boolean ("reinitialize-cache", "Reinitialize cache",
-                          "Reinitialize the underlying EmerCircularFile. See "
-                          "EmerCircularFile:reinitialize for why this might "
-                          "be necessary.",
+                          "Reinitialize the underlying EmerCircularFile or "
+                          "EmerSegmentedFile. See EmerCircularFile:reinitialize "
+                          "for why this might be necessary.",
                           FALSE,
                           G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY |
                           G_PARAM_STATIC_STRINGS);
@@ -866,11 +1847,15 @@ emer_persistent_cache_initable_init (GInitable    *initable,
       return FALSE;
     }
 
-  g_autofree gchar *variant_file_path =
-    g_build_filename (priv->cache_directory, VARIANT_FILENAME, NULL);
+  const StorageLayout *layout = NULL;
+  for (gsize i = 0; layout == NULL; i++)
+    if (is_current_layout (self, &storage_layouts[i]))
+      layout = &storage_layouts[i];
+
+  g_autofree gchar *variant_file_path = get_layout_path (self, layout);
   priv->variant_file =
-      emer_circular_file_new (variant_file_path, priv->cache_size,
-                              priv->reinitialize_cache, error);
+      open_element_store (layout, variant_file_path, priv->cache_size,
+                          priv->reinitialize_cache, error);
   if (priv->variant_file == NULL)
     return FALSE;
 
@@ -893,17 +1878,22 @@ emer_persistent_cache_initable_iface_init (GInitableIface *iface)
 /* Returns a new persistent cache with the default configuration.
  */
 EmerPersistentCache *
-emer_persistent_cache_new (const gchar *directory,
-                           guint64      cache_size,
-                           gboolean     reinitialize_cache,
-                           GError     **error)
+emer_persistent_cache_new (const gchar              *directory,
+                           guint64                   cache_size,
+                           EmerPersistentCacheFlags  flags,
+                           GError                  **error)
 {
   return g_initable_new (EMER_TYPE_PERSISTENT_CACHE,
                          NULL /* GCancellable */,
                          error,
                          "cache-directory", directory,
                          "cache-size", cache_size,
-                         "reinitialize-cache", reinitialize_cache,
+                         "compressed",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_COMPRESSED) != 0,
+                         "segmented",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_SEGMENTED) != 0,
+                         "reinitialize-cache",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE) != 0,
                          NULL);
 }
 
@@ -913,10 +1903,10 @@ emer_persistent_cache_new (const gchar *directory,
 EmerPersistentCache *
 emer_persistent_cache_new_full (const gchar              *directory,
                                 guint64                   cache_size,
+                                EmerPersistentCacheFlags  flags,
                                 EmerBootIdProvider       *boot_id_provider,
                                 EmerCacheVersionProvider *cache_version_provider,
                                 guint                     boot_offset_update_interval,
-                                gboolean                  reinitialize_cache,
                                 GError                  **error)
 {
   return g_initable_new (EMER_TYPE_PERSISTENT_CACHE,
@@ -924,25 +1914,28 @@ emer_persistent_cache_new_full (const gchar              *directory,
                          error,
                          "cache-directory", directory,
                          "cache-size", cache_size,
+                         "compressed",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_COMPRESSED) != 0,
+                         "segmented",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_SEGMENTED) != 0,
                          "boot-id-provider", boot_id_provider,
                          "cache-version-provider", cache_version_provider,
                          "boot-offset-update-interval", boot_offset_update_interval,
-                         "reinitialize-cache", reinitialize_cache,
+                         "reinitialize-cache",
+                         (flags & EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE) != 0,
                          NULL);
 }
 
-/* Returns the cost of the given variant, which is the size of its serialized
- * representation in the persistent cache. See emer_persistent_cache_read for
- * more details.
+/* Returns the cost of the given variant, which is the size of its record in
+ * the persistent cache: the record header followed by the serialized variant.
+ * See emer_persistent_cache_read for more details.
  */
 gsize
 emer_persistent_cache_cost (GVariant *variant)
 {
-  const GVariantType *variant_type = g_variant_get_type (variant);
-  gsize type_string_length =
-    g_variant_type_get_string_length (variant_type) + 1;
+  const gchar *type_string = g_variant_get_type_string (variant);
   gsize variant_size = g_variant_get_size (variant);
-  return type_string_length + variant_size;
+  return emer_cache_record_header_size (type_string) + variant_size;
 }
 
 /* Gets the boot time offset and stores it in the out parameter offset. Pass
@@ -970,6 +1963,71 @@ emer_persistent_cache_get_boot_time_offset (EmerPersistentCache *self,
   return TRUE;
 }
 
+/* Appends the given variant to the variant file as a record, serializing it
+ * straight into the file's write buffer. Only a variant which
+ * is not already little-endian and in normal form needs a copy made first.
+ * Returns FALSE if the variant does not fit.
+ */
+static gboolean
+append_variant (EmerElementStore *variant_file,
+                GVariant         *variant)
+{
+  g_autoptr(GVariant) regularized_variant = NULL;
+  if (G_BYTE_ORDER != G_LITTLE_ENDIAN || !g_variant_is_normal_form (variant))
+    variant = regularized_variant = regularize_pre_storage (variant);
+
+  const gchar *type_string = g_variant_get_type_string (variant);
+  gsize variant_size = g_variant_get_size (variant);
+
+  guint8 *variant_data =
+    reserve_record (variant_file, type_string, variant_size);
+  if (variant_data == NULL)
+    return FALSE;
+
+  g_variant_store (variant, variant_data);
+  emer_element_store_commit (variant_file);
+
+  return TRUE;
+}
+
+/* Appends the given variants to the block file, grouped into blocks. Like
+ * append_variant, serializes each variant straight into the payload of the
+ * block being built. Returns the number of variants stored, which only counts
+ * those in blocks that fit.
+ */
+static gsize
+append_variant_blocks (EmerElementStore *block_file,
+                       GVariant        **variants,
+                       gsize             num_variants)
+{
+  g_autoptr(GByteArray) payload = g_byte_array_sized_new (BLOCK_TARGET_SIZE);
+  guint32 num_pending = 0;
+  gsize num_stored = 0;
+  for (gsize i = 0; i < num_variants; i++)
+    {
+      GVariant *variant = variants[i];
+      g_autoptr(GVariant) regularized_variant = NULL;
+      if (G_BYTE_ORDER != G_LITTLE_ENDIAN || !g_variant_is_normal_form (variant))
+        variant = regularized_variant = regularize_pre_storage (variant);
+
+      const gchar *type_string = g_variant_get_type_string (variant);
+      gsize header_size = emer_cache_record_header_size (type_string);
+      gsize record_size = header_size + g_variant_get_size (variant);
+
+      if (block_is_full (payload, num_pending, record_size) &&
+          !flush_block (block_file, payload, &num_pending, &num_stored))
+        return num_stored;
+
+      guint8 *record = add_block_record (payload, record_size);
+      write_record_header (record, type_string, header_size);
+      g_variant_store (variant, record + header_size);
+      num_pending++;
+    }
+
+  flush_block (block_file, payload, &num_pending, &num_stored);
+  return num_stored;
+}
+
 /* Persistently stores the given variants. Sets num_variants_stored to the
  * number of variants that were actually stored. Returns TRUE on success even
  * if all of the given variants don't fit in the space allocated to the
@@ -986,26 +2044,22 @@ emer_persistent_cache_store (EmerPersistentCache *self,
     emer_persistent_cache_get_instance_private (self);
 
   gsize curr_variants_stored = 0;
-  for (; curr_variants_stored < num_variants; curr_variants_stored++)
+  if (priv->compressed)
     {
-      GVariant *curr_variant = variants[curr_variants_stored];
-      GVariant *regularized_variant = regularize_pre_storage (curr_variant);
-
-      const gchar *type_string = g_variant_get_type_string (regularized_variant);
-      gsize type_length = strlen (type_string) + 1;
-      gconstpointer variant_data = g_variant_get_data (regularized_variant);
-      gsize variant_size = g_variant_get_size (regularized_variant);
-
-      gsize elem_size = type_length + variant_size;
-      guint8 elem[elem_size];
-      memcpy (elem, type_string, type_length);
-      memcpy (elem + type_length, variant_data, variant_size);
-      g_variant_unref (regularized_variant);
-      if (!emer_circular_file_append (priv->variant_file, elem, elem_size))
-        break;
+      curr_variants_stored =
+        append_variant_blocks (priv->variant_file, variants, num_variants);
+    }
+  else
+    {
+      for (; curr_variants_stored < num_variants; curr_variants_stored++)
+        {
+          GVariant *curr_variant = variants[curr_variants_stored];
+          if (!append_variant (priv->variant_file, curr_variant))
+            break;
+        }
     }
 
-  if (!emer_circular_file_save (priv->variant_file, error))
+  if (!emer_element_store_save (priv->variant_file, error))
     return FALSE;
 
   for (gsize i = 0; i < curr_variants_stored; i++)
@@ -1018,6 +2072,82 @@ emer_persistent_cache_store (EmerPersistentCache *self,
   return TRUE;
 }
 
+/* Returns a new floating variant holding the serialized variant in the given
+ * record, or NULL with a warning if the record is malformed. The element store
+ * checks each record against a checksum computed when it was appended, and
+ * every record is in normal form when it is appended: append_variant() and
+ * the migrations from older cache versions check, and the migration from
+ * version 5 also checks any record which only looks migrated, such as an
+ * element converted from the legacy circular file format. So the variant is
+ * marked trusted, which spares GVariant from validating it again.
+ *
+ * Records are not padded, so the serialized variant generally doesn't start
+ * at the alignment its type needs, and GVariant then copies it out of the
+ * record. Only a variant whose type needs no alignment, or which happens to
+ * be aligned, shares memory with the record.
+ */
+static GVariant *
+read_record (GBytes *record)
+{
+  g_autofree gchar *problem = NULL;
+  GVariant *variant = parse_record (record, TRUE, &problem);
+  if (variant == NULL)
+    g_warning ("%s", problem);
+
+  return variant;
+}
+
+/* Reads as many whole blocks from the block file as hold variants costing no
+ * more than the given amount in total. The element store can only limit how
+ * many bytes of blocks it reads, which bears no fixed relation to the cost of
+ * the variants in them, so blocks are read with a growing limit until one is
+ * found that doesn't fit or there are none left, and then read once more with
+ * a limit of exactly the blocks that fit, to get a token for just those.
+ * Returns FALSE on error.
+ */
+static gboolean
+read_blocks (EmerElementStore *block_file,
+             gsize             cost,
+             GBytes         ***blocks,
+             gsize            *num_blocks,
+             guint64          *token,
+             gboolean         *has_invalid,
+             GError          **error)
+{
+  gsize max_bytes = cost;
+  while (TRUE)
+    {
+      if (!emer_element_store_read (block_file, blocks, max_bytes, num_blocks,
+                                    token, has_invalid, error))
+        return FALSE;
+
+      gsize num_fit = 0, fit_cost = 0, fit_bytes = 0;
+      for (; num_fit < *num_blocks; num_fit++)
+        {
+          gsize block_cost = get_block_cost ((*blocks)[num_fit]);
+          if (block_cost > cost - fit_cost)
+            break;
+
+          fit_cost += block_cost;
+          fit_bytes += g_bytes_get_size ((*blocks)[num_fit]);
+        }
+
+      gboolean all_fit = num_fit == *num_blocks;
+      if (all_fit && (!emer_element_store_has_more (block_file, *token) ||
+                      max_bytes == G_MAXSIZE))
+        return TRUE;
+
+      free_elems (*blocks, *num_blocks);
+
+      if (!all_fit)
+        return emer_element_store_read (block_file, blocks, fit_bytes,
+                                        num_blocks, token, has_invalid, error);
+
+      max_bytes = max_bytes >= G_MAXSIZE / 2 ? G_MAXSIZE :
+        MAX (2 * max_bytes, BLOCK_TARGET_SIZE);
+    }
+}
+
 /* Populates variants with a C array of variants that cost no more than the
  * given amount in total (as defined by emer_persistent_cache_cost). Variants
  * are read in the same order in which they were stored; in other words, the
@@ -1026,7 +2156,15 @@ emer_persistent_cache_store (EmerPersistentCache *self,
  * particular call to emer_persistent_cache_read. Tokens may not be reused, and
  * any successful call to emer_persistent_cache_remove invalidates any
  * outstanding tokens. If no variants were read but the read succeeded, then
- * variants is set to NULL. Returns TRUE on success and FALSE on error.
+ * variants is set to NULL. Returns TRUE on success and FALSE on error. Records
+ * which are damaged or malformed are skipped and set has_invalid, but are
+ * still removed along with the variants around them. In compressed mode,
+ * variants are read and removed a block at a time, so fewer may be read than
+ * would fit in the given cost, and none at all if it is smaller than the first
+ * block. Reading the records doesn't copy them, but most variants are copied
+ * out of them, as read_record explains. Some may still share memory with the
+ * cache's data file, so like the elements returned by emer_element_store_read,
+ * the variants must not be used after they have been removed.
  */
 gboolean
 emer_persistent_cache_read (EmerPersistentCache *self,
@@ -1043,76 +2181,43 @@ emer_persistent_cache_read (EmerPersistentCache *self,
   GBytes **elems;
   gsize num_elems;
   guint64 local_token;
-  gsize i;
 
-  gboolean read_succeeded =
-    emer_circular_file_read (priv->variant_file, &elems, cost, &num_elems,
+  gboolean read_succeeded = priv->compressed ?
+    read_blocks (priv->variant_file, cost, &elems, &num_elems, &local_token,
+                 has_invalid, error) :
+    emer_element_store_read (priv->variant_file, &elems, cost, &num_elems,
                              &local_token, has_invalid, error);
   if (!read_succeeded)
     return FALSE;
 
-  gboolean corrupt_data = FALSE;
-  GVariant **local_variants = g_new (GVariant *, num_elems);
-  for (i = 0; i < num_elems; i++)
-    {
-      gsize elem_size;
-      const gchar *elem_data = g_bytes_get_data (elems[i], &elem_size);
-      if (elem_data == NULL)
-        {
-          g_critical ("An element had size 0.");
-          corrupt_data = TRUE;
-          break;
-        }
-
-      const gchar *end_of_type = memchr (elem_data, '\0', elem_size);
-      if (end_of_type == NULL)
-        {
-          g_critical ("An element did not contain a null byte indicating the end of "
-                      "a variant type string.");
-          corrupt_data = TRUE;
-          break;
-        }
+  g_autoptr(GPtrArray) records =
+    g_ptr_array_new_full (num_elems, (GDestroyNotify) g_bytes_unref);
+  if (!get_records (elems, num_elems, priv->compressed, records))
+    *has_invalid = TRUE;
+  free_elems (elems, num_elems);
 
-      if (!g_variant_type_string_is_valid (elem_data))
+  gsize num_read = 0;
+  GVariant **local_variants = g_new (GVariant *, records->len);
+  for (guint i = 0; i < records->len; i++)
+    {
+      GVariant *curr_variant = read_record (g_ptr_array_index (records, i));
+      if (curr_variant == NULL)
         {
-          g_critical ("An element did not begin with a valid variant type string.");
-          corrupt_data = TRUE;
-          break;
+          /* The record passed the element store's checksum, so it was stored
+           * like this; skip it rather than giving up on the whole cache. Its
+           * bytes are still covered by the token. */
+          *has_invalid = TRUE;
+          continue;
         }
 
-      const GVariantType *variant_type = G_VARIANT_TYPE (elem_data);
-      const gchar *start_of_variant = end_of_type + 1;
-      gsize variant_size = (elem_data + elem_size) - start_of_variant;
-      gpointer variant_data = g_memdup2 (start_of_variant, variant_size);
-      GVariant *curr_variant =
-        g_variant_new_from_data (variant_type, variant_data, variant_size,
-                                 FALSE /* trusted */, g_free, variant_data);
-      g_bytes_unref (elems[i]);
-      local_variants[i] = regularize_post_storage (curr_variant);
+      local_variants[num_read++] = regularize_post_storage (curr_variant);
     }
 
-  if (corrupt_data)
-    {
-      /* Somehow the circular file contains corrupt data, meaning that we
-       * can't trust its contents at all, so we clean up and return an error. */
-      gsize j = i;
-
-      while (j < num_elems)
-        g_bytes_unref (elems[j++]);
-      g_free (elems);
+  if (num_read == 0)
+    g_clear_pointer (&local_variants, g_free);
 
-      j = 0;
-      while (j < i)
-        g_variant_unref (local_variants[j++]);
-
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
-                   "Corrupt data found in the persistent cache.");
-      return FALSE;
-    }
-
-  g_free (elems);
   *variants = local_variants;
-  *num_variants = num_elems;
+  *num_variants = num_read;
   *token = local_token;
   return TRUE;
 }
@@ -1134,7 +2239,17 @@ emer_persistent_cache_has_more (EmerPersistentCache *self,
   EmerPersistentCachePrivate *priv =
     emer_persistent_cache_get_instance_private (self);
 
-  return emer_circular_file_has_more (priv->variant_file, token);
+  return emer_element_store_has_more (priv->variant_file, token);
+}
+
+/* Returns the fraction of the persistent cache's capacity that is in use. */
+gdouble
+emer_persistent_cache_get_fill_ratio (EmerPersistentCache *self)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  return emer_element_store_get_fill_ratio (priv->variant_file);
 }
 
 /* Removes the variants that were read in the call to emer_persistent_cache_read
@@ -1151,11 +2266,11 @@ emer_persistent_cache_remove (EmerPersistentCache *self,
   EmerPersistentCachePrivate *priv =
     emer_persistent_cache_get_instance_private (self);
 
-  return emer_circular_file_remove (priv->variant_file, token, error);
+  return emer_element_store_remove (priv->variant_file, token, error);
 }
 
-/* Removes all the data stored by marking it all invalid in the circular file.
- * Returns TRUE on success and FALSE on error.
+/* Removes all the data stored by purging the element store. Returns TRUE on
+ * success and FALSE on error.
  */
 gboolean
 emer_persistent_cache_remove_all (EmerPersistentCache *self,
@@ -1164,5 +2279,5 @@ emer_persistent_cache_remove_all (EmerPersistentCache *self,
   EmerPersistentCachePrivate *priv =
     emer_persistent_cache_get_instance_private (self);
 
-  return emer_circular_file_purge (priv->variant_file, error);
+  return emer_element_store_purge (priv->variant_file, error);
 }
@@ -71,6 +71,23 @@ G_BEGIN_DECLS
 #define CACHE_BOOT_OFFSET_KEY     "boot_offset"
 #define CACHE_WAS_RESET_KEY       "was_reset"
 
+/*
+ * EmerPersistentCacheFlags:
+ * @EMER_PERSISTENT_CACHE_FLAG_DEFAULT: keep each variant in its own element
+ *   of a single circular file, and keep whatever the cache already holds
+ * @EMER_PERSISTENT_CACHE_FLAG_COMPRESSED: store variants in compressed blocks
+ * @EMER_PERSISTENT_CACHE_FLAG_SEGMENTED: keep the elements in a directory of
+ *   segment files rather than a single circular file
+ * @EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE: discard the contents of the cache
+ *   and start afresh
+ */
+typedef enum {
+  EMER_PERSISTENT_CACHE_FLAG_DEFAULT = 0,
+  EMER_PERSISTENT_CACHE_FLAG_COMPRESSED = 1 << 0,
+  EMER_PERSISTENT_CACHE_FLAG_SEGMENTED = 1 << 1,
+  EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE = 1 << 2,
+} EmerPersistentCacheFlags;
+
 typedef struct _EmerPersistentCache EmerPersistentCache;
 typedef struct _EmerPersistentCacheClass EmerPersistentCacheClass;
 
@@ -88,7 +105,7 @@ GType                emer_persistent_cache_get_type             (void) G_GNUC_CO
 
 EmerPersistentCache *emer_persistent_cache_new                  (const gchar              *directory,
                                                                  guint64                   cache_size,
-                                                                 gboolean                  reinitialize_cache,
+                                                                 EmerPersistentCacheFlags  flags,
                                                                  GError                  **error);
 
 gsize                emer_persistent_cache_cost                 (GVariant                 *self);
@@ -121,12 +138,14 @@ gboolean             emer_persistent_cache_remove               (EmerPersistentC
 gboolean             emer_persistent_cache_remove_all           (EmerPersistentCache      *self,
                                                                  GError                  **error);
 
+gdouble              emer_persistent_cache_get_fill_ratio       (EmerPersistentCache      *self);
+
 EmerPersistentCache *emer_persistent_cache_new_full             (const gchar              *directory,
                                                                  guint64                   cache_size,
+                                                                 EmerPersistentCacheFlags  flags,
                                                                  EmerBootIdProvider       *boot_id_provider,
                                                                  EmerCacheVersionProvider *version_provider,
                                                                  guint                     boot_offset_update_interval,
-                                                                 gboolean                  reinitialize_cache,
                                                                  GError                  **error);
 
 G_END_DECLS
@@ -0,0 +1,383 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-rate-limiter.h"
+
+/*
+ * EmerRateLimiter:
+ *
+ * Decides whether to accept events from each producer, so that one
+ * misbehaving client (say, a crash-looping app) can't crowd out everyone
+ * else's events by filling the buffer and persistent cache.
+ *
+ * Each D-Bus sender and each Unix user has two token buckets: one counting
+ * events, which allows short bursts above a steady rate, and one counting
+ * bytes, which refills with the hourly byte quota spread evenly over the
+ * hour. An event is accepted only if both buckets of both its sender and its
+ * user have room for it; dropped events don't consume any tokens.
+ *
+ * The limiter may be used from several threads at once.
+ */
+
+/* How often to forget producers whose buckets have refilled completely,
+ * in microseconds. Such producers are indistinguishable from new ones. */
+#define SWEEP_INTERVAL (60 * G_USEC_PER_SEC)
+
+#define SECONDS_PER_HOUR 3600
+
+typedef enum
+{
+  SCOPE_SENDER,
+  SCOPE_USER,
+  N_SCOPES,
+} Scope;
+
+typedef struct
+{
+  gdouble events;
+  gdouble bytes;
+  /* Monotonic time at which the buckets were last refilled */
+  gint64 updated;
+} Buckets;
+
+struct _EmerRateLimiter
+{
+  GMutex lock;
+
+  EmerRateLimit limits[N_SCOPES];
+
+  /* Owned sender name → Buckets */
+  GHashTable *senders;
+  /* User ID → Buckets */
+  GHashTable *users;
+
+  guint64 drop_counts[EMER_RATE_LIMIT_N_KINDS];
+  gboolean have_logged_drop[EMER_RATE_LIMIT_N_KINDS];
+
+  gint64 last_sweep;
+};
+
+static const gchar * const kind_names[] = {
+  [EMER_RATE_LIMIT_SENDER_EVENTS] = "sender-events",
+  [EMER_RATE_LIMIT_SENDER_BYTES] = "sender-bytes",
+  [EMER_RATE_LIMIT_USER_EVENTS] = "user-events",
+  [EMER_RATE_LIMIT_USER_BYTES] = "user-bytes",
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (kind_names) == EMER_RATE_LIMIT_N_KINDS);
+
+static gboolean
+limits_events (const EmerRateLimit *limit)
+{
+  return limit->events_per_second > 0;
+}
+
+static gboolean
+limits_bytes (const EmerRateLimit *limit)
+{
+  return limit->bytes_per_hour > 0;
+}
+
+static Buckets *
+buckets_new (const EmerRateLimit *limit,
+             gint64               now)
+{
+  Buckets *buckets = g_new (Buckets, 1);
+
+  buckets->events = limit->event_burst;
+  buckets->bytes = limit->bytes_per_hour;
+  buckets->updated = now;
+  return buckets;
+}
+
+static void
+buckets_refill (Buckets             *buckets,
+                const EmerRateLimit *limit,
+                gint64               now)
+{
+  gdouble elapsed_seconds;
+
+  if (now <= buckets->updated)
+    return;
+
+  elapsed_seconds = (gdouble) (now - buckets->updated) / G_USEC_PER_SEC;
+  buckets->events = MIN (limit->event_burst,
+                         buckets->events +
+                         elapsed_seconds * limit->events_per_second);
+  buckets->bytes = MIN (limit->bytes_per_hour,
+                        buckets->bytes +
+                        elapsed_seconds * limit->bytes_per_hour / SECONDS_PER_HOUR);
+  buckets->updated = now;
+}
+
+static gboolean
+buckets_are_full (Buckets             *buckets,
+                  const EmerRateLimit *limit,
+                  gint64               now)
+{
+  buckets_refill (buckets, limit, now);
+  return buckets->events >= limit->event_burst &&
+    buckets->bytes >= limit->bytes_per_hour;
+}
+
+/* Returns the kind of limit which the event would exceed, or
+ * EMER_RATE_LIMIT_N_KINDS if it is within both of them. */
+static EmerRateLimitKind
+buckets_check (Buckets             *buckets,
+               const EmerRateLimit *limit,
+               Scope                scope,
+               gsize                num_bytes)
+{
+  if (limits_events (limit) && buckets->events < 1)
+    return scope == SCOPE_SENDER ?
+      EMER_RATE_LIMIT_SENDER_EVENTS : EMER_RATE_LIMIT_USER_EVENTS;
+
+  if (limits_bytes (limit) && buckets->bytes < num_bytes)
+    return scope == SCOPE_SENDER ?
+      EMER_RATE_LIMIT_SENDER_BYTES : EMER_RATE_LIMIT_USER_BYTES;
+
+  return EMER_RATE_LIMIT_N_KINDS;
+}
+
+static void
+buckets_consume (Buckets             *buckets,
+                 const EmerRateLimit *limit,
+                 gsize                num_bytes)
+{
+  if (limits_events (limit))
+    buckets->events -= 1;
+
+  if (limits_bytes (limit))
+    buckets->bytes -= num_bytes;
+}
+
+static Buckets *
+lookup_buckets (EmerRateLimiter *self,
+                GHashTable      *table,
+                gconstpointer    key,
+                gpointer       (*copy_key) (gconstpointer),
+                Scope            scope,
+                gint64           now)
+{
+  Buckets *buckets = g_hash_table_lookup (table, key);
+
+  if (buckets == NULL)
+    {
+      buckets = buckets_new (&self->limits[scope], now);
+      g_hash_table_insert (table, copy_key (key), buckets);
+    }
+  else
+    {
+      buckets_refill (buckets, &self->limits[scope], now);
+    }
+
+  return buckets;
+}
+
+static gpointer
+copy_sender (gconstpointer sender)
+{
+  return g_strdup (sender);
+}
+
+static gpointer
+copy_user_id (gconstpointer user_id)
+{
+  return (gpointer) user_id;
+}
+
+typedef struct
+{
+  const EmerRateLimit *limit;
+  gint64 now;
+} SweepData;
+
+static gboolean
+remove_if_full (gpointer key,
+                gpointer value,
+                gpointer user_data)
+{
+  SweepData *data = user_data;
+
+  return buckets_are_full (value, data->limit, data->now);
+}
+
+static void
+sweep (EmerRateLimiter *self,
+       gint64           now)
+{
+  SweepData sender_data = { &self->limits[SCOPE_SENDER], now };
+  SweepData user_data = { &self->limits[SCOPE_USER], now };
+
+  g_hash_table_foreach_remove (self->senders, remove_if_full, &sender_data);
+  g_hash_table_foreach_remove (self->users, remove_if_full, &user_data);
+  self->last_sweep = now;
+}
+
+static void
+record_drop (EmerRateLimiter   *self,
+             EmerRateLimitKind  kind,
+             const gchar       *sender,
+             guint32            user_id)
+{
+  self->drop_counts[kind]++;
+
+  if (self->have_logged_drop[kind])
+    return;
+
+  g_message ("Dropping events from sender %s (user %" G_GUINT32_FORMAT ") "
+             "which exceeded the %s rate limit. Further drops for this limit "
+             "will not be logged.", sender, user_id, kind_names[kind]);
+  self->have_logged_drop[kind] = TRUE;
+}
+
+/*
+ * emer_rate_limiter_new:
+ * @sender_limit: the limit for each D-Bus sender
+ * @user_limit: the limit for each Unix user
+ *
+ * Returns: (transfer full): a new rate limiter
+ */
+EmerRateLimiter *
+emer_rate_limiter_new (const EmerRateLimit *sender_limit,
+                       const EmerRateLimit *user_limit)
+{
+  EmerRateLimiter *self = g_new0 (EmerRateLimiter, 1);
+
+  g_mutex_init (&self->lock);
+  self->limits[SCOPE_SENDER] = *sender_limit;
+  self->limits[SCOPE_USER] = *user_limit;
+
+  /* A bucket which can't hold a single event would drop everything. */
+  for (gsize i = 0; i < N_SCOPES; i++)
+    self->limits[i].event_burst = MAX (self->limits[i].event_burst, 1);
+  self->senders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         g_free);
+  self->users = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                       g_free);
+
+  return self;
+}
+
+/*
+ * emer_rate_limiter_admit:
+ * @self: the rate limiter
+ * @sender: the unique bus name of the client recording the event
+ * @user_id: the Unix user ID of the user the event was recorded for
+ * @num_bytes: the size of the event's data
+ * @now: the current monotonic time, in microseconds
+ *
+ * Decides whether to accept an event, and charges it to @sender and @user_id
+ * if so. If not, the drop is counted against the first limit the event
+ * exceeded.
+ *
+ * Returns: %TRUE if the event is within all limits and should be recorded
+ */
+gboolean
+emer_rate_limiter_admit (EmerRateLimiter *self,
+                         const gchar     *sender,
+                         guint32          user_id,
+                         gsize            num_bytes,
+                         gint64           now)
+{
+  Buckets *sender_buckets, *user_buckets;
+  EmerRateLimitKind exceeded;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (sender != NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  if (now - self->last_sweep >= SWEEP_INTERVAL)
+    sweep (self, now);
+
+  sender_buckets = lookup_buckets (self, self->senders, sender, copy_sender,
+                                   SCOPE_SENDER, now);
+  user_buckets = lookup_buckets (self, self->users, GUINT_TO_POINTER (user_id),
+                                 copy_user_id, SCOPE_USER, now);
+
+  exceeded = buckets_check (sender_buckets, &self->limits[SCOPE_SENDER],
+                            SCOPE_SENDER, num_bytes);
+  if (exceeded == EMER_RATE_LIMIT_N_KINDS)
+    exceeded = buckets_check (user_buckets, &self->limits[SCOPE_USER],
+                              SCOPE_USER, num_bytes);
+
+  if (exceeded != EMER_RATE_LIMIT_N_KINDS)
+    {
+      record_drop (self, exceeded, sender, user_id);
+      g_mutex_unlock (&self->lock);
+      return FALSE;
+    }
+
+  buckets_consume (sender_buckets, &self->limits[SCOPE_SENDER], num_bytes);
+  buckets_consume (user_buckets, &self->limits[SCOPE_USER], num_bytes);
+
+  g_mutex_unlock (&self->lock);
+  return TRUE;
+}
+
+/*
+ * emer_rate_limiter_get_drop_count:
+ * @self: the rate limiter
+ * @kind: a kind of limit
+ *
+ * Returns: the number of events dropped so far for exceeding @kind
+ */
+guint64
+emer_rate_limiter_get_drop_count (EmerRateLimiter   *self,
+                                  EmerRateLimitKind  kind)
+{
+  guint64 drop_count;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (kind < EMER_RATE_LIMIT_N_KINDS, 0);
+
+  g_mutex_lock (&self->lock);
+  drop_count = self->drop_counts[kind];
+  g_mutex_unlock (&self->lock);
+
+  return drop_count;
+}
+
+/*
+ * emer_rate_limit_kind_to_string:
+ * @kind: a kind of limit
+ *
+ * Returns: a short name for @kind, such as "sender-events"
+ */
+const gchar *
+emer_rate_limit_kind_to_string (EmerRateLimitKind kind)
+{
+  g_return_val_if_fail (kind < EMER_RATE_LIMIT_N_KINDS, NULL);
+
+  return kind_names[kind];
+}
+
+void
+emer_rate_limiter_free (EmerRateLimiter *self)
+{
+  g_hash_table_unref (self->senders);
+  g_hash_table_unref (self->users);
+  g_mutex_clear (&self->lock);
+  g_free (self);
+}
@@ -0,0 +1,76 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * EmerRateLimit:
+ * @events_per_second: the rate at which a producer may record events in the
+ *   long run, or 0 for no limit
+ * @event_burst: the number of events a producer may record in a burst above
+ *   @events_per_second
+ * @bytes_per_hour: the number of bytes of event data a producer may record per
+ *   hour, or 0 for no limit
+ *
+ * Limits applied to each producer of one kind, such as each D-Bus client.
+ */
+typedef struct
+{
+  gdouble events_per_second;
+  guint event_burst;
+  guint64 bytes_per_hour;
+} EmerRateLimit;
+
+typedef enum
+{
+  EMER_RATE_LIMIT_SENDER_EVENTS,
+  EMER_RATE_LIMIT_SENDER_BYTES,
+  EMER_RATE_LIMIT_USER_EVENTS,
+  EMER_RATE_LIMIT_USER_BYTES,
+  EMER_RATE_LIMIT_N_KINDS,
+} EmerRateLimitKind;
+
+typedef struct _EmerRateLimiter EmerRateLimiter;
+
+EmerRateLimiter *emer_rate_limiter_new            (const EmerRateLimit *sender_limit,
+                                                   const EmerRateLimit *user_limit);
+
+gboolean         emer_rate_limiter_admit          (EmerRateLimiter     *self,
+                                                   const gchar         *sender,
+                                                   guint32              user_id,
+                                                   gsize                num_bytes,
+                                                   gint64               now);
+
+guint64          emer_rate_limiter_get_drop_count (EmerRateLimiter     *self,
+                                                   EmerRateLimitKind    kind);
+
+const gchar     *emer_rate_limit_kind_to_string   (EmerRateLimitKind    kind);
+
+void             emer_rate_limiter_free           (EmerRateLimiter     *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerRateLimiter, emer_rate_limiter_free)
+
+G_END_DECLS
@@ -0,0 +1,1519 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-segmented-file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "emer-crc32c.h"
+
+/* SECTION:emer-segmented-file.c
+ * @title: Segmented File
+ * @short_description: A persistent FIFO of elements kept in a series of files
+ *
+ * An alternative to #EmerCircularFile with the same interface, which keeps its
+ * elements in a directory of append-only segment files rather than in a
+ * single file which wraps around. Elements are appended to the last segment
+ * until the next one would take it past the segment size, at which point a new
+ * segment is started; an element larger than the segment size gets a segment
+ * to itself. An element never spans two segments. Removing elements from the
+ * front deletes each segment they empty, and changing the maximum size only
+ * deletes segments, or truncates the last one kept, so neither copies any
+ * elements.
+ *
+ * Each element is preceded by the same header as in a circular file: its
+ * length and a CRC-32C checksum of the length and the element, each a
+ * little-endian guint32.
+ *
+ * Segments are numbered in order, and named after their number, as 20 decimal
+ * digits followed by SEGMENT_EXTENSION. The state of the segmented file is
+ * kept in SEGMENT_MANIFEST_FILENAME, which, like the header of a circular
+ * file, has two slots which are written in turn, each filling a disk sector. A
+ * slot holds a magic number and the format of the elements, each a
+ * little-endian guint32; a generation count, which increases with every write,
+ * followed by the numbers of the first and last segments, the offset of the
+ * head in the first segment and the length of the last segment, each a
+ * little-endian guint64; and a CRC-32C checksum of all of those, as a
+ * little-endian guint32. The intact slot with the highest generation holds the
+ * current state. Data beyond the end of the last segment, and segments outside
+ * the range recorded in the manifest, are left behind by operations which
+ * were interrupted, and are deleted when the segmented file is opened.
+ *
+ * The maximum size limits the total size of the elements, including their
+ * headers, as it does for a circular file. The disk space taken up by the
+ * segment files may exceed it by the space of elements which have been
+ * removed from the first segment, which is only freed along with that segment.
+ */
+
+#define CURRENT_FORMAT 1
+
+#define ELEM_HEADER_SIZE (2 * sizeof (guint32))
+
+#define MANIFEST_MAGIC 0x4c534d45 /* "EMSL" */
+#define MANIFEST_SLOT_SIZE 512
+#define MANIFEST_SIZE (2 * MANIFEST_SLOT_SIZE)
+#define MANIFEST_FIELDS_SIZE (2 * sizeof (guint32) + 5 * sizeof (guint64))
+#define MANIFEST_RECORD_SIZE (MANIFEST_FIELDS_SIZE + sizeof (guint32))
+
+#define SEGMENT_NUMBER_DIGITS 20
+
+/* Large enough that saving rarely has to start a new segment, and small
+ * enough that little disk space is held by removed elements.
+ */
+#define DEFAULT_SEGMENT_SIZE (1024 * 1024)
+
+typedef struct
+{
+  guint32 format;
+  guint64 generation;
+  guint64 first_segment;
+  guint64 head;
+  guint64 last_segment;
+  guint64 tail;
+} Manifest;
+
+typedef struct _EmerSegmentedFilePrivate
+{
+  gchar *path;
+  guint64 max_size;
+  guint64 segment_size;
+  gboolean reinitialize;
+
+  gint manifest_fd;
+  gint tail_fd; /* the last segment, to which elements are appended */
+
+  guint64 generation;
+  guint64 first_segment;
+  guint64 head; /* offset of the first element in the first segment */
+  GArray *segment_sizes; /* guint64 length of each segment, from the first */
+  guint64 size; /* total size of the elements from the head on */
+
+  GByteArray *write_buffer;
+  gboolean have_reservation; /* last element of write_buffer not committed */
+  guint reservation_offset; /* offset of its header in write_buffer */
+} EmerSegmentedFilePrivate;
+
+static void emer_segmented_file_initable_iface_init (GInitableIface *iface);
+static void emer_segmented_file_element_store_iface_init (EmerElementStoreInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmerSegmentedFile, emer_segmented_file, G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (EmerSegmentedFile)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, emer_segmented_file_initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (EMER_TYPE_ELEMENT_STORE, emer_segmented_file_element_store_iface_init))
+
+enum
+{
+  PROP_0,
+  PROP_PATH,
+  PROP_MAX_SIZE,
+  PROP_SEGMENT_SIZE,
+  PROP_REINITIALIZE,
+  NPROPS
+};
+
+static GParamSpec *emer_segmented_file_props[NPROPS] = { NULL, };
+
+static guint64
+get_segment_size (EmerSegmentedFile *self,
+                  guint              index)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  return g_array_index (priv->segment_sizes, guint64, index);
+}
+
+static guint64
+get_last_segment (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  return priv->first_segment + priv->segment_sizes->len - 1;
+}
+
+static gchar *
+get_segment_path (const gchar *path,
+                  guint64      segment)
+{
+  g_autofree gchar *filename =
+    g_strdup_printf ("%0*" G_GUINT64_FORMAT SEGMENT_EXTENSION,
+                     SEGMENT_NUMBER_DIGITS, segment);
+  return g_build_filename (path, filename, NULL);
+}
+
+/* Sets segment to the number of the segment with the given filename. Returns
+ * FALSE if it isn't the name of a segment.
+ */
+static gboolean
+parse_segment_filename (const gchar *filename,
+                        guint64     *segment)
+{
+  if (strlen (filename) != SEGMENT_NUMBER_DIGITS + strlen (SEGMENT_EXTENSION) ||
+      !g_str_has_suffix (filename, SEGMENT_EXTENSION))
+    return FALSE;
+
+  g_autofree gchar *digits = g_strndup (filename, SEGMENT_NUMBER_DIGITS);
+  return g_ascii_string_to_unsigned (digits, 10, 0, G_MAXUINT64, segment,
+                                     NULL);
+}
+
+static void
+delete_segment (const gchar *path,
+                guint64      segment)
+{
+  g_autofree gchar *segment_path = get_segment_path (path, segment);
+  if (g_unlink (segment_path) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", segment_path, g_strerror (errno));
+}
+
+/* Opens the given segment for reading and writing, creating it if it doesn't
+ * already exist, and passing flags to open() besides. Returns the file
+ * descriptor, or -1 on error.
+ */
+static gint
+open_segment (EmerSegmentedFile *self,
+              guint64            segment,
+              gint               flags,
+              GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_autofree gchar *segment_path = get_segment_path (priv->path, segment);
+  gint fd = g_open (segment_path, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0666);
+  if (fd < 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not open %s: %s", segment_path,
+                   g_strerror (saved_errno));
+    }
+
+  return fd;
+}
+
+/* Maps the given segment into memory, and sets contents to its first
+ * segment_size bytes.
+ */
+static gboolean
+map_segment (EmerSegmentedFile *self,
+             guint64            segment,
+             guint64            segment_size,
+             GBytes           **contents,
+             GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_autofree gchar *segment_path = get_segment_path (priv->path, segment);
+  g_autoptr(GMappedFile) mapped_file =
+    g_mapped_file_new (segment_path, FALSE /* writable */, error);
+  if (mapped_file == NULL)
+    return FALSE;
+
+  g_autoptr(GBytes) file_contents = g_mapped_file_get_bytes (mapped_file);
+  if (g_bytes_get_size (file_contents) < segment_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Segment %s is %" G_GSIZE_FORMAT " bytes long, but "
+                   "expected it to be %" G_GUINT64_FORMAT " bytes long.",
+                   segment_path, g_bytes_get_size (file_contents),
+                   segment_size);
+      return FALSE;
+    }
+
+  *contents = g_bytes_new_from_bytes (file_contents, 0, segment_size);
+  return TRUE;
+}
+
+static gboolean
+write_at (gint           fd,
+          gconstpointer  buffer,
+          gsize          num_bytes,
+          goffset        offset,
+          GError       **error)
+{
+  const guint8 *remaining = buffer;
+  while (num_bytes > 0)
+    {
+      gssize bytes_written = pwrite (fd, remaining, num_bytes, offset);
+      if (bytes_written < 0)
+        {
+          gint saved_errno = errno;
+          if (saved_errno == EINTR)
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Could not write to segmented file: %s",
+                       g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      remaining += bytes_written;
+      num_bytes -= bytes_written;
+      offset += bytes_written;
+    }
+
+  return TRUE;
+}
+
+/* Truncates the file open as fd to length bytes, and waits for it to reach
+ * the disk.
+ */
+static gboolean
+truncate_and_sync (gint     fd,
+                   guint64  length,
+                   GError **error)
+{
+  if (ftruncate (fd, length) == 0 && fdatasync (fd) == 0)
+    return TRUE;
+
+  gint saved_errno = errno;
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+               "Could not sync segmented file: %s", g_strerror (saved_errno));
+  return FALSE;
+}
+
+static void
+encode_manifest_slot (guint8         *slot,
+                      const Manifest *manifest)
+{
+  guint32 little_endian_magic = GUINT32_TO_LE (MANIFEST_MAGIC);
+  guint32 little_endian_format = GUINT32_TO_LE (manifest->format);
+  guint64 little_endian_fields[] = {
+    GUINT64_TO_LE (manifest->generation),
+    GUINT64_TO_LE (manifest->first_segment),
+    GUINT64_TO_LE (manifest->head),
+    GUINT64_TO_LE (manifest->last_segment),
+    GUINT64_TO_LE (manifest->tail),
+  };
+
+  memcpy (slot, &little_endian_magic, sizeof (little_endian_magic));
+  memcpy (slot + sizeof (guint32), &little_endian_format,
+          sizeof (little_endian_format));
+  memcpy (slot + 2 * sizeof (guint32), little_endian_fields,
+          sizeof (little_endian_fields));
+
+  guint32 little_endian_checksum =
+    GUINT32_TO_LE (emer_crc32c (0, slot, MANIFEST_FIELDS_SIZE));
+  memcpy (slot + MANIFEST_FIELDS_SIZE, &little_endian_checksum,
+          sizeof (little_endian_checksum));
+}
+
+/* Reads the manifest slot at the start of slot into manifest. Returns FALSE if
+ * the slot doesn't hold an intact manifest.
+ */
+static gboolean
+decode_manifest_slot (const guint8 *slot,
+                      Manifest     *manifest)
+{
+  guint32 little_endian_magic, little_endian_checksum;
+  memcpy (&little_endian_magic, slot, sizeof (little_endian_magic));
+  memcpy (&little_endian_checksum, slot + MANIFEST_FIELDS_SIZE,
+          sizeof (little_endian_checksum));
+  if (GUINT32_FROM_LE (little_endian_magic) != MANIFEST_MAGIC ||
+      GUINT32_FROM_LE (little_endian_checksum) !=
+        emer_crc32c (0, slot, MANIFEST_FIELDS_SIZE))
+    return FALSE;
+
+  guint32 little_endian_format;
+  guint64 little_endian_fields[5];
+  memcpy (&little_endian_format, slot + sizeof (guint32),
+          sizeof (little_endian_format));
+  memcpy (little_endian_fields, slot + 2 * sizeof (guint32),
+          sizeof (little_endian_fields));
+
+  manifest->format = GUINT32_FROM_LE (little_endian_format);
+  manifest->generation = GUINT64_FROM_LE (little_endian_fields[0]);
+  manifest->first_segment = GUINT64_FROM_LE (little_endian_fields[1]);
+  manifest->head = GUINT64_FROM_LE (little_endian_fields[2]);
+  manifest->last_segment = GUINT64_FROM_LE (little_endian_fields[3]);
+  manifest->tail = GUINT64_FROM_LE (little_endian_fields[4]);
+  return TRUE;
+}
+
+/* Records the given state in the manifest slot which doesn't hold the current
+ * state, and waits for it to reach the disk. Only the generation is updated;
+ * the caller updates the rest of the state once this succeeds.
+ */
+static gboolean
+write_manifest (EmerSegmentedFile *self,
+                guint64            first_segment,
+                guint64            head,
+                guint64            last_segment,
+                guint64            tail,
+                GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  Manifest manifest = {
+    .format = CURRENT_FORMAT,
+    .generation = priv->generation + 1,
+    .first_segment = first_segment,
+    .head = head,
+    .last_segment = last_segment,
+    .tail = tail,
+  };
+  guint8 slot[MANIFEST_RECORD_SIZE];
+  encode_manifest_slot (slot, &manifest);
+
+  goffset slot_offset = (manifest.generation % 2) * MANIFEST_SLOT_SIZE;
+  if (!write_at (priv->manifest_fd, slot, sizeof (slot), slot_offset, error))
+    return FALSE;
+
+  if (fdatasync (priv->manifest_fd) != 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not sync manifest of segmented file: %s",
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  priv->generation = manifest.generation;
+  return TRUE;
+}
+
+/* Makes the file open as fd, which holds the given segment, the last segment,
+ * and the segmented file empty, starting at the beginning of that segment.
+ */
+static void
+set_empty (EmerSegmentedFile *self,
+           guint64            segment,
+           gint               fd)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  guint64 empty_size = 0;
+  if (priv->tail_fd >= 0)
+    close (priv->tail_fd);
+  priv->tail_fd = fd;
+  priv->first_segment = segment;
+  priv->head = 0;
+  g_array_set_size (priv->segment_sizes, 0);
+  g_array_append_val (priv->segment_sizes, empty_size);
+  priv->size = 0;
+}
+
+/* Empties the segmented file by starting a new segment after the last one,
+ * and deletes the segments which held its elements.
+ */
+static gboolean
+empty (EmerSegmentedFile *self,
+       GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  guint64 first_segment = priv->first_segment;
+  guint64 last_segment = get_last_segment (self);
+  guint64 new_segment = last_segment + 1;
+  gint fd = open_segment (self, new_segment, O_TRUNC, error);
+  if (fd < 0)
+    return FALSE;
+
+  if (!write_manifest (self, new_segment, 0, new_segment, 0, error))
+    {
+      close (fd);
+      delete_segment (priv->path, new_segment);
+      return FALSE;
+    }
+
+  set_empty (self, new_segment, fd);
+  for (guint64 segment = first_segment; segment <= last_segment; segment++)
+    delete_segment (priv->path, segment);
+
+  return TRUE;
+}
+
+/* Sets last_segment to the number of the highest-numbered segment in the
+ * directory, and found to whether there are any.
+ */
+static gboolean
+find_last_segment_file (EmerSegmentedFile *self,
+                        guint64           *last_segment,
+                        gboolean          *found,
+                        GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_autoptr(GDir) dir = g_dir_open (priv->path, 0, error);
+  if (dir == NULL)
+    return FALSE;
+
+  *found = FALSE;
+  const gchar *filename;
+  while ((filename = g_dir_read_name (dir)) != NULL)
+    {
+      guint64 segment;
+      if (parse_segment_filename (filename, &segment) &&
+          (!*found || segment > *last_segment))
+        {
+          *last_segment = segment;
+          *found = TRUE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Makes the segmented file empty, writing both slots of the manifest so that
+ * no earlier state can be mistaken for the current one. The new state starts
+ * at a segment after any already in the directory, so that none of them can
+ * be mistaken for part of it.
+ */
+static gboolean
+initialize (EmerSegmentedFile *self,
+            GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  guint64 segment = 0, last_segment_file;
+  gboolean found;
+  if (!find_last_segment_file (self, &last_segment_file, &found, error))
+    return FALSE;
+
+  if (found)
+    segment = last_segment_file + 1;
+
+  gint fd = open_segment (self, segment, O_TRUNC, error);
+  if (fd < 0)
+    return FALSE;
+
+  Manifest manifest = {
+    .format = CURRENT_FORMAT,
+    .generation = 1,
+    .first_segment = segment,
+    .head = 0,
+    .last_segment = segment,
+    .tail = 0,
+  };
+  guint8 slots[MANIFEST_SIZE] = { 0, };
+  encode_manifest_slot (slots + MANIFEST_SLOT_SIZE, &manifest);
+  if (!write_at (priv->manifest_fd, slots, sizeof (slots), 0, error) ||
+      !truncate_and_sync (priv->manifest_fd, MANIFEST_SIZE, error))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  priv->generation = 1;
+  set_empty (self, segment, fd);
+  return TRUE;
+}
+
+/* Reads the manifest into manifest, setting found to FALSE if there is none.
+ * Returns FALSE if the manifest could not be read, or if neither of its slots
+ * is intact.
+ */
+static gboolean
+read_manifest (EmerSegmentedFile *self,
+               Manifest          *manifest,
+               gboolean          *found,
+               GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  *found = FALSE;
+
+  guint8 buffer[MANIFEST_SIZE];
+  gssize bytes_read;
+  do
+    bytes_read = pread (priv->manifest_fd, buffer, sizeof (buffer), 0);
+  while (bytes_read < 0 && errno == EINTR);
+
+  if (bytes_read < 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not read manifest of segmented file: %s",
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  /* Both slots are written when the manifest is created, so a shorter one was
+   * never finished.
+   */
+  if (bytes_read < MANIFEST_SIZE)
+    return TRUE;
+
+  gboolean has_magic = FALSE;
+  for (gsize i = 0; i < 2; i++)
+    {
+      const guint8 *slot = buffer + i * MANIFEST_SLOT_SIZE;
+      guint32 little_endian_magic;
+      memcpy (&little_endian_magic, slot, sizeof (little_endian_magic));
+      if (GUINT32_FROM_LE (little_endian_magic) == MANIFEST_MAGIC)
+        has_magic = TRUE;
+
+      Manifest slot_manifest;
+      if (decode_manifest_slot (slot, &slot_manifest) &&
+          (!*found || slot_manifest.generation > manifest->generation))
+        {
+          *manifest = slot_manifest;
+          *found = TRUE;
+        }
+    }
+
+  if (has_magic && !*found)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Both slots of the segmented file's manifest are damaged.");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Takes the state of the segmented file from the given manifest, finding the
+ * length of each segment from the file holding it. Anything written to the
+ * last segment after the end recorded in the manifest is discarded.
+ */
+static gboolean
+load_manifest (EmerSegmentedFile *self,
+               const Manifest    *manifest,
+               GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (manifest->format != CURRENT_FORMAT)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Segmented "
+                   "file has unknown format %u.", manifest->format);
+      return FALSE;
+    }
+
+  if (manifest->first_segment > manifest->last_segment ||
+      manifest->last_segment - manifest->first_segment >= G_MAXUINT)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Segmented "
+                   "file has invalid range of segments [%" G_GUINT64_FORMAT
+                   ", %" G_GUINT64_FORMAT "].", manifest->first_segment,
+                   manifest->last_segment);
+      return FALSE;
+    }
+
+  g_autoptr(GArray) segment_sizes =
+    g_array_new (FALSE, FALSE, sizeof (guint64));
+  for (guint64 segment = manifest->first_segment;
+       segment < manifest->last_segment; segment++)
+    {
+      g_autofree gchar *segment_path = get_segment_path (priv->path, segment);
+      GStatBuf stat_buf;
+      if (g_stat (segment_path, &stat_buf) != 0)
+        {
+          gint saved_errno = errno;
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Could not find size of segment %s: %s", segment_path,
+                       g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      guint64 segment_size = stat_buf.st_size;
+      g_array_append_val (segment_sizes, segment_size);
+    }
+
+  guint64 tail = manifest->tail;
+  g_array_append_val (segment_sizes, tail);
+
+  if (manifest->head > g_array_index (segment_sizes, guint64, 0))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Head of "
+                   "segmented file must lie in range [0, %" G_GUINT64_FORMAT
+                   "], but was %" G_GUINT64_FORMAT ".",
+                   g_array_index (segment_sizes, guint64, 0), manifest->head);
+      return FALSE;
+    }
+
+  gint fd = open_segment (self, manifest->last_segment, 0, error);
+  if (fd < 0)
+    return FALSE;
+
+  struct stat stat_buf;
+  if (fstat (fd, &stat_buf) != 0 || (guint64) stat_buf.st_size < tail)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Last segment "
+                   "of segmented file is shorter than the %" G_GUINT64_FORMAT
+                   " bytes expected.", tail);
+      close (fd);
+      return FALSE;
+    }
+
+  if (!truncate_and_sync (fd, tail, error))
+    {
+      close (fd);
+      return FALSE;
+    }
+
+  guint64 total_size = 0;
+  for (guint i = 0; i < segment_sizes->len; i++)
+    total_size += g_array_index (segment_sizes, guint64, i);
+
+  priv->generation = manifest->generation;
+  set_empty (self, manifest->first_segment, fd);
+  g_array_set_size (priv->segment_sizes, 0);
+  g_array_append_vals (priv->segment_sizes, segment_sizes->data,
+                       segment_sizes->len);
+  priv->head = manifest->head;
+  priv->size = total_size - manifest->head;
+  return TRUE;
+}
+
+/* Deletes the segments in the directory which aren't part of the segmented
+ * file, which were left behind by an operation which was interrupted.
+ */
+static void
+delete_stray_segments (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) dir = g_dir_open (priv->path, 0, &error);
+  if (dir == NULL)
+    {
+      g_warning ("Could not look for stray segments in %s: %s", priv->path,
+                 error->message);
+      return;
+    }
+
+  guint64 last_segment = get_last_segment (self);
+  const gchar *filename;
+  while ((filename = g_dir_read_name (dir)) != NULL)
+    {
+      guint64 segment;
+      if (parse_segment_filename (filename, &segment) &&
+          (segment < priv->first_segment || segment > last_segment))
+        delete_segment (priv->path, segment);
+    }
+}
+
+/* Drops the most recently saved elements which don't fit in priv->max_size
+ * bytes. Whole segments are deleted, and the last segment kept is truncated
+ * after the last element in it which fits.
+ */
+static gboolean
+shrink (EmerSegmentedFile *self,
+        GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (priv->size <= priv->max_size)
+    return TRUE;
+
+  /* Find the segment holding the first element which doesn't fit. */
+  guint64 kept_size = 0;
+  guint index = 0;
+  for (; index < priv->segment_sizes->len; index++)
+    {
+      guint64 start = index == 0 ? priv->head : 0;
+      guint64 segment_size = get_segment_size (self, index);
+      if (kept_size + segment_size - start > priv->max_size)
+        break;
+
+      kept_size += segment_size - start;
+    }
+
+  guint64 segment = priv->first_segment + index;
+  guint64 segment_size = get_segment_size (self, index);
+  g_autoptr(GBytes) contents = NULL;
+  if (!map_segment (self, segment, segment_size, &contents, error))
+    return FALSE;
+
+  const guint8 *data = g_bytes_get_data (contents, NULL);
+  guint64 start = index == 0 ? priv->head : 0;
+  guint64 tail = start;
+  while (tail + ELEM_HEADER_SIZE <= segment_size)
+    {
+      guint32 little_endian_elem_size;
+      memcpy (&little_endian_elem_size, data + tail,
+              sizeof (little_endian_elem_size));
+      guint64 next_tail =
+        tail + ELEM_HEADER_SIZE + GUINT32_FROM_LE (little_endian_elem_size);
+      if (next_tail > segment_size ||
+          kept_size + next_tail - start > priv->max_size)
+        break;
+
+      tail = next_tail;
+    }
+
+  guint64 new_size = kept_size + tail - start;
+
+  /* Rather than keep an empty segment, make the one before it the last. */
+  if (tail == 0 && index > 0)
+    {
+      index--;
+      segment--;
+      tail = get_segment_size (self, index);
+    }
+
+  guint64 last_segment = get_last_segment (self);
+  if (!write_manifest (self, priv->first_segment, priv->head, segment, tail,
+                       error))
+    return FALSE;
+
+  if (segment != last_segment)
+    {
+      gint fd = open_segment (self, segment, 0, error);
+      if (fd < 0)
+        return FALSE;
+
+      close (priv->tail_fd);
+      priv->tail_fd = fd;
+    }
+
+  g_array_set_size (priv->segment_sizes, index + 1);
+  g_array_index (priv->segment_sizes, guint64, index) = tail;
+  priv->size = new_size;
+  for (guint64 dropped = segment + 1; dropped <= last_segment; dropped++)
+    delete_segment (priv->path, dropped);
+
+  return truncate_and_sync (priv->tail_fd, tail, error);
+}
+
+static void
+emer_segmented_file_set_property (GObject      *object,
+                                  guint         property_id,
+                                  const GValue *value,
+                                  GParamSpec   *pspec)
+{
+  EmerSegmentedFile *self = EMER_SEGMENTED_FILE (object);
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  switch (property_id)
+    {
+    case PROP_PATH:
+      priv->path = g_value_dup_string (value);
+      break;
+
+    case PROP_MAX_SIZE:
+      priv->max_size = g_value_get_uint64 (value);
+      break;
+
+    case PROP_SEGMENT_SIZE:
+      priv->segment_size = g_value_get_uint64 (value);
+      break;
+
+    case PROP_REINITIALIZE:
+      priv->reinitialize = g_value_get_boolean (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+emer_segmented_file_finalize (GObject *object)
+{
+  EmerSegmentedFile *self = EMER_SEGMENTED_FILE (object);
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (priv->manifest_fd >= 0)
+    close (priv->manifest_fd);
+  if (priv->tail_fd >= 0)
+    close (priv->tail_fd);
+  g_clear_pointer (&priv->path, g_free);
+  g_clear_pointer (&priv->segment_sizes, g_array_unref);
+  g_clear_pointer (&priv->write_buffer, g_byte_array_unref);
+
+  G_OBJECT_CLASS (emer_segmented_file_parent_class)->finalize (object);
+}
+
+static void
+emer_segmented_file_class_init (EmerSegmentedFileClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->set_property = emer_segmented_file_set_property;
+  object_class->finalize = emer_segmented_file_finalize;
+
+  emer_segmented_file_props[PROP_PATH] =
+    g_param_spec_string ("path", "Path",
+                         "Path of the directory in which the segmented file "
+                         "is stored",
+                         NULL,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                         G_PARAM_STATIC_STRINGS);
+
+  emer_segmented_file_props[PROP_MAX_SIZE] =
+    g_param_spec_uint64 ("max-size", "Max size",
+                         "The maximum total size of the elements, including "
+                         "the header preceding each one.",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                         G_PARAM_STATIC_STRINGS);
+
+  emer_segmented_file_props[PROP_SEGMENT_SIZE] =
+    g_param_spec_uint64 ("segment-size", "Segment size",
+                         "The size past which elements are saved to a new "
+                         "segment. A segment is only ever larger than this to "
+                         "hold a single element which is larger itself.",
+                         1, G_MAXUINT64, DEFAULT_SEGMENT_SIZE,
+                         G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                         G_PARAM_STATIC_STRINGS);
+
+  emer_segmented_file_props[PROP_REINITIALIZE] =
+    g_param_spec_boolean ("reinitialize", "Reinitialize",
+                          "Disregard the existing contents of the segmented "
+                          "file, if any. This is intended as a recovery "
+                          "mechanism if its manifest is corrupt.",
+                          FALSE,
+                          G_PARAM_CONSTRUCT_ONLY | G_PARAM_WRITABLE |
+                          G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, NPROPS,
+                                     emer_segmented_file_props);
+}
+
+static void
+emer_segmented_file_init (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  priv->manifest_fd = -1;
+  priv->tail_fd = -1;
+  priv->segment_sizes = g_array_new (FALSE, FALSE, sizeof (guint64));
+  priv->write_buffer = g_byte_array_new ();
+}
+
+static gboolean
+emer_segmented_file_initable_init (GInitable    *initable,
+                                   GCancellable *cancellable,
+                                   GError      **error)
+{
+  EmerSegmentedFile *self = EMER_SEGMENTED_FILE (initable);
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (g_mkdir_with_parents (priv->path, 0777) != 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not create directory %s: %s", priv->path,
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  g_autofree gchar *manifest_path =
+    g_build_filename (priv->path, SEGMENT_MANIFEST_FILENAME, NULL);
+  priv->manifest_fd =
+    g_open (manifest_path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (priv->manifest_fd < 0)
+    {
+      gint saved_errno = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not open %s: %s", manifest_path,
+                   g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  /* If the :reinitialize construct-time property was set to TRUE, the
+   * existing segments are disregarded, and deleted below.
+   */
+  gboolean init_succeeded;
+  if (priv->reinitialize)
+    {
+      init_succeeded = initialize (self, error);
+    }
+  else
+    {
+      Manifest manifest;
+      gboolean found;
+      if (!read_manifest (self, &manifest, &found, error))
+        return FALSE;
+
+      init_succeeded = found ?
+        load_manifest (self, &manifest, error) : initialize (self, error);
+    }
+
+  if (!init_succeeded)
+    return FALSE;
+
+  delete_stray_segments (self);
+  return shrink (self, error);
+}
+
+static void
+emer_segmented_file_initable_iface_init (GInitableIface *iface)
+{
+  iface->init = emer_segmented_file_initable_init;
+}
+
+static void
+emer_segmented_file_element_store_iface_init (EmerElementStoreInterface *iface)
+{
+  iface->reserve = (gpointer (*) (EmerElementStore *, guint64))
+    emer_segmented_file_reserve;
+  iface->commit = (void (*) (EmerElementStore *)) emer_segmented_file_commit;
+  iface->save = (gboolean (*) (EmerElementStore *, GError **))
+    emer_segmented_file_save;
+  iface->read = (gboolean (*) (EmerElementStore *, GBytes ***, gsize, gsize *,
+                               guint64 *, gboolean *, GError **))
+    emer_segmented_file_read;
+  iface->has_more = (gboolean (*) (EmerElementStore *, guint64))
+    emer_segmented_file_has_more;
+  iface->remove = (gboolean (*) (EmerElementStore *, guint64, GError **))
+    emer_segmented_file_remove;
+  iface->purge = (gboolean (*) (EmerElementStore *, GError **))
+    emer_segmented_file_purge;
+  iface->get_fill_ratio = (gdouble (*) (EmerElementStore *))
+    emer_segmented_file_get_fill_ratio;
+}
+
+/* Returns a new segmented file, kept in the directory at the given path, or
+ * NULL on error. If the directory doesn't already hold a segmented file, a new
+ * one is created. Limits the total size of the elements to max_size bytes; if
+ * an existing segmented file holds more than that, the most recently saved
+ * elements are dropped until the rest fit.
+ */
+EmerSegmentedFile *
+emer_segmented_file_new (const gchar *path,
+                         guint64      max_size,
+                         gboolean     reinitialize,
+                         GError     **error)
+{
+  return g_initable_new (EMER_TYPE_SEGMENTED_FILE,
+                         NULL /* GCancellable */,
+                         error,
+                         "path", path,
+                         "max-size", max_size,
+                         "reinitialize", reinitialize,
+                         NULL);
+}
+
+/* Appends the given element in memory only, as emer_circular_file_append
+ * does. Returns FALSE if it would not fit in the space allotted to the
+ * segmented file.
+ */
+gboolean
+emer_segmented_file_append (EmerSegmentedFile *self,
+                            gconstpointer      elem,
+                            guint64            elem_size)
+{
+  gpointer reserved = emer_segmented_file_reserve (self, elem_size);
+  if (reserved == NULL)
+    return FALSE;
+
+  memcpy (reserved, elem, elem_size);
+  emer_segmented_file_commit (self);
+
+  return TRUE;
+}
+
+/* Like emer_segmented_file_append, but returns a pointer to elem_size bytes
+ * into which the caller should write the element, as
+ * emer_circular_file_reserve does.
+ */
+gpointer
+emer_segmented_file_reserve (EmerSegmentedFile *self,
+                             guint64            elem_size)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_return_val_if_fail (!priv->have_reservation, NULL);
+
+  if (elem_size > G_MAXUINT32)
+    return NULL;
+
+  guint64 elem_size_on_disk = ELEM_HEADER_SIZE + elem_size;
+  guint64 total_size = priv->size + priv->write_buffer->len + elem_size_on_disk;
+  if (total_size > priv->max_size)
+    return NULL;
+
+  guint offset = priv->write_buffer->len;
+  g_byte_array_set_size (priv->write_buffer, offset + elem_size_on_disk);
+  priv->reservation_offset = offset;
+  priv->have_reservation = TRUE;
+
+  return priv->write_buffer->data + offset + ELEM_HEADER_SIZE;
+}
+
+/* Completes the element whose space was returned by the last call to
+ * emer_segmented_file_reserve, computing its checksum.
+ */
+void
+emer_segmented_file_commit (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_return_if_fail (priv->have_reservation);
+
+  guint8 *record = priv->write_buffer->data + priv->reservation_offset;
+  guint32 elem_size =
+    priv->write_buffer->len - priv->reservation_offset - ELEM_HEADER_SIZE;
+  guint32 little_endian_elem_size = GUINT32_TO_LE (elem_size);
+  memcpy (record, &little_endian_elem_size, sizeof (little_endian_elem_size));
+
+  guint32 checksum = emer_crc32c (0, record, sizeof (guint32));
+  checksum = emer_crc32c (checksum, record + ELEM_HEADER_SIZE, elem_size);
+  guint32 little_endian_checksum = GUINT32_TO_LE (checksum);
+  memcpy (record + sizeof (little_endian_elem_size), &little_endian_checksum,
+          sizeof (little_endian_checksum));
+  priv->have_reservation = FALSE;
+}
+
+/* Writes the elements in the write buffer to the end of the last segment,
+ * starting new segments as they fill up, and waits for them to reach the disk.
+ * Sets fd to the file descriptor of the last segment written to, which the
+ * caller must close if it isn't priv->tail_fd, and appends the length of each
+ * segment written to, starting with the current last one, to segment_sizes.
+ * Returns FALSE on error, in which case fd is still set.
+ */
+static gboolean
+write_elems (EmerSegmentedFile *self,
+             gint              *fd,
+             GArray            *segment_sizes,
+             GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  const guint8 *data = priv->write_buffer->data;
+  gsize length = priv->write_buffer->len;
+  guint64 segment = get_last_segment (self);
+  guint64 tail = get_segment_size (self, priv->segment_sizes->len - 1);
+
+  /* The run of elements which is written to the current segment in one go. */
+  gsize run_start = 0;
+  guint64 run_offset = tail;
+
+  *fd = priv->tail_fd;
+  for (gsize pos = 0; pos < length; )
+    {
+      guint32 little_endian_elem_size;
+      memcpy (&little_endian_elem_size, data + pos,
+              sizeof (little_endian_elem_size));
+      guint64 record_size =
+        ELEM_HEADER_SIZE + GUINT32_FROM_LE (little_endian_elem_size);
+
+      if (tail > 0 && tail + record_size > priv->segment_size)
+        {
+          /* Anything after the end of the segment was left by a save which
+           * failed, and must not be read as part of it.
+           */
+          if (!write_at (*fd, data + run_start, pos - run_start, run_offset,
+                         error) ||
+              !truncate_and_sync (*fd, tail, error))
+            return FALSE;
+
+          g_array_append_val (segment_sizes, tail);
+          if (*fd != priv->tail_fd)
+            close (*fd);
+
+          *fd = open_segment (self, ++segment, O_TRUNC, error);
+          if (*fd < 0)
+            return FALSE;
+
+          tail = 0;
+          run_start = pos;
+          run_offset = 0;
+        }
+
+      tail += record_size;
+      pos += record_size;
+    }
+
+  if (!write_at (*fd, data + run_start, length - run_start, run_offset,
+                 error) ||
+      !truncate_and_sync (*fd, tail, error))
+    return FALSE;
+
+  g_array_append_val (segment_sizes, tail);
+  return TRUE;
+}
+
+/* Flushes all elements appended since the last save to the segment files, and
+ * records them in the manifest. Elements are saved in the same order in which
+ * they were appended. Returns TRUE on success and FALSE on error.
+ */
+gboolean
+emer_segmented_file_save (EmerSegmentedFile *self,
+                          GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  g_return_val_if_fail (!priv->have_reservation, FALSE);
+
+  if (priv->write_buffer->len == 0)
+    return TRUE;
+
+  guint64 last_segment = get_last_segment (self);
+  g_autoptr(GArray) segment_sizes =
+    g_array_new (FALSE, FALSE, sizeof (guint64));
+  gint fd;
+  gboolean save_succeeded = write_elems (self, &fd, segment_sizes, error);
+  guint64 new_last_segment = last_segment + segment_sizes->len - 1;
+  if (save_succeeded)
+    {
+      guint64 tail =
+        g_array_index (segment_sizes, guint64, segment_sizes->len - 1);
+      save_succeeded = write_manifest (self, priv->first_segment, priv->head,
+                                       new_last_segment, tail, error);
+    }
+
+  if (!save_succeeded)
+    {
+      /* The segment being written to when the error occurred isn't in
+       * segment_sizes yet.
+       */
+      if (fd >= 0 && fd != priv->tail_fd)
+        close (fd);
+      for (guint64 segment = last_segment + 1;
+           segment <= last_segment + segment_sizes->len; segment++)
+        delete_segment (priv->path, segment);
+
+      return FALSE;
+    }
+
+  if (fd != priv->tail_fd)
+    {
+      close (priv->tail_fd);
+      priv->tail_fd = fd;
+    }
+
+  g_array_set_size (priv->segment_sizes, priv->segment_sizes->len - 1);
+  g_array_append_vals (priv->segment_sizes, segment_sizes->data,
+                       segment_sizes->len);
+  priv->size += priv->write_buffer->len;
+  g_byte_array_set_size (priv->write_buffer, 0);
+  return TRUE;
+}
+
+/* Returns the element whose header is at the given offset of a segment with
+ * the given contents, which together with the element may take up at most
+ * max_record_size bytes, or NULL if the header isn't intact or the element
+ * doesn't match its checksum.
+ */
+static GBytes *
+read_record (GBytes  *contents,
+             guint64  offset,
+             guint64  max_record_size)
+{
+  if (max_record_size <= ELEM_HEADER_SIZE)
+    return NULL;
+
+  const guint8 *record = (const guint8 *) g_bytes_get_data (contents, NULL) +
+    offset;
+  guint32 little_endian_elem_size, little_endian_checksum;
+  memcpy (&little_endian_elem_size, record, sizeof (little_endian_elem_size));
+  memcpy (&little_endian_checksum, record + sizeof (little_endian_elem_size),
+          sizeof (little_endian_checksum));
+  guint32 elem_size = GUINT32_FROM_LE (little_endian_elem_size);
+
+  if (elem_size == 0 || elem_size > max_record_size - ELEM_HEADER_SIZE)
+    return NULL;
+
+  guint32 checksum = emer_crc32c (0, record, sizeof (guint32));
+  checksum = emer_crc32c (checksum, record + ELEM_HEADER_SIZE, elem_size);
+  if (checksum != GUINT32_FROM_LE (little_endian_checksum))
+    return NULL;
+
+  return g_bytes_new_from_bytes (contents, offset + ELEM_HEADER_SIZE,
+                                 elem_size);
+}
+
+/* Populates elems with a C array of elements that consume no more than the
+ * given number of bytes in total, read from the front of the segmented file,
+ * as emer_circular_file_read does. Each segment read is memory-mapped, and the
+ * elements are slices of the mappings, whose contents are only guaranteed
+ * until they are removed.
+ *
+ * A run of damaged data is skipped, up to the next intact element or the end
+ * of the segment holding it, and sets has_invalid; its bytes are covered by
+ * the token. Damaged data at the end of the last segment is removed straight
+ * away.
+ */
+gboolean
+emer_segmented_file_read (EmerSegmentedFile *self,
+                          GBytes          ***elems,
+                          gsize              data_bytes_to_read,
+                          gsize             *num_elems,
+                          guint64           *token,
+                          gboolean          *has_invalid,
+                          GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  *has_invalid = FALSE;
+
+  if (priv->size == 0)
+    {
+      *elems = NULL;
+      *num_elems = 0;
+      *token = 0;
+      return TRUE;
+    }
+
+  g_autoptr(GPtrArray) elem_array =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+  guint64 curr_data_bytes = 0;
+  guint64 curr_disk_bytes = 0;
+
+  /* The number of bytes from the head to the start of the run of damaged data
+   * we are currently skipping, if any.
+   */
+  gboolean skipping = FALSE;
+  guint64 skip_start = 0;
+
+  gboolean done = FALSE;
+  guint n_segments = priv->segment_sizes->len;
+  for (guint i = 0; i < n_segments && !done; i++)
+    {
+      guint64 segment = priv->first_segment + i;
+      guint64 segment_size = get_segment_size (self, i);
+      guint64 offset = i == 0 ? priv->head : 0;
+      if (offset == segment_size)
+        continue;
+
+      g_autoptr(GBytes) contents = NULL;
+      if (!map_segment (self, segment, segment_size, &contents, error))
+        return FALSE;
+
+      while (offset < segment_size)
+        {
+          g_autoptr(GBytes) elem =
+            read_record (contents, offset, segment_size - offset);
+
+          /* Look for the next intact element one byte further on. */
+          if (elem == NULL)
+            {
+              if (!skipping)
+                {
+                  skipping = TRUE;
+                  skip_start = curr_disk_bytes;
+                  *has_invalid = TRUE;
+                }
+
+              offset++;
+              curr_disk_bytes++;
+              continue;
+            }
+
+          if (skipping)
+            {
+              g_warning ("Skipping %" G_GUINT64_FORMAT " bytes of invalid data "
+                         "in segment %" G_GUINT64_FORMAT,
+                         curr_disk_bytes - skip_start, segment);
+              skipping = FALSE;
+            }
+
+          gsize elem_size = g_bytes_get_size (elem);
+          guint64 next_data_bytes = curr_data_bytes + elem_size;
+          if (next_data_bytes > data_bytes_to_read)
+            {
+              done = TRUE;
+              break;
+            }
+
+          g_ptr_array_add (elem_array, g_steal_pointer (&elem));
+          curr_data_bytes = next_data_bytes;
+          offset += ELEM_HEADER_SIZE + elem_size;
+          curr_disk_bytes += ELEM_HEADER_SIZE + elem_size;
+        }
+
+      /* Elements never span segments, so damaged data at the end of a segment
+       * other than the last ends there.
+       */
+      if (skipping && i + 1 < n_segments)
+        {
+          g_warning ("Skipping %" G_GUINT64_FORMAT " bytes of invalid data at "
+                     "the end of segment %" G_GUINT64_FORMAT,
+                     curr_disk_bytes - skip_start, segment);
+          skipping = FALSE;
+        }
+    }
+
+  if (skipping)
+    {
+      guint64 invalid_size = curr_disk_bytes - skip_start;
+      guint64 tail = get_segment_size (self, n_segments - 1) - invalid_size;
+      g_warning ("Discarding %" G_GUINT64_FORMAT " bytes of invalid data at "
+                 "the end of segment %" G_GUINT64_FORMAT, invalid_size,
+                 get_last_segment (self));
+      if (!write_manifest (self, priv->first_segment, priv->head,
+                           get_last_segment (self), tail, error))
+        return FALSE;
+
+      g_array_index (priv->segment_sizes, guint64, n_segments - 1) = tail;
+      priv->size -= invalid_size;
+      curr_disk_bytes = skip_start;
+    }
+
+  *num_elems = elem_array->len;
+  *elems = (GBytes **) g_ptr_array_free (g_steal_pointer (&elem_array), FALSE);
+  *token = curr_disk_bytes;
+  return TRUE;
+}
+
+/* Returns TRUE if there would still be at least one element remaining after a
+ * successful call to emer_segmented_file_remove with this token, as
+ * emer_circular_file_has_more does.
+ */
+gboolean
+emer_segmented_file_has_more (EmerSegmentedFile *self,
+                              guint64            token)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  return token < priv->size;
+}
+
+/* Returns the fraction of the file's maximum size that is in use, counting
+ * elements which have been appended but not yet saved.
+ */
+gdouble
+emer_segmented_file_get_fill_ratio (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (priv->max_size == 0)
+    return 1.0;
+
+  return (gdouble) (priv->size + priv->write_buffer->len) / priv->max_size;
+}
+
+/* Removes the elements that were read in the call to emer_segmented_file_read
+ * that produced the given token, as emer_circular_file_remove does. Each
+ * segment left with no elements is deleted. Returns TRUE on success and FALSE
+ * on error.
+ */
+gboolean
+emer_segmented_file_remove (EmerSegmentedFile *self,
+                            guint64            token,
+                            GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  if (token == 0)
+    return TRUE;
+
+  if (token >= priv->size)
+    return empty (self, error);
+
+  /* Since some elements remain, the head stays short of the end of the last
+   * segment.
+   */
+  guint num_emptied = 0;
+  guint64 head = priv->head + token;
+  while (head >= get_segment_size (self, num_emptied))
+    head -= get_segment_size (self, num_emptied++);
+
+  guint64 first_segment = priv->first_segment;
+  guint64 new_first_segment = first_segment + num_emptied;
+  guint64 last_segment = get_last_segment (self);
+  guint64 tail = get_segment_size (self, priv->segment_sizes->len - 1);
+  if (!write_manifest (self, new_first_segment, head, last_segment, tail,
+                       error))
+    return FALSE;
+
+  g_array_remove_range (priv->segment_sizes, 0, num_emptied);
+  priv->first_segment = new_first_segment;
+  priv->head = head;
+  priv->size -= token;
+  for (guint64 segment = first_segment; segment < new_first_segment; segment++)
+    delete_segment (priv->path, segment);
+
+  return TRUE;
+}
+
+/* Removes all data stored in the segmented file, deleting every segment which
+ * held it. Does not remove any data that has been appended but not saved.
+ * Returns TRUE on success and FALSE on error.
+ */
+gboolean
+emer_segmented_file_purge (EmerSegmentedFile *self,
+                           GError           **error)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  return priv->size == 0 ? TRUE : empty (self, error);
+}
+
+/* Returns the number of segment files the segmented file is made up of. */
+guint
+emer_segmented_file_get_n_segments (EmerSegmentedFile *self)
+{
+  EmerSegmentedFilePrivate *priv =
+    emer_segmented_file_get_instance_private (self);
+
+  return priv->segment_sizes->len;
+}
+
+/* Deletes the segmented file in the directory at the given path, along with
+ * the directory, if it exists.
+ */
+void
+emer_segmented_file_delete (const gchar *path)
+{
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GDir) dir = g_dir_open (path, 0, &error);
+  if (dir == NULL)
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("Could not delete %s: %s", path, error->message);
+      return;
+    }
+
+  const gchar *filename;
+  while ((filename = g_dir_read_name (dir)) != NULL)
+    {
+      guint64 segment;
+      if (parse_segment_filename (filename, &segment))
+        delete_segment (path, segment);
+    }
+
+  g_autofree gchar *manifest_path =
+    g_build_filename (path, SEGMENT_MANIFEST_FILENAME, NULL);
+  if (g_unlink (manifest_path) != 0 && errno != ENOENT)
+    g_warning ("Could not delete %s: %s", manifest_path, g_strerror (errno));
+  if (g_rmdir (path) != 0)
+    g_warning ("Could not delete %s: %s", path, g_strerror (errno));
+}
@@ -0,0 +1,118 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMER_SEGMENTED_FILE_H
+#define EMER_SEGMENTED_FILE_H
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+#include "emer-element-store.h"
+
+G_BEGIN_DECLS
+
+#define EMER_TYPE_SEGMENTED_FILE emer_segmented_file_get_type()
+
+#define EMER_SEGMENTED_FILE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  EMER_TYPE_SEGMENTED_FILE, EmerSegmentedFile))
+
+#define EMER_SEGMENTED_FILE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  EMER_TYPE_SEGMENTED_FILE, EmerSegmentedFileClass))
+
+#define EMER_IS_SEGMENTED_FILE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  EMER_TYPE_SEGMENTED_FILE))
+
+#define EMER_IS_SEGMENTED_FILE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  EMER_TYPE_SEGMENTED_FILE))
+
+#define EMER_SEGMENTED_FILE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  EMER_TYPE_SEGMENTED_FILE, EmerSegmentedFileClass))
+
+#define SEGMENT_MANIFEST_FILENAME "manifest"
+#define SEGMENT_EXTENSION ".seg"
+
+typedef struct _EmerSegmentedFile EmerSegmentedFile;
+typedef struct _EmerSegmentedFileClass EmerSegmentedFileClass;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmerSegmentedFile, g_object_unref)
+
+struct _EmerSegmentedFile
+{
+  GObject parent;
+};
+
+struct _EmerSegmentedFileClass
+{
+  GObjectClass parent_class;
+};
+
+GType              emer_segmented_file_get_type       (void) G_GNUC_CONST;
+
+EmerSegmentedFile *emer_segmented_file_new            (const gchar       *path,
+                                                       guint64            max_size,
+                                                       gboolean           reinitialize,
+                                                       GError           **error);
+
+gboolean           emer_segmented_file_append         (EmerSegmentedFile *self,
+                                                       gconstpointer      elem,
+                                                       guint64            elem_size);
+
+gpointer           emer_segmented_file_reserve        (EmerSegmentedFile *self,
+                                                       guint64            elem_size);
+
+void               emer_segmented_file_commit         (EmerSegmentedFile *self);
+
+gboolean           emer_segmented_file_save           (EmerSegmentedFile *self,
+                                                       GError           **error);
+
+gboolean           emer_segmented_file_read           (EmerSegmentedFile *self,
+                                                       GBytes          ***elems,
+                                                       gsize              num_bytes,
+                                                       gsize             *num_elems,
+                                                       guint64           *token,
+                                                       gboolean          *has_invalid,
+                                                       GError           **error);
+
+gboolean           emer_segmented_file_has_more       (EmerSegmentedFile *self,
+                                                       guint64            token);
+
+gboolean           emer_segmented_file_remove         (EmerSegmentedFile *self,
+                                                       guint64            token,
+                                                       GError           **error);
+
+gboolean           emer_segmented_file_purge          (EmerSegmentedFile *self,
+                                                       GError           **error);
+
+gdouble            emer_segmented_file_get_fill_ratio (EmerSegmentedFile *self);
+
+guint              emer_segmented_file_get_n_segments (EmerSegmentedFile *self);
+
+void               emer_segmented_file_delete         (const gchar       *path);
+
+G_END_DECLS
+
+#endif /* EMER_SEGMENTED_FILE_H */
@@ -32,7 +32,6 @@
  * used when preparing reports or visualisations of the metrics data.
  */
 
-#define LOCATION_CONF_FILE SYSCONFDIR "/metrics/location.conf"
 #define LOCATION_LABEL_GROUP "Label"
 
 static void
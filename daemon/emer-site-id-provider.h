@@ -27,6 +27,9 @@
 
 G_BEGIN_DECLS
 
+/* The file from which the site information is read. */
+#define LOCATION_CONF_FILE SYSCONFDIR "/metrics/location.conf"
+
 GVariant *emer_site_id_provider_get_id (void);
 
 G_END_DECLS
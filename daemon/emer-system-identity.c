@@ -0,0 +1,280 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-system-identity.h"
+
+#include <gio/gio.h>
+
+#include "emer-boot-id-provider.h"
+#include "emer-image-id-provider.h"
+#include "emer-site-id-provider.h"
+
+/*
+ * EmerSystemIdentity:
+ *
+ * A snapshot of the values which identify this system in every event and
+ * network request: the OS version, the image version, the site ID and the boot
+ * type. Each value is read from its provider the first time it is needed and
+ * then kept, so that recording an event or building a request doesn't touch
+ * the filesystem.
+ *
+ * The OS version and site ID come from files which may be changed while the
+ * daemon is running (by an OS update being deployed in place, or by an
+ * administrator editing location.conf), so those files are monitored and the
+ * cached values are dropped when they change. The image version and boot type
+ * can't change without a reboot.
+ */
+
+/* The files read by g_get_os_info(), in order of preference. */
+static const gchar * const os_release_files[] = {
+  "/etc/os-release",
+  "/usr/lib/os-release",
+  NULL
+};
+
+struct _EmerSystemIdentity
+{
+  GObject parent_instance;
+
+  gchar *os_version;
+  gchar *image_version;
+  GVariant *site_id;
+  guint8 boot_type;
+  gboolean have_boot_type;
+
+  GPtrArray *os_release_monitors;
+  GFileMonitor *location_monitor;
+};
+
+G_DEFINE_TYPE (EmerSystemIdentity, emer_system_identity, G_TYPE_OBJECT)
+
+static void
+on_os_release_changed (GFileMonitor      *monitor,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event_type,
+                       gpointer           user_data)
+{
+  EmerSystemIdentity *self = EMER_SYSTEM_IDENTITY (user_data);
+
+  g_clear_pointer (&self->os_version, g_free);
+}
+
+static void
+on_location_changed (GFileMonitor      *monitor,
+                     GFile             *file,
+                     GFile             *other_file,
+                     GFileMonitorEvent  event_type,
+                     gpointer           user_data)
+{
+  EmerSystemIdentity *self = EMER_SYSTEM_IDENTITY (user_data);
+
+  g_clear_pointer (&self->site_id, g_variant_unref);
+}
+
+static GFileMonitor *
+monitor_file (EmerSystemIdentity *self,
+              const gchar        *path,
+              GCallback           callback)
+{
+  g_autoptr(GFile) file = g_file_new_for_path (path);
+  g_autoptr(GError) error = NULL;
+  GFileMonitor *monitor =
+    g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, &error);
+
+  if (monitor == NULL)
+    {
+      /* Without a monitor, changes to this file won't be noticed until the
+       * daemon restarts, which is no worse than before it was cached.
+       */
+      g_message ("Unable to monitor %s for changes: %s", path, error->message);
+      return NULL;
+    }
+
+  g_signal_connect_object (monitor, "changed", callback, self, 0);
+  return monitor;
+}
+
+static void
+emer_system_identity_finalize (GObject *object)
+{
+  EmerSystemIdentity *self = EMER_SYSTEM_IDENTITY (object);
+
+  g_clear_pointer (&self->os_release_monitors, g_ptr_array_unref);
+  g_clear_object (&self->location_monitor);
+
+  g_clear_pointer (&self->os_version, g_free);
+  g_clear_pointer (&self->image_version, g_free);
+  g_clear_pointer (&self->site_id, g_variant_unref);
+
+  G_OBJECT_CLASS (emer_system_identity_parent_class)->finalize (object);
+}
+
+static void
+emer_system_identity_class_init (EmerSystemIdentityClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emer_system_identity_finalize;
+}
+
+static void
+emer_system_identity_init (EmerSystemIdentity *self)
+{
+  self->os_release_monitors = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+EmerSystemIdentity *
+emer_system_identity_new (void)
+{
+  return emer_system_identity_new_full (os_release_files, LOCATION_CONF_FILE);
+}
+
+/*
+ * emer_system_identity_new_full:
+ * @os_release_paths: (array zero-terminated=1): the files to monitor for
+ *   changes to the OS version
+ * @location_path: the file to monitor for changes to the site ID
+ *
+ * Like emer_system_identity_new(), but monitors the given files rather than
+ * the ones the providers read, so that tests can change them.
+ *
+ * Returns: (transfer full): a new identity
+ */
+EmerSystemIdentity *
+emer_system_identity_new_full (const gchar * const *os_release_paths,
+                               const gchar         *location_path)
+{
+  g_return_val_if_fail (os_release_paths != NULL, NULL);
+  g_return_val_if_fail (location_path != NULL, NULL);
+
+  EmerSystemIdentity *self = g_object_new (EMER_TYPE_SYSTEM_IDENTITY, NULL);
+
+  for (gsize i = 0; os_release_paths[i] != NULL; i++)
+    {
+      GFileMonitor *monitor =
+        monitor_file (self, os_release_paths[i],
+                      G_CALLBACK (on_os_release_changed));
+      if (monitor != NULL)
+        g_ptr_array_add (self->os_release_monitors, monitor);
+    }
+
+  self->location_monitor =
+    monitor_file (self, location_path, G_CALLBACK (on_location_changed));
+
+  return self;
+}
+
+/*
+ * emer_system_identity_get_os_version:
+ * @self: the identity
+ *
+ * Returns: (transfer none): the OS version, as returned by
+ *   emer_image_id_provider_get_os_version(). This is only valid until control
+ *   returns to the main loop.
+ */
+const gchar *
+emer_system_identity_get_os_version (EmerSystemIdentity *self)
+{
+  g_return_val_if_fail (EMER_IS_SYSTEM_IDENTITY (self), NULL);
+
+  if (self->os_version == NULL)
+    self->os_version = emer_image_id_provider_get_os_version ();
+
+  return self->os_version;
+}
+
+/*
+ * emer_system_identity_get_image_version:
+ * @self: the identity
+ *
+ * Returns: (transfer none): the image version, as returned by
+ *   emer_image_id_provider_get_version()
+ */
+const gchar *
+emer_system_identity_get_image_version (EmerSystemIdentity *self)
+{
+  g_return_val_if_fail (EMER_IS_SYSTEM_IDENTITY (self), NULL);
+
+  if (self->image_version == NULL)
+    self->image_version = emer_image_id_provider_get_version ();
+
+  return self->image_version;
+}
+
+/*
+ * emer_system_identity_get_site_id:
+ * @self: the identity
+ *
+ * Returns: (transfer none): the site information, as returned by
+ *   emer_site_id_provider_get_id(). This is only valid until control returns
+ *   to the main loop.
+ */
+GVariant *
+emer_system_identity_get_site_id (EmerSystemIdentity *self)
+{
+  g_return_val_if_fail (EMER_IS_SYSTEM_IDENTITY (self), NULL);
+
+  if (self->site_id == NULL)
+    self->site_id = g_variant_ref_sink (emer_site_id_provider_get_id ());
+
+  return self->site_id;
+}
+
+/*
+ * emer_system_identity_get_boot_type:
+ * @self: the identity
+ *
+ * Returns: the boot type, as returned by emer_boot_id_provider_get_boot_type()
+ */
+guint8
+emer_system_identity_get_boot_type (EmerSystemIdentity *self)
+{
+  g_return_val_if_fail (EMER_IS_SYSTEM_IDENTITY (self), 0);
+
+  if (!self->have_boot_type)
+    {
+      self->boot_type = emer_boot_id_provider_get_boot_type ();
+      self->have_boot_type = TRUE;
+    }
+
+  return self->boot_type;
+}
+
+/*
+ * emer_system_identity_invalidate:
+ * @self: the identity
+ *
+ * Drops all cached values, so that they are read again from their providers
+ * the next time they are needed.
+ */
+void
+emer_system_identity_invalidate (EmerSystemIdentity *self)
+{
+  g_return_if_fail (EMER_IS_SYSTEM_IDENTITY (self));
+
+  g_clear_pointer (&self->os_version, g_free);
+  g_clear_pointer (&self->image_version, g_free);
+  g_clear_pointer (&self->site_id, g_variant_unref);
+  self->have_boot_type = FALSE;
+}
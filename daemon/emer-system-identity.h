@@ -0,0 +1,49 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define EMER_TYPE_SYSTEM_IDENTITY (emer_system_identity_get_type())
+G_DECLARE_FINAL_TYPE (EmerSystemIdentity,
+                      emer_system_identity,
+                      EMER, SYSTEM_IDENTITY, GObject)
+
+EmerSystemIdentity *emer_system_identity_new (void);
+
+EmerSystemIdentity *emer_system_identity_new_full (const gchar * const *os_release_paths,
+                                                   const gchar         *location_path);
+
+const gchar *emer_system_identity_get_os_version (EmerSystemIdentity *self);
+
+const gchar *emer_system_identity_get_image_version (EmerSystemIdentity *self);
+
+GVariant *emer_system_identity_get_site_id (EmerSystemIdentity *self);
+
+guint8 emer_system_identity_get_boot_type (EmerSystemIdentity *self);
+
+void emer_system_identity_invalidate (EmerSystemIdentity *self);
+
+G_END_DECLS
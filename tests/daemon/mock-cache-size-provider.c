@@ -39,3 +39,27 @@ emer_cache_size_provider_get_max_cache_size (const gchar *path)
 
   return DEFAULT_MAX_CACHE_SIZE;
 }
+
+gboolean
+emer_cache_size_provider_get_compressed (const gchar *path)
+{
+  g_assert_cmpstr (path, ==, NULL);
+
+  return FALSE;
+}
+
+gboolean
+emer_cache_size_provider_get_store_batches (const gchar *path)
+{
+  g_assert_cmpstr (path, ==, NULL);
+
+  return FALSE;
+}
+
+gboolean
+emer_cache_size_provider_get_segmented (const gchar *path)
+{
+  g_assert_cmpstr (path, ==, NULL);
+
+  return FALSE;
+}
@@ -29,6 +29,7 @@
 
 static GError *mock_circular_file_construct_error = NULL;
 static gboolean mock_circular_file_reinitialize = FALSE;
+static GBytes *mock_circular_file_initial_data = NULL;
 
 typedef struct _EmerCircularFilePrivate
 {
@@ -36,10 +37,14 @@ typedef struct _EmerCircularFilePrivate
   gsize max_size;
   gsize saved_size;
   gsize unsaved_size;
+  gsize reserved_size;
 } EmerCircularFilePrivate;
 
-G_DEFINE_TYPE_WITH_PRIVATE (EmerCircularFile, emer_circular_file,
-                            G_TYPE_OBJECT);
+static void emer_circular_file_element_store_iface_init (EmerElementStoreInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmerCircularFile, emer_circular_file, G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (EmerCircularFile)
+                         G_IMPLEMENT_INTERFACE (EMER_TYPE_ELEMENT_STORE, emer_circular_file_element_store_iface_init))
 
 enum
 {
@@ -117,6 +122,27 @@ emer_circular_file_class_init (EmerCircularFileClass *klass)
                                      emer_circular_file_props);
 }
 
+static void
+emer_circular_file_element_store_iface_init (EmerElementStoreInterface *iface)
+{
+  iface->reserve = (gpointer (*) (EmerElementStore *, guint64))
+    emer_circular_file_reserve;
+  iface->commit = (void (*) (EmerElementStore *)) emer_circular_file_commit;
+  iface->save = (gboolean (*) (EmerElementStore *, GError **))
+    emer_circular_file_save;
+  iface->read = (gboolean (*) (EmerElementStore *, GBytes ***, gsize, gsize *,
+                               guint64 *, gboolean *, GError **))
+    emer_circular_file_read;
+  iface->has_more = (gboolean (*) (EmerElementStore *, guint64))
+    emer_circular_file_has_more;
+  iface->remove = (gboolean (*) (EmerElementStore *, guint64, GError **))
+    emer_circular_file_remove;
+  iface->purge = (gboolean (*) (EmerElementStore *, GError **))
+    emer_circular_file_purge;
+  iface->get_fill_ratio = (gdouble (*) (EmerElementStore *))
+    emer_circular_file_get_fill_ratio;
+}
+
 EmerCircularFile *
 emer_circular_file_new (const gchar *path,
                         guint64      max_size,
@@ -132,28 +158,70 @@ emer_circular_file_new (const gchar *path,
       return NULL;
     }
 
-  return g_object_new (EMER_TYPE_CIRCULAR_FILE,
-                       "max-size", max_size,
-                       NULL);
+  EmerCircularFile *self = g_object_new (EMER_TYPE_CIRCULAR_FILE,
+                                         "max-size", max_size,
+                                         NULL);
+
+  if (mock_circular_file_initial_data != NULL)
+    {
+      EmerCircularFilePrivate *priv =
+        emer_circular_file_get_instance_private (self);
+      g_autoptr(GBytes) initial_data =
+        g_steal_pointer (&mock_circular_file_initial_data);
+      gsize initial_size;
+      gconstpointer data = g_bytes_get_data (initial_data, &initial_size);
+
+      g_assert_cmpuint (initial_size, <=, max_size);
+      memcpy (priv->buffer, data, initial_size);
+      priv->saved_size = initial_size;
+    }
+
+  return self;
 }
 
 gboolean
 emer_circular_file_append (EmerCircularFile *self,
                            gconstpointer     elem,
                            guint64           elem_size)
+{
+  gpointer reserved = emer_circular_file_reserve (self, elem_size);
+  if (reserved == NULL)
+    return FALSE;
+
+  memcpy (reserved, elem, elem_size);
+  emer_circular_file_commit (self);
+  return TRUE;
+}
+
+gpointer
+emer_circular_file_reserve (EmerCircularFile *self,
+                            guint64           elem_size)
 {
   EmerCircularFilePrivate *priv =
     emer_circular_file_get_instance_private (self);
 
-  gsize new_unsaved_size = priv->unsaved_size + sizeof (elem_size) + elem_size;
-  if (priv->saved_size + new_unsaved_size > priv->max_size)
-    return FALSE;
+  g_assert_cmpuint (priv->reserved_size, ==, 0);
+
+  gsize reserved_size = sizeof (elem_size) + elem_size;
+  if (priv->saved_size + priv->unsaved_size + reserved_size > priv->max_size)
+    return NULL;
 
   guint8 *tail = priv->buffer + priv->saved_size + priv->unsaved_size;
   memcpy (tail, &elem_size, sizeof (elem_size));
-  memcpy (tail + sizeof (elem_size), elem, elem_size);
-  priv->unsaved_size = new_unsaved_size;
-  return TRUE;
+  priv->reserved_size = reserved_size;
+  return tail + sizeof (elem_size);
+}
+
+void
+emer_circular_file_commit (EmerCircularFile *self)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  g_assert_cmpuint (priv->reserved_size, >, 0);
+
+  priv->unsaved_size += priv->reserved_size;
+  priv->reserved_size = 0;
 }
 
 gboolean
@@ -226,6 +294,18 @@ emer_circular_file_has_more (EmerCircularFile *self,
   return token < priv->saved_size;
 }
 
+gdouble
+emer_circular_file_get_fill_ratio (EmerCircularFile *self)
+{
+  EmerCircularFilePrivate *priv =
+    emer_circular_file_get_instance_private (self);
+
+  if (priv->max_size == 0)
+    return 1.0;
+
+  return (gdouble) (priv->saved_size + priv->unsaved_size) / priv->max_size;
+}
+
 gboolean
 emer_circular_file_remove (EmerCircularFile *self,
                            guint64           token,
@@ -262,6 +342,19 @@ mock_circular_file_set_construct_error (const GError *error)
     mock_circular_file_construct_error = g_error_copy (error);
 }
 
+/* Sets the saved contents of the file returned by the next call to
+ * emer_circular_file_new(). Each element in @data must be preceded by its
+ * length, as a guint64 in host byte order.
+ */
+void
+mock_circular_file_set_initial_data (GBytes *data)
+{
+  g_clear_pointer (&mock_circular_file_initial_data, g_bytes_unref);
+
+  if (data != NULL)
+    mock_circular_file_initial_data = g_bytes_ref (data);
+}
+
 gboolean
 mock_circular_file_got_reinitialize (void)
 {
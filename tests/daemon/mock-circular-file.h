@@ -30,6 +30,7 @@
 G_BEGIN_DECLS
 
 void                 mock_circular_file_set_construct_error     (const GError             *error);
+void                 mock_circular_file_set_initial_data        (GBytes                   *data);
 gboolean             mock_circular_file_got_reinitialize        (void);
 
 G_END_DECLS
@@ -34,6 +34,7 @@ typedef struct _EmerPersistentCachePrivate
 {
   gboolean reinitialize_cache;
   GPtrArray *variant_array;
+  guint num_stores;
 } EmerPersistentCachePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (EmerPersistentCache, emer_persistent_cache,
@@ -69,10 +70,10 @@ emer_persistent_cache_class_init (EmerPersistentCacheClass *klass)
 }
 
 EmerPersistentCache *
-emer_persistent_cache_new (const gchar *directory,
-                           guint64      cache_size,
-                           gboolean     reinitialize_cache,
-                           GError     **error)
+emer_persistent_cache_new (const gchar              *directory,
+                           guint64                   cache_size,
+                           EmerPersistentCacheFlags  flags,
+                           GError                  **error)
 {
   if (mock_persistent_cache_construct_error != NULL)
     {
@@ -85,17 +86,18 @@ emer_persistent_cache_new (const gchar *directory,
   EmerPersistentCachePrivate *priv =
     emer_persistent_cache_get_instance_private (self);
 
-  priv->reinitialize_cache = reinitialize_cache;
+  priv->reinitialize_cache =
+    (flags & EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE) != 0;
   return self;
 }
 
 EmerPersistentCache *
 emer_persistent_cache_new_full (const gchar              *directory,
                                 guint64                   cache_size,
+                                EmerPersistentCacheFlags  flags,
                                 EmerBootIdProvider       *boot_id_provider,
                                 EmerCacheVersionProvider *version_provider,
                                 guint                     boot_offset_update_interval,
-                                gboolean                  reinitialize_cache,
                                 GError                  **error)
 {
   g_return_val_if_reached (NULL);
@@ -127,14 +129,17 @@ emer_persistent_cache_store (EmerPersistentCache *self,
   EmerPersistentCachePrivate *priv =
     emer_persistent_cache_get_instance_private (self);
 
-  for (gsize i = 0; priv->variant_array->len < MAX_NUM_VARIANTS &&
+  priv->num_stores++;
+
+  gsize i;
+  for (i = 0; priv->variant_array->len < MAX_NUM_VARIANTS &&
        i < num_variants; i++)
     {
       g_variant_ref_sink (variants[i]);
       g_ptr_array_add (priv->variant_array, variants[i]);
     }
 
-  *num_variants_stored = num_variants;
+  *num_variants_stored = i;
 
   return TRUE;
 }
@@ -211,6 +216,15 @@ emer_persistent_cache_remove_all (EmerPersistentCache *self,
   return TRUE;
 }
 
+gdouble
+emer_persistent_cache_get_fill_ratio (EmerPersistentCache *self)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  return (gdouble) priv->variant_array->len / MAX_NUM_VARIANTS;
+}
+
 gboolean
 mock_persistent_cache_is_empty (EmerPersistentCache *self)
 {
@@ -220,6 +234,18 @@ mock_persistent_cache_is_empty (EmerPersistentCache *self)
   return priv->variant_array->len == 0;
 }
 
+/* Returns the number of times emer_persistent_cache_store() has been called,
+ * each of which would be a write to disk.
+ */
+guint
+mock_persistent_cache_get_num_stores (EmerPersistentCache *self)
+{
+  EmerPersistentCachePrivate *priv =
+    emer_persistent_cache_get_instance_private (self);
+
+  return priv->num_stores;
+}
+
 /* Sets an error to raise from the next call to emer_persistent_cache_new().
  */
 void
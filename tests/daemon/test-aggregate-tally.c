@@ -244,6 +244,169 @@ test_aggregate_tally_iter (struct Fixture *fixture,
   g_assert_cmpuint (events->len, ==, 0);
 }
 
+/* Increments added with emer_aggregate_tally_add_event() should be coalesced
+ * in memory, and be visible to iteration without an explicit flush.
+ */
+static void
+test_aggregate_tally_add_event (struct Fixture *fixture,
+                                gconstpointer   payload_str)
+{
+  g_autoptr(GDateTime) datetime = g_date_time_new_utc (2021, 9, 22, 0, 0, 0);
+  g_autoptr(GVariant) payload = v_str (payload_str);
+  g_autoptr(GPtrArray) events = g_ptr_array_new_with_free_func (aggregate_event_free);
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      emer_aggregate_tally_add_event (fixture->tally,
+                                      EMER_TALLY_DAILY_EVENTS,
+                                      1001,
+                                      uuids[i % 2],
+                                      payload,
+                                      1,
+                                      datetime);
+    }
+
+  /* Mixing in an immediate store must not lose either increment */
+  g_autoptr(GError) error = NULL;
+  emer_aggregate_tally_store_event (fixture->tally,
+                                    EMER_TALLY_DAILY_EVENTS,
+                                    1001,
+                                    uuids[0],
+                                    payload,
+                                    5,
+                                    datetime,
+                                    &error);
+  g_assert_no_error (error);
+
+  emer_aggregate_tally_iter (fixture->tally,
+                             EMER_TALLY_DAILY_EVENTS,
+                             datetime,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             tally_iter_func,
+                             events);
+
+  g_assert_cmpuint (events->len, ==, 2);
+  for (i = 0; i < 2; i++)
+    {
+      AggregateEvent *e = g_ptr_array_index (events, i);
+      gboolean is_first = uuid_compare (e->event_id, uuids[0]) == 0;
+
+      g_assert_cmpuint (e->counter, ==, is_first ? 505 : 500);
+      g_assert_cmpuint (e->unix_user_id, ==, 1001);
+      g_assert_cmpstr (e->date, ==, "2021-09-22");
+      if (payload_str == NULL)
+        g_assert_null (e->payload);
+      else
+        g_assert_cmpvariant (e->payload, payload);
+    }
+}
+
+/* Pending increments should be written out when the tally is finalized. */
+static void
+test_aggregate_tally_add_event_flushed_on_finalize (struct Fixture *fixture,
+                                                    gconstpointer   dontuseme)
+{
+  g_autoptr(GDateTime) datetime = g_date_time_new_utc (2021, 9, 22, 0, 0, 0);
+  g_autoptr(GVariant) payload = v_str (G_STRFUNC);
+  g_autoptr(GPtrArray) events = g_ptr_array_new_with_free_func (aggregate_event_free);
+
+  emer_aggregate_tally_add_event (fixture->tally,
+                                  EMER_TALLY_MONTHLY_EVENTS,
+                                  1001,
+                                  uuids[2],
+                                  payload,
+                                  G_MAXUINT32,
+                                  datetime);
+  emer_aggregate_tally_add_event (fixture->tally,
+                                  EMER_TALLY_MONTHLY_EVENTS,
+                                  1001,
+                                  uuids[2],
+                                  payload,
+                                  G_MAXUINT32,
+                                  datetime);
+
+  teardown (fixture, dontuseme);
+  setup (fixture, dontuseme);
+
+  emer_aggregate_tally_iter (fixture->tally,
+                             EMER_TALLY_MONTHLY_EVENTS,
+                             datetime,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             tally_iter_func,
+                             events);
+
+  g_assert_cmpuint (events->len, ==, 1);
+  AggregateEvent *e = g_ptr_array_index (events, 0);
+  g_assert_cmpuint (e->counter, ==, G_MAXUINT32);
+  g_assert_cmpstr (e->date, ==, "2021-09");
+}
+
+/* Clearing the tally should also discard pending increments. */
+static void
+test_aggregate_tally_clear_discards_pending (struct Fixture *fixture,
+                                             gconstpointer   dontuseme)
+{
+  g_autoptr(GDateTime) datetime = g_date_time_new_utc (2021, 9, 22, 0, 0, 0);
+  g_autoptr(GPtrArray) events = g_ptr_array_new_with_free_func (aggregate_event_free);
+  g_autoptr(GError) error = NULL;
+
+  emer_aggregate_tally_add_event (fixture->tally,
+                                  EMER_TALLY_DAILY_EVENTS,
+                                  1001,
+                                  uuids[0],
+                                  NULL,
+                                  1,
+                                  datetime);
+
+  emer_aggregate_tally_clear (fixture->tally, &error);
+  g_assert_no_error (error);
+
+  emer_aggregate_tally_iter (fixture->tally,
+                             EMER_TALLY_DAILY_EVENTS,
+                             datetime,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             tally_iter_func,
+                             events);
+  g_assert_cmpuint (events->len, ==, 0);
+}
+
+/* Releasing memory should write out pending increments rather than drop
+ * them.
+ */
+static void
+test_aggregate_tally_release_memory (struct Fixture *fixture,
+                                     gconstpointer   dontuseme)
+{
+  g_autoptr(GDateTime) datetime = g_date_time_new_utc (2021, 9, 22, 0, 0, 0);
+  g_autoptr(GVariant) payload = v_str (G_STRFUNC);
+  g_autoptr(GPtrArray) events = g_ptr_array_new_with_free_func (aggregate_event_free);
+
+  gsize initial_usage = emer_aggregate_tally_get_memory_usage (fixture->tally);
+
+  emer_aggregate_tally_add_event (fixture->tally,
+                                  EMER_TALLY_DAILY_EVENTS,
+                                  1001,
+                                  uuids[0],
+                                  payload,
+                                  3,
+                                  datetime);
+  g_assert_cmpuint (emer_aggregate_tally_get_memory_usage (fixture->tally), >,
+                    initial_usage);
+
+  emer_aggregate_tally_release_memory (fixture->tally);
+
+  emer_aggregate_tally_iter (fixture->tally,
+                             EMER_TALLY_DAILY_EVENTS,
+                             datetime,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             tally_iter_func,
+                             events);
+  g_assert_cmpuint (events->len, ==, 1);
+  AggregateEvent *e = g_ptr_array_index (events, 0);
+  g_assert_cmpuint (e->counter, ==, 3);
+}
+
 static void
 test_aggregate_tally_permutations (struct Fixture *fixture,
                                    gconstpointer   data)
@@ -634,6 +797,24 @@ main (gint                argc,
               test_aggregate_tally_iter,
               teardown);
 
+  g_test_add ("/aggregate-tally/add-event/null-payload",
+              struct Fixture,
+              NULL,
+              setup,
+              test_aggregate_tally_add_event,
+              teardown);
+  g_test_add ("/aggregate-tally/add-event/nonnull-payload",
+              struct Fixture,
+              "a hot counter",
+              setup,
+              test_aggregate_tally_add_event,
+              teardown);
+  ADD_AGGREGATE_TALLY_TEST_FUNC ("/aggregate-tally/add-event/flushed-on-finalize",
+                                 test_aggregate_tally_add_event_flushed_on_finalize);
+  ADD_AGGREGATE_TALLY_TEST_FUNC ("/aggregate-tally/add-event/clear-discards-pending",
+                                 test_aggregate_tally_clear_discards_pending);
+  ADD_AGGREGATE_TALLY_TEST_FUNC ("/aggregate-tally/release-memory",
+                                 test_aggregate_tally_release_memory);
   ADD_AGGREGATE_TALLY_TEST_FUNC ("/aggregate-tally/permutations",
                                  test_aggregate_tally_permutations);
   ADD_AGGREGATE_TALLY_TEST_FUNC ("/aggregate-tally/large-counter/single",
@@ -0,0 +1,329 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-persistent-cache.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "emer-boot-id-provider.h"
+#include "emer-cache-version-provider.h"
+#include "emer-circular-file.h"
+
+/* These tests migrate caches stored in real circular files, rather than the
+ * mock circular file used by test-persistent-cache, so that the time taken to
+ * migrate a full cache includes the disk I/O.
+ */
+
+#define VARIANT_FILENAME "variants.dat"
+#define CACHE_VERSION_FILENAME "local_version_file"
+
+/* The size of the cache unless cache-size.conf says otherwise. */
+#define FULL_CACHE_SIZE G_GUINT64_CONSTANT (10000000)
+
+#define SMALL_CACHE_SIZE G_GUINT64_CONSTANT (1000000)
+
+#define TEST_UPDATE_OFFSET_INTERVAL (60u * 60u)
+
+static const guchar EVENT_ID[] = {
+  0x5f, 0xae, 0x6b, 0x99, 0x2c, 0x4f, 0x4d, 0x51,
+  0x8d, 0x34, 0x6d, 0x6b, 0xa9, 0x6e, 0x1b, 0x02,
+};
+
+typedef struct
+{
+  gchar *cache_dir;
+} Fixture;
+
+static void
+setup (Fixture      *fixture,
+       gconstpointer unused)
+{
+  g_autoptr(GError) error = NULL;
+  fixture->cache_dir = g_dir_make_tmp ("cache-migration-XXXXXX", &error);
+  g_assert_no_error (error);
+}
+
+/* Deletes the directory at the given path, and everything in it. */
+static void
+remove_directory (const gchar *dir_path)
+{
+  g_autoptr(GDir) dir = g_dir_open (dir_path, 0, NULL);
+  const gchar *name;
+  while (dir != NULL && (name = g_dir_read_name (dir)) != NULL)
+    {
+      g_autofree gchar *path = g_build_filename (dir_path, name, NULL);
+      if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        remove_directory (path);
+      else
+        g_unlink (path);
+    }
+
+  g_rmdir (dir_path);
+}
+
+static void
+teardown (Fixture      *fixture,
+          gconstpointer unused)
+{
+  remove_directory (fixture->cache_dir);
+  g_free (fixture->cache_dir);
+}
+
+/* Returns a singular event with a payload of about the usual size, serialized
+ * as the daemon stores it.
+ */
+static GVariant *
+make_event (void)
+{
+  g_autofree gchar *payload = g_strnfill (100, 'x');
+  GVariant *event_id =
+    g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, EVENT_ID,
+                               G_N_ELEMENTS (EVENT_ID), sizeof (guchar));
+  g_autoptr(GVariant) event =
+    g_variant_ref_sink (g_variant_new ("(@aysxmv)", event_id, "5.0.0",
+                                       G_GINT64_CONSTANT (123456789),
+                                       g_variant_new_string (payload)));
+
+  return G_BYTE_ORDER == G_LITTLE_ENDIAN ? g_variant_get_normal_form (event) :
+                                           g_variant_byteswap (event);
+}
+
+/* Fills the variant file in the cache directory with version 5 elements, each
+ * holding the given event, and records the cache version as 5. Returns the
+ * number of elements written.
+ */
+static gsize
+write_version_5_cache (Fixture  *fixture,
+                       guint64   max_size,
+                       GVariant *event)
+{
+  g_autofree gchar *variant_path =
+    g_build_filename (fixture->cache_dir, VARIANT_FILENAME, NULL);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(EmerCircularFile) variant_file =
+    emer_circular_file_new (variant_path, max_size, FALSE, &error);
+  g_assert_no_error (error);
+
+  /* In version 5, each element was a variant's type string and its
+   * little-endian serialization, with nothing in between. */
+  const gchar *type_string = g_variant_get_type_string (event);
+  gsize type_length = strlen (type_string) + 1;
+  gsize elem_size = type_length + g_variant_get_size (event);
+  g_autofree guint8 *elem = g_malloc (elem_size);
+  memcpy (elem, type_string, type_length);
+  memcpy (elem + type_length, g_variant_get_data (event),
+          g_variant_get_size (event));
+
+  gsize num_elems = 0;
+  while (emer_circular_file_append (variant_file, elem, elem_size))
+    {
+      /* Save as we go, so that the whole file isn't held in memory. */
+      if (++num_elems % 1000 == 0)
+        {
+          emer_circular_file_save (variant_file, &error);
+          g_assert_no_error (error);
+        }
+    }
+
+  emer_circular_file_save (variant_file, &error);
+  g_assert_no_error (error);
+
+  g_autofree gchar *version_path =
+    g_build_filename (fixture->cache_dir, CACHE_VERSION_FILENAME, NULL);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (version_path);
+  emer_cache_version_provider_set_version (cache_version_provider, 5, &error);
+  g_assert_no_error (error);
+
+  return num_elems;
+}
+
+static EmerPersistentCache *
+make_cache (Fixture                  *fixture,
+            guint64                   max_size,
+            EmerPersistentCacheFlags  flags)
+{
+  g_autoptr(EmerBootIdProvider) boot_id_provider =
+    emer_boot_id_provider_new ();
+  g_autofree gchar *version_path =
+    g_build_filename (fixture->cache_dir, CACHE_VERSION_FILENAME, NULL);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (version_path);
+  g_autoptr(GError) error = NULL;
+  EmerPersistentCache *cache =
+    emer_persistent_cache_new_full (fixture->cache_dir, max_size, flags,
+                                    boot_id_provider, cache_version_provider,
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  gint version;
+  g_assert_true (emer_cache_version_provider_get_version (cache_version_provider,
+                                                          &version));
+  g_assert_cmpint (version, >, 5);
+
+  return cache;
+}
+
+/* Writes the variant file in the cache directory to disk and drops it from the
+ * page cache, so that the next read of it comes from the disk.
+ */
+static void
+evict_variant_file (Fixture *fixture)
+{
+  g_autofree gchar *variant_path =
+    g_build_filename (fixture->cache_dir, VARIANT_FILENAME, NULL);
+  int fd = g_open (variant_path, O_RDONLY, 0);
+  g_assert_cmpint (fd, >=, 0);
+  g_assert_cmpint (fdatasync (fd), ==, 0);
+  g_assert_cmpint (posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED), ==, 0);
+  close (fd);
+}
+
+static glong
+get_peak_rss_kib (void)
+{
+  struct rusage usage;
+  g_assert_cmpint (getrusage (RUSAGE_SELF, &usage), ==, 0);
+  return usage.ru_maxrss;
+}
+
+/* Asserts that the cache holds num_events copies of the given event and
+ * nothing else.
+ */
+static void
+assert_cache_holds_events (EmerPersistentCache *cache,
+                           GVariant            *event,
+                           gsize                num_events)
+{
+  GVariant **variants;
+  gsize num_variants;
+  guint64 token;
+  gboolean has_invalid;
+  g_autoptr(GError) error = NULL;
+  emer_persistent_cache_read (cache, &variants, G_MAXSIZE, &num_variants,
+                              &token, &has_invalid, &error);
+  g_assert_no_error (error);
+  g_assert_false (has_invalid);
+  g_assert_cmpuint (num_variants, ==, num_events);
+
+  for (gsize i = 0; i < num_variants; i++)
+    {
+      g_assert_true (g_variant_equal (variants[i], event));
+      g_variant_unref (variants[i]);
+    }
+
+  g_free (variants);
+}
+
+static void
+test_cache_migration_migrates_every_event (Fixture      *fixture,
+                                           gconstpointer unused)
+{
+  g_autoptr(GVariant) event = make_event ();
+  gsize num_events = write_version_5_cache (fixture, SMALL_CACHE_SIZE, event);
+  EmerPersistentCache *cache = make_cache (fixture, SMALL_CACHE_SIZE,
+                                           EMER_PERSISTENT_CACHE_FLAG_DEFAULT);
+
+  assert_cache_holds_events (cache, event, num_events);
+  g_object_unref (cache);
+}
+
+/* Switching to segmented mode moves every event out of the circular file,
+ * which is then deleted.
+ */
+static void
+test_cache_migration_migrates_to_segmented (Fixture      *fixture,
+                                            gconstpointer unused)
+{
+  g_autoptr(GVariant) event = make_event ();
+  gsize num_events = write_version_5_cache (fixture, SMALL_CACHE_SIZE, event);
+  EmerPersistentCache *cache = make_cache (fixture, SMALL_CACHE_SIZE,
+                                           EMER_PERSISTENT_CACHE_FLAG_SEGMENTED);
+
+  g_autofree gchar *variant_path =
+    g_build_filename (fixture->cache_dir, VARIANT_FILENAME, NULL);
+  g_assert_false (g_file_test (variant_path, G_FILE_TEST_EXISTS));
+
+  assert_cache_holds_events (cache, event, num_events);
+  g_object_unref (cache);
+}
+
+/* Reports how long it takes to migrate a full cache from version 5. The cache
+ * is evicted from the page cache beforehand, so the time includes reading it
+ * from the disk; run with TMPDIR on the storage to be measured, such as eMMC.
+ * Only run in performance mode (-m perf).
+ */
+static void
+test_cache_migration_full_cache_time (Fixture      *fixture,
+                                      gconstpointer unused)
+{
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  g_autoptr(GVariant) event = make_event ();
+  gsize num_events = write_version_5_cache (fixture, FULL_CACHE_SIZE, event);
+  evict_variant_file (fixture);
+
+  glong peak_rss_before = get_peak_rss_kib ();
+  g_autoptr(GTimer) timer = g_timer_new ();
+  EmerPersistentCache *cache = make_cache (fixture, FULL_CACHE_SIZE,
+                                           EMER_PERSISTENT_CACHE_FLAG_DEFAULT);
+  gdouble elapsed = g_timer_elapsed (timer, NULL);
+  g_object_unref (cache);
+
+  g_test_minimized_result (elapsed,
+                           "%" G_GSIZE_FORMAT " events migrated in %.3f "
+                           "seconds", num_events, elapsed);
+  g_test_message ("Peak resident memory grew by %ld KiB during the migration",
+                  get_peak_rss_kib () - peak_rss_before);
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+#define ADD_MIGRATION_TEST_FUNC(path, func) \
+  g_test_add ((path), Fixture, NULL, setup, (func), teardown)
+
+  ADD_MIGRATION_TEST_FUNC ("/cache-migration/migrates-every-event",
+                           test_cache_migration_migrates_every_event);
+  ADD_MIGRATION_TEST_FUNC ("/cache-migration/migrates-to-segmented",
+                           test_cache_migration_migrates_to_segmented);
+  ADD_MIGRATION_TEST_FUNC ("/cache-migration/full-cache-time",
+                           test_cache_migration_full_cache_time);
+#undef ADD_MIGRATION_TEST_FUNC
+
+  return g_test_run ();
+}
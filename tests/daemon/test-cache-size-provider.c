@@ -172,6 +172,56 @@ test_cache_size_provider_recovers_if_corrupt_garbage (Fixture      *fixture,
   g_test_assert_expected_messages ();
 }
 
+static void
+test_cache_size_provider_can_get_compressed (Fixture      *fixture,
+                                             gconstpointer unused)
+{
+  write_cache_size_file (fixture, FIRST_CACHE_SIZE_FILE_CONTENTS, -1);
+  g_assert_false (emer_cache_size_provider_get_compressed (fixture->tmp_path));
+
+  write_cache_size_file (fixture,
+                         "[persistent_cache_size]\n"
+                         "maximum=40\n"
+                         "compressed=true\n", -1);
+  g_assert_true (emer_cache_size_provider_get_compressed (fixture->tmp_path));
+
+  g_assert_false (emer_cache_size_provider_get_compressed ("/nonexistent"));
+}
+
+static void
+test_cache_size_provider_can_get_store_batches (Fixture      *fixture,
+                                                gconstpointer unused)
+{
+  write_cache_size_file (fixture, FIRST_CACHE_SIZE_FILE_CONTENTS, -1);
+  g_assert_false (emer_cache_size_provider_get_store_batches (fixture->tmp_path));
+
+  write_cache_size_file (fixture,
+                         "[persistent_cache_size]\n"
+                         "maximum=40\n"
+                         "store_batches=true\n", -1);
+  g_assert_true (emer_cache_size_provider_get_store_batches (fixture->tmp_path));
+  g_assert_false (emer_cache_size_provider_get_compressed (fixture->tmp_path));
+
+  g_assert_false (emer_cache_size_provider_get_store_batches ("/nonexistent"));
+}
+
+static void
+test_cache_size_provider_can_get_segmented (Fixture      *fixture,
+                                            gconstpointer unused)
+{
+  write_cache_size_file (fixture, FIRST_CACHE_SIZE_FILE_CONTENTS, -1);
+  g_assert_false (emer_cache_size_provider_get_segmented (fixture->tmp_path));
+
+  write_cache_size_file (fixture,
+                         "[persistent_cache_size]\n"
+                         "maximum=40\n"
+                         "segmented=true\n", -1);
+  g_assert_true (emer_cache_size_provider_get_segmented (fixture->tmp_path));
+  g_assert_false (emer_cache_size_provider_get_compressed (fixture->tmp_path));
+
+  g_assert_false (emer_cache_size_provider_get_segmented ("/nonexistent"));
+}
+
 gint
 main (gint                argc,
       const gchar * const argv[])
@@ -184,6 +234,12 @@ main (gint                argc,
 
   ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/can-get-max-cache-size",
                             test_cache_size_provider_can_get_max_cache_size);
+  ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/can-get-compressed",
+                            test_cache_size_provider_can_get_compressed);
+  ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/can-get-store-batches",
+                            test_cache_size_provider_can_get_store_batches);
+  ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/can-get-segmented",
+                            test_cache_size_provider_can_get_segmented);
   ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/writes-file-if-missing",
                             test_cache_size_provider_writes_file_if_missing);
   ADD_CACHE_SIZE_TEST_FUNC ("/cache-size-provider/recovers-if-corrupt/empty",
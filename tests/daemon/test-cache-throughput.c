@@ -0,0 +1,366 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-persistent-cache.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "emer-boot-id-provider.h"
+#include "emer-cache-record.h"
+#include "emer-cache-version-provider.h"
+#include "emer-circular-file.h"
+
+/* These tests store events in caches backed by real circular and segmented
+ * files, rather than the mock circular file used by test-persistent-cache, so
+ * that the rate at which events can be stored includes the checksums and disk
+ * I/O.
+ */
+
+#define CACHE_VERSION_FILENAME "local_version_file"
+
+/* The size of the cache unless cache-size.conf says otherwise. */
+#define FULL_CACHE_SIZE G_GUINT64_CONSTANT (10000000)
+
+#define SMALL_CACHE_SIZE G_GUINT64_CONSTANT (1000000)
+
+#define TEST_UPDATE_OFFSET_INTERVAL (60u * 60u)
+
+static const guchar EVENT_ID[] = {
+  0x5f, 0xae, 0x6b, 0x99, 0x2c, 0x4f, 0x4d, 0x51,
+  0x8d, 0x34, 0x6d, 0x6b, 0xa9, 0x6e, 0x1b, 0x02,
+};
+
+typedef struct
+{
+  gchar *cache_dir;
+} Fixture;
+
+static void
+setup (Fixture      *fixture,
+       gconstpointer unused)
+{
+  g_autoptr(GError) error = NULL;
+  fixture->cache_dir = g_dir_make_tmp ("cache-throughput-XXXXXX", &error);
+  g_assert_no_error (error);
+}
+
+/* Deletes the directory at the given path, and everything in it. */
+static void
+remove_directory (const gchar *dir_path)
+{
+  g_autoptr(GDir) dir = g_dir_open (dir_path, 0, NULL);
+  const gchar *name;
+  while (dir != NULL && (name = g_dir_read_name (dir)) != NULL)
+    {
+      g_autofree gchar *path = g_build_filename (dir_path, name, NULL);
+      if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        remove_directory (path);
+      else
+        g_unlink (path);
+    }
+
+  g_rmdir (dir_path);
+}
+
+static void
+teardown (Fixture      *fixture,
+          gconstpointer unused)
+{
+  remove_directory (fixture->cache_dir);
+  g_free (fixture->cache_dir);
+}
+
+/* Returns a singular event with a payload of about the usual size, serialized
+ * as it arrives from the daemon's buffer rather than in tree form.
+ */
+static GVariant *
+make_event (void)
+{
+  g_autofree gchar *payload = g_strnfill (200, 'x');
+  GVariant *event_id =
+    g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, EVENT_ID,
+                               G_N_ELEMENTS (EVENT_ID), sizeof (guchar));
+  g_autoptr(GVariant) event =
+    g_variant_ref_sink (g_variant_new ("(@aysxmv)", event_id, "5.0.0",
+                                       G_GINT64_CONSTANT (123456789),
+                                       g_variant_new_string (payload)));
+
+  return g_variant_get_normal_form (event);
+}
+
+static EmerPersistentCache *
+make_cache (Fixture                  *fixture,
+            guint64                   max_size,
+            EmerPersistentCacheFlags  flags)
+{
+  g_autoptr(EmerBootIdProvider) boot_id_provider =
+    emer_boot_id_provider_new ();
+  g_autofree gchar *version_path =
+    g_build_filename (fixture->cache_dir, CACHE_VERSION_FILENAME, NULL);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (version_path);
+  g_autoptr(GError) error = NULL;
+  EmerPersistentCache *cache =
+    emer_persistent_cache_new_full (fixture->cache_dir, max_size, flags,
+                                    boot_id_provider, cache_version_provider,
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  return cache;
+}
+
+/* Stores copies of @event in @cache until it is full, and returns the number
+ * stored.
+ */
+static gsize
+fill_cache (EmerPersistentCache *cache,
+            GVariant            *event,
+            guint64              max_size)
+{
+  gsize num_variants = max_size / emer_persistent_cache_cost (event);
+  g_autofree GVariant **variants = g_new0 (GVariant *, num_variants);
+  for (gsize i = 0; i < num_variants; i++)
+    variants[i] = event;
+
+  g_autoptr(GError) error = NULL;
+  gsize num_variants_stored;
+  gboolean store_succeeded =
+    emer_persistent_cache_store (cache, variants, num_variants,
+                                 &num_variants_stored, &error);
+  g_assert_no_error (error);
+  g_assert_true (store_succeeded);
+  g_assert_cmpuint (num_variants_stored, >, 0);
+
+  return num_variants_stored;
+}
+
+/* A cache which is filled, read back and emptied again should hold every
+ * event stored each time.
+ */
+static void
+test_cache_throughput_refills (Fixture      *fixture,
+                               gconstpointer user_data)
+{
+  EmerPersistentCacheFlags flags = GPOINTER_TO_INT (user_data);
+  g_autoptr(GVariant) event = make_event ();
+  EmerPersistentCache *cache = make_cache (fixture, SMALL_CACHE_SIZE, flags);
+
+  for (gint i = 0; i < 3; i++)
+    {
+      gsize num_stored = fill_cache (cache, event, SMALL_CACHE_SIZE);
+
+      GVariant **variants;
+      gsize num_variants;
+      guint64 token;
+      gboolean has_invalid;
+      g_autoptr(GError) error = NULL;
+      emer_persistent_cache_read (cache, &variants, G_MAXSIZE, &num_variants,
+                                  &token, &has_invalid, &error);
+      g_assert_no_error (error);
+      g_assert_false (has_invalid);
+      g_assert_cmpuint (num_variants, ==, num_stored);
+
+      for (gsize j = 0; j < num_variants; j++)
+        {
+          g_assert_true (g_variant_equal (variants[j], event));
+          g_variant_unref (variants[j]);
+        }
+
+      g_free (variants);
+
+      emer_persistent_cache_remove_all (cache, &error);
+      g_assert_no_error (error);
+    }
+
+  g_object_unref (cache);
+}
+
+/* Reports how many events per second can be stored, filling and emptying a
+ * full-sized cache repeatedly for about a second. Run with TMPDIR on the
+ * storage to be measured, such as eMMC. Only run in performance mode
+ * (-m perf).
+ */
+static void
+test_cache_throughput_store (Fixture      *fixture,
+                             gconstpointer user_data)
+{
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  EmerPersistentCacheFlags flags = GPOINTER_TO_INT (user_data);
+  g_autoptr(GVariant) event = make_event ();
+  EmerPersistentCache *cache = make_cache (fixture, FULL_CACHE_SIZE, flags);
+
+  g_autoptr(GTimer) timer = g_timer_new ();
+  guint64 total_stored = 0;
+  do
+    {
+      total_stored += fill_cache (cache, event, FULL_CACHE_SIZE);
+
+      g_autoptr(GError) error = NULL;
+      emer_persistent_cache_remove_all (cache, &error);
+      g_assert_no_error (error);
+    }
+  while (g_timer_elapsed (timer, NULL) < 1.0);
+
+  gdouble events_per_second = total_stored / g_timer_elapsed (timer, NULL);
+  g_test_maximized_result (events_per_second,
+                           "%.0f events of %" G_GSIZE_FORMAT " bytes stored "
+                           "per second", events_per_second,
+                           g_variant_get_size (event));
+
+  g_object_unref (cache);
+}
+
+/* Appends records holding event to store until it is full, as
+ * emer_persistent_cache_store does, and returns the number appended. If
+ * copy_first is TRUE, each record is built in a separate buffer and then
+ * copied into the store, as emer_persistent_cache_store did before it
+ * serialized events straight into the store's write buffer; otherwise, each
+ * is serialized straight into the space reserved for it.
+ */
+static gsize
+append_until_full (EmerElementStore *store,
+                   GVariant         *event,
+                   gboolean          copy_first)
+{
+  /* A singular event's record header is just its kind. */
+  const gchar *type_string = g_variant_get_type_string (event);
+  gsize header_size = emer_cache_record_header_size (type_string);
+  g_assert_cmpuint (header_size, ==, 1);
+  gsize record_size = header_size + g_variant_get_size (event);
+  g_autofree guint8 *buffer = g_malloc (record_size);
+
+  gsize num_appended = 0;
+  while (TRUE)
+    {
+      guint8 *record = copy_first ? buffer :
+        emer_element_store_reserve (store, record_size);
+      if (record == NULL)
+        break;
+
+      record[0] = emer_cache_record_kind_from_type_string (type_string);
+      g_variant_store (event, record + header_size);
+
+      if (copy_first)
+        {
+          if (!emer_element_store_append (store, record, record_size))
+            break;
+        }
+      else
+        {
+          emer_element_store_commit (store);
+        }
+
+      num_appended++;
+    }
+
+  g_autoptr(GError) error = NULL;
+  emer_element_store_save (store, &error);
+  g_assert_no_error (error);
+
+  return num_appended;
+}
+
+/* Reports how many events per second can be appended to a full-sized circular
+ * file, either copied in from a separate buffer, which is the baseline, or
+ * serialized straight into its write buffer. Comparing the two shows what
+ * serializing in place saves, without the rest of the persistent cache. Only
+ * run in performance mode (-m perf).
+ */
+static void
+test_cache_throughput_append (Fixture      *fixture,
+                              gconstpointer user_data)
+{
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  gboolean copy_first = GPOINTER_TO_INT (user_data);
+  g_autoptr(GVariant) event = make_event ();
+  g_autofree gchar *path =
+    g_build_filename (fixture->cache_dir, "variant_data", NULL);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(EmerElementStore) store =
+    EMER_ELEMENT_STORE (emer_circular_file_new (path, FULL_CACHE_SIZE,
+                                                FALSE /* reinitialize */,
+                                                &error));
+  g_assert_no_error (error);
+
+  g_autoptr(GTimer) timer = g_timer_new ();
+  guint64 total_appended = 0;
+  do
+    {
+      total_appended += append_until_full (store, event, copy_first);
+
+      emer_element_store_purge (store, &error);
+      g_assert_no_error (error);
+    }
+  while (g_timer_elapsed (timer, NULL) < 1.0);
+
+  gdouble events_per_second = total_appended / g_timer_elapsed (timer, NULL);
+  g_test_maximized_result (events_per_second,
+                           "%.0f events of %" G_GSIZE_FORMAT " bytes appended "
+                           "per second, %s", events_per_second,
+                           g_variant_get_size (event),
+                           copy_first ? "copied from a buffer (baseline)" :
+                                        "serialized in place");
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+#define ADD_THROUGHPUT_TEST_FUNC(path, flags, func) \
+  g_test_add ((path), Fixture, GINT_TO_POINTER (flags), setup, (func), \
+              teardown)
+
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/circular/refills",
+                            EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
+                            test_cache_throughput_refills);
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/segmented/refills",
+                            EMER_PERSISTENT_CACHE_FLAG_SEGMENTED,
+                            test_cache_throughput_refills);
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/circular/store",
+                            EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
+                            test_cache_throughput_store);
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/segmented/store",
+                            EMER_PERSISTENT_CACHE_FLAG_SEGMENTED,
+                            test_cache_throughput_store);
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/circular/append/baseline", TRUE,
+                            test_cache_throughput_append);
+  ADD_THROUGHPUT_TEST_FUNC ("/cache-throughput/circular/append/in-place",
+                            FALSE, test_cache_throughput_append);
+#undef ADD_THROUGHPUT_TEST_FUNC
+
+  return g_test_run ();
+}
@@ -26,6 +26,13 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
+/* Each element is preceded on disk by its length and a checksum. */
+#define ELEM_HEADER_SIZE (2 * sizeof (guint32))
+
+/* The elements follow a header made up of two slots, each of this size. */
+#define HEADER_SLOT_SIZE 512
+#define FILE_HEADER_SIZE (2 * HEADER_SLOT_SIZE)
+
 typedef struct _Fixture
 {
   gchar *data_file_path;
@@ -51,10 +58,14 @@ teardown (Fixture      *fixture,
   g_unlink (fixture->data_file_path);
   gchar *metadata_file_path =
     g_strconcat (fixture->data_file_path, METADATA_EXTENSION, NULL);
+  gchar *temp_file_path =
+    g_strconcat (fixture->data_file_path, TEMP_EXTENSION, NULL);
   g_free (fixture->data_file_path);
 
   g_unlink (metadata_file_path);
   g_free (metadata_file_path);
+  g_unlink (temp_file_path);
+  g_free (temp_file_path);
 }
 
 static gsize
@@ -81,7 +92,7 @@ static guint64
 get_disk_size (const gchar *string)
 {
   gsize elem_size = get_elem_size (string);
-  return sizeof (guint64) + elem_size;
+  return ELEM_HEADER_SIZE + elem_size;
 }
 
 /* Returns the number of bytes the given array of strings will consume when
@@ -222,6 +233,21 @@ remove_strings_and_check (EmerCircularFile    *circular_file,
   g_assert_true (remove_succeeded);
 }
 
+/* Replaces the contents of the data file with the given contents. The
+ * circular file keeps its data file open, so the data file is written in
+ * place, rather than replaced by a new file as g_file_set_contents does.
+ */
+static void
+overwrite_data_file (Fixture     *fixture,
+                     const gchar *contents,
+                     gsize        length)
+{
+  GError *error = NULL;
+  g_file_set_contents_full (fixture->data_file_path, contents, length,
+                            G_FILE_SET_CONTENTS_NONE, 0666, &error);
+  g_assert_no_error (error);
+}
+
 static void
 purge_and_check_empty (EmerCircularFile *circular_file)
 {
@@ -368,6 +394,484 @@ test_circular_file_read_many (Fixture      *fixture,
   g_object_unref (circular_file);
 }
 
+static void
+test_circular_file_reserve (Fixture      *fixture,
+                            gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Happy", "Bashful", "Temple of Artemis" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  EmerCircularFile *circular_file =
+    make_minimal_circular_file (fixture, STRINGS, NUM_STRINGS);
+
+  for (gsize i = 0; i < NUM_STRINGS; i++)
+    {
+      gsize elem_size = get_elem_size (STRINGS[i]);
+      gpointer elem = emer_circular_file_reserve (circular_file, elem_size);
+      g_assert_nonnull (elem);
+      memcpy (elem, STRINGS[i], elem_size);
+      emer_circular_file_commit (circular_file);
+    }
+
+  /* The file is now exactly full. */
+  g_assert_null (emer_circular_file_reserve (circular_file, 0));
+
+  GError *error = NULL;
+  gboolean save_succeeded = emer_circular_file_save (circular_file, &error);
+  g_assert_no_error (error);
+  g_assert_true (save_succeeded);
+
+  read_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+
+  g_object_unref (circular_file);
+}
+
+/* An element which wraps around the end of the data file should be read back
+ * in one piece.
+ */
+static void
+test_circular_file_read_wrapped (Fixture      *fixture,
+                                 gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Mausoleum at Halicarnassus", "Sleepy" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  const gchar * const WRAPPED_STRINGS[] = { "Sleepy", "Colossus of Rhodes" };
+  gsize NUM_WRAPPED_STRINGS = G_N_ELEMENTS (WRAPPED_STRINGS);
+
+  /* Leave room at the end for the next element's header and a few bytes of
+   * its data, but not all of it. */
+  const guint64 SLACK = ELEM_HEADER_SIZE + 4;
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS) + SLACK;
+  g_assert_cmpuint (SLACK, <, get_disk_size (WRAPPED_STRINGS[1]));
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  remove_strings_and_check (circular_file, STRINGS, 1);
+  append_strings_and_check (circular_file, WRAPPED_STRINGS + 1, 1);
+  read_strings_and_check (circular_file, WRAPPED_STRINGS, NUM_WRAPPED_STRINGS);
+
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_skips_damaged_elem (Fixture      *fixture,
+                                       gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Lighthouse", "of", "Alexandria" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  const gchar * const INTACT_STRINGS[] = { "Lighthouse", "Alexandria" };
+  EmerCircularFile *circular_file =
+    make_minimal_circular_file (fixture, STRINGS, NUM_STRINGS);
+
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+
+  /* Flip a bit in the middle element's data. */
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  GError *error = NULL;
+  g_file_get_contents (fixture->data_file_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[FILE_HEADER_SIZE + get_disk_size (STRINGS[0]) +
+           ELEM_HEADER_SIZE] ^= 0x10;
+  overwrite_data_file (fixture, contents, length);
+
+  GBytes **elems;
+  gsize num_elems;
+  guint64 token;
+  gboolean has_invalid;
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Skipping * bytes of invalid data*");
+  gboolean read_succeeded =
+    emer_circular_file_read (circular_file, &elems, G_MAXSIZE, &num_elems,
+                             &token, &has_invalid, &error);
+  g_test_assert_expected_messages ();
+
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_true (has_invalid);
+  g_assert_cmpuint (num_elems, ==, G_N_ELEMENTS (INTACT_STRINGS));
+  for (gsize i = 0; i < num_elems; i++)
+    {
+      g_assert_cmpstr (g_bytes_get_data (elems[i], NULL), ==,
+                       INTACT_STRINGS[i]);
+      g_bytes_unref (elems[i]);
+    }
+  g_free (elems);
+
+  /* The damaged element is removed along with the others. */
+  g_assert_cmpuint (token, ==, get_total_disk_size (STRINGS, NUM_STRINGS));
+  g_assert_false (emer_circular_file_has_more (circular_file, token));
+  gboolean remove_succeeded =
+    emer_circular_file_remove (circular_file, token, &error);
+  g_assert_no_error (error);
+  g_assert_true (remove_succeeded);
+  assert_circular_file_is_empty (circular_file);
+
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_discards_damaged_tail (Fixture      *fixture,
+                                          gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Temple", "of", "Artemis" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  EmerCircularFile *circular_file =
+    make_minimal_circular_file (fixture, STRINGS, NUM_STRINGS);
+
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+
+  /* Flip a bit in the last element's checksum. */
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  GError *error = NULL;
+  g_file_get_contents (fixture->data_file_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[FILE_HEADER_SIZE + get_total_disk_size (STRINGS, NUM_STRINGS - 1) +
+           sizeof (guint32)] ^= 0x01;
+  overwrite_data_file (fixture, contents, length);
+
+  GBytes **elems;
+  gsize num_elems;
+  guint64 token;
+  gboolean has_invalid;
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Discarding invalid data*");
+  gboolean read_succeeded =
+    emer_circular_file_read (circular_file, &elems, G_MAXSIZE, &num_elems,
+                             &token, &has_invalid, &error);
+  g_test_assert_expected_messages ();
+
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_true (has_invalid);
+  g_assert_cmpuint (num_elems, ==, NUM_STRINGS - 1);
+  for (gsize i = 0; i < num_elems; i++)
+    g_bytes_unref (elems[i]);
+  g_free (elems);
+
+  /* The damaged element is no longer part of the file. */
+  g_assert_cmpuint (token, ==, get_total_disk_size (STRINGS, NUM_STRINGS - 1));
+  g_assert_false (emer_circular_file_has_more (circular_file, token));
+  read_strings_and_check (circular_file, STRINGS, NUM_STRINGS - 1);
+
+  g_object_unref (circular_file);
+}
+
+/* An intact element left over from an earlier lap around the file should not
+ * be read in place of one which never reached the disk.
+ */
+static void
+test_circular_file_ignores_stale_elem (Fixture      *fixture,
+                                       gconstpointer unused)
+{
+  const gchar * const OLD_STRINGS[] = { "Olympia", "Babylon" };
+  const gchar * const NEW_STRINGS[] = { "Ephesus", "Memphis" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (OLD_STRINGS);
+  EmerCircularFile *circular_file =
+    make_minimal_circular_file (fixture, OLD_STRINGS, NUM_STRINGS);
+  gsize first_disk_size = get_disk_size (OLD_STRINGS[0]);
+  g_assert_cmpuint (get_disk_size (NEW_STRINGS[0]), ==, first_disk_size);
+
+  append_strings_and_check (circular_file, OLD_STRINGS, NUM_STRINGS);
+  g_autofree gchar *old_contents = NULL;
+  GError *error = NULL;
+  g_file_get_contents (fixture->data_file_path, &old_contents, NULL, &error);
+  g_assert_no_error (error);
+
+  /* The new elements take the place of the old ones. */
+  remove_strings_and_check (circular_file, OLD_STRINGS, NUM_STRINGS);
+  append_strings_and_check (circular_file, NEW_STRINGS, NUM_STRINGS);
+
+  /* Put the last old element back, as if the last new one had never been
+   * written. */
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  g_file_get_contents (fixture->data_file_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  gsize last_offset = FILE_HEADER_SIZE + first_disk_size;
+  memcpy (contents + last_offset, old_contents + last_offset,
+          get_disk_size (OLD_STRINGS[1]));
+  overwrite_data_file (fixture, contents, length);
+
+  GBytes **elems;
+  gsize num_elems;
+  guint64 token;
+  gboolean has_invalid;
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Discarding invalid data*");
+  gboolean read_succeeded =
+    emer_circular_file_read (circular_file, &elems, G_MAXSIZE, &num_elems,
+                             &token, &has_invalid, &error);
+  g_test_assert_expected_messages ();
+
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_true (has_invalid);
+  g_assert_cmpuint (num_elems, ==, 1);
+  g_assert_cmpstr (g_bytes_get_data (elems[0], NULL), ==, NEW_STRINGS[0]);
+  g_bytes_unref (elems[0]);
+  g_free (elems);
+  g_assert_cmpuint (token, ==, first_disk_size);
+
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_upgrades_legacy_format (Fixture      *fixture,
+                                           gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Statue", "of", "Zeus" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  g_autofree gchar *metadata_file_path =
+    g_strconcat (fixture->data_file_path, METADATA_EXTENSION, NULL);
+  GError *error = NULL;
+
+  /* Before checksums were added, each element was preceded only by its
+   * length as a little-endian guint64, and the metadata had no format key. */
+  g_autoptr(GByteArray) legacy_data = g_byte_array_new ();
+  for (gsize i = 0; i < NUM_STRINGS; i++)
+    {
+      guint64 elem_size = GUINT64_TO_LE (get_elem_size (STRINGS[i]));
+      g_byte_array_append (legacy_data, (const guint8 *) &elem_size,
+                           sizeof (elem_size));
+      g_byte_array_append (legacy_data, (const guint8 *) STRINGS[i],
+                           get_elem_size (STRINGS[i]));
+    }
+  g_file_set_contents (fixture->data_file_path,
+                       (const gchar *) legacy_data->data, legacy_data->len,
+                       &error);
+  g_assert_no_error (error);
+
+  g_autofree gchar *metadata =
+    g_strdup_printf ("[metadata]\nmax_size=%" G_GUINT64_FORMAT "\n"
+                     "size=%u\nhead=0\n", max_size, legacy_data->len);
+  g_file_set_contents (metadata_file_path, metadata, -1, &error);
+  g_assert_no_error (error);
+
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+  read_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  g_object_unref (circular_file);
+
+  /* The conversion is only done once. */
+  g_assert_false (g_file_test (metadata_file_path, G_FILE_TEST_EXISTS));
+  circular_file = make_circular_file (fixture, max_size);
+  remove_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  assert_circular_file_is_empty (circular_file);
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_moves_metadata_into_header (Fixture      *fixture,
+                                               gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Great", "Pyramid", "of", "Giza" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  g_autofree gchar *metadata_file_path =
+    g_strconcat (fixture->data_file_path, METADATA_EXTENSION, NULL);
+  GError *error = NULL;
+
+  /* Before the header was added, the elements started at the beginning of the
+   * data file, and the metadata was kept in a key file alongside it. */
+  g_autoptr(GByteArray) old_data = g_byte_array_new ();
+  for (gsize i = 0; i < NUM_STRINGS; i++)
+    {
+      guint64 elem_size = GUINT64_TO_LE (get_elem_size (STRINGS[i]));
+      g_byte_array_append (old_data, (const guint8 *) &elem_size,
+                           sizeof (elem_size));
+      g_byte_array_append (old_data, (const guint8 *) STRINGS[i],
+                           get_elem_size (STRINGS[i]));
+    }
+  g_file_set_contents (fixture->data_file_path,
+                       (const gchar *) old_data->data, old_data->len, &error);
+  g_assert_no_error (error);
+
+  g_autofree gchar *metadata =
+    g_strdup_printf ("[metadata]\nmax_size=%" G_GUINT64_FORMAT "\n"
+                     "size=%u\nhead=0\n", max_size, old_data->len);
+  g_file_set_contents (metadata_file_path, metadata, -1, &error);
+  g_assert_no_error (error);
+
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+  g_assert_false (g_file_test (metadata_file_path, G_FILE_TEST_EXISTS));
+  remove_strings_and_check (circular_file, STRINGS, 2);
+  g_object_unref (circular_file);
+
+  circular_file = make_circular_file (fixture, max_size);
+  remove_strings_and_check (circular_file, STRINGS + 2, NUM_STRINGS - 2);
+  assert_circular_file_is_empty (circular_file);
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_falls_back_to_previous_header (Fixture      *fixture,
+                                                  gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Hanging", "Gardens" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+
+  /* Creating the file writes the first generation of the header to the second
+   * slot, saving writes the second to the first slot, and removing writes the
+   * third to the second slot again. */
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  remove_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  g_object_unref (circular_file);
+
+  /* Damage the newest slot, as an interrupted write might. */
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  GError *error = NULL;
+  g_file_get_contents (fixture->data_file_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[HEADER_SLOT_SIZE + 20] ^= 0x01;
+  g_file_set_contents (fixture->data_file_path, contents, length, &error);
+  g_assert_no_error (error);
+
+  /* The state recorded before the removal is used instead. */
+  circular_file = make_circular_file (fixture, max_size);
+  read_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  g_object_unref (circular_file);
+
+  /* If both slots are damaged, the file can't be opened. */
+  contents[20] ^= 0x01;
+  g_file_set_contents (fixture->data_file_path, contents, length, &error);
+  g_assert_no_error (error);
+
+  circular_file = emer_circular_file_new (fixture->data_file_path, max_size,
+                                          FALSE /* reinitialize */, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_null (circular_file);
+  g_clear_error (&error);
+}
+
+/* Sets syscr and syscw to the number of read and write system calls the
+ * process has made. Returns FALSE if the kernel doesn't count them.
+ */
+static gboolean
+get_io_syscalls (guint64 *syscr,
+                 guint64 *syscw)
+{
+  g_autofree gchar *io = NULL;
+  if (!g_file_get_contents ("/proc/self/io", &io, NULL, NULL))
+    return FALSE;
+
+  const gchar *syscr_line = strstr (io, "syscr: ");
+  const gchar *syscw_line = strstr (io, "syscw: ");
+  if (syscr_line == NULL || syscw_line == NULL)
+    return FALSE;
+
+  *syscr = g_ascii_strtoull (syscr_line + strlen ("syscr: "), NULL, 10);
+  *syscw = g_ascii_strtoull (syscw_line + strlen ("syscw: "), NULL, 10);
+  return TRUE;
+}
+
+/* Opens the data file and closes it again, as the circular file did on every
+ * save and every read before it kept the file open. Used for the baseline
+ * cycle-latency measurement.
+ */
+static void
+reopen_data_file (Fixture *fixture,
+                  gboolean for_writing)
+{
+  g_autoptr(GFile) file = g_file_new_for_path (fixture->data_file_path);
+  GError *error = NULL;
+
+  if (for_writing)
+    {
+      g_autoptr(GFileIOStream) stream =
+        g_file_open_readwrite (file, NULL /* GCancellable */, &error);
+      g_assert_no_error (error);
+      g_io_stream_close (G_IO_STREAM (stream), NULL /* GCancellable */,
+                         &error);
+    }
+  else
+    {
+      g_autoptr(GFileInputStream) stream =
+        g_file_read (file, NULL /* GCancellable */, &error);
+      g_assert_no_error (error);
+      g_input_stream_close (G_INPUT_STREAM (stream), NULL /* GCancellable */,
+                            &error);
+    }
+
+  g_assert_no_error (error);
+}
+
+/* Reports how long it takes to save an element, read it back and remove it,
+ * as the persistent cache does with each batch of events it stores and
+ * uploads, and how many read and write system calls that takes. The
+ * elements wrap around the end of the file regularly. If user_data is
+ * TRUE, the data file is also opened and closed before each save and read,
+ * giving a baseline for the cost the circular file paid before it kept its
+ * file open. Only run in performance mode (-m perf).
+ */
+static void
+test_circular_file_cycle_latency (Fixture      *fixture,
+                                  gconstpointer user_data)
+{
+  gboolean reopen = GPOINTER_TO_INT (user_data);
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  g_autofree gchar *string = g_strnfill (1000, 'x');
+  gsize elem_size = get_elem_size (string);
+  EmerCircularFile *circular_file =
+    make_circular_file (fixture, 100 * get_disk_size (string) + 1);
+
+  guint64 syscr_before = 0, syscw_before = 0;
+  gboolean have_syscalls = get_io_syscalls (&syscr_before, &syscw_before);
+
+  g_autoptr(GTimer) timer = g_timer_new ();
+  guint64 num_cycles = 0;
+  do
+    {
+      GError *error = NULL;
+      g_assert_true (emer_circular_file_append (circular_file, string,
+                                                elem_size));
+      if (reopen)
+        reopen_data_file (fixture, TRUE /* for_writing */);
+      emer_circular_file_save (circular_file, &error);
+      g_assert_no_error (error);
+
+      GBytes **elems;
+      gsize num_elems;
+      guint64 token;
+      gboolean has_invalid;
+      if (reopen)
+        reopen_data_file (fixture, FALSE /* for_writing */);
+      emer_circular_file_read (circular_file, &elems, G_MAXSIZE, &num_elems,
+                               &token, &has_invalid, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (num_elems, ==, 1);
+      g_bytes_unref (elems[0]);
+      g_free (elems);
+
+      emer_circular_file_remove (circular_file, token, &error);
+      g_assert_no_error (error);
+      num_cycles++;
+    }
+  while (g_timer_elapsed (timer, NULL) < 1.0);
+
+  gdouble latency = g_timer_elapsed (timer, NULL) / num_cycles;
+  g_test_minimized_result (latency, "%.1f microseconds per save, read and "
+                           "remove", latency * G_USEC_PER_SEC);
+
+  guint64 syscr_after, syscw_after;
+  if (have_syscalls && get_io_syscalls (&syscr_after, &syscw_after))
+    g_test_message ("%.1f read and %.1f write system calls per save, read and "
+                    "remove",
+                    (gdouble) (syscr_after - syscr_before) / num_cycles,
+                    (gdouble) (syscw_after - syscw_before) / num_cycles);
+
+  g_object_unref (circular_file);
+}
+
 static void
 test_circular_file_read_when_empty (Fixture      *fixture,
                                     gconstpointer unused)
@@ -612,6 +1116,127 @@ test_circular_file_shrink (Fixture      *fixture,
   g_object_unref (circular_file_2);
 }
 
+/* Damaged data should be left out when the file is rewritten, and the
+ * elements after it should still be intact at their new positions.
+ */
+static void
+test_circular_file_resize_skips_damaged_elem (Fixture      *fixture,
+                                              gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Colossus", "of", "Rhodes" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  const gchar * const INTACT_STRINGS[] = { "Colossus", "Rhodes" };
+  gsize NUM_INTACT_STRINGS = G_N_ELEMENTS (INTACT_STRINGS);
+  gsize max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+
+  g_object_unref (circular_file);
+
+  /* Flip a bit in the middle element's data. */
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  GError *error = NULL;
+  g_file_get_contents (fixture->data_file_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[FILE_HEADER_SIZE + get_disk_size (STRINGS[0]) +
+           ELEM_HEADER_SIZE] ^= 0x10;
+  overwrite_data_file (fixture, contents, length);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Skipping * bytes of invalid data found while "
+                         "rewriting*");
+  EmerCircularFile *circular_file_2 =
+    make_circular_file (fixture, 2 * max_size);
+  g_test_assert_expected_messages ();
+
+  remove_strings_and_check (circular_file_2, INTACT_STRINGS,
+                            NUM_INTACT_STRINGS);
+  assert_circular_file_is_empty (circular_file_2);
+
+  g_object_unref (circular_file_2);
+}
+
+static void
+test_circular_file_resize_large (Fixture      *fixture,
+                                 gconstpointer unused)
+{
+  /* Enough data to be copied in several chunks when the file is resized,
+   * including one element larger than a chunk.
+   */
+  const gsize NUM_STRINGS = 1000;
+  const gsize LARGE_STRING_INDEX = NUM_STRINGS / 2;
+  const gsize NUM_WRAPPED = 10;
+  g_auto(GStrv) strings = g_new0 (gchar *, NUM_STRINGS + 1);
+  for (gsize i = 0; i < NUM_STRINGS; i++)
+    strings[i] = g_strnfill (i == LARGE_STRING_INDEX ? 1024 * 1024 : 1000 + i,
+                             'a' + i % 26);
+
+  const gchar * const *STRINGS = (const gchar * const *) strings;
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+
+  /* Move the head along, so that the elements wrap around the end of the
+   * file.
+   */
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  remove_strings_and_check (circular_file, STRINGS, NUM_WRAPPED);
+  append_strings_and_check (circular_file, STRINGS, NUM_WRAPPED);
+  g_object_unref (circular_file);
+
+  /* Shrinking the file by a byte drops the last element. */
+  g_autofree const gchar **expected = g_new (const gchar *, NUM_STRINGS);
+  for (gsize i = 0; i < NUM_STRINGS; i++)
+    expected[i] = STRINGS[(NUM_WRAPPED + i) % NUM_STRINGS];
+
+  circular_file = make_circular_file (fixture, max_size - 1);
+  read_strings_and_check (circular_file, expected, NUM_STRINGS - 1);
+  g_object_unref (circular_file);
+
+  /* Growing it again keeps the rest. */
+  circular_file = make_circular_file (fixture, 2 * max_size);
+  remove_strings_and_check (circular_file, expected, NUM_STRINGS - 1);
+  assert_circular_file_is_empty (circular_file);
+  g_object_unref (circular_file);
+}
+
+static void
+test_circular_file_ignores_unfinished_resize (Fixture      *fixture,
+                                              gconstpointer unused)
+{
+  const gchar * const STRINGS[] = { "Lighthouse", "of", "Alexandria" };
+  gsize NUM_STRINGS = G_N_ELEMENTS (STRINGS);
+  guint64 max_size = get_total_disk_size (STRINGS, NUM_STRINGS);
+  g_autofree gchar *temp_file_path =
+    g_strconcat (fixture->data_file_path, TEMP_EXTENSION, NULL);
+  GError *error = NULL;
+
+  EmerCircularFile *circular_file = make_circular_file (fixture, max_size);
+  append_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  g_object_unref (circular_file);
+
+  /* A resize which was interrupted leaves part of a new data file behind,
+   * without a header.
+   */
+  g_file_set_contents (temp_file_path, "partial", -1, &error);
+  g_assert_no_error (error);
+
+  circular_file = make_circular_file (fixture, max_size);
+  g_assert_false (g_file_test (temp_file_path, G_FILE_TEST_EXISTS));
+  read_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  g_object_unref (circular_file);
+
+  g_file_set_contents (temp_file_path, "partial", -1, &error);
+  g_assert_no_error (error);
+
+  circular_file = make_circular_file (fixture, 2 * max_size);
+  g_assert_false (g_file_test (temp_file_path, G_FILE_TEST_EXISTS));
+  remove_strings_and_check (circular_file, STRINGS, NUM_STRINGS);
+  assert_circular_file_is_empty (circular_file);
+  g_object_unref (circular_file);
+}
+
 static void
 assert_circular_file_works_after_recovery (Fixture          *fixture,
                                            EmerCircularFile *circular_file,
@@ -862,6 +1487,28 @@ main (gint                argc,
                                test_circular_file_read_one);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/read-many",
                                test_circular_file_read_many);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/reserve",
+                               test_circular_file_reserve);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/read-wrapped",
+                               test_circular_file_read_wrapped);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/skips-damaged-elem",
+                               test_circular_file_skips_damaged_elem);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/discards-damaged-tail",
+                               test_circular_file_discards_damaged_tail);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/ignores-stale-elem",
+                               test_circular_file_ignores_stale_elem);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/upgrades-legacy-format",
+                               test_circular_file_upgrades_legacy_format);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/moves-metadata-into-header",
+                               test_circular_file_moves_metadata_into_header);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/falls-back-to-previous-header",
+                               test_circular_file_falls_back_to_previous_header);
+  g_test_add ("/circular-file/cycle-latency/baseline", Fixture,
+              GINT_TO_POINTER (TRUE), setup, test_circular_file_cycle_latency,
+              teardown);
+  g_test_add ("/circular-file/cycle-latency/open-file", Fixture,
+              GINT_TO_POINTER (FALSE), setup, test_circular_file_cycle_latency,
+              teardown);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/read-when-empty",
                                test_circular_file_read_when_empty);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/has-more",
@@ -887,6 +1534,12 @@ main (gint                argc,
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/grow", test_circular_file_grow);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/shrink",
                                test_circular_file_shrink);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/resize-skips-damaged-elem",
+                               test_circular_file_resize_skips_damaged_elem);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/resize-large",
+                               test_circular_file_resize_large);
+  ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/ignores-unfinished-resize",
+                               test_circular_file_ignores_unfinished_resize);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/metadata-file-nul-bytes",
                                test_circular_file_metadata_file_nul_bytes);
   ADD_CIRCULAR_FILE_TEST_FUNC ("/circular-file/metadata-file-empty",
@@ -0,0 +1,152 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-crc32c.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+/* Computes the checksum one bit at a time, as a reference for the optimized
+ * implementations. */
+static guint32
+reference_crc32c (const guint8 *data,
+                  gsize         length)
+{
+  guint32 crc = 0xffffffff;
+
+  for (gsize i = 0; i < length; i++)
+    {
+      crc ^= data[i];
+      for (guint j = 0; j < 8; j++)
+        crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    }
+
+  return ~crc;
+}
+
+typedef guint32 (*Crc32cFunc) (guint32       crc,
+                               gconstpointer data,
+                               gsize         length);
+
+static void
+test_crc32c_known_values (gconstpointer user_data)
+{
+  Crc32cFunc crc32c = user_data;
+  guint8 zeros[32], ones[32];
+
+  memset (zeros, 0x00, sizeof (zeros));
+  memset (ones, 0xff, sizeof (ones));
+
+  /* Test vectors from RFC 3720, appendix B.4, and the customary check value */
+  g_assert_cmphex (crc32c (0, "123456789", 9), ==, 0xe3069283);
+  g_assert_cmphex (crc32c (0, zeros, sizeof (zeros)), ==, 0x8a9136aa);
+  g_assert_cmphex (crc32c (0, ones, sizeof (ones)), ==, 0x62a8ab43);
+  g_assert_cmphex (crc32c (0, NULL, 0), ==, 0);
+}
+
+static void
+test_crc32c_matches_reference (gconstpointer user_data)
+{
+  Crc32cFunc crc32c = user_data;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1913);
+  guint8 data[1024 + 8];
+
+  for (gsize i = 0; i < sizeof (data); i++)
+    data[i] = g_rand_int_range (rand, 0, 256);
+
+  /* Cover every alignment, and lengths on either side of whole words */
+  for (gsize offset = 0; offset < 8; offset++)
+    {
+      for (gsize length = 0; length <= 1024; length += (length < 64) ? 1 : 61)
+        {
+          g_assert_cmphex (crc32c (0, data + offset, length), ==,
+                           reference_crc32c (data + offset, length));
+        }
+    }
+}
+
+static void
+test_crc32c_incremental (gconstpointer user_data)
+{
+  Crc32cFunc crc32c = user_data;
+  const gchar *data = "The quick brown fox jumps over the lazy dog";
+  gsize length = strlen (data);
+  guint32 whole = crc32c (0, data, length);
+
+  for (gsize split = 0; split <= length; split++)
+    {
+      guint32 crc = crc32c (0, data, split);
+      crc = crc32c (crc, data + split, length - split);
+      g_assert_cmphex (crc, ==, whole);
+    }
+}
+
+/* The portable implementation must agree with whichever one emer_crc32c()
+ * uses on this processor, which is usually the CRC instructions, on buffers
+ * of random contents, lengths and alignments, continuing from random
+ * checksums.
+ */
+static void
+test_crc32c_generic_matches_default (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1847);
+  g_autofree guint8 *data = g_malloc (65536 + 8);
+
+  for (gsize i = 0; i < 65536 + 8; i++)
+    data[i] = g_rand_int_range (rand, 0, 256);
+
+  for (guint i = 0; i < 1000; i++)
+    {
+      gsize offset = g_rand_int_range (rand, 0, 8);
+      gsize length = g_rand_int_range (rand, 0, 65536 + 1);
+      guint32 crc = g_rand_int (rand);
+
+      g_assert_cmphex (emer_crc32c_generic (crc, data + offset, length), ==,
+                       emer_crc32c (crc, data + offset, length));
+    }
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_data_func ("/crc32c/known-values", emer_crc32c,
+                        test_crc32c_known_values);
+  g_test_add_data_func ("/crc32c/matches-reference", emer_crc32c,
+                        test_crc32c_matches_reference);
+  g_test_add_data_func ("/crc32c/incremental", emer_crc32c,
+                        test_crc32c_incremental);
+  g_test_add_data_func ("/crc32c/generic/known-values", emer_crc32c_generic,
+                        test_crc32c_known_values);
+  g_test_add_data_func ("/crc32c/generic/matches-reference",
+                        emer_crc32c_generic, test_crc32c_matches_reference);
+  g_test_add_data_func ("/crc32c/generic/incremental", emer_crc32c_generic,
+                        test_crc32c_incremental);
+  g_test_add_func ("/crc32c/generic/matches-default",
+                   test_crc32c_generic_matches_default);
+
+  return g_test_run ();
+}
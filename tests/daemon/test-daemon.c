@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/prctl.h>
+#include <unistd.h>
 #include <uuid/uuid.h>
 
 #include <gio/gio.h>
@@ -49,11 +50,24 @@
 #define MOCK_SERVER_PATH TEST_DIR "daemon/mock-server.py"
 
 #define MEANINGLESS_EVENT "350ac4ff-3026-4c25-9e7e-e8103b4fd5d8"
+#define HIGH_PRIORITY_EVENT "cf09194a-3090-4782-ab03-87b2f1515aed"
+#define DENIED_EVENT "b6b7a4e2-52e3-4a8f-a47a-8d1c3f6e09d4"
+
+/* The event policy used by every daemon under test, rather than the host's */
+#define EVENT_POLICY \
+  "[" HIGH_PRIORITY_EVENT "]\n" \
+  "priority=high\n" \
+  "[" DENIED_EVENT "]\n" \
+  "action=deny\n"
 
 #define NUM_EVENTS 101u
 #define RELATIVE_TIMESTAMP G_GINT64_CONSTANT (123456789)
 #define OFFSET_TIMESTAMP (RELATIVE_TIMESTAMP + BOOT_TIME_OFFSET)
 
+/* A day in nanoseconds, an offset between the events of a sequence which takes
+ * several bytes to store */
+#define SEQUENCE_LONG_OFFSET G_GINT64_CONSTANT (86400000000000)
+
 #define MAX_REQUEST_PAYLOAD 100000
 
 /* The non-array portion of the singular in make_large_singular costs 60 bytes,
@@ -70,6 +84,8 @@ typedef struct _Fixture
   EmerPersistentCache *mock_persistent_cache;
   EmerAggregateTally *mock_aggregate_tally;
 
+  gchar *event_policy_path;
+
   GSubprocess *mock_server;
   gchar *server_url;
 
@@ -553,6 +569,110 @@ record_singulars (EmerDaemon *daemon)
                                      make_auxiliary_payload ());
 }
 
+static void
+record_singular_batch (EmerDaemon *daemon)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uayxbv)"));
+  g_variant_builder_add (&builder, "(u@ayxb@v)", 0u, make_event_id_variant (),
+                         RELATIVE_TIMESTAMP, FALSE,
+                         g_variant_new_variant (g_variant_new_string ("This must be ignored.")));
+  g_variant_builder_add (&builder, "(u@ayxb@v)", 0u,
+                         g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                    "not a uuid", 10, 1),
+                         RELATIVE_TIMESTAMP, FALSE,
+                         make_auxiliary_payload ());
+  g_variant_builder_add (&builder, "(u@ayxb@v)", 0u, make_event_id_variant (),
+                         RELATIVE_TIMESTAMP, FALSE,
+                         g_variant_new_variant (g_variant_new_boolean (FALSE)));
+  g_variant_builder_add (&builder, "(u@ayxb@v)", 0u, make_event_id_variant (),
+                         RELATIVE_TIMESTAMP, TRUE,
+                         make_auxiliary_payload ());
+
+  g_autoptr(GVariant) events =
+    g_variant_ref_sink (g_variant_builder_end (&builder));
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Event ID must be a UUID*");
+  emer_daemon_record_singular_events (daemon, events);
+  g_test_assert_expected_messages ();
+}
+
+static void
+record_sequence (EmerDaemon *daemon)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xmv)"));
+  g_variant_builder_add (&builder, "(xmv)", RELATIVE_TIMESTAMP, NULL);
+  g_variant_builder_add (&builder, "(x@mv)",
+                         RELATIVE_TIMESTAMP + SEQUENCE_LONG_OFFSET,
+                         g_variant_new_maybe (G_VARIANT_TYPE_VARIANT,
+                                              make_auxiliary_payload ()));
+  g_variant_builder_add (&builder, "(xmv)", RELATIVE_TIMESTAMP - 5000, NULL);
+
+  emer_daemon_record_event_sequence (daemon, 0u, make_event_id_variant (),
+                                     g_variant_builder_end (&builder));
+}
+
+/* Returns the cost of each event in a sequence recorded by
+ * record_long_sequence once it is expanded into a singular event. */
+static gsize
+get_expanded_event_cost (void)
+{
+  g_autoptr(GVariant) singular =
+    g_variant_ref_sink (g_variant_new ("(@aysxmv)", make_event_id_variant (),
+                                       OS_VERSION, OFFSET_TIMESTAMP, NULL));
+  return emer_persistent_cache_cost (singular);
+}
+
+/* Records a sequence of @num_events events without payloads. Its expanded
+ * cost is much larger than its own, as each event repeats the event ID and OS
+ * version.
+ */
+static void
+record_long_sequence (EmerDaemon *daemon,
+                      gsize       num_events)
+{
+  GVariantBuilder builder, payloads;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xmv)"));
+  g_variant_builder_init (&payloads, G_VARIANT_TYPE ("amv"));
+  for (gsize i = 0; i < num_events; i++)
+    {
+      g_variant_builder_add (&builder, "(xmv)", RELATIVE_TIMESTAMP + i, NULL);
+      g_variant_builder_add (&payloads, "mv", NULL);
+    }
+
+  /* As stored, each offset but the first, which is zero, is one byte long. */
+  g_autofree guint8 *deltas = g_malloc0 (num_events);
+  memset (deltas + 1, 2, num_events - 1);
+
+  g_autoptr(GVariant) event_values =
+    g_variant_ref_sink (g_variant_builder_end (&builder));
+  g_autoptr(GVariant) sequence =
+    g_variant_ref_sink (g_variant_new ("(@aysx@ay@amv)",
+                                       make_event_id_variant (), OS_VERSION,
+                                       OFFSET_TIMESTAMP,
+                                       g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                                  deltas,
+                                                                  num_events,
+                                                                  1),
+                                       g_variant_builder_end (&payloads)));
+  g_assert_cmpuint (emer_persistent_cache_cost (sequence), <,
+                    MAX_REQUEST_PAYLOAD / 2);
+
+  emer_daemon_record_event_sequence (daemon, 0u, make_event_id_variant (),
+                                     event_values);
+}
+
+/* The number of events in each sequence in
+ * test_daemon_limits_expanded_sequences, which fill 60% of a request once
+ * expanded. */
+static gsize
+get_long_sequence_length (void)
+{
+  return MAX_REQUEST_PAYLOAD * 6 / 10 / get_expanded_event_cost ();
+}
+
 static void
 record_aggregates (EmerDaemon *daemon)
 {
@@ -667,6 +787,50 @@ assert_singulars_received (GByteArray *request,
   g_variant_iter_free (aggregate_iterator);
 }
 
+static void
+assert_sequence_received (GByteArray *request,
+                          Fixture    *fixture)
+{
+  GVariantIter *singular_iterator, *aggregate_iterator;
+  get_events_from_request (request, fixture, &singular_iterator,
+                           &aggregate_iterator);
+
+  /* The sequence is expanded into one singular event per element */
+  g_assert_cmpuint (g_variant_iter_n_children (singular_iterator), ==, 3u);
+  assert_variants_equal (g_variant_iter_next_value (singular_iterator),
+                         g_variant_new ("(@aysxmv)", make_event_id_variant (),
+                                        OS_VERSION, OFFSET_TIMESTAMP, NULL));
+  assert_variants_equal (g_variant_iter_next_value (singular_iterator),
+                         g_variant_new ("(@aysxm@v)", make_event_id_variant (),
+                                        OS_VERSION,
+                                        OFFSET_TIMESTAMP + SEQUENCE_LONG_OFFSET,
+                                        make_auxiliary_payload ()));
+  assert_variants_equal (g_variant_iter_next_value (singular_iterator),
+                         g_variant_new ("(@aysxmv)", make_event_id_variant (),
+                                        OS_VERSION, OFFSET_TIMESTAMP - 5000,
+                                        NULL));
+  g_variant_iter_free (singular_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (aggregate_iterator), ==, 0u);
+  g_variant_iter_free (aggregate_iterator);
+}
+
+static void
+assert_long_sequence_received (GByteArray *request,
+                               Fixture    *fixture)
+{
+  GVariantIter *singular_iterator, *aggregate_iterator;
+  get_events_from_request (request, fixture, &singular_iterator,
+                           &aggregate_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (singular_iterator), ==,
+                    get_long_sequence_length ());
+  g_variant_iter_free (singular_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (aggregate_iterator), ==, 0u);
+  g_variant_iter_free (aggregate_iterator);
+}
+
 static void
 assert_large_singular_received (GByteArray *request,
                                 Fixture    *fixture)
@@ -705,6 +869,47 @@ assert_aggregates_received (GByteArray *request,
   g_variant_iter_free (aggregate_iterator);
 }
 
+static void
+assert_high_priority_singular_received (GByteArray *request,
+                                        Fixture    *fixture)
+{
+  GVariantIter *singular_iterator, *aggregate_iterator;
+  get_events_from_request (request, fixture, &singular_iterator,
+                           &aggregate_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (singular_iterator), ==, 1u);
+  assert_variants_equal (g_variant_iter_next_value (singular_iterator),
+                         g_variant_new ("(@aysxmv)",
+                                        make_variant_for_event_id (HIGH_PRIORITY_EVENT),
+                                        OS_VERSION, OFFSET_TIMESTAMP, NULL));
+  g_variant_iter_free (singular_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (aggregate_iterator), ==, 0u);
+  g_variant_iter_free (aggregate_iterator);
+}
+
+static void
+assert_two_high_priority_singulars_received (GByteArray *request,
+                                             Fixture    *fixture)
+{
+  GVariantIter *singular_iterator, *aggregate_iterator;
+  get_events_from_request (request, fixture, &singular_iterator,
+                           &aggregate_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (singular_iterator), ==, 2u);
+  for (gint i = 0; i < 2; i++)
+    {
+      assert_variants_equal (g_variant_iter_next_value (singular_iterator),
+                             g_variant_new ("(@aysxmv)",
+                                            make_variant_for_event_id (HIGH_PRIORITY_EVENT),
+                                            OS_VERSION, OFFSET_TIMESTAMP, NULL));
+    }
+  g_variant_iter_free (singular_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (aggregate_iterator), ==, 0u);
+  g_variant_iter_free (aggregate_iterator);
+}
+
 static void
 handle_upload_finished (EmerDaemon *test_object,
                         GMainLoop  *main_loop)
@@ -821,12 +1026,33 @@ static void
 create_test_object (Fixture *fixture)
 {
   fixture->test_object =
-    emer_daemon_new_full (g_rand_new_with_seed (18),
-                          2 /* network send interval */,
-                          fixture->mock_permissions_provider,
-                          fixture->mock_persistent_cache,
-                          fixture->mock_aggregate_tally,
-                          100000 /* max bytes buffered */);
+    g_object_new (EMER_TYPE_DAEMON,
+                  "random-number-generator", g_rand_new_with_seed (18),
+                  "network-send-interval", 2u,
+                  "permissions-provider", fixture->mock_permissions_provider,
+                  "persistent-cache", fixture->mock_persistent_cache,
+                  "aggregate-tally", fixture->mock_aggregate_tally,
+                  "max-bytes-buffered", 100000ul,
+                  "event-policy-path", fixture->event_policy_path,
+                  NULL);
+}
+
+/* Like create_test_object, but stores events as ready-made requests when they
+ * can't be uploaded. */
+static void
+create_batching_test_object (Fixture *fixture)
+{
+  fixture->test_object =
+    g_object_new (EMER_TYPE_DAEMON,
+                  "random-number-generator", g_rand_new_with_seed (18),
+                  "network-send-interval", 2u,
+                  "permissions-provider", fixture->mock_permissions_provider,
+                  "persistent-cache", fixture->mock_persistent_cache,
+                  "aggregate-tally", fixture->mock_aggregate_tally,
+                  "max-bytes-buffered", 100000ul,
+                  "event-policy-path", fixture->event_policy_path,
+                  "store-batches", TRUE,
+                  NULL);
 }
 
 static void
@@ -851,6 +1077,15 @@ setup_most (Fixture      *fixture,
 
   fixture->mock_permissions_provider = mock_permissions_provider_new (fixture->server_url);
   fixture->mock_persistent_cache = NULL;
+
+  g_autoptr(GError) error = NULL;
+  gint fd = g_file_open_tmp ("event_policy_XXXXXX",
+                             &fixture->event_policy_path, &error);
+  g_assert_no_error (error);
+  close (fd);
+  g_file_set_contents (fixture->event_policy_path, EVENT_POLICY, -1, &error);
+  g_assert_no_error (error);
+
   /* Not actually a mock! */
   fixture->mock_aggregate_tally = emer_aggregate_tally_new (g_get_user_cache_dir ());
 }
@@ -864,7 +1099,7 @@ setup_persistent_cache (Fixture *fixture)
   fixture->mock_persistent_cache =
     emer_persistent_cache_new (NULL /* directory */,
                                10000000, /* max_cache_size */
-                               FALSE /* reinitialize_cache */,
+                               EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
                                &error);
   g_assert_no_error (error);
 }
@@ -888,6 +1123,9 @@ teardown (Fixture      *fixture,
   g_clear_object (&fixture->mock_aggregate_tally);
   g_clear_pointer (&fixture->mock_server, terminate_subprocess_and_wait);
   g_clear_pointer (&fixture->server_url, g_free);
+
+  g_unlink (fixture->event_policy_path);
+  g_clear_pointer (&fixture->event_policy_path, g_free);
 }
 
 // Unit Tests next:
@@ -931,6 +1169,26 @@ test_daemon_records_singulars (Fixture      *fixture,
   wait_for_upload_to_finish (fixture);
 }
 
+static void
+test_daemon_records_singular_batch (Fixture      *fixture,
+                                    gconstpointer unused)
+{
+  record_singular_batch (fixture->test_object);
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_singulars_received);
+  wait_for_upload_to_finish (fixture);
+}
+
+static void
+test_daemon_records_sequence (Fixture      *fixture,
+                              gconstpointer unused)
+{
+  record_sequence (fixture->test_object);
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_sequence_received);
+  wait_for_upload_to_finish (fixture);
+}
+
 static void
 test_daemon_records_aggregates (Fixture      *fixture,
                                 gconstpointer unused)
@@ -941,6 +1199,114 @@ test_daemon_records_aggregates (Fixture      *fixture,
   wait_for_upload_to_finish (fixture);
 }
 
+static EmerTallyIterResult
+count_tally_entries (guint32     unix_user_id,
+                     uuid_t      event_id,
+                     GVariant   *payload,
+                     guint32     counter,
+                     const char *date,
+                     gpointer    user_data)
+{
+  guint64 *total = user_data;
+
+  g_assert_cmpuint (unix_user_id, ==, 1001);
+  g_assert_nonnull (payload);
+  *total += counter;
+
+  return EMER_TALLY_ITER_CONTINUE;
+}
+
+static void
+test_daemon_records_aggregate_event (Fixture      *fixture,
+                                     gconstpointer unused)
+{
+  g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+  guint64 daily_total = 0, monthly_total = 0;
+  gint64 relative_time;
+  gint i;
+
+  g_assert_true (emtr_util_get_current_time (CLOCK_BOOTTIME, &relative_time));
+
+  for (i = 0; i < 3; i++)
+    emer_daemon_record_aggregate_event (fixture->test_object, 1001,
+                                        make_event_id_variant (), NUM_EVENTS,
+                                        relative_time, TRUE,
+                                        make_auxiliary_payload ());
+
+  /* Non-positive counts are ignored */
+  emer_daemon_record_aggregate_event (fixture->test_object, 1001,
+                                      make_event_id_variant (), 0,
+                                      relative_time, TRUE,
+                                      make_auxiliary_payload ());
+
+  emer_aggregate_tally_iter (fixture->mock_aggregate_tally,
+                             EMER_TALLY_DAILY_EVENTS, now,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             count_tally_entries, &daily_total);
+  emer_aggregate_tally_iter (fixture->mock_aggregate_tally,
+                             EMER_TALLY_MONTHLY_EVENTS, now,
+                             EMER_TALLY_ITER_FLAG_DELETE,
+                             count_tally_entries, &monthly_total);
+
+  g_assert_cmpuint (daily_total, ==, 3 * NUM_EVENTS);
+  g_assert_cmpuint (monthly_total, ==, 3 * NUM_EVENTS);
+}
+
+static void
+assert_late_aggregate_received (GByteArray *request,
+                                Fixture    *fixture)
+{
+  GVariantIter *singular_iterator, *aggregate_iterator;
+  get_events_from_request (request, fixture, &singular_iterator,
+                           &aggregate_iterator);
+
+  g_assert_cmpuint (g_variant_iter_n_children (singular_iterator), ==, 0u);
+  g_variant_iter_free (singular_iterator);
+
+  /* The monthly tally is only over too if yesterday was last month. */
+  g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+  g_autoptr(GDateTime) yesterday = g_date_time_add_days (now, -1);
+  g_autofree gchar *yesterday_date = g_date_time_format (yesterday, "%Y-%m-%d");
+  gsize num_aggregates = g_date_time_get_day_of_month (now) == 1 ? 2 : 1;
+  g_assert_cmpuint (g_variant_iter_n_children (aggregate_iterator), ==,
+                    num_aggregates);
+  assert_aggregate_matches_next_value (aggregate_iterator, yesterday_date,
+                                       make_auxiliary_payload ());
+  g_variant_iter_free (aggregate_iterator);
+}
+
+static void
+test_daemon_buffers_late_aggregate_event (Fixture      *fixture,
+                                          gconstpointer unused)
+{
+  g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+  gint64 relative_time;
+
+  g_assert_true (emtr_util_get_current_time (CLOCK_BOOTTIME, &relative_time));
+
+  /* A minute before midnight yesterday, in nanoseconds */
+  gint64 age = (g_date_time_get_hour (now) * G_TIME_SPAN_HOUR +
+                g_date_time_get_minute (now) * G_TIME_SPAN_MINUTE +
+                g_date_time_get_second (now) * G_TIME_SPAN_SECOND +
+                G_TIME_SPAN_MINUTE) * 1000;
+  if (relative_time < age)
+    {
+      g_test_skip ("The system has not been up since yesterday");
+      return;
+    }
+
+  /* Yesterday's tally was buffered when the daemon started, so this event
+   * arrives too late to be buffered along with it. */
+  emer_daemon_record_aggregate_event (fixture->test_object, 1001,
+                                      make_event_id_variant (), NUM_EVENTS,
+                                      relative_time - age, TRUE,
+                                      make_auxiliary_payload ());
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_late_aggregate_received);
+  wait_for_upload_to_finish (fixture);
+}
+
 static void
 test_daemon_retries_singular_uploads (Fixture      *fixture,
                                       gconstpointer unused)
@@ -1046,6 +1412,47 @@ test_daemon_does_not_record_singulars_when_daemon_disabled (Fixture      *fixtur
   wait_for_upload_to_finish (fixture);
 }
 
+/* Events denied by the event policy should be dropped as they are recorded,
+ * without being buffered.
+ */
+static void
+test_daemon_does_not_record_denied_events (Fixture      *fixture,
+                                           gconstpointer unused)
+{
+  EmerMemoryBudget *budget =
+    emer_daemon_get_memory_budget (fixture->test_object);
+  gsize buffer_usage =
+    emer_memory_budget_get_usage (budget, EMER_MEMORY_COMPONENT_BUFFER);
+
+  emer_daemon_record_singular_event (fixture->test_object,
+                                     make_variant_for_event_id (DENIED_EVENT),
+                                     RELATIVE_TIMESTAMP, TRUE,
+                                     make_auxiliary_payload ());
+
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xmv)"));
+  g_variant_builder_add (&builder, "(xmv)", RELATIVE_TIMESTAMP, NULL);
+  g_variant_builder_add (&builder, "(xmv)", RELATIVE_TIMESTAMP + 1000, NULL);
+  emer_daemon_record_event_sequence (fixture->test_object, 0u,
+                                     make_variant_for_event_id (DENIED_EVENT),
+                                     g_variant_builder_end (&builder));
+
+  emer_daemon_enqueue_aggregate_event (fixture->test_object,
+                                       make_variant_for_event_id (DENIED_EVENT),
+                                       "2021-08-27", NUM_EVENTS, NULL);
+
+  budget = emer_daemon_get_memory_budget (fixture->test_object);
+  g_assert_cmpuint (emer_memory_budget_get_usage (budget,
+                                                  EMER_MEMORY_COMPONENT_BUFFER),
+                    ==, buffer_usage);
+  g_assert_cmpfloat (emer_daemon_get_buffer_fill (fixture->test_object), ==,
+                     0.0);
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_no_events_received);
+  wait_for_upload_to_finish (fixture);
+}
+
 static void
 test_daemon_does_not_record_aggregates_when_daemon_disabled (Fixture      *fixture,
                                                              gconstpointer unused)
@@ -1209,6 +1616,72 @@ test_daemon_flushes_to_persistent_cache_on_finalize (Fixture      *fixture,
   wait_for_upload_to_finish (fixture);
 }
 
+static void
+test_daemon_stores_batches (Fixture      *fixture,
+                            gconstpointer unused)
+{
+  g_clear_object (&fixture->test_object);
+  create_batching_test_object (fixture);
+  record_singulars (fixture->test_object);
+
+  /* Unref the daemon, causing it to flush its buffer. */
+  g_clear_object (&fixture->test_object);
+
+  GVariant **variants;
+  gsize num_variants;
+  guint64 token;
+  gboolean has_invalid;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (fixture->mock_persistent_cache, &variants,
+                                G_MAXSIZE, &num_variants, &token, &has_invalid,
+                                NULL /* GError */);
+  g_assert_true (read_succeeded);
+  g_assert_false (has_invalid);
+  g_assert_cmpuint (num_variants, ==, 1u);
+  g_assert_cmpstr (g_variant_get_type_string (variants[0]), ==, "(uuay)");
+  destroy_variants (variants, num_variants);
+
+  /* A daemon which doesn't store batches should still send them, with fresh
+   * timestamps and a checksum to match. */
+  create_test_object (fixture);
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_singulars_received);
+  wait_for_upload_to_finish (fixture);
+
+  g_assert_true (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+}
+
+/* A stored batch claiming an implausibly long request body should be
+ * discarded rather than decompressed into a buffer of that length. */
+static void
+test_daemon_discards_oversized_stored_batch (Fixture      *fixture,
+                                             gconstpointer unused)
+{
+  static const guint8 compressed[] = { 0x1f, 0x8b, 0x08, 0x00 };
+  GVariant *compressed_variant =
+    g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, compressed,
+                               G_N_ELEMENTS (compressed), sizeof (guint8));
+  g_autoptr(GVariant) batch =
+    g_variant_ref_sink (g_variant_new ("(uu@ay)", 1u, G_MAXUINT32,
+                                       compressed_variant));
+
+  gsize num_variants_stored;
+  gboolean store_succeeded =
+    emer_persistent_cache_store (fixture->mock_persistent_cache, &batch, 1,
+                                 &num_variants_stored, NULL /* GError */);
+  g_assert_true (store_succeeded);
+  g_assert_cmpuint (num_variants_stored, ==, 1);
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Discarding a damaged batch*");
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_no_events_received);
+  g_test_assert_expected_messages ();
+  wait_for_upload_to_finish (fixture);
+
+  g_assert_true (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+}
+
 static void
 test_daemon_limits_network_upload_size (Fixture      *fixture,
                                         gconstpointer unused)
@@ -1243,6 +1716,466 @@ test_daemon_limits_network_upload_size (Fixture      *fixture,
   wait_for_upload_to_finish (fixture);
 }
 
+/* Two sequences which fit in one request together, but not once each is
+ * expanded into singular events, should be sent in separate requests. */
+static void
+test_daemon_limits_expanded_sequences (Fixture      *fixture,
+                                       gconstpointer unused)
+{
+  gsize num_events = get_long_sequence_length ();
+  g_assert_cmpuint (2 * num_events * get_expanded_event_cost (), >,
+                    MAX_REQUEST_PAYLOAD);
+
+  record_long_sequence (fixture->test_object, num_events);
+  record_long_sequence (fixture->test_object, num_events);
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_long_sequence_received);
+  wait_for_upload_to_finish (fixture);
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_long_sequence_received);
+  wait_for_upload_to_finish (fixture);
+}
+
+/* A sequence which would not fit in a request once expanded should be
+ * dropped, even though it fits on its own. */
+static void
+test_daemon_drops_sequence_too_long_to_expand (Fixture      *fixture,
+                                               gconstpointer unused)
+{
+  gsize num_events = 2 * get_long_sequence_length ();
+
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Dropping event sequence of*");
+  record_long_sequence (fixture->test_object, num_events);
+  g_test_assert_expected_messages ();
+
+  record_aggregates (fixture->test_object);
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_aggregates_received);
+  wait_for_upload_to_finish (fixture);
+}
+
+static void
+count_notifications (GObject    *object,
+                     GParamSpec *pspec,
+                     guint      *num_notifications)
+{
+  (*num_notifications)++;
+}
+
+/* Pressure should rise through each level as the buffer fills, notifying once
+ * per level, and the fill ratio should only be republished in coarse steps.
+ */
+static void
+test_daemon_reports_buffer_pressure (Fixture      *fixture,
+                                     gconstpointer unused)
+{
+  g_autofree gchar *padding = g_strnfill (10000, 'x');
+  guint num_pressure_notifications = 0;
+  guint num_fill_notifications = 0;
+
+  g_signal_connect (fixture->test_object, "notify::pressure",
+                    G_CALLBACK (count_notifications),
+                    &num_pressure_notifications);
+  g_signal_connect (fixture->test_object, "notify::buffer-fill",
+                    G_CALLBACK (count_notifications), &num_fill_notifications);
+
+  g_assert_cmpuint (emer_daemon_get_pressure (fixture->test_object), ==,
+                    EMER_PRESSURE_NONE);
+
+  /* Each event costs slightly more than a tenth of the buffer, so the ninth
+   * crosses the critical threshold and the tenth would overflow. */
+  for (gint i = 1; i <= 9; i++)
+    {
+      emer_daemon_record_singular_event (fixture->test_object,
+                                         make_event_id_variant (),
+                                         RELATIVE_TIMESTAMP,
+                                         TRUE,
+                                         g_variant_new_string (padding));
+
+      gdouble buffer_fill = emer_daemon_get_buffer_fill (fixture->test_object);
+      g_assert_cmpfloat (buffer_fill, >, i * 0.1);
+      g_assert_cmpfloat (buffer_fill, <, i * 0.1 + 0.05);
+
+      EmerPressure expected_pressure =
+        i >= 9 ? EMER_PRESSURE_CRITICAL :
+        i >= 8 ? EMER_PRESSURE_ELEVATED :
+        EMER_PRESSURE_NONE;
+      g_assert_cmpuint (emer_daemon_get_pressure (fixture->test_object), ==,
+                        expected_pressure);
+    }
+
+  g_assert_cmpuint (num_pressure_notifications, ==, 2);
+  g_assert_cmpuint (num_fill_notifications, ==, 9);
+  g_assert_cmpfloat (emer_daemon_get_cache_fill (fixture->test_object), ==,
+                     0.0);
+}
+
+/* Records an event which costs slightly more than padding_length bytes; the
+ * rest of the event takes less than 500. */
+static void
+record_padded_event (EmerDaemon *daemon,
+                     gsize       padding_length)
+{
+  g_autofree gchar *padding = g_strnfill (padding_length, 'x');
+  emer_daemon_record_singular_event (daemon,
+                                     make_event_id_variant (),
+                                     RELATIVE_TIMESTAMP,
+                                     TRUE,
+                                     g_variant_new_string (padding));
+}
+
+/* Records an event which costs slightly more than a tenth of the buffer. */
+static void
+record_tenth_of_buffer (EmerDaemon *daemon)
+{
+  record_padded_event (daemon, 10000);
+}
+
+static void
+run_pending_sources (void)
+{
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+/* Recording events faster than they are uploaded should spill the oldest
+ * events to the persistent cache, rather than overflowing the buffer.
+ */
+static void
+test_daemon_spills_to_persistent_cache (Fixture      *fixture,
+                                        gconstpointer unused)
+{
+  g_assert_true (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+
+  /* Each event costs slightly more than a tenth of the buffer, so 11 of them
+   * would overflow it were it not for the spills after the 7th and the 11th,
+   * each of which brings the buffer back down to 3 events. */
+  for (gint i = 0; i < 11; i++)
+    {
+      record_tenth_of_buffer (fixture->test_object);
+      run_pending_sources ();
+    }
+
+  g_autofree GVariant **variants = NULL;
+  gsize num_variants;
+  guint64 token;
+  gboolean has_invalid;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (fixture->mock_persistent_cache, &variants,
+                                G_MAXSIZE, &num_variants, &token,
+                                &has_invalid, NULL /* GError */);
+  g_assert_true (read_succeeded);
+  g_assert_cmpuint (num_variants, ==, 8);
+  for (gsize i = 0; i < num_variants; i++)
+    g_variant_unref (variants[i]);
+
+  gdouble buffer_fill = emer_daemon_get_buffer_fill (fixture->test_object);
+  g_assert_cmpfloat (buffer_fill, >, 0.3);
+  g_assert_cmpfloat (buffer_fill, <, 0.35);
+}
+
+/* Each spill is a synced write to disk, so a sustained overload should be
+ * spilled in a few large batches rather than an event at a time.
+ */
+static void
+test_daemon_spills_in_batches (Fixture      *fixture,
+                               gconstpointer unused)
+{
+  run_pending_sources ();
+  guint num_stores =
+    mock_persistent_cache_get_num_stores (fixture->mock_persistent_cache);
+
+  /* Once the buffer first reaches the high watermark, every event recorded
+   * would take it past again; but each spill makes room for 4 more events, so
+   * 14 events cause just two. */
+  for (gint i = 0; i < 14; i++)
+    {
+      record_tenth_of_buffer (fixture->test_object);
+      run_pending_sources ();
+    }
+
+  g_assert_cmpuint (mock_persistent_cache_get_num_stores (fixture->mock_persistent_cache),
+                    ==, num_stores + 2);
+  g_assert_cmpfloat (emer_persistent_cache_get_fill_ratio (fixture->mock_persistent_cache),
+                     ==, 0.8);
+}
+
+/* Stores or removes variants so that the mock persistent cache holds
+ * num_variants, each filling a tenth of it, and records a small event so that
+ * the daemon notices. Returns the resulting pressure. */
+static EmerPressure
+fill_cache_to (Fixture *fixture,
+               gsize    num_variants)
+{
+  EmerPersistentCache *cache = fixture->mock_persistent_cache;
+  gsize curr_num_variants =
+    emer_persistent_cache_get_fill_ratio (cache) * MAX_NUM_VARIANTS + 0.5;
+
+  if (num_variants < curr_num_variants)
+    {
+      g_assert_true (emer_persistent_cache_remove (cache,
+                                                   curr_num_variants - num_variants,
+                                                   NULL /* GError */));
+    }
+  else if (num_variants > curr_num_variants)
+    {
+      g_autoptr(GVariant) variant =
+        g_variant_ref_sink (g_variant_new_string ("fill"));
+      GVariant *variants[MAX_NUM_VARIANTS];
+      for (gsize i = 0; i < MAX_NUM_VARIANTS; i++)
+        variants[i] = variant;
+
+      gsize num_variants_stored;
+      g_assert_true (emer_persistent_cache_store (cache, variants,
+                                                  num_variants - curr_num_variants,
+                                                  &num_variants_stored,
+                                                  NULL /* GError */));
+      g_assert_cmpuint (num_variants_stored, ==,
+                        num_variants - curr_num_variants);
+    }
+
+  record_padded_event (fixture->test_object, 0);
+  return emer_daemon_get_pressure (fixture->test_object);
+}
+
+/* The pressure should only fall back once the fill ratio has dropped
+ * PRESSURE_HYSTERESIS (0.15) below the threshold it rose past, and only to
+ * the level that the fill ratio then calls for.
+ */
+static void
+test_daemon_pressure_falls_with_hysteresis (Fixture      *fixture,
+                                            gconstpointer unused)
+{
+  g_assert_cmpuint (fill_cache_to (fixture, 8), ==, EMER_PRESSURE_ELEVATED);
+
+  /* Draining to 0.7, above 0.6, keeps elevated pressure. */
+  g_assert_cmpuint (fill_cache_to (fixture, 7), ==, EMER_PRESSURE_ELEVATED);
+
+  /* Draining to 0.5, below 0.6, drops it. */
+  g_assert_cmpuint (fill_cache_to (fixture, 5), ==, EMER_PRESSURE_NONE);
+
+  /* Draining from critical pressure to below 0.75, but above 0.6, drops it
+   * to elevated pressure. */
+  g_assert_cmpuint (fill_cache_to (fixture, 9), ==, EMER_PRESSURE_CRITICAL);
+  g_assert_cmpuint (fill_cache_to (fixture, 7), ==, EMER_PRESSURE_ELEVATED);
+}
+
+/* Steady spilling to the persistent cache should not raise the pressure by
+ * itself, as the buffer is spilled before it fills past the elevated
+ * threshold.
+ */
+static void
+test_daemon_spilling_keeps_pressure (Fixture      *fixture,
+                                     gconstpointer unused)
+{
+  guint num_pressure_notifications = 0;
+  g_signal_connect (fixture->test_object, "notify::pressure",
+                    G_CALLBACK (count_notifications),
+                    &num_pressure_notifications);
+
+  /* The 7th event is spilled along with the 3 before it, and the rest fill
+   * the buffer back up to just below the high watermark. */
+  for (gint i = 0; i < 10; i++)
+    {
+      record_tenth_of_buffer (fixture->test_object);
+      run_pending_sources ();
+      g_assert_cmpuint (emer_daemon_get_pressure (fixture->test_object), ==,
+                        EMER_PRESSURE_NONE);
+    }
+
+  g_assert_false (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+  g_assert_cmpuint (num_pressure_notifications, ==, 0);
+}
+
+/* Once a spill stores nothing because the persistent cache is full, recording
+ * more events should not schedule any more spills until something is removed
+ * from the persistent cache.
+ */
+static void
+test_daemon_backs_off_spilling_when_cache_full (Fixture      *fixture,
+                                                gconstpointer unused)
+{
+  run_pending_sources ();
+
+  GVariant *variant = g_variant_ref_sink (g_variant_new_string ("full"));
+  GVariant *variants[MAX_NUM_VARIANTS];
+  for (gsize i = 0; i < MAX_NUM_VARIANTS; i++)
+    variants[i] = variant;
+
+  gsize num_variants_stored;
+  gboolean store_succeeded =
+    emer_persistent_cache_store (fixture->mock_persistent_cache, variants,
+                                 MAX_NUM_VARIANTS, &num_variants_stored,
+                                 NULL /* GError */);
+  g_variant_unref (variant);
+  g_assert_true (store_succeeded);
+  g_assert_cmpuint (num_variants_stored, ==, MAX_NUM_VARIANTS);
+
+  for (gint i = 0; i < 6; i++)
+    {
+      record_tenth_of_buffer (fixture->test_object);
+      run_pending_sources ();
+    }
+
+  /* The 7th event crosses the high watermark, but the spill stores nothing. */
+  record_tenth_of_buffer (fixture->test_object);
+  g_assert_true (g_main_context_iteration (NULL, FALSE));
+  g_assert_cmpfloat (emer_daemon_get_buffer_fill (fixture->test_object), >,
+                     0.7);
+
+  /* So the 8th doesn't schedule another one. */
+  record_tenth_of_buffer (fixture->test_object);
+  g_assert_false (g_main_context_iteration (NULL, FALSE));
+
+  /* Clearing the persistent cache, along with the buffer, makes room again. */
+  emer_permissions_provider_set_daemon_enabled (fixture->mock_permissions_provider,
+                                                FALSE);
+  emer_permissions_provider_set_daemon_enabled (fixture->mock_permissions_provider,
+                                                TRUE);
+  run_pending_sources ();
+  g_assert_true (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+
+  for (gint i = 0; i < 7; i++)
+    {
+      record_tenth_of_buffer (fixture->test_object);
+      run_pending_sources ();
+    }
+
+  g_assert_false (mock_persistent_cache_is_empty (fixture->mock_persistent_cache));
+}
+
+/* On a low-memory warning, buffered events should be moved to the persistent
+ * cache and the memory accounted to the buffer given back.
+ */
+static void
+test_daemon_releases_memory (Fixture      *fixture,
+                             gconstpointer unused)
+{
+  g_autofree gchar *padding = g_strnfill (1000, 'x');
+
+  for (gint i = 0; i < 3; i++)
+    emer_daemon_record_singular_event (fixture->test_object,
+                                       make_event_id_variant (),
+                                       RELATIVE_TIMESTAMP,
+                                       TRUE,
+                                       g_variant_new_string (padding));
+
+  /* The usage is only brought up to date on demand. */
+  EmerMemoryBudget *budget =
+    emer_daemon_get_memory_budget (fixture->test_object);
+  gsize buffer_usage =
+    emer_memory_budget_get_usage (budget, EMER_MEMORY_COMPONENT_BUFFER);
+  g_assert_cmpuint (buffer_usage, >, 3 * 1000);
+  g_assert_cmpuint (emer_memory_budget_get_total_usage (budget), <=,
+                    emer_memory_budget_get_budget (budget));
+
+  emer_daemon_release_memory (fixture->test_object);
+
+  g_autofree GVariant **variants = NULL;
+  gsize num_variants;
+  guint64 token;
+  gboolean has_invalid;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (fixture->mock_persistent_cache, &variants,
+                                G_MAXSIZE, &num_variants, &token,
+                                &has_invalid, NULL /* GError */);
+  g_assert_true (read_succeeded);
+  g_assert_cmpuint (num_variants, ==, 3);
+  for (gsize i = 0; i < num_variants; i++)
+    g_variant_unref (variants[i]);
+
+  g_assert_cmpfloat (emer_daemon_get_buffer_fill (fixture->test_object), ==,
+                     0.0);
+  g_assert_cmpuint (emer_memory_budget_get_usage (budget,
+                                                  EMER_MEMORY_COMPONENT_BUFFER),
+                    <, 1000);
+}
+
+/* Replaces the test object with one which won't make a periodic upload during
+ * the test, so that only high-priority events are uploaded. */
+static void
+create_priority_test_object (Fixture *fixture)
+{
+  g_clear_object (&fixture->test_object);
+  fixture->test_object =
+    g_object_new (EMER_TYPE_DAEMON,
+                  "random-number-generator", g_rand_new_with_seed (18),
+                  "network-send-interval", 3600,
+                  "permissions-provider", fixture->mock_permissions_provider,
+                  "persistent-cache", fixture->mock_persistent_cache,
+                  "aggregate-tally", fixture->mock_aggregate_tally,
+                  "event-policy-path", fixture->event_policy_path,
+                  NULL);
+}
+
+static void
+record_high_priority_singular (EmerDaemon *daemon)
+{
+  emer_daemon_record_singular_event (daemon,
+                                     make_variant_for_event_id (HIGH_PRIORITY_EVENT),
+                                     RELATIVE_TIMESTAMP,
+                                     FALSE,
+                                     make_auxiliary_payload ());
+}
+
+/* Events marked as high-priority by the event policy should be uploaded within
+ * seconds, on their own, rather than waiting for the periodic upload.
+ */
+static void
+test_daemon_uploads_high_priority_events_early (Fixture      *fixture,
+                                                gconstpointer unused)
+{
+  create_priority_test_object (fixture);
+
+  emer_daemon_record_singular_event (fixture->test_object,
+                                     make_event_id_variant (),
+                                     RELATIVE_TIMESTAMP,
+                                     FALSE,
+                                     make_auxiliary_payload ());
+  record_high_priority_singular (fixture->test_object);
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_high_priority_singular_received);
+  wait_for_upload_to_finish (fixture);
+}
+
+/* If the daemon is disabled while high-priority events are being uploaded,
+ * and re-enabled before the upload succeeds, the high-priority events recorded
+ * in the meantime should be kept for the next upload rather than being
+ * removed in place of those which were discarded.
+ */
+static void
+test_daemon_discards_in_flight_priority_events_when_daemon_disabled (Fixture      *fixture,
+                                                                     gconstpointer unused)
+{
+  create_priority_test_object (fixture);
+
+  record_high_priority_singular (fixture->test_object);
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_high_priority_singular_received);
+
+  /* Before the server sends a reply, disable and re-enable the daemon */
+  emer_permissions_provider_set_daemon_enabled (fixture->mock_permissions_provider,
+                                                FALSE);
+  assert_metrics_disabled (fixture);
+  emer_permissions_provider_set_daemon_enabled (fixture->mock_permissions_provider,
+                                                TRUE);
+
+  /* Two events are recorded, where the upload in flight carried one */
+  record_high_priority_singular (fixture->test_object);
+  record_high_priority_singular (fixture->test_object);
+
+  /* Now allow the server to reply */
+  wait_for_upload_to_finish (fixture);
+
+  read_network_request (fixture,
+                        (ProcessBytesSourceFunc) assert_two_high_priority_singulars_received);
+  wait_for_upload_to_finish (fixture);
+}
+
 /* If the first attempt to create the EmerPersistentCache fails with a
  * G_KEY_FILE_ERROR, the daemon should attempt to reset the cache, and log an
  * event indicating that the cache metadata was corrupt.
@@ -1351,6 +2284,13 @@ main (gint                argc,
   ADD_DAEMON_TEST ("/daemon/new-succeeds-if-disabled", test_daemon_new_succeeds_if_disabled);
   ADD_DAEMON_TEST ("/daemon/new-full-succeeds", test_daemon_new_full_succeeds);
   ADD_DAEMON_TEST ("/daemon/records-singulars", test_daemon_records_singulars);
+  ADD_DAEMON_TEST ("/daemon/records-singular-batch",
+                   test_daemon_records_singular_batch);
+  ADD_DAEMON_TEST ("/daemon/records-sequence", test_daemon_records_sequence);
+  ADD_DAEMON_TEST ("/daemon/records-aggregate-event",
+                   test_daemon_records_aggregate_event);
+  ADD_DAEMON_TEST ("/daemon/buffers-late-aggregate-event",
+                   test_daemon_buffers_late_aggregate_event);
   ADD_DAEMON_TEST ("/daemon/records-aggregates",
                    test_daemon_records_aggregates);
   ADD_DAEMON_TEST ("/daemon/retries-singular-uploads",
@@ -1365,6 +2305,8 @@ main (gint                argc,
                    test_daemon_only_reports_aggregates_when_uploading_enabled);
   ADD_DAEMON_TEST ("/daemon/does-not-record-singulars-when-daemon-disabled",
                    test_daemon_does_not_record_singulars_when_daemon_disabled);
+  ADD_DAEMON_TEST ("/daemon/does-not-record-denied-events",
+                   test_daemon_does_not_record_denied_events);
   ADD_DAEMON_TEST ("/daemon/does-not-record-aggregates-when-daemon-disabled",
                    test_daemon_does_not_record_aggregates_when_daemon_disabled);
   ADD_DAEMON_TEST ("/daemon/discards/in-memory-singulars-when-daemon-disabled",
@@ -1373,12 +2315,37 @@ main (gint                argc,
                    test_daemon_discards_in_flight_singulars_when_daemon_disabled);
   ADD_DAEMON_TEST ("/daemon/discards/failed-in-flight-singulars-when-daemon-disabled",
                    test_daemon_discards_failed_in_flight_singulars_when_daemon_disabled);
+  ADD_DAEMON_TEST ("/daemon/discards/in-flight-priority-events-when-daemon-disabled",
+                   test_daemon_discards_in_flight_priority_events_when_daemon_disabled);
   ADD_DAEMON_TEST ("/daemon/discards/persistent-cache-when-daemon-disabled",
                    test_daemon_discards_persistent_cache_when_daemon_disabled);
   ADD_DAEMON_TEST ("/daemon/flushes-to-persistent-cache-on-finalize",
                    test_daemon_flushes_to_persistent_cache_on_finalize);
+  ADD_DAEMON_TEST ("/daemon/stores-batches", test_daemon_stores_batches);
+  ADD_DAEMON_TEST ("/daemon/discards-oversized-stored-batch",
+                   test_daemon_discards_oversized_stored_batch);
   ADD_DAEMON_TEST ("/daemon/limits-network-upload-size",
                    test_daemon_limits_network_upload_size);
+  ADD_DAEMON_TEST ("/daemon/limits-expanded-sequences",
+                   test_daemon_limits_expanded_sequences);
+  ADD_DAEMON_TEST ("/daemon/drops-sequence-too-long-to-expand",
+                   test_daemon_drops_sequence_too_long_to_expand);
+  ADD_DAEMON_TEST ("/daemon/reports-buffer-pressure",
+                   test_daemon_reports_buffer_pressure);
+  ADD_DAEMON_TEST ("/daemon/releases-memory",
+                   test_daemon_releases_memory);
+  ADD_DAEMON_TEST ("/daemon/pressure-falls-with-hysteresis",
+                   test_daemon_pressure_falls_with_hysteresis);
+  ADD_DAEMON_TEST ("/daemon/spills-to-persistent-cache",
+                   test_daemon_spills_to_persistent_cache);
+  ADD_DAEMON_TEST ("/daemon/spills-in-batches",
+                   test_daemon_spills_in_batches);
+  ADD_DAEMON_TEST ("/daemon/spilling-keeps-pressure",
+                   test_daemon_spilling_keeps_pressure);
+  ADD_DAEMON_TEST ("/daemon/backs-off-spilling-when-cache-full",
+                   test_daemon_backs_off_spilling_when_cache_full);
+  ADD_DAEMON_TEST ("/daemon/uploads-high-priority-events-early",
+                   test_daemon_uploads_high_priority_events_early);
 
 #undef ADD_DAEMON_TEST
 
@@ -0,0 +1,364 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-event-buffer.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "shared/metrics-util.h"
+
+#define OS_VERSION "5.1.0"
+
+static const guchar event_ids[][UUID_LENGTH] = {
+  { 0x35, 0x0a, 0xc4, 0xff, 0x30, 0x26, 0x4c, 0x25,
+    0x9e, 0x7e, 0xe8, 0x10, 0x3b, 0x4f, 0xd5, 0xd8 },
+  { 0xb8, 0x9e, 0xd6, 0x2b, 0x2f, 0x3c, 0x4b, 0x3b,
+    0x90, 0x48, 0x0a, 0x12, 0x7e, 0x83, 0xa6, 0x4e },
+};
+
+/* Sizes of byte-array payloads chosen so that the singular's framing offsets
+ * are 1, 2 and 4 bytes wide, and to straddle each boundary.
+ */
+static const gsize payload_sizes[] = {
+  0, 1, 200, 220, 221, 222, 223, 224, 225, 226, 300, 65000, 65490, 65500,
+  65510, 65520, 100000,
+};
+
+/* Returns the cost of @variant as computed by emer_persistent_cache_cost() */
+static gsize
+variant_cost (GVariant *variant)
+{
+  const gchar *type_string = g_variant_get_type_string (variant);
+  gsize header_size = 1;
+
+  /* Only singular and aggregate events are identified by their record kind
+   * alone; any other variant's record also holds its type string. */
+  if (strcmp (type_string, "(aysxmv)") != 0 &&
+      strcmp (type_string, "(ayssumv)") != 0)
+    header_size += strlen (type_string) + 1;
+
+  return header_size + g_variant_get_size (variant);
+}
+
+static GVariant *
+make_payload (gsize size)
+{
+  g_autofree guchar *data = g_malloc0 (size);
+
+  return g_variant_new_variant (
+    g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, size, 1));
+}
+
+static GVariant *
+make_singular (const guchar *event_id,
+               const gchar  *os_version,
+               gint64        relative_timestamp,
+               GVariant     *payload)
+{
+  return g_variant_new ("(@aysxm@v)",
+                        g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                   event_id, UUID_LENGTH, 1),
+                        os_version, relative_timestamp, payload);
+}
+
+static void
+test_event_buffer_new_is_empty (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+
+  g_assert_cmpuint (emer_event_buffer_get_length (buffer), ==, 0);
+  g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==, 0);
+}
+
+static void
+test_event_buffer_singular_cost (void)
+{
+  const gchar *os_versions[] = { "", OS_VERSION, "a much longer OS version" };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (os_versions); i++)
+    {
+      g_autoptr(GVariant) singular =
+        g_variant_ref_sink (make_singular (event_ids[0], os_versions[i], 0,
+                                           NULL));
+
+      g_assert_cmpuint (emer_event_buffer_singular_cost (os_versions[i], NULL),
+                        ==, variant_cost (singular));
+
+      for (gsize j = 0; j < G_N_ELEMENTS (payload_sizes); j++)
+        {
+          g_autoptr(GVariant) payload =
+            g_variant_ref_sink (make_payload (payload_sizes[j]));
+          g_autoptr(GVariant) singular_with_payload =
+            g_variant_ref_sink (make_singular (event_ids[0], os_versions[i],
+                                               0, payload));
+
+          g_assert_cmpuint (emer_event_buffer_singular_cost (os_versions[i],
+                                                             payload),
+                            ==, variant_cost (singular_with_payload));
+        }
+    }
+}
+
+static void
+test_event_buffer_round_trip (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+  g_autoptr(GPtrArray) expected =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  gsize expected_cost = 0;
+
+  for (gsize i = 0; i < G_N_ELEMENTS (payload_sizes); i++)
+    {
+      const guchar *event_id = event_ids[i % G_N_ELEMENTS (event_ids)];
+      g_autoptr(GVariant) payload =
+        i == 0 ? NULL : g_variant_ref_sink (make_payload (payload_sizes[i]));
+
+      emer_event_buffer_append_singular (buffer, event_id, OS_VERSION, i,
+                                         payload);
+      g_ptr_array_add (expected,
+                       g_variant_ref_sink (make_singular (event_id, OS_VERSION,
+                                                          i, payload)));
+    }
+
+  /* Events of other types are stored whole */
+  GVariant *aggregate =
+    g_variant_new ("(@ayssumv)",
+                   g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                              event_ids[1], UUID_LENGTH, 1),
+                   OS_VERSION, "2026-10", 42, NULL);
+  g_ptr_array_add (expected, g_variant_ref_sink (aggregate));
+  emer_event_buffer_append_variant (buffer, aggregate);
+
+  g_assert_cmpuint (emer_event_buffer_get_length (buffer), ==, expected->len);
+
+  for (gsize i = 0; i < expected->len; i++)
+    {
+      GVariant *expected_event = g_ptr_array_index (expected, i);
+      g_autoptr(GVariant) actual_event =
+        emer_event_buffer_get_event (buffer, i);
+
+      g_assert_false (g_variant_is_floating (actual_event));
+      g_assert_cmpvariant (actual_event, expected_event);
+      g_assert_cmpuint (emer_event_buffer_get_event_cost (buffer, i), ==,
+                        variant_cost (expected_event));
+      expected_cost += variant_cost (expected_event);
+    }
+
+  g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==, expected_cost);
+}
+
+static void
+test_event_buffer_consumes_floating_refs (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+
+  emer_event_buffer_append_singular (buffer, event_ids[0], OS_VERSION, 0,
+                                     make_payload (8));
+  emer_event_buffer_append_variant (buffer,
+                                    g_variant_new_string ("mcfloatface"));
+
+  g_assert_cmpuint (emer_event_buffer_get_length (buffer), ==, 2);
+}
+
+/* Removing events from the head should leave the remaining events, and their
+ * total cost, intact, including across compaction and once the buffer has
+ * been emptied and reused.
+ */
+static void
+test_event_buffer_remove_head (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+  const gsize num_events = 1000;
+  gsize removed = 0;
+
+  for (gsize i = 0; i < num_events; i++)
+    {
+      g_autoptr(GVariant) payload =
+        i % 3 == 0 ? NULL : g_variant_ref_sink (make_payload (i % 50));
+
+      emer_event_buffer_append_singular (buffer,
+                                         event_ids[i % G_N_ELEMENTS (event_ids)],
+                                         OS_VERSION, i, payload);
+    }
+
+  while (removed < num_events)
+    {
+      gsize to_remove = MIN (num_events - removed, 1 + removed / 4);
+      gsize expected_cost = 0;
+
+      emer_event_buffer_remove_head (buffer, to_remove);
+      removed += to_remove;
+
+      g_assert_cmpuint (emer_event_buffer_get_length (buffer), ==,
+                        num_events - removed);
+
+      for (gsize i = 0; i < num_events - removed; i++)
+        {
+          g_autoptr(GVariant) event = emer_event_buffer_get_event (buffer, i);
+          gint64 relative_timestamp;
+
+          g_variant_get_child (event, 2, "x", &relative_timestamp);
+          g_assert_cmpint (relative_timestamp, ==, removed + i);
+          expected_cost += variant_cost (event);
+        }
+
+      g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==,
+                        expected_cost);
+    }
+
+  g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==, 0);
+
+  emer_event_buffer_append_singular (buffer, event_ids[1], OS_VERSION, 7,
+                                     NULL);
+  g_autoptr(GVariant) event = emer_event_buffer_get_event (buffer, 0);
+  g_autoptr(GVariant) expected =
+    g_variant_ref_sink (make_singular (event_ids[1], OS_VERSION, 7, NULL));
+  g_assert_cmpvariant (event, expected);
+}
+
+/* The prefix costs, and the binary search over them, should agree with summing
+ * the events' costs one by one, including after events have been removed.
+ */
+static void
+test_event_buffer_head_cost (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+  const gsize num_events = 200;
+
+  g_assert_cmpuint (emer_event_buffer_count_within_cost (buffer, G_MAXSIZE),
+                    ==, 0);
+
+  for (gsize i = 0; i < num_events; i++)
+    {
+      g_autoptr(GVariant) payload =
+        i % 4 == 0 ? NULL : g_variant_ref_sink (make_payload (i * 7 % 300));
+
+      emer_event_buffer_append_singular (buffer, event_ids[0], OS_VERSION, i,
+                                         payload);
+    }
+
+  for (gsize removed = 0; removed < num_events; removed += 37)
+    {
+      gsize length = emer_event_buffer_get_length (buffer);
+      gsize expected_cost = 0;
+
+      for (gsize n = 0; n <= length; n++)
+        {
+          g_assert_cmpuint (emer_event_buffer_get_head_cost (buffer, n), ==,
+                            expected_cost);
+
+          /* Exactly enough for n events, and one byte short of that */
+          g_assert_cmpuint (emer_event_buffer_count_within_cost (buffer,
+                                                                 expected_cost),
+                            ==, n);
+          if (n > 0)
+            g_assert_cmpuint (emer_event_buffer_count_within_cost (buffer,
+                                                                   expected_cost - 1),
+                              ==, n - 1);
+
+          if (n < length)
+            expected_cost += emer_event_buffer_get_event_cost (buffer, n);
+        }
+
+      g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==,
+                        expected_cost);
+      g_assert_cmpuint (emer_event_buffer_count_within_cost (buffer, G_MAXSIZE),
+                        ==, length);
+
+      emer_event_buffer_remove_head (buffer, MIN (37, length));
+    }
+}
+
+/* Trimming should release the memory of removed events without disturbing
+ * the remaining ones.
+ */
+static void
+test_event_buffer_trim (void)
+{
+  g_autoptr(EmerEventBuffer) buffer = emer_event_buffer_new ();
+  const gsize num_events = 100, num_removed = 60;
+
+  for (gsize i = 0; i < num_events; i++)
+    {
+      g_autoptr(GVariant) payload = g_variant_ref_sink (make_payload (100));
+
+      emer_event_buffer_append_singular (buffer, event_ids[0], OS_VERSION, i,
+                                         payload);
+    }
+
+  emer_event_buffer_remove_head (buffer, num_removed);
+  gsize cost = emer_event_buffer_get_cost (buffer);
+  gsize usage = emer_event_buffer_get_memory_usage (buffer);
+
+  emer_event_buffer_trim (buffer);
+
+  g_assert_cmpuint (emer_event_buffer_get_memory_usage (buffer), <, usage);
+  g_assert_cmpuint (emer_event_buffer_get_cost (buffer), ==, cost);
+  g_assert_cmpuint (emer_event_buffer_get_length (buffer), ==,
+                    num_events - num_removed);
+
+  for (gsize i = 0; i < num_events - num_removed; i++)
+    {
+      g_autoptr(GVariant) event = emer_event_buffer_get_event (buffer, i);
+      g_autoptr(GVariant) payload = g_variant_ref_sink (make_payload (100));
+      g_autoptr(GVariant) expected =
+        g_variant_ref_sink (make_singular (event_ids[0], OS_VERSION,
+                                           num_removed + i, payload));
+
+      g_assert_cmpvariant (event, expected);
+    }
+
+  /* Once emptied, a trimmed buffer holds no more than a new one. */
+  g_autoptr(EmerEventBuffer) empty = emer_event_buffer_new ();
+
+  emer_event_buffer_remove_head (buffer, num_events - num_removed);
+  emer_event_buffer_trim (buffer);
+  g_assert_cmpuint (emer_event_buffer_get_memory_usage (buffer), <=,
+                    emer_event_buffer_get_memory_usage (empty));
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_func ("/event-buffer/new-is-empty",
+                   test_event_buffer_new_is_empty);
+  g_test_add_func ("/event-buffer/singular-cost",
+                   test_event_buffer_singular_cost);
+  g_test_add_func ("/event-buffer/round-trip",
+                   test_event_buffer_round_trip);
+  g_test_add_func ("/event-buffer/consumes-floating-refs",
+                   test_event_buffer_consumes_floating_refs);
+  g_test_add_func ("/event-buffer/remove-head",
+                   test_event_buffer_remove_head);
+  g_test_add_func ("/event-buffer/head-cost",
+                   test_event_buffer_head_cost);
+  g_test_add_func ("/event-buffer/trim",
+                   test_event_buffer_trim);
+
+  return g_test_run ();
+}
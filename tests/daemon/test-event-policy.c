@@ -0,0 +1,264 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-event-policy.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <uuid/uuid.h>
+
+#include "shared/metrics-util.h"
+
+#define EVENT_POLICY_FILE_PATH "event_policy_file_XXXXXX"
+
+#define MACHINE_ID "0123456789abcdef0123456789abcdef"
+
+#define DENIED_EVENT_ID "350ac4ff-3026-4c25-9e7e-e8103b4fd5d8"
+#define ALLOWED_EVENT_ID "ab839fd2-a927-456c-8c69-dfc6cca0e5e6"
+#define NEVER_SAMPLED_EVENT_ID "e4531a67-2ac5-4ee7-8a69-8e1a9b5c5a0c"
+#define ALWAYS_SAMPLED_EVENT_ID "5ad7d7ff-4b4c-4a4b-a4f3-6ab1b6f3c4fa"
+#define HALF_SAMPLED_EVENT_ID "b9e2b1b0-3a0a-4d23-9c49-57a1d7e1a1c1"
+#define UNLISTED_EVENT_ID "9d03daad-f1ed-41a8-bc5a-6b532c075832"
+#define HIGH_PRIORITY_EVENT_ID "cf09194a-3090-4782-ab03-87b2f1515aed"
+
+#define EVENT_POLICY_FILE_CONTENTS \
+  "[" DENIED_EVENT_ID "]\n" \
+  "action=deny\n" \
+  "\n" \
+  "[" ALLOWED_EVENT_ID "]\n" \
+  "action=allow\n" \
+  "\n" \
+  "[" NEVER_SAMPLED_EVENT_ID "]\n" \
+  "sample_rate=0\n" \
+  "\n" \
+  "[" ALWAYS_SAMPLED_EVENT_ID "]\n" \
+  "sample_rate=1.0\n" \
+  "\n" \
+  "[" HALF_SAMPLED_EVENT_ID "]\n" \
+  "sample_rate=0.5\n" \
+  "\n" \
+  "[" HIGH_PRIORITY_EVENT_ID "]\n" \
+  "priority=high\n"
+
+typedef struct
+{
+  gchar *tmp_path;
+} Fixture;
+
+static void
+setup (Fixture       *fixture,
+       gconstpointer  file_contents)
+{
+  g_autoptr(GError) error = NULL;
+  gint fd = g_file_open_tmp (EVENT_POLICY_FILE_PATH, &fixture->tmp_path,
+                             &error);
+
+  g_assert_no_error (error);
+  close (fd);
+
+  g_file_set_contents (fixture->tmp_path, file_contents, -1, &error);
+  g_assert_no_error (error);
+}
+
+static void
+teardown (Fixture       *fixture,
+          gconstpointer  unused)
+{
+  g_unlink (fixture->tmp_path);
+  g_free (fixture->tmp_path);
+}
+
+static gboolean
+should_record (EmerEventPolicy *policy,
+               const gchar     *event_id_string)
+{
+  uuid_t event_id;
+
+  g_assert_cmpint (uuid_parse (event_id_string, event_id), ==, 0);
+  return emer_event_policy_should_record (policy, event_id);
+}
+
+static void
+test_event_policy_absent_file (void)
+{
+  g_autoptr(EmerEventPolicy) policy =
+    emer_event_policy_new_full ("/nonexistent/event-policy.conf", MACHINE_ID);
+
+  g_assert_true (should_record (policy, DENIED_EVENT_ID));
+  g_assert_true (should_record (policy, UNLISTED_EVENT_ID));
+}
+
+static void
+test_event_policy_allow_deny (Fixture       *fixture,
+                              gconstpointer  unused)
+{
+  g_autoptr(EmerEventPolicy) policy =
+    emer_event_policy_new_full (fixture->tmp_path, MACHINE_ID);
+
+  g_assert_false (should_record (policy, DENIED_EVENT_ID));
+  g_assert_true (should_record (policy, ALLOWED_EVENT_ID));
+  g_assert_true (should_record (policy, UNLISTED_EVENT_ID));
+}
+
+static void
+test_event_policy_applies_to_monthly_tally (Fixture       *fixture,
+                                            gconstpointer  unused)
+{
+  g_autoptr(EmerEventPolicy) policy =
+    emer_event_policy_new_full (fixture->tmp_path, MACHINE_ID);
+  uuid_t event_id, monthly_event_id;
+
+  uuid_parse (DENIED_EVENT_ID, event_id);
+  uuid_generate_sha1 (monthly_event_id, event_id, "monthly",
+                      strlen ("monthly"));
+  g_assert_false (emer_event_policy_should_record (policy, monthly_event_id));
+
+  uuid_parse (ALLOWED_EVENT_ID, event_id);
+  uuid_generate_sha1 (monthly_event_id, event_id, "monthly",
+                      strlen ("monthly"));
+  g_assert_true (emer_event_policy_should_record (policy, monthly_event_id));
+}
+
+static void
+test_event_policy_sample_rate_bounds (Fixture       *fixture,
+                                      gconstpointer  unused)
+{
+  for (guint i = 0; i < 100; i++)
+    {
+      g_autofree gchar *machine_id = g_strdup_printf ("machine-%u", i);
+      g_autoptr(EmerEventPolicy) policy =
+        emer_event_policy_new_full (fixture->tmp_path, machine_id);
+
+      g_assert_false (should_record (policy, NEVER_SAMPLED_EVENT_ID));
+      g_assert_true (should_record (policy, ALWAYS_SAMPLED_EVENT_ID));
+    }
+}
+
+static void
+test_event_policy_sampling (Fixture       *fixture,
+                            gconstpointer  unused)
+{
+  guint num_machines = 1000, num_sampled = 0;
+
+  for (guint i = 0; i < num_machines; i++)
+    {
+      g_autofree gchar *machine_id = g_strdup_printf ("machine-%u", i);
+      g_autoptr(EmerEventPolicy) policy =
+        emer_event_policy_new_full (fixture->tmp_path, machine_id);
+      g_autoptr(EmerEventPolicy) same_machine_policy =
+        emer_event_policy_new_full (fixture->tmp_path, machine_id);
+      gboolean sampled = should_record (policy, HALF_SAMPLED_EVENT_ID);
+
+      /* Each machine always makes the same decision. */
+      g_assert_cmpint (sampled, ==,
+                       should_record (same_machine_policy,
+                                      HALF_SAMPLED_EVENT_ID));
+
+      if (sampled)
+        num_sampled++;
+    }
+
+  /* About half of all machines record the event. */
+  g_assert_cmpuint (num_sampled, >, 400);
+  g_assert_cmpuint (num_sampled, <, 600);
+}
+
+static void
+test_event_policy_priority (Fixture       *fixture,
+                            gconstpointer  unused)
+{
+  g_autoptr(EmerEventPolicy) policy =
+    emer_event_policy_new_full (fixture->tmp_path, MACHINE_ID);
+  uuid_t event_id, monthly_event_id;
+
+  uuid_parse (HIGH_PRIORITY_EVENT_ID, event_id);
+  g_assert_true (emer_event_policy_is_high_priority (policy, event_id));
+  g_assert_true (emer_event_policy_should_record (policy, event_id));
+
+  /* Monthly tallies are never uploaded early */
+  uuid_generate_sha1 (monthly_event_id, event_id, "monthly",
+                      strlen ("monthly"));
+  g_assert_false (emer_event_policy_is_high_priority (policy,
+                                                      monthly_event_id));
+
+  uuid_parse (ALLOWED_EVENT_ID, event_id);
+  g_assert_false (emer_event_policy_is_high_priority (policy, event_id));
+  uuid_parse (UNLISTED_EVENT_ID, event_id);
+  g_assert_false (emer_event_policy_is_high_priority (policy, event_id));
+}
+
+static void
+test_event_policy_ignores_invalid_groups (Fixture       *fixture,
+                                          gconstpointer  unused)
+{
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "*'not-a-uuid'*");
+  g_autoptr(EmerEventPolicy) policy =
+    emer_event_policy_new_full (fixture->tmp_path, MACHINE_ID);
+  g_test_assert_expected_messages ();
+
+  g_assert_false (should_record (policy, DENIED_EVENT_ID));
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+#define ADD_EVENT_POLICY_TEST(path, file_contents, test_func) \
+  g_test_add ((path), Fixture, (file_contents), setup, (test_func), teardown);
+
+  g_test_add_func ("/event-policy/absent-file",
+                   test_event_policy_absent_file);
+  ADD_EVENT_POLICY_TEST ("/event-policy/allow-deny",
+                         EVENT_POLICY_FILE_CONTENTS,
+                         test_event_policy_allow_deny);
+  ADD_EVENT_POLICY_TEST ("/event-policy/applies-to-monthly-tally",
+                         EVENT_POLICY_FILE_CONTENTS,
+                         test_event_policy_applies_to_monthly_tally);
+  ADD_EVENT_POLICY_TEST ("/event-policy/sample-rate-bounds",
+                         EVENT_POLICY_FILE_CONTENTS,
+                         test_event_policy_sample_rate_bounds);
+  ADD_EVENT_POLICY_TEST ("/event-policy/sampling",
+                         EVENT_POLICY_FILE_CONTENTS,
+                         test_event_policy_sampling);
+  ADD_EVENT_POLICY_TEST ("/event-policy/priority",
+                         EVENT_POLICY_FILE_CONTENTS,
+                         test_event_policy_priority);
+  ADD_EVENT_POLICY_TEST ("/event-policy/ignores-invalid-groups",
+                         "[not-a-uuid]\n"
+                         "action=deny\n"
+                         "\n"
+                         "[" DENIED_EVENT_ID "]\n"
+                         "action=deny\n",
+                         test_event_policy_ignores_invalid_groups);
+
+#undef ADD_EVENT_POLICY_TEST
+
+  return g_test_run ();
+}
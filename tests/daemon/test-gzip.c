@@ -109,11 +109,19 @@ test_gzip_roundtrip (const gchar *input_string)
   gchar *decompressed_string =
     (gchar *) gzip_decompress (compressed_string, compressed_length,
                                &decompressed_length);
-  g_free (compressed_string);
 
   g_assert_cmpmem (input_string, input_length, decompressed_string,
                    decompressed_length);
   g_free (decompressed_string);
+
+  decompressed_string = emer_gzip_decompress (compressed_string,
+                                              compressed_length,
+                                              input_length, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (input_string, input_length, decompressed_string,
+                   input_length);
+  g_free (decompressed_string);
+  g_free (compressed_string);
 }
 
 static void
@@ -142,6 +150,95 @@ test_gzip_compress_on_incompressible_payload (gboolean     *unused,
                        "\x88Ý\n\x8eWï^Q\x88^NãS%\x9d`¥");
 }
 
+static void
+test_gzip_decompress_checks_length (gboolean     *unused,
+                                    gconstpointer dont_use_me)
+{
+  const gchar *input_string = "Not as many zips as you might think.";
+  gsize input_length = strlen (input_string);
+  gsize compressed_length;
+  GError *error = NULL;
+  g_autofree gpointer compressed_string =
+    emer_gzip_compress (input_string, input_length, &compressed_length, &error);
+  g_assert_no_error (error);
+
+  gpointer decompressed_string =
+    emer_gzip_decompress (compressed_string, compressed_length,
+                          input_length - 1, &error);
+  g_assert_null (decompressed_string);
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+
+  decompressed_string =
+    emer_gzip_decompress (compressed_string, compressed_length,
+                          input_length + 1, &error);
+  g_assert_null (decompressed_string);
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+
+  decompressed_string =
+    emer_gzip_decompress (compressed_string, compressed_length / 2,
+                          input_length, &error);
+  g_assert_null (decompressed_string);
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+}
+
+static void
+test_gzip_replaces_prefix (gboolean     *unused,
+                           gconstpointer dont_use_me)
+{
+  gchar input_string[] = "0123456789: How many zips could a gzip zip?";
+  gsize input_length = strlen (input_string);
+  gsize prefix_length = 10;
+  gsize compressed_length;
+  GError *error = NULL;
+  g_autofree gpointer compressed_string =
+    emer_gzip_compress_with_prefix (input_string, input_length, prefix_length,
+                                    &compressed_length, &error);
+  g_assert_no_error (error);
+
+  gsize decompressed_length;
+  g_autofree gchar *decompressed_string =
+    gzip_decompress (compressed_string, compressed_length,
+                     &decompressed_length);
+  g_assert_cmpmem (input_string, input_length, decompressed_string,
+                   decompressed_length);
+  g_clear_pointer (&decompressed_string, g_free);
+
+  memcpy (input_string, "9876543210", prefix_length);
+  gboolean replace_succeeded =
+    emer_gzip_replace_prefix (compressed_string, compressed_length,
+                              input_string, input_length, prefix_length,
+                              &error);
+  g_assert_no_error (error);
+  g_assert_true (replace_succeeded);
+
+  /* GZlibDecompressor verifies the checksum in the trailer */
+  decompressed_string = emer_gzip_decompress (compressed_string,
+                                              compressed_length,
+                                              input_length, &error);
+  g_assert_no_error (error);
+  g_assert_cmpmem (input_string, input_length, decompressed_string,
+                   input_length);
+
+  replace_succeeded =
+    emer_gzip_replace_prefix (compressed_string, compressed_length,
+                              input_string, input_length, prefix_length + 1,
+                              &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_false (replace_succeeded);
+  g_clear_error (&error);
+
+  replace_succeeded =
+    emer_gzip_replace_prefix (compressed_string, compressed_length,
+                              input_string, input_length - 1, prefix_length,
+                              &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_false (replace_succeeded);
+  g_clear_error (&error);
+}
+
 gint
 main (gint                argc,
       const gchar * const argv[])
@@ -158,6 +255,9 @@ main (gint                argc,
                       test_gzip_compress_on_standard_payload);
   ADD_GZIP_TEST_FUNC ("/gzip/compress-on-incompressible-payload",
                       test_gzip_compress_on_incompressible_payload);
+  ADD_GZIP_TEST_FUNC ("/gzip/decompress-checks-length",
+                      test_gzip_decompress_checks_length);
+  ADD_GZIP_TEST_FUNC ("/gzip/replaces-prefix", test_gzip_replaces_prefix);
 
 #undef ADD_GZIP_TEST_FUNC
 
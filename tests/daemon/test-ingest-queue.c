@@ -0,0 +1,193 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-ingest-queue.h"
+
+#include <glib.h>
+
+#define NUM_PRODUCERS 8
+#define ITEMS_PER_PRODUCER 10000
+
+typedef struct
+{
+  guint producer;
+  guint sequence_number;
+} Item;
+
+typedef struct
+{
+  GThread *main_thread;
+  guint next_sequence_number[NUM_PRODUCERS];
+  guint num_received;
+  guint num_freed;
+} Consumer;
+
+typedef struct
+{
+  EmerIngestQueue *queue;
+  guint producer;
+} Producer;
+
+static void
+consume_item (gpointer item_,
+              gpointer user_data)
+{
+  Item *item = item_;
+  Consumer *consumer = user_data;
+
+  g_assert_true (g_thread_self () == consumer->main_thread);
+  g_assert_cmpuint (item->producer, <, NUM_PRODUCERS);
+
+  /* Items from each producer must arrive in the order they were pushed */
+  g_assert_cmpuint (item->sequence_number, ==,
+                    consumer->next_sequence_number[item->producer]);
+  consumer->next_sequence_number[item->producer]++;
+  consumer->num_received++;
+
+  g_free (item);
+}
+
+static void
+free_item (gpointer item)
+{
+  g_free (item);
+}
+
+static gpointer
+produce_items (gpointer user_data)
+{
+  Producer *producer = user_data;
+
+  for (guint i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+      Item *item = g_new (Item, 1);
+
+      item->producer = producer->producer;
+      item->sequence_number = i;
+      emer_ingest_queue_push (producer->queue, item);
+    }
+
+  return NULL;
+}
+
+static void
+test_ingest_queue_single_thread (void)
+{
+  Consumer consumer = { g_thread_self (), };
+  g_autoptr(EmerIngestQueue) queue =
+    emer_ingest_queue_new (NULL, consume_item, &consumer, free_item);
+  Producer producer = { queue, 0 };
+
+  produce_items (&producer);
+
+  /* Nothing is consumed until the context is iterated */
+  g_assert_cmpuint (consumer.num_received, ==, 0);
+
+  while (consumer.num_received < ITEMS_PER_PRODUCER)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (consumer.num_received, ==, ITEMS_PER_PRODUCER);
+  g_assert_cmpuint (consumer.next_sequence_number[0], ==, ITEMS_PER_PRODUCER);
+}
+
+static void
+test_ingest_queue_many_producers (void)
+{
+  Consumer consumer = { g_thread_self (), };
+  g_autoptr(EmerIngestQueue) queue =
+    emer_ingest_queue_new (NULL, consume_item, &consumer, free_item);
+  Producer producers[NUM_PRODUCERS];
+  GThread *threads[NUM_PRODUCERS];
+
+  for (guint i = 0; i < NUM_PRODUCERS; i++)
+    {
+      producers[i].queue = queue;
+      producers[i].producer = i;
+      threads[i] = g_thread_new ("producer", produce_items, &producers[i]);
+    }
+
+  /* Consume concurrently with the producers */
+  while (consumer.num_received < NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (guint i = 0; i < NUM_PRODUCERS; i++)
+    {
+      g_thread_join (threads[i]);
+      g_assert_cmpuint (consumer.next_sequence_number[i], ==,
+                        ITEMS_PER_PRODUCER);
+    }
+}
+
+static void
+count_freed (gpointer item)
+{
+  Consumer *consumer = *(Consumer **) item;
+
+  consumer->num_freed++;
+  g_free (item);
+}
+
+static void
+test_ingest_queue_drain_and_free (void)
+{
+  Consumer consumer = { g_thread_self (), };
+  EmerIngestQueue *queue =
+    emer_ingest_queue_new (NULL, consume_item, &consumer, free_item);
+  Producer producer = { queue, 0 };
+
+  /* Draining explicitly consumes items without iterating the context */
+  produce_items (&producer);
+  emer_ingest_queue_drain (queue);
+  g_assert_cmpuint (consumer.num_received, ==, ITEMS_PER_PRODUCER);
+  emer_ingest_queue_free (queue);
+
+  /* Freeing the queue frees any unconsumed items */
+  queue = emer_ingest_queue_new (NULL, consume_item, &consumer, count_freed);
+  for (guint i = 0; i < 3; i++)
+    {
+      Consumer **item = g_new (Consumer *, 1);
+
+      *item = &consumer;
+      emer_ingest_queue_push (queue, item);
+    }
+
+  emer_ingest_queue_free (queue);
+  g_assert_cmpuint (consumer.num_freed, ==, 3);
+  g_assert_cmpuint (consumer.num_received, ==, ITEMS_PER_PRODUCER);
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_func ("/ingest-queue/single-thread",
+                   test_ingest_queue_single_thread);
+  g_test_add_func ("/ingest-queue/many-producers",
+                   test_ingest_queue_many_producers);
+  g_test_add_func ("/ingest-queue/drain-and-free",
+                   test_ingest_queue_drain_and_free);
+
+  return g_test_run ();
+}
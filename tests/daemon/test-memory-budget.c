@@ -0,0 +1,91 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-memory-budget.h"
+
+#include <glib.h>
+
+static void
+test_memory_budget_starts_empty (void)
+{
+  g_autoptr(EmerMemoryBudget) budget = emer_memory_budget_new (1000);
+
+  g_assert_cmpuint (emer_memory_budget_get_budget (budget), ==, 1000);
+  g_assert_cmpuint (emer_memory_budget_get_total_usage (budget), ==, 0);
+  g_assert_cmpuint (emer_memory_budget_get_available (budget), ==, 1000);
+
+  for (EmerMemoryComponent component = 0;
+       component < EMER_MEMORY_N_COMPONENTS;
+       component++)
+    {
+      g_assert_cmpuint (emer_memory_budget_get_usage (budget, component), ==,
+                        0);
+      g_assert_nonnull (emer_memory_component_to_string (component));
+    }
+}
+
+static void
+test_memory_budget_sums_components (void)
+{
+  g_autoptr(EmerMemoryBudget) budget = emer_memory_budget_new (1000);
+
+  emer_memory_budget_set_usage (budget, EMER_MEMORY_COMPONENT_BUFFER, 300);
+  emer_memory_budget_set_usage (budget, EMER_MEMORY_COMPONENT_REQUEST, 200);
+  g_assert_cmpuint (emer_memory_budget_get_total_usage (budget), ==, 500);
+  g_assert_cmpuint (emer_memory_budget_get_available (budget), ==, 500);
+
+  /* Usage replaces, rather than adds to, the previous value */
+  emer_memory_budget_set_usage (budget, EMER_MEMORY_COMPONENT_BUFFER, 100);
+  g_assert_cmpuint (emer_memory_budget_get_usage (budget,
+                                                  EMER_MEMORY_COMPONENT_BUFFER),
+                    ==, 100);
+  g_assert_cmpuint (emer_memory_budget_get_available (budget), ==, 700);
+}
+
+static void
+test_memory_budget_exhausted (void)
+{
+  g_autoptr(EmerMemoryBudget) budget = emer_memory_budget_new (1000);
+
+  emer_memory_budget_set_usage (budget, EMER_MEMORY_COMPONENT_BUFFER, 800);
+  emer_memory_budget_set_usage (budget, EMER_MEMORY_COMPONENT_AGGREGATE_TALLY,
+                                800);
+  g_assert_cmpuint (emer_memory_budget_get_total_usage (budget), ==, 1600);
+  g_assert_cmpuint (emer_memory_budget_get_available (budget), ==, 0);
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_func ("/memory-budget/starts-empty",
+                   test_memory_budget_starts_empty);
+  g_test_add_func ("/memory-budget/sums-components",
+                   test_memory_budget_sums_components);
+  g_test_add_func ("/memory-budget/exhausted",
+                   test_memory_budget_exhausted);
+
+  return g_test_run ();
+}
@@ -72,6 +72,18 @@ const char *PERMISSIONS_CONFIG_FILE_WITH_PLAIN_URL =
   "uploading_enabled=true\n"
   "environment=dev\n"
   "server_url=https://example.com/";
+const char *PERMISSIONS_CONFIG_FILE_WITH_RATE_LIMITS =
+  "[global]\n"
+  "enabled=true\n"
+  "uploading_enabled=true\n"
+  "environment=test\n"
+  "\n"
+  "[rate_limits]\n"
+  "sender_events_per_second=2.5\n"
+  "sender_event_burst=40\n"
+  "sender_bytes_per_hour=65536\n"
+  "user_events_per_second=0\n"
+  "user_bytes_per_hour=0";
 
 const char *OSTREE_CONFIG_FILE_STAGING_URL =
   "[core]\n"
@@ -573,6 +585,44 @@ test_permissions_provider_handles_plain_url (Fixture       *fixture,
   g_assert_cmpstr (url, ==, "https://example.com/");
 }
 
+static void
+test_permissions_provider_get_rate_limits (Fixture       *fixture,
+                                           gconstpointer  unused)
+{
+  EmerRateLimit sender_limit, user_limit;
+
+  emer_permissions_provider_get_rate_limits (fixture->test_object,
+                                             &sender_limit, &user_limit);
+
+  g_assert_cmpfloat (sender_limit.events_per_second, ==, 2.5);
+  g_assert_cmpuint (sender_limit.event_burst, ==, 40);
+  g_assert_cmpuint (sender_limit.bytes_per_hour, ==, 65536);
+
+  /* Limits can be switched off... */
+  g_assert_cmpfloat (user_limit.events_per_second, ==, 0);
+  g_assert_cmpuint (user_limit.bytes_per_hour, ==, 0);
+
+  /* ...and any which aren't configured keep a default. */
+  g_assert_cmpuint (user_limit.event_burst, >, 0);
+}
+
+static void
+test_permissions_provider_get_rate_limits_default (Fixture       *fixture,
+                                                   gconstpointer  unused)
+{
+  EmerRateLimit sender_limit, user_limit;
+
+  emer_permissions_provider_get_rate_limits (fixture->test_object,
+                                             &sender_limit, &user_limit);
+
+  g_assert_cmpfloat (sender_limit.events_per_second, >, 0);
+  g_assert_cmpuint (sender_limit.event_burst, >, 0);
+  g_assert_cmpuint (sender_limit.bytes_per_hour, >, 0);
+  g_assert_cmpfloat (user_limit.events_per_second, >, 0);
+  g_assert_cmpuint (user_limit.event_burst, >, 0);
+  g_assert_cmpuint (user_limit.bytes_per_hour, >, 0);
+}
+
 gint
 main (gint                argc,
       const gchar * const argv[])
@@ -673,6 +723,14 @@ main (gint                argc,
                                  PERMISSIONS_CONFIG_FILE_WITH_PLAIN_URL,
                                  setup_with_config_file,
                                  test_permissions_provider_handles_plain_url);
+  ADD_PERMISSIONS_PROVIDER_TEST ("/permissions-provider/get-rate-limits/configured",
+                                 PERMISSIONS_CONFIG_FILE_WITH_RATE_LIMITS,
+                                 setup_with_config_file,
+                                 test_permissions_provider_get_rate_limits);
+  ADD_PERMISSIONS_PROVIDER_TEST ("/permissions-provider/get-rate-limits/default",
+                                 PERMISSIONS_CONFIG_FILE_ENABLED_TEST,
+                                 setup_with_config_file,
+                                 test_permissions_provider_get_rate_limits_default);
 
 #undef ADD_PERMISSIONS_PROVIDER_TEST
 
@@ -29,6 +29,7 @@
 #include <eosmetrics/eosmetrics.h>
 
 #include "emer-boot-id-provider.h"
+#include "emer-cache-record.h"
 #include "emer-cache-version-provider.h"
 #include "mock-circular-file.h"
 #include "shared/metrics-util.h"
@@ -57,6 +58,11 @@
 
 #define MAX_CACHE_SIZE 10000000
 
+static const guchar EVENT_ID[] = {
+  0x5f, 0xae, 0x6b, 0x99, 0x2c, 0x4f, 0x4d, 0x51,
+  0x8d, 0x34, 0x6d, 0x6b, 0xa9, 0x6e, 0x1b, 0x02,
+};
+
 #define DEFAULT_CACHE_VERSION_KEY_FILE_DATA \
   "[cache_version_info]\n" \
   "version=4\n"
@@ -132,9 +138,11 @@ make_testing_cache_full (Fixture   *fixture,
 
   EmerPersistentCache *cache =
     emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    reinitialize_cache ?
+                                    EMER_PERSISTENT_CACHE_FLAG_REINITIALIZE :
+                                    EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
                                     boot_id_provider, cache_version_provider,
-                                    TEST_UPDATE_OFFSET_INTERVAL,
-                                    reinitialize_cache, error);
+                                    TEST_UPDATE_OFFSET_INTERVAL, error);
   return cache;
 }
 
@@ -371,6 +379,25 @@ make_variant (gint choice)
                             G_GINT64_CONSTANT (5965),
                             g_variant_new_string ("Gandalf"));
 
+    /* The types of singular and aggregate events, which have record kinds of
+     * their own. make_many_variants() doesn't include these. */
+    case 16:
+      return g_variant_new ("(@aysxmv)",
+                            g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                       EVENT_ID,
+                                                       G_N_ELEMENTS (EVENT_ID),
+                                                       sizeof (guchar)),
+                            "5.1.0", G_GINT64_CONSTANT (2387),
+                            g_variant_new_string ("Frodo"));
+
+    case 17:
+      return g_variant_new ("(@ayssumv)",
+                            g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                       EVENT_ID,
+                                                       G_N_ELEMENTS (EVENT_ID),
+                                                       sizeof (guchar)),
+                            "5.1.0", "2026-10", 17u, NULL);
+
     default:
       g_error ("Tried to make a variant that hasn't been programmed.");
     }
@@ -533,11 +560,19 @@ test_persistent_cache_cost (Fixture      *fixture,
       const gchar *type_string = g_variant_get_type_string (curr_variant);
       gsize type_string_length = strlen (type_string) + 1;
       gsize variant_size = g_variant_get_size (curr_variant);
-      gsize expected_cost = type_string_length + variant_size;
+      gsize expected_cost = 1 + type_string_length + variant_size;
       g_assert_cmpuint (actual_cost, ==, expected_cost);
     }
 
   g_ptr_array_unref (variants);
+
+  /* Singular and aggregate events are stored without their type strings. */
+  for (gint choice = 16; choice <= 17; choice++)
+    {
+      g_autoptr(GVariant) event = g_variant_ref_sink (make_variant (choice));
+      g_assert_cmpuint (emer_persistent_cache_cost (event), ==,
+                        1 + g_variant_get_size (event));
+    }
 }
 
 static void
@@ -588,9 +623,9 @@ test_persistent_cache_store_when_full (Fixture      *fixture,
   GError *error = NULL;
   EmerPersistentCache *cache =
     emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
                                     boot_id_provider, cache_version_provider,
-                                    TEST_UPDATE_OFFSET_INTERVAL, FALSE,
-                                    &error);
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
   g_assert_no_error (error);
   g_assert_nonnull (cache);
 
@@ -798,9 +833,9 @@ test_persistent_cache_purges_when_out_of_date (Fixture      *fixture,
   GError *error = NULL;
   EmerPersistentCache *cache =
     emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
                                     boot_id_provider, cache_version_provider,
-                                    TEST_UPDATE_OFFSET_INTERVAL, FALSE,
-                                    &error);
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
   g_assert_no_error (error);
   g_assert_nonnull (cache);
 
@@ -816,9 +851,11 @@ test_persistent_cache_purges_when_out_of_date (Fixture      *fixture,
                                              &current_version);
   g_assert_true (get_succeeded);
 
+  /* There is no migration from version 4. */
+  g_assert_cmpint (current_version, >, 4);
   gboolean set_succeeded =
-    emer_cache_version_provider_set_version (cache_version_provider,
-                                             current_version - 1, &error);
+    emer_cache_version_provider_set_version (cache_version_provider, 4,
+                                             &error);
   g_assert_no_error (error);
   g_assert_true (set_succeeded);
 
@@ -830,6 +867,504 @@ test_persistent_cache_purges_when_out_of_date (Fixture      *fixture,
   g_object_unref (cache2);
 }
 
+/* Returns the little-endian normal form of the given variant, as stored in the
+ * persistent cache.
+ */
+static GVariant *
+get_stored_variant (GVariant *variant)
+{
+  return G_BYTE_ORDER == G_LITTLE_ENDIAN ? g_variant_get_normal_form (variant) :
+                                           g_variant_byteswap (variant);
+}
+
+/* Appends the given variant to data as a version 5 element of the mock
+ * circular file. In version 5, each element was a variant's type string and
+ * its little-endian serialization, with nothing in between.
+ */
+static void
+append_version_5_elem (GByteArray *data,
+                       GVariant   *variant)
+{
+  const gchar *type_string = g_variant_get_type_string (variant);
+  g_autoptr(GVariant) stored_variant = get_stored_variant (variant);
+  gsize type_length = strlen (type_string) + 1;
+  guint64 elem_size = type_length + g_variant_get_size (stored_variant);
+
+  g_byte_array_append (data, (const guint8 *) &elem_size, sizeof (elem_size));
+  g_byte_array_append (data, (const guint8 *) type_string, type_length);
+  g_byte_array_append (data, g_variant_get_data (stored_variant),
+                       g_variant_get_size (stored_variant));
+}
+
+/* Appends the given variant to data as a record in the current format, as an
+ * element of the mock circular file.
+ */
+static void
+append_current_elem (GByteArray *data,
+                     GVariant   *variant)
+{
+  const gchar *type_string = g_variant_get_type_string (variant);
+  g_autoptr(GVariant) stored_variant = get_stored_variant (variant);
+  gsize header_size = emer_cache_record_header_size (type_string);
+  guint64 elem_size = header_size + g_variant_get_size (stored_variant);
+  guint8 kind = emer_cache_record_kind_from_type_string (type_string);
+
+  g_byte_array_append (data, (const guint8 *) &elem_size, sizeof (elem_size));
+  g_byte_array_append (data, &kind, sizeof (kind));
+  if (kind == EMER_CACHE_RECORD_TYPED)
+    g_byte_array_append (data, (const guint8 *) type_string,
+                         header_size - sizeof (kind));
+  g_byte_array_append (data, g_variant_get_data (stored_variant),
+                       g_variant_get_size (stored_variant));
+}
+
+/* Returns a new uncompressed persistent cache over the given circular file
+ * data, stored by the given cache version.
+ */
+static EmerPersistentCache *
+make_cache_from_version (Fixture *fixture,
+                         GBytes  *data,
+                         gint     version)
+{
+  mock_circular_file_set_initial_data (data);
+
+  g_autoptr(EmerBootIdProvider) boot_id_provider =
+    emer_boot_id_provider_new_full (fixture->boot_id_path);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (NULL);
+  g_autoptr(GError) error = NULL;
+  emer_cache_version_provider_set_version (cache_version_provider, version,
+                                           &error);
+  g_assert_no_error (error);
+
+  EmerPersistentCache *cache =
+    emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    EMER_PERSISTENT_CACHE_FLAG_DEFAULT,
+                                    boot_id_provider, cache_version_provider,
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  gint new_version;
+  g_assert_true (emer_cache_version_provider_get_version (cache_version_provider,
+                                                          &new_version));
+  g_assert_cmpint (new_version, >, version);
+
+  return cache;
+}
+
+static void
+test_persistent_cache_migrates_from_version_5 (Fixture      *fixture,
+                                               gconstpointer dontuseme)
+{
+  GPtrArray *variants = make_many_variants ();
+  g_ptr_array_add (variants, g_variant_ref_sink (make_variant (16)));
+  g_ptr_array_add (variants, g_variant_ref_sink (make_variant (17)));
+
+  GByteArray *old_data = g_byte_array_new ();
+  for (gsize i = 0; i < variants->len; i++)
+    append_version_5_elem (old_data, g_ptr_array_index (variants, i));
+
+  g_autoptr(GBytes) old_bytes = g_byte_array_free_to_bytes (old_data);
+  EmerPersistentCache *cache = make_cache_from_version (fixture, old_bytes, 5);
+
+  assert_variants_read (cache, (GVariant **) variants->pdata, variants->len);
+  g_ptr_array_unref (variants);
+  g_object_unref (cache);
+}
+
+static void
+test_persistent_cache_migration_drops_non_normal_variant (Fixture      *fixture,
+                                                          gconstpointer dontuseme)
+{
+  g_autoptr(GPtrArray) variants = make_many_variants ();
+
+  /* A version 5 element with a valid type string, but a string which isn't
+   * nul-terminated after it.
+   */
+  GByteArray *old_data = g_byte_array_new ();
+  const gchar bad_elem[] = { 's', '\0', 'a', 'b', 'c' };
+  guint64 bad_elem_size = sizeof (bad_elem);
+  g_byte_array_append (old_data, (const guint8 *) &bad_elem_size,
+                       sizeof (bad_elem_size));
+  g_byte_array_append (old_data, (const guint8 *) bad_elem, sizeof (bad_elem));
+  for (gsize i = 0; i < variants->len; i++)
+    append_version_5_elem (old_data, g_ptr_array_index (variants, i));
+
+  g_autoptr(GBytes) old_bytes = g_byte_array_free_to_bytes (old_data);
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Dropped 1 of * variants while migrating*");
+  EmerPersistentCache *cache = make_cache_from_version (fixture, old_bytes, 5);
+  g_test_assert_expected_messages ();
+
+  assert_variants_read (cache, (GVariant **) variants->pdata, variants->len);
+  g_object_unref (cache);
+}
+
+static void
+test_persistent_cache_migrates_in_chunks (Fixture      *fixture,
+                                          gconstpointer dontuseme)
+{
+  /* Enough variants that they are migrated over several chunks. */
+  gsize NUM_VARIANTS = 6000;
+  g_autoptr(GPtrArray) variants =
+    g_ptr_array_new_full (NUM_VARIANTS, (GDestroyNotify) g_variant_unref);
+  GByteArray *old_data = g_byte_array_new ();
+  for (gsize i = 0; i < NUM_VARIANTS; i++)
+    {
+      GVariant *variant = g_variant_ref_sink (make_variant (i % 16));
+      g_ptr_array_add (variants, variant);
+      append_version_5_elem (old_data, variant);
+    }
+
+  g_autoptr(GBytes) old_bytes = g_byte_array_free_to_bytes (old_data);
+  g_assert_cmpuint (g_bytes_get_size (old_bytes), >, 2 * 65536);
+  EmerPersistentCache *cache = make_cache_from_version (fixture, old_bytes, 5);
+
+  assert_variants_read (cache, (GVariant **) variants->pdata, variants->len);
+  g_object_unref (cache);
+}
+
+static void
+test_persistent_cache_resumes_migration (Fixture      *fixture,
+                                         gconstpointer dontuseme)
+{
+  g_autoptr(GPtrArray) variants = make_many_variants ();
+  gsize num_migrated = variants->len / 2;
+
+  /* An interrupted migration has moved the first variants to the back of the
+   * file in the current format, leaving the rest at the front.
+   */
+  GByteArray *old_data = g_byte_array_new ();
+  for (gsize i = num_migrated; i < variants->len; i++)
+    append_version_5_elem (old_data, g_ptr_array_index (variants, i));
+  for (gsize i = 0; i < num_migrated; i++)
+    append_current_elem (old_data, g_ptr_array_index (variants, i));
+
+  g_autoptr(GBytes) old_bytes = g_byte_array_free_to_bytes (old_data);
+  EmerPersistentCache *cache = make_cache_from_version (fixture, old_bytes, 5);
+
+  assert_variants_read (cache, (GVariant **) variants->pdata, variants->len);
+  g_object_unref (cache);
+}
+
+/* Returns a new persistent cache in compressed mode. If version is nonzero,
+ * the cache version is set to it beforehand, so that the contents of the
+ * circular file are kept.
+ */
+static EmerPersistentCache *
+make_compressed_testing_cache (Fixture *fixture,
+                               gint     version)
+{
+  g_autoptr(EmerBootIdProvider) boot_id_provider =
+    emer_boot_id_provider_new_full (fixture->boot_id_path);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (NULL);
+  g_autoptr(GError) error = NULL;
+  if (version != 0)
+    {
+      emer_cache_version_provider_set_version (cache_version_provider,
+                                               version, &error);
+      g_assert_no_error (error);
+    }
+
+  EmerPersistentCache *cache =
+    emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    EMER_PERSISTENT_CACHE_FLAG_COMPRESSED,
+                                    boot_id_provider, cache_version_provider,
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  return cache;
+}
+
+static void
+test_persistent_cache_compressed_round_trip (Fixture      *fixture,
+                                             gconstpointer dontuseme)
+{
+  EmerPersistentCache *cache = make_compressed_testing_cache (fixture, 0);
+  assert_cache_is_empty (cache);
+
+  GPtrArray *variants = make_many_variants ();
+  g_ptr_array_add (variants, g_variant_ref_sink (make_variant (16)));
+  g_ptr_array_add (variants, g_variant_ref_sink (make_variant (17)));
+  assert_variants_stored (cache, (GVariant **) variants->pdata, variants->len);
+  g_assert_true (emer_persistent_cache_has_more (cache, 0));
+
+  GVariant **variants_read;
+  gsize num_variants_read;
+  guint64 token;
+  gboolean has_invalid;
+  GError *error = NULL;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, G_MAXSIZE,
+                                &num_variants_read, &token, &has_invalid,
+                                &error);
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_cmpuint (num_variants_read, ==, variants->len);
+  assert_variants_equal (variants_read, (GVariant **) variants->pdata,
+                         variants->len);
+  g_assert_false (has_invalid);
+  g_assert_false (emer_persistent_cache_has_more (cache, token));
+  destroy_variants (variants_read, num_variants_read);
+
+  gboolean remove_succeeded =
+    emer_persistent_cache_remove (cache, token, &error);
+  g_assert_no_error (error);
+  g_assert_true (remove_succeeded);
+  assert_cache_is_empty (cache);
+
+  g_ptr_array_unref (variants);
+  g_object_unref (cache);
+}
+
+static void
+test_persistent_cache_compressed_reads_whole_blocks (Fixture      *fixture,
+                                                     gconstpointer dontuseme)
+{
+  EmerPersistentCache *cache = make_compressed_testing_cache (fixture, 0);
+
+  /* Enough variants to fill several blocks. */
+  gsize NUM_VARIANTS = 3000;
+  GPtrArray *variants =
+    g_ptr_array_new_full (NUM_VARIANTS, (GDestroyNotify) g_variant_unref);
+  gsize total_cost = 0;
+  for (gsize i = 0; i < NUM_VARIANTS; i++)
+    {
+      GVariant *variant = g_variant_ref_sink (make_variant (i % 18));
+      g_ptr_array_add (variants, variant);
+      total_cost += emer_persistent_cache_cost (variant);
+    }
+
+  assert_variants_stored (cache, (GVariant **) variants->pdata, variants->len);
+
+  /* Too little to read even the first block. */
+  GVariant **variants_read;
+  gsize num_variants_read;
+  guint64 token;
+  gboolean has_invalid;
+  GError *error = NULL;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, 1, &num_variants_read,
+                                &token, &has_invalid, &error);
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_null (variants_read);
+  g_assert_cmpuint (num_variants_read, ==, 0);
+  g_assert_cmpuint (token, ==, 0);
+
+  read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, total_cost / 2,
+                                &num_variants_read, &token, &has_invalid,
+                                &error);
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_cmpuint (num_variants_read, >, 0);
+  g_assert_cmpuint (num_variants_read, <, NUM_VARIANTS);
+  assert_variants_equal (variants_read, (GVariant **) variants->pdata,
+                         num_variants_read);
+  g_assert_false (has_invalid);
+
+  gsize cost_read = 0;
+  for (gsize i = 0; i < num_variants_read; i++)
+    cost_read += emer_persistent_cache_cost (variants_read[i]);
+  g_assert_cmpuint (cost_read, <=, total_cost / 2);
+  destroy_variants (variants_read, num_variants_read);
+
+  g_assert_true (emer_persistent_cache_has_more (cache, token));
+  gboolean remove_succeeded =
+    emer_persistent_cache_remove (cache, token, &error);
+  g_assert_no_error (error);
+  g_assert_true (remove_succeeded);
+
+  g_ptr_array_remove_range (variants, 0, num_variants_read);
+  read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, G_MAXSIZE,
+                                &num_variants_read, &token, &has_invalid,
+                                &error);
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_cmpuint (num_variants_read, ==, variants->len);
+  assert_variants_equal (variants_read, (GVariant **) variants->pdata,
+                         variants->len);
+  g_assert_false (emer_persistent_cache_has_more (cache, token));
+  destroy_variants (variants_read, num_variants_read);
+
+  g_ptr_array_unref (variants);
+  g_object_unref (cache);
+}
+
+/* Appends an element to data as the mock circular file expects it: preceded
+ * by its length as a guint64 in host byte order.
+ */
+static void
+append_mock_elem (GByteArray   *data,
+                  const guint8 *elem,
+                  guint64       elem_size)
+{
+  g_byte_array_append (data, (const guint8 *) &elem_size, sizeof (elem_size));
+  g_byte_array_append (data, elem, elem_size);
+}
+
+static void
+test_persistent_cache_compressed_skips_damaged_block (Fixture      *fixture,
+                                                      gconstpointer dontuseme)
+{
+  g_autoptr(GVariant) variant = g_variant_ref_sink (make_variant (16));
+  g_autoptr(GVariant) stored_variant =
+    G_BYTE_ORDER == G_LITTLE_ENDIAN ? g_variant_get_normal_form (variant) :
+                                      g_variant_byteswap (variant);
+  guint32 record_size = 1 + g_variant_get_size (stored_variant);
+
+  GByteArray *data = g_byte_array_new ();
+
+  /* A block with an encoding which doesn't exist. */
+  const guint8 bad_block[] = { 7, 0, 0, 0, 0, 0, 0, 0, 0 };
+  append_mock_elem (data, bad_block, sizeof (bad_block));
+
+  /* An uncompressed block holding a single singular event. */
+  g_autoptr(GByteArray) good_block = g_byte_array_new ();
+  guint8 encoding = 0, kind = 1;
+  guint32 payload_size = GUINT32_TO_LE (sizeof (guint32) + record_size);
+  guint32 num_records = GUINT32_TO_LE (1);
+  guint32 le_record_size = GUINT32_TO_LE (record_size);
+  g_byte_array_append (good_block, &encoding, 1);
+  g_byte_array_append (good_block, (const guint8 *) &payload_size,
+                       sizeof (payload_size));
+  g_byte_array_append (good_block, (const guint8 *) &num_records,
+                       sizeof (num_records));
+  g_byte_array_append (good_block, (const guint8 *) &le_record_size,
+                       sizeof (le_record_size));
+  g_byte_array_append (good_block, &kind, 1);
+  g_byte_array_append (good_block, g_variant_get_data (stored_variant),
+                       g_variant_get_size (stored_variant));
+  append_mock_elem (data, good_block->data, good_block->len);
+
+  g_autoptr(GBytes) bytes = g_byte_array_free_to_bytes (data);
+  mock_circular_file_set_initial_data (bytes);
+
+  /* The current cache version, so that the blocks are kept. */
+  EmerPersistentCache *cache = make_compressed_testing_cache (fixture, 6);
+
+  GVariant **variants_read;
+  gsize num_variants_read;
+  guint64 token;
+  gboolean has_invalid;
+  GError *error = NULL;
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "*unknown encoding 7*");
+  gboolean read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, G_MAXSIZE,
+                                &num_variants_read, &token, &has_invalid,
+                                &error);
+  g_test_assert_expected_messages ();
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_true (has_invalid);
+  g_assert_cmpuint (num_variants_read, ==, 1);
+  g_assert_cmpvariant (variants_read[0], variant);
+  g_assert_false (emer_persistent_cache_has_more (cache, token));
+  destroy_variants (variants_read, num_variants_read);
+
+  g_object_unref (cache);
+}
+
+static void
+test_persistent_cache_migration_drops_non_normal_record (Fixture      *fixture,
+                                                         gconstpointer dontuseme)
+{
+  g_autoptr(GVariant) variant = g_variant_ref_sink (make_variant (16));
+  GByteArray *data = g_byte_array_new ();
+
+  /* An element which looks like a current record but whose string isn't
+   * nul-terminated, as a damaged element of a version 5 cache kept in the
+   * legacy circular file format might. Its checksum was computed when the
+   * circular file was converted, so it passes that.
+   */
+  const guint8 bad_record[] = { EMER_CACHE_RECORD_TYPED, 's', '\0',
+                                'a', 'b', 'c' };
+  append_mock_elem (data, bad_record, sizeof (bad_record));
+  append_current_elem (data, variant);
+
+  g_autoptr(GBytes) bytes = g_byte_array_free_to_bytes (data);
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Dropped 1 of 1 variants while migrating*");
+  EmerPersistentCache *cache = make_cache_from_version (fixture, bytes, 5);
+  g_test_assert_expected_messages ();
+
+  GVariant **variants_read;
+  gsize num_variants_read;
+  guint64 token;
+  gboolean has_invalid;
+  GError *error = NULL;
+  gboolean read_succeeded =
+    emer_persistent_cache_read (cache, &variants_read, G_MAXSIZE,
+                                &num_variants_read, &token, &has_invalid,
+                                &error);
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_false (has_invalid);
+  g_assert_cmpuint (num_variants_read, ==, 1);
+  g_assert_cmpvariant (variants_read[0], variant);
+  g_assert_false (emer_persistent_cache_has_more (cache, token));
+  destroy_variants (variants_read, num_variants_read);
+
+  g_object_unref (cache);
+}
+
+/* Returns a new persistent cache in segmented mode, which keeps its data in
+ * real segment files in the cache directory rather than in the mock circular
+ * file.
+ */
+static EmerPersistentCache *
+make_segmented_testing_cache (Fixture *fixture)
+{
+  g_autoptr(EmerBootIdProvider) boot_id_provider =
+    emer_boot_id_provider_new_full (fixture->boot_id_path);
+  g_autoptr(EmerCacheVersionProvider) cache_version_provider =
+    emer_cache_version_provider_new (NULL);
+  g_autoptr(GError) error = NULL;
+  EmerPersistentCache *cache =
+    emer_persistent_cache_new_full (fixture->cache_dir, MAX_CACHE_SIZE,
+                                    EMER_PERSISTENT_CACHE_FLAG_SEGMENTED,
+                                    boot_id_provider, cache_version_provider,
+                                    TEST_UPDATE_OFFSET_INTERVAL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  return cache;
+}
+
+static void
+test_persistent_cache_segmented_round_trip (Fixture      *fixture,
+                                            gconstpointer dontuseme)
+{
+  EmerPersistentCache *cache = make_segmented_testing_cache (fixture);
+  assert_cache_is_empty (cache);
+
+  GPtrArray *variants = make_many_variants ();
+  assert_variants_stored (cache, (GVariant **) variants->pdata, variants->len);
+  g_object_unref (cache);
+
+  /* The variants were saved to the segment files, so a new cache finds them. */
+  cache = make_segmented_testing_cache (fixture);
+  guint64 token =
+    assert_variants_read (cache, (GVariant **) variants->pdata, variants->len);
+  g_assert_false (emer_persistent_cache_has_more (cache, token));
+
+  GError *error = NULL;
+  gboolean remove_succeeded =
+    emer_persistent_cache_remove (cache, token, &error);
+  g_assert_no_error (error);
+  g_assert_true (remove_succeeded);
+  assert_cache_is_empty (cache);
+
+  g_ptr_array_unref (variants);
+  g_object_unref (cache);
+}
+
 /*
  * Ensures that the persistent cache creates a new metadata file should one not
  * be found.
@@ -1144,6 +1679,24 @@ main (gint                argc,
                        test_persistent_cache_remove_when_empty);
   ADD_CACHE_TEST_FUNC ("/persistent-cache/purges-when-out-of-date",
                        test_persistent_cache_purges_when_out_of_date);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/migrates-from-version-5",
+                       test_persistent_cache_migrates_from_version_5);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/migration-drops-non-normal-variant",
+                       test_persistent_cache_migration_drops_non_normal_variant);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/migrates-in-chunks",
+                       test_persistent_cache_migrates_in_chunks);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/resumes-migration",
+                       test_persistent_cache_resumes_migration);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/compressed/round-trip",
+                       test_persistent_cache_compressed_round_trip);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/compressed/reads-whole-blocks",
+                       test_persistent_cache_compressed_reads_whole_blocks);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/compressed/skips-damaged-block",
+                       test_persistent_cache_compressed_skips_damaged_block);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/migration-drops-non-normal-record",
+                       test_persistent_cache_migration_drops_non_normal_record);
+  ADD_CACHE_TEST_FUNC ("/persistent-cache/segmented/round-trip",
+                       test_persistent_cache_segmented_round_trip);
   ADD_CACHE_TEST_FUNC ("/persistent-cache/builds-boot-metadata-file",
                        test_persistent_cache_builds_boot_metadata_file);
   ADD_CACHE_TEST_FUNC ("/persistent-cache/computes-reasonable-offset",
@@ -0,0 +1,184 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-rate-limiter.h"
+
+#include <glib.h>
+
+#define START_TIME (1000 * G_USEC_PER_SEC)
+
+static const EmerRateLimit NO_LIMIT = { 0, 0, 0 };
+
+static void
+test_rate_limiter_unlimited (void)
+{
+  g_autoptr(EmerRateLimiter) limiter =
+    emer_rate_limiter_new (&NO_LIMIT, &NO_LIMIT);
+
+  for (guint i = 0; i < 10000; i++)
+    g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 1024,
+                                            START_TIME));
+
+  for (EmerRateLimitKind kind = 0; kind < EMER_RATE_LIMIT_N_KINDS; kind++)
+    g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter, kind), ==, 0);
+}
+
+static void
+test_rate_limiter_sender_events (void)
+{
+  EmerRateLimit sender_limit = { 10, 5, 0 };
+  g_autoptr(EmerRateLimiter) limiter =
+    emer_rate_limiter_new (&sender_limit, &NO_LIMIT);
+
+  /* A full burst is allowed straight away... */
+  for (guint i = 0; i < 5; i++)
+    g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                            START_TIME));
+
+  /* ...but no more... */
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                           START_TIME));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_SENDER_EVENTS),
+                    ==, 1);
+
+  /* ...while other senders are unaffected. */
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.2", 1000, 10,
+                                          START_TIME));
+
+  /* The bucket refills at the configured rate. */
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                          START_TIME + G_USEC_PER_SEC / 10));
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                           START_TIME + G_USEC_PER_SEC / 10));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_SENDER_EVENTS),
+                    ==, 2);
+
+  /* Refilling never exceeds the burst size. */
+  for (guint i = 0; i < 5; i++)
+    g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                            START_TIME + 30 * G_USEC_PER_SEC));
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                           START_TIME + 30 * G_USEC_PER_SEC));
+}
+
+static void
+test_rate_limiter_sender_bytes (void)
+{
+  /* One byte per second */
+  EmerRateLimit sender_limit = { 0, 0, 3600 };
+  g_autoptr(EmerRateLimiter) limiter =
+    emer_rate_limiter_new (&sender_limit, &NO_LIMIT);
+
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 3000,
+                                          START_TIME));
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.1", 1000, 1000,
+                                           START_TIME));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_SENDER_BYTES),
+                    ==, 1);
+
+  /* Smaller events still fit in what's left of the quota. */
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 600,
+                                          START_TIME));
+
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 400,
+                                          START_TIME + 400 * G_USEC_PER_SEC));
+}
+
+static void
+test_rate_limiter_user_events (void)
+{
+  EmerRateLimit user_limit = { 1, 2, 0 };
+  g_autoptr(EmerRateLimiter) limiter =
+    emer_rate_limiter_new (&NO_LIMIT, &user_limit);
+
+  /* The limit applies to the user, however many senders they use. */
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.1", 1000, 10,
+                                          START_TIME));
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.2", 1000, 10,
+                                          START_TIME));
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.3", 1000, 10,
+                                           START_TIME));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_USER_EVENTS),
+                    ==, 1);
+
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.3", 1001, 10,
+                                          START_TIME));
+}
+
+static void
+test_rate_limiter_drops_consume_nothing (void)
+{
+  EmerRateLimit sender_limit = { 0, 0, 100 };
+  EmerRateLimit user_limit = { 1, 1, 0 };
+  g_autoptr(EmerRateLimiter) limiter =
+    emer_rate_limiter_new (&sender_limit, &user_limit);
+
+  /* Over the first sender's byte quota... */
+  g_assert_false (emer_rate_limiter_admit (limiter, ":1.1", 1000, 1000,
+                                           START_TIME));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_SENDER_BYTES),
+                    ==, 1);
+
+  /* ...which must not have used up the user's only event. */
+  g_assert_true (emer_rate_limiter_admit (limiter, ":1.2", 1000, 10,
+                                          START_TIME));
+  g_assert_cmpuint (emer_rate_limiter_get_drop_count (limiter,
+                                                      EMER_RATE_LIMIT_USER_EVENTS),
+                    ==, 0);
+}
+
+static void
+test_rate_limiter_kind_to_string (void)
+{
+  g_assert_cmpstr (emer_rate_limit_kind_to_string (EMER_RATE_LIMIT_SENDER_EVENTS),
+                   ==, "sender-events");
+  g_assert_cmpstr (emer_rate_limit_kind_to_string (EMER_RATE_LIMIT_USER_BYTES),
+                   ==, "user-bytes");
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_func ("/rate-limiter/unlimited",
+                   test_rate_limiter_unlimited);
+  g_test_add_func ("/rate-limiter/sender-events",
+                   test_rate_limiter_sender_events);
+  g_test_add_func ("/rate-limiter/sender-bytes",
+                   test_rate_limiter_sender_bytes);
+  g_test_add_func ("/rate-limiter/user-events",
+                   test_rate_limiter_user_events);
+  g_test_add_func ("/rate-limiter/drops-consume-nothing",
+                   test_rate_limiter_drops_consume_nothing);
+  g_test_add_func ("/rate-limiter/kind-to-string",
+                   test_rate_limiter_kind_to_string);
+
+  return g_test_run ();
+}
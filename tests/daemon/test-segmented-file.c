@@ -0,0 +1,517 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-segmented-file.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* Each element is preceded on disk by its length and a checksum. */
+#define ELEM_HEADER_SIZE (2 * sizeof (guint32))
+
+/* The manifest is made up of two slots, each of this size. */
+#define MANIFEST_SLOT_SIZE 512
+
+typedef struct _Fixture
+{
+  gchar *path;
+} Fixture;
+
+static const gchar * const STRINGS[] = { "Lighthouse", "of", "Alexandria" };
+
+static void
+setup (Fixture      *fixture,
+       gconstpointer unused)
+{
+  g_autoptr(GError) error = NULL;
+  fixture->path = g_dir_make_tmp ("segmented-file-XXXXXX", &error);
+  g_assert_no_error (error);
+}
+
+static void
+teardown (Fixture      *fixture,
+          gconstpointer unused)
+{
+  emer_segmented_file_delete (fixture->path);
+  g_assert_false (g_file_test (fixture->path, G_FILE_TEST_EXISTS));
+  g_free (fixture->path);
+}
+
+/* Returns the number of bytes the given string will consume when saved in a
+ * segmented file.
+ */
+static guint64
+get_disk_size (const gchar *string)
+{
+  return ELEM_HEADER_SIZE + strlen (string) + 1;
+}
+
+static guint64
+get_total_disk_size (const gchar * const *strings,
+                     gsize                num_strings)
+{
+  guint64 total_disk_size = 0;
+  for (gsize i = 0; i < num_strings; i++)
+    total_disk_size += get_disk_size (strings[i]);
+
+  return total_disk_size;
+}
+
+static gchar *
+get_segment_path (Fixture *fixture,
+                  guint64  segment)
+{
+  g_autofree gchar *filename =
+    g_strdup_printf ("%020" G_GUINT64_FORMAT SEGMENT_EXTENSION, segment);
+  return g_build_filename (fixture->path, filename, NULL);
+}
+
+static guint
+count_segment_files (Fixture *fixture)
+{
+  g_autoptr(GDir) dir = g_dir_open (fixture->path, 0, NULL);
+  g_assert_nonnull (dir);
+
+  guint num_segments = 0;
+  const gchar *filename;
+  while ((filename = g_dir_read_name (dir)) != NULL)
+    if (g_str_has_suffix (filename, SEGMENT_EXTENSION))
+      num_segments++;
+
+  return num_segments;
+}
+
+static EmerSegmentedFile *
+make_segmented_file_full (Fixture  *fixture,
+                          guint64   max_size,
+                          guint64   segment_size,
+                          gboolean  reinitialize,
+                          GError  **error)
+{
+  return g_initable_new (EMER_TYPE_SEGMENTED_FILE, NULL /* GCancellable */,
+                         error,
+                         "path", fixture->path,
+                         "max-size", max_size,
+                         "segment-size", segment_size,
+                         "reinitialize", reinitialize,
+                         NULL);
+}
+
+/* Returns a segmented file whose segments are small enough for STRINGS to be
+ * saved in two of them: the first two strings in the first, and the last in
+ * the second.
+ */
+static EmerSegmentedFile *
+make_segmented_file (Fixture *fixture,
+                     guint64  max_size)
+{
+  g_autoptr(GError) error = NULL;
+  guint64 segment_size = get_disk_size (STRINGS[0]) + get_disk_size (STRINGS[1]);
+  EmerSegmentedFile *segmented_file =
+    make_segmented_file_full (fixture, max_size, segment_size,
+                              FALSE /* reinitialize */, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (segmented_file);
+
+  return segmented_file;
+}
+
+static void
+append_strings_and_check (EmerSegmentedFile   *segmented_file,
+                          const gchar * const *strings,
+                          gsize                num_strings)
+{
+  for (gsize i = 0; i < num_strings; i++)
+    g_assert_true (emer_segmented_file_append (segmented_file, strings[i],
+                                               strlen (strings[i]) + 1));
+
+  g_autoptr(GError) error = NULL;
+  gboolean save_succeeded = emer_segmented_file_save (segmented_file, &error);
+  g_assert_no_error (error);
+  g_assert_true (save_succeeded);
+}
+
+static guint64
+read_strings_and_check (EmerSegmentedFile   *segmented_file,
+                        const gchar * const *strings,
+                        gsize                num_strings)
+{
+  GBytes **elems;
+  gsize num_elems;
+  guint64 token;
+  gboolean has_invalid;
+  g_autoptr(GError) error = NULL;
+  gboolean read_succeeded =
+    emer_segmented_file_read (segmented_file, &elems, G_MAXSIZE, &num_elems,
+                              &token, &has_invalid, &error);
+
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_false (has_invalid);
+  g_assert_cmpuint (num_elems, ==, num_strings);
+  for (gsize i = 0; i < num_elems; i++)
+    {
+      g_assert_cmpstr (g_bytes_get_data (elems[i], NULL), ==, strings[i]);
+      g_bytes_unref (elems[i]);
+    }
+
+  g_free (elems);
+  g_assert_cmpuint (token, ==, get_total_disk_size (strings, num_strings));
+  g_assert_false (emer_segmented_file_has_more (segmented_file, token));
+
+  return token;
+}
+
+static void
+remove_and_check (EmerSegmentedFile *segmented_file,
+                  guint64            token)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean remove_succeeded =
+    emer_segmented_file_remove (segmented_file, token, &error);
+  g_assert_no_error (error);
+  g_assert_true (remove_succeeded);
+}
+
+static void
+test_segmented_file_new (Fixture      *fixture,
+                         gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+
+  read_strings_and_check (segmented_file, NULL, 0);
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 1);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+  g_assert_cmpfloat (emer_segmented_file_get_fill_ratio (segmented_file), ==,
+                     0.0);
+}
+
+static void
+test_segmented_file_round_trip (Fixture      *fixture,
+                                gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 2);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 2);
+
+  guint64 token = read_strings_and_check (segmented_file, STRINGS,
+                                          G_N_ELEMENTS (STRINGS));
+  remove_and_check (segmented_file, token);
+  read_strings_and_check (segmented_file, NULL, 0);
+
+  /* Emptying the segmented file starts a new segment, and deletes the rest. */
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 1);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+}
+
+static void
+test_segmented_file_append_when_full (Fixture      *fixture,
+                                      gconstpointer unused)
+{
+  guint64 max_size = get_total_disk_size (STRINGS, G_N_ELEMENTS (STRINGS));
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, max_size);
+
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  g_assert_cmpfloat (emer_segmented_file_get_fill_ratio (segmented_file), ==,
+                     1.0);
+  g_assert_false (emer_segmented_file_append (segmented_file, "x", 2));
+}
+
+static void
+test_segmented_file_remove_deletes_segments (Fixture      *fixture,
+                                             gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+
+  /* Removing part of the first segment keeps it... */
+  remove_and_check (segmented_file, get_disk_size (STRINGS[0]));
+  g_assert_cmpuint (count_segment_files (fixture), ==, 2);
+
+  /* ...until the rest of it has been removed too. */
+  remove_and_check (segmented_file, get_disk_size (STRINGS[1]));
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 1);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+  g_autofree gchar *first_segment_path = get_segment_path (fixture, 0);
+  g_assert_false (g_file_test (first_segment_path, G_FILE_TEST_EXISTS));
+
+  read_strings_and_check (segmented_file, STRINGS + 2, 1);
+}
+
+static void
+test_segmented_file_reopen (Fixture      *fixture,
+                            gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  remove_and_check (segmented_file, get_disk_size (STRINGS[0]));
+
+  /* Elements which were appended but not saved are lost. */
+  g_assert_true (emer_segmented_file_append (segmented_file, "unsaved", 8));
+  g_clear_object (&segmented_file);
+
+  segmented_file = make_segmented_file (fixture, 1000);
+  read_strings_and_check (segmented_file, STRINGS + 1, 2);
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 2);
+}
+
+static void
+test_segmented_file_shrink (Fixture      *fixture,
+                            gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  g_clear_object (&segmented_file);
+
+  /* The most recently saved elements are dropped, along with their segments. */
+  guint64 max_size = get_disk_size (STRINGS[0]) + get_disk_size (STRINGS[1]);
+  segmented_file = make_segmented_file (fixture, max_size);
+  read_strings_and_check (segmented_file, STRINGS, 2);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+
+  /* Part of a segment may be dropped too. */
+  g_clear_object (&segmented_file);
+  segmented_file = make_segmented_file (fixture, max_size - 1);
+  read_strings_and_check (segmented_file, STRINGS, 1);
+
+  g_autofree gchar *segment_path = get_segment_path (fixture, 0);
+  g_autoptr(GFile) segment = g_file_new_for_path (segment_path);
+  g_autoptr(GFileInfo) info =
+    g_file_query_info (segment, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                       G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  g_assert_nonnull (info);
+  g_assert_cmpint (g_file_info_get_size (info), ==,
+                   get_disk_size (STRINGS[0]));
+}
+
+static void
+test_segmented_file_skips_damaged_elem (Fixture      *fixture,
+                                        gconstpointer unused)
+{
+  const gchar * const INTACT_STRINGS[] = { "Lighthouse", "Alexandria" };
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+
+  /* Flip a bit in the data of the element at the end of the first segment. */
+  g_autofree gchar *segment_path = get_segment_path (fixture, 0);
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  g_autoptr(GError) error = NULL;
+  g_file_get_contents (segment_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[get_disk_size (STRINGS[0]) + ELEM_HEADER_SIZE] ^= 0x10;
+  g_file_set_contents (segment_path, contents, length, &error);
+  g_assert_no_error (error);
+
+  GBytes **elems;
+  gsize num_elems;
+  guint64 token;
+  gboolean has_invalid;
+  g_test_expect_message (G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                         "Skipping * bytes of invalid data*");
+  gboolean read_succeeded =
+    emer_segmented_file_read (segmented_file, &elems, G_MAXSIZE, &num_elems,
+                              &token, &has_invalid, &error);
+  g_test_assert_expected_messages ();
+
+  g_assert_no_error (error);
+  g_assert_true (read_succeeded);
+  g_assert_true (has_invalid);
+  g_assert_cmpuint (num_elems, ==, G_N_ELEMENTS (INTACT_STRINGS));
+  for (gsize i = 0; i < num_elems; i++)
+    {
+      g_assert_cmpstr (g_bytes_get_data (elems[i], NULL), ==,
+                       INTACT_STRINGS[i]);
+      g_bytes_unref (elems[i]);
+    }
+  g_free (elems);
+
+  /* The damaged element is removed along with the others. */
+  g_assert_cmpuint (token, ==,
+                    get_total_disk_size (STRINGS, G_N_ELEMENTS (STRINGS)));
+  remove_and_check (segmented_file, token);
+  read_strings_and_check (segmented_file, NULL, 0);
+}
+
+static void
+test_segmented_file_discards_crash_leftovers (Fixture      *fixture,
+                                              gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  g_clear_object (&segmented_file);
+
+  /* A save which was interrupted may leave data after the end of the last
+   * segment, and a segment beyond it.
+   */
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *last_segment_path = get_segment_path (fixture, 1);
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  g_file_get_contents (last_segment_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  g_autoptr(GByteArray) extended_contents = g_byte_array_new ();
+  g_byte_array_append (extended_contents, (const guint8 *) contents, length);
+  g_byte_array_append (extended_contents, (const guint8 *) "junk", 4);
+  g_file_set_contents (last_segment_path,
+                       (const gchar *) extended_contents->data,
+                       extended_contents->len, &error);
+  g_assert_no_error (error);
+
+  g_autofree gchar *stray_segment_path = get_segment_path (fixture, 2);
+  g_file_set_contents (stray_segment_path, "junk", -1, &error);
+  g_assert_no_error (error);
+
+  segmented_file = make_segmented_file (fixture, 1000);
+  g_assert_false (g_file_test (stray_segment_path, G_FILE_TEST_EXISTS));
+  read_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+
+  /* New elements follow straight on from the saved ones. */
+  append_strings_and_check (segmented_file, STRINGS, 1);
+  const gchar * const ALL_STRINGS[] = {
+    "Lighthouse", "of", "Alexandria", "Lighthouse"
+  };
+  read_strings_and_check (segmented_file, ALL_STRINGS,
+                          G_N_ELEMENTS (ALL_STRINGS));
+}
+
+static void
+test_segmented_file_purge (Fixture      *fixture,
+                           gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+
+  g_autoptr(GError) error = NULL;
+  gboolean purge_succeeded = emer_segmented_file_purge (segmented_file, &error);
+  g_assert_no_error (error);
+  g_assert_true (purge_succeeded);
+  read_strings_and_check (segmented_file, NULL, 0);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  read_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+}
+
+static void
+test_segmented_file_large_elem (Fixture      *fixture,
+                                gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+
+  /* An element larger than a segment gets a segment to itself. */
+  g_autofree gchar *large_string = g_strnfill (100, 'x');
+  const gchar * const LARGE_STRINGS[] = { "small", large_string, "small" };
+  append_strings_and_check (segmented_file, LARGE_STRINGS,
+                            G_N_ELEMENTS (LARGE_STRINGS));
+  g_assert_cmpuint (emer_segmented_file_get_n_segments (segmented_file), ==, 3);
+  read_strings_and_check (segmented_file, LARGE_STRINGS,
+                          G_N_ELEMENTS (LARGE_STRINGS));
+}
+
+static void
+test_segmented_file_damaged_manifest (Fixture      *fixture,
+                                      gconstpointer unused)
+{
+  g_autoptr(EmerSegmentedFile) segmented_file =
+    make_segmented_file (fixture, 1000);
+  append_strings_and_check (segmented_file, STRINGS, G_N_ELEMENTS (STRINGS));
+  g_clear_object (&segmented_file);
+
+  /* Flip a bit in the generation of each slot. */
+  g_autofree gchar *manifest_path =
+    g_build_filename (fixture->path, SEGMENT_MANIFEST_FILENAME, NULL);
+  g_autofree gchar *contents = NULL;
+  gsize length;
+  g_autoptr(GError) error = NULL;
+  g_file_get_contents (manifest_path, &contents, &length, &error);
+  g_assert_no_error (error);
+  contents[2 * sizeof (guint32)] ^= 0x01;
+  contents[MANIFEST_SLOT_SIZE + 2 * sizeof (guint32)] ^= 0x01;
+  g_file_set_contents (manifest_path, contents, length, &error);
+  g_assert_no_error (error);
+
+  guint64 segment_size = get_disk_size (STRINGS[0]) + get_disk_size (STRINGS[1]);
+  segmented_file = make_segmented_file_full (fixture, 1000, segment_size,
+                                             FALSE /* reinitialize */, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_null (segmented_file);
+  g_clear_error (&error);
+
+  /* Reinitializing recovers, discarding the old segments. */
+  segmented_file = make_segmented_file_full (fixture, 1000, segment_size,
+                                             TRUE /* reinitialize */, &error);
+  g_assert_no_error (error);
+  read_strings_and_check (segmented_file, NULL, 0);
+  g_assert_cmpuint (count_segment_files (fixture), ==, 1);
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+#define ADD_SEGMENTED_FILE_TEST_FUNC(path, func) \
+  g_test_add ((path), Fixture, NULL, setup, (func), teardown)
+
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/new", test_segmented_file_new);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/round-trip",
+                                test_segmented_file_round_trip);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/append-when-full",
+                                test_segmented_file_append_when_full);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/remove-deletes-segments",
+                                test_segmented_file_remove_deletes_segments);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/reopen",
+                                test_segmented_file_reopen);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/shrink",
+                                test_segmented_file_shrink);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/skips-damaged-elem",
+                                test_segmented_file_skips_damaged_elem);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/discards-crash-leftovers",
+                                test_segmented_file_discards_crash_leftovers);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/purge",
+                                test_segmented_file_purge);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/large-elem",
+                                test_segmented_file_large_elem);
+  ADD_SEGMENTED_FILE_TEST_FUNC ("/segmented-file/damaged-manifest",
+                                test_segmented_file_damaged_manifest);
+#undef ADD_SEGMENTED_FILE_TEST_FUNC
+
+  return g_test_run ();
+}
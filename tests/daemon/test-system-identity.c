@@ -0,0 +1,154 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Copyright 2026 Endless OS Foundation, LLC */
+
+/*
+ * This file is part of eos-event-recorder-daemon.
+ *
+ * eos-event-recorder-daemon is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * eos-event-recorder-daemon is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with eos-event-recorder-daemon.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "emer-system-identity.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "emer-boot-id-provider.h"
+#include "mock-image-id-provider.h"
+
+static void
+test_system_identity_returns_provider_values (void)
+{
+  g_autoptr(EmerSystemIdentity) identity = emer_system_identity_new ();
+  const gchar *site_value;
+
+  g_assert_cmpstr (emer_system_identity_get_os_version (identity), ==,
+                   OS_VERSION);
+  g_assert_cmpstr (emer_system_identity_get_image_version (identity), ==,
+                   IMAGE_VERSION);
+  g_assert_cmpuint (emer_system_identity_get_boot_type (identity), ==,
+                    emer_boot_id_provider_get_boot_type ());
+
+  GVariant *site_id = emer_system_identity_get_site_id (identity);
+  g_assert_false (g_variant_is_floating (site_id));
+  g_assert_true (g_variant_lookup (site_id, "id", "&s", &site_value));
+  g_assert_cmpstr (site_value, ==, "myid");
+}
+
+static void
+test_system_identity_caches_values (void)
+{
+  g_autoptr(EmerSystemIdentity) identity = emer_system_identity_new ();
+
+  const gchar *os_version = emer_system_identity_get_os_version (identity);
+  const gchar *image_version =
+    emer_system_identity_get_image_version (identity);
+  GVariant *site_id = emer_system_identity_get_site_id (identity);
+
+  g_assert_true (emer_system_identity_get_os_version (identity) == os_version);
+  g_assert_true (emer_system_identity_get_image_version (identity) ==
+                 image_version);
+  g_assert_true (emer_system_identity_get_site_id (identity) == site_id);
+}
+
+static void
+test_system_identity_invalidate (void)
+{
+  g_autoptr(EmerSystemIdentity) identity = emer_system_identity_new ();
+  g_autofree gchar *os_version =
+    g_strdup (emer_system_identity_get_os_version (identity));
+  g_autoptr(GVariant) site_id =
+    g_variant_ref (emer_system_identity_get_site_id (identity));
+
+  emer_system_identity_invalidate (identity);
+
+  g_assert_cmpstr (emer_system_identity_get_os_version (identity), ==,
+                   os_version);
+  g_assert_cmpvariant (emer_system_identity_get_site_id (identity), site_id);
+  g_assert_true (emer_system_identity_get_site_id (identity) != site_id);
+}
+
+static gboolean
+timeout (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/* Rewriting a monitored file, as an administrator editing location.conf
+ * would, should drop the value read from it, so that the next request gets
+ * the new one.
+ */
+static void
+test_system_identity_rereads_changed_file (void)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *dir = g_dir_make_tmp ("system-identity-XXXXXX", &error);
+  g_assert_no_error (error);
+  g_autofree gchar *os_release_path = g_build_filename (dir, "os-release",
+                                                        NULL);
+  g_autofree gchar *location_path = g_build_filename (dir, "location.conf",
+                                                      NULL);
+  const gchar * const os_release_paths[] = { os_release_path, NULL };
+
+  g_file_set_contents (os_release_path, "VERSION_ID=\"1\"\n", -1, &error);
+  g_assert_no_error (error);
+  g_file_set_contents (location_path, "[Label]\nid=before\n", -1, &error);
+  g_assert_no_error (error);
+
+  g_autoptr(EmerSystemIdentity) identity =
+    emer_system_identity_new_full (os_release_paths, location_path);
+  g_autoptr(GVariant) site_id =
+    g_variant_ref (emer_system_identity_get_site_id (identity));
+
+  g_file_set_contents (location_path, "[Label]\nid=after\n", -1, &error);
+  g_assert_no_error (error);
+
+  gboolean timed_out = FALSE;
+  guint timeout_id = g_timeout_add_seconds (5, timeout, &timed_out);
+  while (!timed_out && emer_system_identity_get_site_id (identity) == site_id)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_false (timed_out);
+  g_source_remove (timeout_id);
+
+  /* The mock provider always returns the same value */
+  g_assert_cmpvariant (emer_system_identity_get_site_id (identity), site_id);
+
+  g_unlink (os_release_path);
+  g_unlink (location_path);
+  g_rmdir (dir);
+}
+
+gint
+main (gint                argc,
+      const gchar * const argv[])
+{
+  g_test_init (&argc, (gchar ***) &argv, NULL);
+
+  g_test_add_func ("/system-identity/returns-provider-values",
+                   test_system_identity_returns_provider_values);
+  g_test_add_func ("/system-identity/caches-values",
+                   test_system_identity_caches_values);
+  g_test_add_func ("/system-identity/invalidate",
+                   test_system_identity_invalidate);
+  g_test_add_func ("/system-identity/rereads-changed-file",
+                   test_system_identity_rereads_changed_file);
+
+  return g_test_run ();
+}
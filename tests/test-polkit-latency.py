@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+
+# Copyright 2026 Endless OS Foundation LLC
+
+# This file is part of eos-event-recorder-daemon.
+#
+# eos-event-recorder-daemon is free software: you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or (at your
+# option) any later version.
+#
+# eos-event-recorder-daemon is distributed in the hope that it will be
+# useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+# Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with eos-event-recorder-daemon.  If not, see
+# <http://www.gnu.org/licenses/>.
+
+import dbus
+import os
+import subprocess
+import taptestrunner
+import tempfile
+import time
+import unittest
+import uuid
+
+import dbusmock
+
+_METRICS_IFACE = "com.endlessm.Metrics.EventRecorderServer"
+_POLKIT_IFACE = "org.freedesktop.PolicyKit1.Authority"
+
+# How long the mock polkitd takes to answer CheckAuthorization()
+_POLKIT_DELAY = 3
+
+
+class TestPolkitLatency(dbusmock.DBusTestCase):
+    """
+    Makes sure a slow PolicyKit doesn't hold up the daemon.
+    """
+
+    @classmethod
+    def setUpClass(klass):
+        """Set up a mock system bus."""
+        klass.start_system_bus()
+        klass.dbus_con = klass.get_dbus(system_bus=True)
+
+    def setUp(self):
+        """Start the event recorder on the mock system bus."""
+
+        # Put a polkitd mock which takes its time over authorizing everything
+        # onto the mock system bus.
+        (self.polkit_popen, self.polkit_obj) = self.spawn_server_template("polkitd")
+        self.polkit_obj.AddMethod(
+            _POLKIT_IFACE,
+            "CheckAuthorization",
+            "(sa{sv})sa{ss}us",
+            "(bba{ss})",
+            "import time; time.sleep({}); ret = (True, False, {{}})".format(_POLKIT_DELAY),
+        )
+
+        self.test_dir = tempfile.TemporaryDirectory(
+            prefix="eos-event-recorder-daemon-test."
+        )
+
+        persistent_cache_directory = os.path.join(self.test_dir.name, "cache")
+        persistent_cache_dir_arg = (
+            "--persistent-cache-directory=" + persistent_cache_directory
+        )
+
+        config_file = os.path.join(self.test_dir.name, "permissions.conf")
+        config_file_arg = "--config-file-path={}".format(config_file)
+
+        daemon_path = os.environ.get("EMER_PATH", "./eos-metrics-event-recorder")
+        # e.g. valgrind
+        exe_wrapper = os.environ.get("EXE_WRAPPER", "").split()
+        daemon_command = exe_wrapper + [daemon_path, persistent_cache_dir_arg, config_file_arg]
+        self.daemon = subprocess.Popen(daemon_command)
+
+        # Wait for the service to come up
+        self.wait_for_bus_object(
+            "com.endlessm.Metrics", "/com/endlessm/Metrics", system_bus=True
+        )
+
+        metrics_object = self.dbus_con.get_object(
+            "com.endlessm.Metrics", "/com/endlessm/Metrics"
+        )
+        self.interface = dbus.Interface(metrics_object, _METRICS_IFACE)
+
+    def tearDown(self):
+        self.polkit_popen.terminate()
+        self.daemon.terminate()
+
+        self.polkit_popen.wait()
+        self.assertEqual(self.daemon.wait(), 0)
+
+        self.test_dir.cleanup()
+
+    def _set_enabled_in_subprocess(self):
+        """
+        Calls SetEnabled() from a separate bus connection, so that the
+        daemon has no cached authorization for it.
+        """
+        return subprocess.Popen(
+            [
+                "gdbus", "call", "--system",
+                "--dest", "com.endlessm.Metrics",
+                "--object-path", "/com/endlessm/Metrics",
+                "--method", _METRICS_IFACE + ".SetEnabled",
+                "true",
+            ],
+            stdout=subprocess.DEVNULL,
+        )
+
+    def test_recording_not_delayed_by_authorization(self):
+        """
+        Make sure recording calls are answered promptly while an authorization
+        check is outstanding.
+        """
+        set_enabled = self._set_enabled_in_subprocess()
+        # Give the daemon time to start asking polkitd
+        time.sleep(0.5)
+
+        event_id = uuid.UUID("350ac4ff-3026-4c25-9e7e-e8103b4fd5d8")
+        start = time.monotonic()
+        for _ in range(10):
+            self.interface.RecordSingularEvent(0, event_id.bytes, 0, False, False)
+        elapsed = time.monotonic() - start
+
+        self.assertIsNone(set_enabled.poll())
+        self.assertLess(elapsed, _POLKIT_DELAY / 2)
+
+        self.assertEqual(set_enabled.wait(), 0)
+
+    def test_authorization_cached_per_sender(self):
+        """
+        Make sure only the first privileged call from a client waits for
+        PolicyKit.
+        """
+        start = time.monotonic()
+        self.interface.SetEnabled(True)
+        self.assertGreaterEqual(time.monotonic() - start, _POLKIT_DELAY)
+
+        start = time.monotonic()
+        self.interface.SetEnabled(False)
+        self.assertLess(time.monotonic() - start, _POLKIT_DELAY / 2)
+
+        self.assertFalse(
+            self.interface.Get(
+                _METRICS_IFACE, "Enabled", dbus_interface=dbus.PROPERTIES_IFACE
+            )
+        )
+
+    def test_unimplemented_method_not_authorized(self):
+        """
+        Make sure a privileged method with no implementation is rejected
+        without asking PolicyKit.
+        """
+        start = time.monotonic()
+        with self.assertRaises(dbus.exceptions.DBusException) as context:
+            self.interface.ResetTrackingId()
+        self.assertLess(time.monotonic() - start, _POLKIT_DELAY / 2)
+
+        self.assertEqual(
+            context.exception.get_dbus_name(),
+            "org.freedesktop.DBus.Error.UnknownMethod",
+        )
+
+
+if __name__ == "__main__":
+    unittest.main(testRunner=taptestrunner.TAPTestRunner())
@@ -98,8 +98,13 @@ make_persistent_cache (const gchar *directory)
   GError *error = NULL;
   guint64 max_cache_size =
     emer_cache_size_provider_get_max_cache_size (NULL);
+  EmerPersistentCacheFlags flags = EMER_PERSISTENT_CACHE_FLAG_DEFAULT;
+  if (emer_cache_size_provider_get_compressed (NULL))
+    flags |= EMER_PERSISTENT_CACHE_FLAG_COMPRESSED;
+  if (emer_cache_size_provider_get_segmented (NULL))
+    flags |= EMER_PERSISTENT_CACHE_FLAG_SEGMENTED;
   EmerPersistentCache *persistent_cache =
-    emer_persistent_cache_new (directory, max_cache_size, FALSE, &error);
+    emer_persistent_cache_new (directory, max_cache_size, flags, &error);
 
   if (persistent_cache == NULL)
     {